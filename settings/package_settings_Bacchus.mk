@@ -1,4 +1,19 @@
 test_Bacchus="This is in Bacchus settings"
-package_dependencies_Bacchus=$(filter-out ./src/Minerva/programs/%.c,$(shell find ./src/Minerva/ -regex [^\#]*\\.c$))
+# Mercury computes the 2NF matrix blocks in memory for the bacchus program,
+# with the Neptune modules that read and decouple the 2NF interaction. Their
+# objects are linked into one object that only exports the matrix_free_2nf
+# functions, so that their names cannot clash with those of Bacchus
+neptune_modules_Bacchus=bases block_transform clebsch_gordan input jjj_transformation jt_block_iterator jt_transformation matrix_builder matrix_transform read_packed_states utils
+matrix_free_2nf_sources_Bacchus=$(filter-out ./src/Mercury/programs/%.c,$(shell find ./src/Mercury/ -regex [^\#]*\\.c$)) $(foreach module,$(neptune_modules_Bacchus),$(shell find ./src/Neptune/$(module)/ -regex [^\#]*\\.c$))
+matrix_free_2nf_object_Bacchus=./$(object_path)/Mercury/matrix_free_2nf_linked.o
+matrix_free_2nf_symbols_Bacchus=new_matrix_free_2nf generate_matrix_free_2nf_block free_matrix_free_2nf
 
-package_compiler_flags_Bacchus=-I./src/Minerva/
+$(matrix_free_2nf_object_Bacchus): $(matrix_free_2nf_sources_Bacchus:./$(source_path)/%.c=./$(object_path)/%.o)
+	echo "Linking $@"
+	mkdir -p $(@D)
+	ld -r -o $@ $^
+	objcopy $(matrix_free_2nf_symbols_Bacchus:%=--keep-global-symbol=%) $@
+
+package_dependencies_Bacchus=$(filter-out ./src/Minerva/programs/%.c,$(shell find ./src/Minerva/ -regex [^\#]*\\.c$)) $(matrix_free_2nf_object_Bacchus)
+
+package_compiler_flags_Bacchus=-I./src/Minerva/ -I./src/Mercury/ -I./src/Neptune/
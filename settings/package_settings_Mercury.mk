@@ -1,3 +1,3 @@
-package_dependencies_Mercury=$(filter-out ./src/Neptune/programs/%.c,$(shell find ./src/Neptune/ -regex [^\#]*\\.c$))
+package_dependencies_Mercury=$(filter-out ./src/Neptune/programs/%.c,$(shell find ./src/Neptune/ -regex [^\#]*\\.c$)) $(filter-out ./src/Minerva/programs/%.c,$(shell find ./src/Minerva/ -regex [^\#]*\\.c$))
                                                            
-package_compiler_flags_Mercury=-I./src/Neptune/
+package_compiler_flags_Mercury=-I./src/Neptune/ -I./src/Minerva/
@@ -36,7 +36,8 @@ basis_t new_basis_copy(basis_t origin)
 	return basis;
 }
 
-void basis_append_vector(basis_t basis)
+static
+void append_vector(basis_t basis,int existing)
 {
 	assert(*basis->num_vectors < basis->max_num_vectors);
 	char vector_directory_name[2048] = {0};
@@ -47,11 +48,22 @@ void basis_append_vector(basis_t basis)
 	vector_settings_t vector_settings =
 		basis->vector_settings;
 	vector_settings.directory_name = copy_string(vector_directory_name);
-	basis->vectors[*basis->num_vectors] = 
+	basis->vectors[*basis->num_vectors] = existing ?
+		new_existing_vector(vector_settings) :
 		new_zero_vector(vector_settings);
 	(*basis->num_vectors)++;
 }
 
+void basis_append_vector(basis_t basis)
+{
+	append_vector(basis,0);
+}
+
+void basis_append_existing_vector(basis_t basis)
+{
+	append_vector(basis,1);
+}
+
 void basis_remove_last(basis_t basis)
 {
 	(*basis->num_vectors)--;
@@ -82,13 +94,44 @@ void basis_construct_vector(vector_t result,
 	assert(basis != NULL);
 	assert(amplitudes != NULL);
 	assert(basis->vectors != NULL);
-	assert(num_amplitudes < *basis->num_vectors);	
+	assert(num_amplitudes <= *basis->num_vectors);	
 	for (size_t i = 0; i<num_amplitudes; i++)
 		vector_add_scaled(result,
 				  amplitudes[i],
 				  basis->vectors[i]);
 }
 
+void basis_construct_vectors(vector_t *results,
+			     size_t num_results,
+			     basis_t basis,
+			     const double *amplitudes,
+			     size_t num_amplitudes)
+{
+	assert(basis != NULL);
+	assert(amplitudes != NULL);
+	assert(basis->vectors != NULL);
+	assert(num_amplitudes <= *basis->num_vectors);
+	combine_vectors(results,
+			num_results,
+			basis->vectors,
+			num_amplitudes,
+			amplitudes);
+}
+
+void basis_restart(basis_t basis,
+		   const double *coefficients,
+		   size_t num_kept)
+{
+	assert(num_kept <= *basis->num_vectors);
+	combine_vectors(basis->vectors,
+			num_kept,
+			basis->vectors,
+			*basis->num_vectors,
+			coefficients);
+	while (*basis->num_vectors > num_kept)
+		basis_remove_last(basis);
+}
+
 void free_basis(basis_t basis)
 {
 	if (*basis->num_instances == 1)
@@ -15,6 +15,10 @@ basis_t new_basis_copy(basis_t origin);
 
 void basis_append_vector(basis_t basis);
 
+/* Appends the vector left in the basis directory by an earlier run.
+ */
+void basis_append_existing_vector(basis_t basis);
+
 void basis_remove_last(basis_t basis);
 
 vector_t basis_get_vector(basis_t basis,
@@ -29,6 +33,23 @@ void basis_construct_vector(vector_t result,
 			    double *amplitudes,
 			    size_t num_amplitudes);
 
+/* Sets the results to combinations of the first num_amplitudes basis
+ * vectors, the amplitudes of result i start at amplitudes +
+ * i*num_amplitudes. Every basis vector is read once for all the results.
+ */
+void basis_construct_vectors(vector_t *results,
+			     size_t num_results,
+			     basis_t basis,
+			     const double *amplitudes,
+			     size_t num_amplitudes);
+
+/* Replaces the basis by num_kept combinations of its vectors, the
+ * coefficients are a column major dimension x num_kept matrix.
+ */
+void basis_restart(basis_t basis,
+		   const double *coefficients,
+		   size_t num_kept);
+
 void free_basis(basis_t basis);
 
 #endif
@@ -0,0 +1,619 @@
+#include <block_lanczos/block_lanczos.h>
+#include <basis/basis.h>
+#include <vector/vector.h>
+#include <diagonalization/diagonalization.h>
+#include <string_tools/string_tools.h>
+#include <directory_tools/directory_tools.h>
+#include <math_tools/math_tools.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <log/log.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+struct _block_lanczos_environment_
+{
+	lanczos_settings_t settings;
+	size_t block_size;
+	size_t max_num_steps;
+	basis_t krylow_basis;
+	// The column major projection of the matrix on the Krylow basis, with
+	// room for the whole basis in every column
+	double *projected_matrix;
+	size_t max_basis_dimension;
+	// The norms of the matrix times the current block, which the norms of
+	// the new block are compared to when it is orthonormalized
+	double *block_norms;
+	size_t num_steps;
+	size_t num_multiplications;
+	size_t num_deflations;
+};
+
+static
+double *projected_element(block_lanczos_environment_t environment,
+			  size_t row,
+			  size_t column);
+
+static
+void initialize_first_block(block_lanczos_environment_t environment);
+
+static
+void block_lanczos_step(block_lanczos_environment_t environment,
+			size_t step);
+
+static
+void orthonormalize_block(block_lanczos_environment_t environment,
+			  size_t first,
+			  double *triangular);
+
+static
+void deflate_block(block_lanczos_environment_t environment,
+		   size_t first,
+		   double *triangular);
+
+static
+double residual_norm(const double *residual_gram,
+		     const double *last_amplitudes,
+		     size_t block_size);
+
+block_lanczos_environment_t
+new_block_lanczos_environment(lanczos_settings_t settings,
+			      size_t block_size)
+{
+	if (block_size == 0 || block_size > settings.dimension)
+		error("The block size, %lu, has to be between 1 and the"
+		      " dimension, %lu\n",
+		      block_size,
+		      settings.dimension);
+	if (settings.target_eigenvalue >= block_size)
+		error("Block Lanczos with block size %lu can not target"
+		      " eigenvalue %lu\n",
+		      block_size,
+		      settings.target_eigenvalue);
+	block_lanczos_environment_t environment =
+		(block_lanczos_environment_t)
+		malloc(sizeof(struct _block_lanczos_environment_));
+	environment->settings = settings;
+	environment->block_size = block_size;
+	environment->max_num_steps =
+		(settings.max_num_iterations + block_size - 1)/block_size;
+	if (environment->max_num_steps == 0)
+		environment->max_num_steps = 1;
+	// The matrix times the last block is kept next to the basis
+	environment->max_basis_dimension =
+		(environment->max_num_steps+1)*block_size;
+	if (!directory_exists(settings.krylow_vectors_directory_name) &&
+		create_directory(settings.krylow_vectors_directory_name) != 0)
+		error("Could not create krylow vector directory \"%s\". %s\n",
+		      settings.krylow_vectors_directory_name,
+		      strerror(errno));
+	environment->krylow_basis =
+		new_basis_empty(settings.vector_settings,
+				settings.krylow_vectors_directory_name,
+				environment->max_basis_dimension);
+	environment->projected_matrix =
+		(double*)calloc(environment->max_basis_dimension*
+				environment->max_basis_dimension,
+				sizeof(double));
+	environment->block_norms =
+		(double*)malloc(block_size*sizeof(double));
+	environment->num_steps = 0;
+	environment->num_multiplications = 0;
+	environment->num_deflations = 0;
+	return environment;
+}
+
+void block_diagonalize(block_lanczos_environment_t environment)
+{
+	struct timespec t_start,t_end;
+	printf("Block Lanczos diagonalization start:\n");
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const size_t block_size = environment->block_size;
+	const size_t num_converged = environment->settings.target_eigenvalue+1;
+	initialize_first_block(environment);
+	double *previous_eigenvalues =
+		(double*)calloc(num_converged,sizeof(double));
+	double *previous_amplitudes =
+		(double*)calloc(num_converged*environment->max_basis_dimension,
+				sizeof(double));
+	size_t previous_dimension = 0;
+	for (size_t step = 0; step < environment->max_num_steps; step++)
+	{
+		block_lanczos_step(environment,step);
+		const size_t dimension = (step+1)*block_size;
+		eigensystem_t projected_system =
+			diagonalize_leading_submatrix
+			(environment->projected_matrix,
+			 environment->max_basis_dimension,
+			 dimension);
+		// The residuals of the Ritz vectors are combinations of the
+		// new, not yet normalized, block
+		double *residual_gram = NULL;
+		if (environment->settings.convergence_critera ==
+		    converge_residuals)
+		{
+			vector_t *next_block =
+				basis_get_all_vectors
+				(environment->krylow_basis) + dimension;
+			residual_gram = (double*)malloc(block_size*block_size*
+							sizeof(double));
+			compute_gram_matrix(residual_gram,
+					    next_block,block_size,
+					    next_block,block_size);
+		}
+		double difference = 0.0;
+		for (size_t i = 0; i<num_converged; i++)
+		{
+			double eigenvalue_difference = 0.0;
+			switch (environment->settings.convergence_critera)
+			{
+				case converge_eigenvalues:
+					eigenvalue_difference =
+						fabs(get_eigenvalue
+						     (projected_system,i) -
+						     previous_eigenvalues[i]);
+					break;
+				case converge_eigenvectors:
+					eigenvalue_difference =
+						difference_eigenvectors
+						(get_eigenvector_amplitudes
+						 (projected_system,i),
+						 dimension,
+						 previous_amplitudes +
+						 i*environment->
+						 max_basis_dimension,
+						 previous_dimension);
+					break;
+				case converge_residuals:
+					eigenvalue_difference =
+						residual_norm
+						(residual_gram,
+						 get_eigenvector_amplitudes
+						 (projected_system,i) +
+						 dimension-block_size,
+						 block_size);
+					break;
+				case no_convergence:
+					eigenvalue_difference =
+						environment->settings.
+						eigenvalue_tolerance*2;
+					break;
+			}
+			if (eigenvalue_difference > difference)
+				difference = eigenvalue_difference;
+			previous_eigenvalues[i] =
+				get_eigenvalue(projected_system,i);
+			memcpy(previous_amplitudes +
+			       i*environment->max_basis_dimension,
+			       get_eigenvector_amplitudes(projected_system,i),
+			       dimension*sizeof(double));
+		}
+		previous_dimension = dimension;
+		free(residual_gram);
+		print_convergence_progress(NULL,0,
+					   num_converged,
+					   environment->settings.
+					   convergence_critera,
+					   difference,
+					   environment->settings.
+					   eigenvalue_tolerance);
+		free_eigensystem(projected_system);
+		const int is_last_step =
+			difference < environment->settings.eigenvalue_tolerance
+			|| step+1 == environment->max_num_steps
+			|| dimension + block_size >
+			environment->settings.dimension;
+		if (is_last_step)
+			break;
+		double *triangular =
+			(double*)calloc(block_size*block_size,sizeof(double));
+		orthonormalize_block(environment,dimension,triangular);
+		for (size_t k = 0; k<block_size; k++)
+			for (size_t l = 0; l<=k; l++)
+				*projected_element(environment,
+						   dimension+l,
+						   dimension-block_size+k) =
+					*projected_element(environment,
+							   dimension-block_size+k,
+							   dimension+l) =
+					triangular[k*block_size+l];
+		free(triangular);
+	}
+	// The last block holds the matrix times the basis
+	for (size_t k = 0; k<block_size; k++)
+		basis_remove_last(environment->krylow_basis);
+	free(previous_eigenvalues);
+	free(previous_amplitudes);
+	printf("Block Lanczos steps: %lu, matrix vector multiplications: %lu,"
+	       " deflated vectors: %lu\n",
+	       environment->num_steps,
+	       environment->num_multiplications,
+	       environment->num_deflations);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double diagonalization_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("Block Lanczos diagonalization end after %lg µs\n",
+	       diagonalization_time);
+}
+
+eigensystem_t get_block_eigensystem(block_lanczos_environment_t environment)
+{
+	eigensystem_t diagonalized_system =
+		diagonalize_leading_submatrix
+		(environment->projected_matrix,
+		 environment->max_basis_dimension,
+		 basis_get_dimension(environment->krylow_basis));
+	set_basis(diagonalized_system,
+		  environment->krylow_basis);
+	return diagonalized_system;
+}
+
+void free_block_lanczos_environment(block_lanczos_environment_t environment)
+{
+	free_basis(environment->krylow_basis);
+	free(environment->projected_matrix);
+	free(environment->block_norms);
+	free(environment);
+}
+
+static
+double *projected_element(block_lanczos_environment_t environment,
+			  size_t row,
+			  size_t column)
+{
+	return environment->projected_matrix +
+		column*environment->max_basis_dimension + row;
+}
+
+/* The first block starts with the initial vectors, or else with the first
+ * basis state like Lanczos, and is filled up with random vectors.
+ */
+static
+void initialize_first_block(block_lanczos_environment_t environment)
+{
+	const size_t block_size = environment->block_size;
+	const lanczos_settings_t settings = environment->settings;
+	const size_t num_initial_vectors =
+		settings.num_initial_vectors < block_size ?
+		settings.num_initial_vectors : block_size;
+	for (size_t k = 0; k<block_size; k++)
+	{
+		basis_append_vector(environment->krylow_basis);
+		vector_t vector =
+			basis_get_vector(environment->krylow_basis,k);
+		if (k == 0 && num_initial_vectors == 0)
+		{
+			set_element(vector,0,1.0);
+			save_vector(vector);
+		}
+		else if (k >= num_initial_vectors)
+			fill_random(vector);
+		environment->block_norms[k] = 1.0;
+	}
+	if (num_initial_vectors > 0)
+	{
+		double *coefficients =
+			(double*)calloc(settings.num_initial_vectors*
+					num_initial_vectors,
+					sizeof(double));
+		for (size_t k = 0; k<num_initial_vectors; k++)
+			coefficients[k*settings.num_initial_vectors+k] = 1;
+		combine_vectors(basis_get_all_vectors(environment->krylow_basis),
+				num_initial_vectors,
+				settings.initial_vectors,
+				settings.num_initial_vectors,
+				coefficients);
+		free(coefficients);
+	}
+	double *triangular =
+		(double*)calloc(environment->block_size*environment->block_size,
+				sizeof(double));
+	orthonormalize_block(environment,0,triangular);
+	free(triangular);
+}
+
+/* Multiplies the matrix with the current block and orthogonalizes the
+ * products against the whole Krylow basis, twice, with matrix matrix
+ * products. The projections are the new columns of the projected matrix.
+ * The products are appended to the basis as the next block.
+ */
+static
+void block_lanczos_step(block_lanczos_environment_t environment,
+			size_t step)
+{
+	struct timespec t_start,t_end;
+	printf("Block Lanczos step %lu start:\n",step+1);
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const size_t block_size = environment->block_size;
+	const size_t first = step*block_size;
+	const size_t next = first + block_size;
+	for (size_t k = 0; k<block_size; k++)
+		basis_append_vector(environment->krylow_basis);
+	vector_t *vectors = basis_get_all_vectors(environment->krylow_basis);
+	matrix_block_multiplication(vectors + next,
+				    environment->settings.matrix,
+				    vectors + first,
+				    block_size);
+	environment->num_multiplications += block_size;
+	for (size_t k = 0; k<block_size; k++)
+		environment->block_norms[k] = norm(vectors[next+k]);
+	double *projections =
+		(double*)malloc(next*block_size*sizeof(double));
+	for (size_t round = 0; round<2; round++)
+	{
+		compute_gram_matrix(projections,
+				    vectors,next,
+				    vectors + next,block_size);
+		subtract_combinations(vectors + next,block_size,
+				      vectors,next,
+				      projections);
+		for (size_t k = 0; k<block_size; k++)
+			for (size_t i = 0; i<next; i++)
+			{
+				double *element =
+					projected_element(environment,
+							  i,first+k);
+				*element = round == 0 ?
+					projections[k*next+i] :
+					*element + projections[k*next+i];
+			}
+	}
+	free(projections);
+	for (size_t k = 0; k<block_size; k++)
+	{
+		for (size_t i = 0; i<first; i++)
+			*projected_element(environment,first+k,i) =
+				*projected_element(environment,i,first+k);
+		for (size_t l = 0; l<k; l++)
+		{
+			double mean =
+				(*projected_element(environment,
+						    first+l,first+k) +
+				 *projected_element(environment,
+						    first+k,first+l))/2;
+			*projected_element(environment,first+l,first+k) =
+				*projected_element(environment,first+k,first+l) =
+				mean;
+		}
+	}
+	environment->num_steps++;
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double step_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("Block Lanczos step %lu end after %lg µs\n",
+	       step+1, step_time);
+}
+
+/* Orthonormalizes the block starting at first with two rounds of Cholesky
+ * QR, the block is then the orthonormal factor of a QR factorization and
+ * the column major triangular factor is stored. A block that is
+ * numerically rank deficient, compared to the norms of the matrix times
+ * the previous block, is deflated instead.
+ */
+static
+void orthonormalize_block(block_lanczos_environment_t environment,
+			  size_t first,
+			  double *triangular)
+{
+	const size_t block_size = environment->block_size;
+	vector_t *block =
+		basis_get_all_vectors(environment->krylow_basis) + first;
+	double *min_diagonal = (double*)malloc(block_size*sizeof(double));
+	for (size_t k = 0; k<block_size; k++)
+		min_diagonal[k] = sqrt(DBL_EPSILON)*environment->block_norms[k];
+	int has_full_rank = cholesky_qr(block,block,block_size,
+					0.0,min_diagonal,triangular);
+	free(min_diagonal);
+	if (!has_full_rank)
+	{
+		memset(triangular,0,block_size*block_size*sizeof(double));
+		deflate_block(environment,first,triangular);
+		return;
+	}
+	double *second_factor =
+		(double*)malloc(block_size*block_size*sizeof(double));
+	if (!cholesky_qr(block,block,block_size,0.0,NULL,second_factor))
+		error("Could not orthonormalize block %lu of block Lanczos\n",
+		      first/block_size);
+	// The triangular factor of the block is the product of both rounds
+	double *product =
+		(double*)calloc(block_size*block_size,sizeof(double));
+	for (size_t j = 0; j<block_size; j++)
+		for (size_t l = 0; l<=j; l++)
+			for (size_t i = 0; i<=l; i++)
+				product[j*block_size+i] +=
+					second_factor[l*block_size+i]*
+					triangular[j*block_size+l];
+	memcpy(triangular,product,block_size*block_size*sizeof(double));
+	free(product);
+	free(second_factor);
+}
+
+/* Orthonormalizes the block starting at first one vector at a time with
+ * classical Gram-Schmidt done twice and stores the column major triangular
+ * factor. A vector that is linearly dependent on the basis is replaced by
+ * a random vector orthogonal to it, with a zero diagonal element.
+ */
+static
+void deflate_block(block_lanczos_environment_t environment,
+		   size_t first,
+		   double *triangular)
+{
+	const size_t block_size = environment->block_size;
+	vector_t *block =
+		basis_get_all_vectors(environment->krylow_basis) + first;
+	double *projections = (double*)malloc(block_size*sizeof(double));
+	for (size_t k = 0; k<block_size; k++)
+	{
+		double *column = triangular + k*block_size;
+		for (size_t round = 0; k > 0 && round<2; round++)
+		{
+			compute_gram_matrix(projections,block,k,block+k,1);
+			subtract_combinations(block+k,1,block,k,projections);
+			for (size_t l = 0; l<k; l++)
+				column[l] += projections[l];
+		}
+		double vector_norm = norm(block[k]);
+		if (vector_norm > sqrt(DBL_EPSILON)*
+		    environment->block_norms[k])
+		{
+			column[k] = vector_norm;
+			scale(block[k],1.0/vector_norm);
+			continue;
+		}
+		fill_random(block[k]);
+		reorthogonalize_vector(block[k],
+				       basis_get_all_vectors
+				       (environment->krylow_basis),
+				       first+k);
+		scale(block[k],1.0/norm(block[k]));
+		column[k] = 0.0;
+		environment->num_deflations++;
+	}
+	free(projections);
+}
+
+/* The norm of the residual of a Ritz vector, which is the new block times
+ * the last block_size amplitudes of the Ritz vector, from the Gram matrix
+ * of the new block.
+ */
+static
+double residual_norm(const double *residual_gram,
+		     const double *last_amplitudes,
+		     size_t block_size)
+{
+	double square_norm = 0.0;
+	for (size_t k = 0; k<block_size; k++)
+		for (size_t l = 0; l<block_size; l++)
+			square_norm += last_amplitudes[k]*
+				residual_gram[k*block_size+l]*
+				last_amplitudes[l];
+	return square_norm > 0 ? sqrt(square_norm) : 0.0;
+}
+
+#ifdef TEST
+/* A block diagonal matrix with two copies of the same block has only
+ * degenerate eigenvalues, of which Lanczos started from the first basis
+ * state only finds one copy. The lowest pair is well separated from the
+ * rest of the spectrum.
+ */
+static
+matrix_t new_doubly_degenerate_matrix(size_t dimension)
+{
+	const size_t half = dimension/2;
+	matrix_t matrix = new_zero_matrix(dimension,dimension);
+	for (size_t i = 0; i<half; i++)
+		for (size_t j = i; j<half; j++)
+		{
+			double element = i == j ? (i == 0 ? -10.0 : i) :
+				0.1*(2*drand48()-1);
+			set_matrix_element(matrix,i,j,element);
+			set_matrix_element(matrix,j,i,element);
+			set_matrix_element(matrix,half+i,half+j,element);
+			set_matrix_element(matrix,half+j,half+i,element);
+		}
+	return matrix;
+}
+#endif
+
+new_test(block_lanczos_finds_degenerate_lowest_eigenvalues,
+	 size_t dimension = 200;
+	 size_t block_size = 4;
+	 matrix_t matrix = new_doubly_degenerate_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 100,
+		 .target_eigenvalue = 1,
+		 .eigenvalue_tolerance = 1e-9,
+		 .convergence_critera = converge_eigenvalues,
+		 .matrix = matrix
+	 };
+	 block_lanczos_environment_t environment =
+		 new_block_lanczos_environment(settings,block_size);
+	 block_diagonalize(environment);
+	 assert_that(environment->num_multiplications < 100);
+	 eigensystem_t block_lanczos_eigensystem =
+		 get_block_eigensystem(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 for (size_t i = 0; i<2; i++)
+	 {
+		 printf("(%lu) block lanczos: %lg, lapack: %lg\n",
+			i,
+			get_eigenvalue(block_lanczos_eigensystem,i),
+			get_eigenvalue(lapack_eigensystem,i));
+		 assert_that(fabs(get_eigenvalue(block_lanczos_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) < 1e-8);
+	 }
+	 free_block_lanczos_environment(environment);
+	 free_eigensystem(block_lanczos_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
+
+new_test(exhausted_krylow_space_is_deflated_to_an_orthonormal_basis,
+	 size_t dimension = 200;
+	 size_t block_size = 4;
+	 // With three distinct eigenvalues the Krylow space of the first
+	 // block is exhausted after three steps
+	 matrix_t matrix = new_zero_matrix(dimension,dimension);
+	 for (size_t i = 0; i<dimension; i++)
+		 set_matrix_element(matrix,i,i,i%3);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 24,
+		 .target_eigenvalue = 1,
+		 .eigenvalue_tolerance = 0,
+		 .convergence_critera = no_convergence,
+		 .matrix = matrix
+	 };
+	 block_lanczos_environment_t environment =
+		 new_block_lanczos_environment(settings,block_size);
+	 block_diagonalize(environment);
+	 assert_that(environment->num_deflations > 0);
+	 const size_t basis_dimension =
+		 basis_get_dimension(environment->krylow_basis);
+	 double *gram = (double*)malloc(basis_dimension*basis_dimension*
+					sizeof(double));
+	 compute_symmetric_gram_matrix(gram,
+				       basis_get_all_vectors
+				       (environment->krylow_basis),
+				       basis_dimension);
+	 for (size_t i = 0; i<basis_dimension; i++)
+		 for (size_t j = 0; j<basis_dimension; j++)
+			 assert_that(fabs(gram[i*basis_dimension+j] -
+					  (i == j ? 1.0 : 0.0)) < 1e-10);
+	 free(gram);
+	 eigensystem_t eigensystem = get_block_eigensystem(environment);
+	 for (size_t i = 0; i<2; i++)
+		 assert_that(fabs(get_eigenvalue(eigensystem,i)) < 1e-10);
+	 free_eigensystem(eigensystem);
+	 free_block_lanczos_environment(environment);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
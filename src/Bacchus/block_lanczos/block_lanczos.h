@@ -0,0 +1,29 @@
+#ifndef __BLOCK_LANCZOS__
+#define __BLOCK_LANCZOS__
+
+#include <stdlib.h>
+#include <lanczos/lanczos.h>
+#include <eigensystem/eigensystem.h>
+
+/* Block Lanczos applies the matrix to block_size Krylow vectors at a time
+ * and finds the lowest block_size eigenvalues, also degenerate ones, in
+ * about max_num_iterations/block_size steps. Every new block is
+ * orthogonalized against the whole Krylow basis with matrix matrix
+ * products, so the reorthogonalization and restart settings of Lanczos
+ * are not used.
+ */
+
+struct _block_lanczos_environment_;
+typedef struct _block_lanczos_environment_ *block_lanczos_environment_t;
+
+block_lanczos_environment_t
+new_block_lanczos_environment(lanczos_settings_t settings,
+			      size_t block_size);
+
+void block_diagonalize(block_lanczos_environment_t environment);
+
+eigensystem_t get_block_eigensystem(block_lanczos_environment_t environment);
+
+void free_block_lanczos_environment(block_lanczos_environment_t environment);
+
+#endif
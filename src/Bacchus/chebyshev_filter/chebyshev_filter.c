@@ -0,0 +1,519 @@
+#include <chebyshev_filter/chebyshev_filter.h>
+#include <basis/basis.h>
+#include <vector/vector.h>
+#include <diagonalization/diagonalization.h>
+#include <string_tools/string_tools.h>
+#include <directory_tools/directory_tools.h>
+#include <math_tools/math_tools.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <log/log.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+// The number of Lanczos steps for the upper bound of the spectrum
+static const size_t num_bound_steps = 10;
+
+struct _chebyshev_filter_environment_
+{
+	lanczos_settings_t settings;
+	size_t block_size;
+	size_t filter_degree;
+	size_t num_wanted;
+	// The block holds the Ritz vectors after every iteration, the
+	// scratch blocks the terms of the Chebyshev recurrence
+	basis_t block;
+	basis_t first_scratch;
+	basis_t second_scratch;
+	double *ritz_values;
+	double upper_bound;
+	size_t num_iterations;
+	size_t num_multiplications;
+};
+
+static
+double estimate_upper_bound(chebyshev_filter_environment_t environment);
+
+static
+void initialize_block(chebyshev_filter_environment_t environment);
+
+static
+vector_t *filter_block(chebyshev_filter_environment_t environment,
+		       double lowest_value,
+		       double cutoff);
+
+static
+void orthonormalize_block(chebyshev_filter_environment_t environment,
+			  vector_t *results,
+			  vector_t *vectors);
+
+static
+void rayleigh_ritz(chebyshev_filter_environment_t environment,
+		   double *residual_norms);
+
+chebyshev_filter_environment_t
+new_chebyshev_filter_environment(lanczos_settings_t settings,
+				 size_t block_size,
+				 size_t filter_degree)
+{
+	const size_t num_wanted = settings.target_eigenvalue+1;
+	if (block_size < num_wanted || block_size >= settings.dimension)
+		error("The block size, %lu, has to be between the number of"
+		      " wanted eigenvalues, %lu, and the dimension, %lu\n",
+		      block_size,
+		      num_wanted,
+		      settings.dimension);
+	if (filter_degree == 0)
+		error("The degree of the Chebyshev filter has to be at least"
+		      " 1\n");
+	chebyshev_filter_environment_t environment =
+		(chebyshev_filter_environment_t)
+		malloc(sizeof(struct _chebyshev_filter_environment_));
+	environment->settings = settings;
+	environment->block_size = block_size;
+	environment->filter_degree = filter_degree;
+	environment->num_wanted = num_wanted;
+	if (!directory_exists(settings.krylow_vectors_directory_name) &&
+		create_directory(settings.krylow_vectors_directory_name) != 0)
+		error("Could not create krylow vector directory \"%s\". %s\n",
+		      settings.krylow_vectors_directory_name,
+		      strerror(errno));
+	const char *subdirectories[] = {"block","first_scratch",
+					"second_scratch"};
+	basis_t *bases[] = {&environment->block,
+			    &environment->first_scratch,
+			    &environment->second_scratch};
+	for (size_t i = 0; i<3; i++)
+	{
+		char *directory_name =
+			new_subdirectory_name
+			(settings.krylow_vectors_directory_name,
+			 subdirectories[i]);
+		*bases[i] = new_basis_empty(settings.vector_settings,
+					    directory_name,
+					    block_size);
+		for (size_t j = 0; j<block_size; j++)
+			basis_append_vector(*bases[i]);
+		free(directory_name);
+	}
+	environment->ritz_values =
+		(double*)calloc(block_size,sizeof(double));
+	environment->upper_bound = 0.0;
+	environment->num_iterations = 0;
+	environment->num_multiplications = 0;
+	return environment;
+}
+
+void chebyshev_filter_diagonalize(chebyshev_filter_environment_t environment)
+{
+	struct timespec t_start,t_end;
+	printf("Chebyshev filtered subspace iteration start:\n");
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const lanczos_settings_t settings = environment->settings;
+	const size_t num_wanted = environment->num_wanted;
+	const size_t block_size = environment->block_size;
+	// The eigenvector criterion converges the residuals
+	const convergence_critera_t criteria =
+		settings.convergence_critera == converge_eigenvectors ?
+		converge_residuals : settings.convergence_critera;
+	environment->upper_bound = estimate_upper_bound(environment);
+	printf("Upper bound of the spectrum: %.17lg\n",
+	       environment->upper_bound);
+	initialize_block(environment);
+	double *residual_norms = (double*)malloc(block_size*sizeof(double));
+	double *previous_eigenvalues =
+		(double*)malloc(num_wanted*sizeof(double));
+	for (size_t i = 0; i<num_wanted; i++)
+		previous_eigenvalues[i] = INFINITY;
+	rayleigh_ritz(environment,residual_norms);
+	while (1)
+	{
+		double difference = 0.0;
+		for (size_t i = 0; i<num_wanted; i++)
+		{
+			double eigenvalue_difference = residual_norms[i];
+			if (criteria == converge_eigenvalues)
+				eigenvalue_difference =
+					fabs(environment->ritz_values[i] -
+					     previous_eigenvalues[i]);
+			else if (criteria == no_convergence)
+				eigenvalue_difference =
+					settings.eigenvalue_tolerance*2;
+			if (eigenvalue_difference > difference)
+				difference = eigenvalue_difference;
+			previous_eigenvalues[i] = environment->ritz_values[i];
+		}
+		print_convergence_progress(environment->ritz_values,
+					   num_wanted,
+					   num_wanted,
+					   criteria,
+					   difference,
+					   settings.eigenvalue_tolerance);
+		if (difference < settings.eigenvalue_tolerance ||
+		    environment->num_multiplications +
+		    (environment->filter_degree+1)*block_size >
+		    settings.max_num_iterations)
+			break;
+		// Everything above the largest Ritz value of the block is
+		// damped, the lowest one keeps the filtered vectors scaled
+		vector_t *filtered =
+			filter_block(environment,
+				     environment->ritz_values[0],
+				     environment->ritz_values[block_size-1]);
+		orthonormalize_block(environment,
+				     basis_get_all_vectors(environment->block),
+				     filtered);
+		rayleigh_ritz(environment,residual_norms);
+		environment->num_iterations++;
+	}
+	free(residual_norms);
+	free(previous_eigenvalues);
+	printf("Chebyshev filtered subspace iterations: %lu, matrix vector"
+	       " multiplications: %lu\n",
+	       environment->num_iterations,
+	       environment->num_multiplications);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double diagonalization_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("Chebyshev filtered subspace iteration end after %lg µs\n",
+	       diagonalization_time);
+}
+
+/* The block holds the Ritz vectors, so the projected matrix is diagonal.
+ */
+eigensystem_t
+get_chebyshev_filter_eigensystem(chebyshev_filter_environment_t environment)
+{
+	const size_t block_size = environment->block_size;
+	double *elements =
+		(double*)calloc(block_size*block_size,sizeof(double));
+	for (size_t i = 0; i<block_size; i++)
+		elements[i*block_size+i] = environment->ritz_values[i];
+	eigensystem_t diagonalized_system =
+		diagonalize_dense_symmetric_matrix(elements,block_size);
+	free(elements);
+	set_basis(diagonalized_system,
+		  environment->block);
+	return diagonalized_system;
+}
+
+void
+free_chebyshev_filter_environment(chebyshev_filter_environment_t environment)
+{
+	free_basis(environment->block);
+	free_basis(environment->first_scratch);
+	free_basis(environment->second_scratch);
+	free(environment->ritz_values);
+	free(environment);
+}
+
+/* A few Lanczos steps without reorthogonalization from a random vector.
+ * The largest Ritz value plus the last off diagonal element bounds the
+ * spectrum from above, see Zhou and Li, J. Comput. Phys. 219 (2006).
+ * Uses the first vectors of the three blocks.
+ */
+static
+double estimate_upper_bound(chebyshev_filter_environment_t environment)
+{
+	const size_t num_steps =
+		num_bound_steps < environment->settings.dimension ?
+		num_bound_steps : environment->settings.dimension;
+	vector_t previous = basis_get_vector(environment->first_scratch,0);
+	vector_t current = basis_get_vector(environment->second_scratch,0);
+	vector_t next = basis_get_vector(environment->block,0);
+	double *tridiagonal =
+		(double*)calloc(num_steps*num_steps,sizeof(double));
+	fill_random(current);
+	scale(current,1.0/norm(current));
+	double beta = 0.0;
+	size_t dimension = 0;
+	for (size_t i = 0; i<num_steps; i++)
+	{
+		matrix_vector_multiplication(next,
+					     environment->settings.matrix,
+					     current);
+		environment->num_multiplications++;
+		const double alpha = scalar_multiplication(next,current);
+		vector_add_scaled(next,-alpha,current);
+		if (i > 0)
+			vector_add_scaled(next,-beta,previous);
+		tridiagonal[i*num_steps+i] = alpha;
+		beta = norm(next);
+		dimension = i+1;
+		if (beta == 0 || i+1 == num_steps)
+			break;
+		tridiagonal[i*num_steps+i+1] = tridiagonal[(i+1)*num_steps+i] =
+			beta;
+		scale(next,1.0/beta);
+		vector_t old_previous = previous;
+		previous = current;
+		current = next;
+		next = old_previous;
+	}
+	double *elements =
+		(double*)malloc(dimension*dimension*sizeof(double));
+	for (size_t j = 0; j<dimension; j++)
+		memcpy(elements + j*dimension,
+		       tridiagonal + j*num_steps,
+		       dimension*sizeof(double));
+	eigensystem_t tridiagonal_system =
+		diagonalize_dense_symmetric_matrix(elements,dimension);
+	const double upper_bound =
+		get_eigenvalue(tridiagonal_system,dimension-1) + fabs(beta);
+	free_eigensystem(tridiagonal_system);
+	free(elements);
+	free(tridiagonal);
+	return upper_bound;
+}
+
+/* Starts from the initial vectors, filled up with random vectors.
+ */
+static
+void initialize_block(chebyshev_filter_environment_t environment)
+{
+	const lanczos_settings_t settings = environment->settings;
+	const size_t block_size = environment->block_size;
+	vector_t *start = basis_get_all_vectors(environment->first_scratch);
+	for (size_t i = 0; i<block_size; i++)
+		if (i < settings.num_initial_vectors)
+		{
+			const double one = 1.0;
+			combine_vectors(start+i,1,
+					settings.initial_vectors+i,1,
+					&one);
+		}
+		else
+			fill_random(start[i]);
+	orthonormalize_block(environment,
+			     basis_get_all_vectors(environment->block),
+			     start);
+}
+
+/* Applies the Chebyshev polynomial of the filter degree, mapped from
+ * [-1,1] to [cutoff,upper bound] and scaled to 1 at the lowest value, to
+ * the block with the three term recurrence
+ * Y_i+1 = 2 sigma_i+1/e (A - c) Y_i - sigma_i sigma_i+1 Y_i-1,
+ * see Zhou and Saad, SIAM J. Matrix Anal. Appl. 29 (2007). The terms
+ * rotate through the block and the scratch blocks, the returned one holds
+ * the filtered vectors.
+ */
+static
+vector_t *filter_block(chebyshev_filter_environment_t environment,
+		       double lowest_value,
+		       double cutoff)
+{
+	const size_t block_size = environment->block_size;
+	const double half_width = (environment->upper_bound - cutoff)/2;
+	const double center = (environment->upper_bound + cutoff)/2;
+	if (half_width <= 0)
+		error("The upper bound of the spectrum, %lg, is not above the"
+		      " largest Ritz value of the block, %lg\n",
+		      environment->upper_bound,
+		      cutoff);
+	vector_t *previous = basis_get_all_vectors(environment->block);
+	vector_t *current = basis_get_all_vectors(environment->first_scratch);
+	vector_t *next = basis_get_all_vectors(environment->second_scratch);
+	double sigma = half_width/(lowest_value - center);
+	const double tau = 2/sigma;
+	matrix_block_multiplication(current,
+				    environment->settings.matrix,
+				    previous,
+				    block_size);
+	for (size_t j = 0; j<block_size; j++)
+	{
+		vector_add_scaled(current[j],-center,previous[j]);
+		scale(current[j],sigma/half_width);
+	}
+	for (size_t i = 1; i<environment->filter_degree; i++)
+	{
+		const double next_sigma = 1/(tau - sigma);
+		matrix_block_multiplication(next,
+					    environment->settings.matrix,
+					    current,
+					    block_size);
+		for (size_t j = 0; j<block_size; j++)
+		{
+			vector_add_scaled(next[j],-center,current[j]);
+			scale(next[j],2*next_sigma/half_width);
+			vector_add_scaled(next[j],
+					  -sigma*next_sigma,
+					  previous[j]);
+		}
+		sigma = next_sigma;
+		vector_t *old_previous = previous;
+		previous = current;
+		current = next;
+		next = old_previous;
+	}
+	environment->num_multiplications +=
+		environment->filter_degree*block_size;
+	return current;
+}
+
+/* Sets the results to the orthonormalized vectors with two rounds of
+ * Cholesky QR. The results may be the vectors. When the Cholesky
+ * factorization of an ill conditioned block fails, its Gram matrix is
+ * shifted and a third round restores the orthogonality, as in shifted
+ * Cholesky QR.
+ */
+static
+void orthonormalize_block(chebyshev_filter_environment_t environment,
+			  vector_t *results,
+			  vector_t *vectors)
+{
+	const size_t block_size = environment->block_size;
+	size_t num_rounds = 2;
+	for (size_t round = 0; round<num_rounds; round++)
+	{
+		vector_t *source = round == 0 ? vectors : results;
+		if (cholesky_qr(results,source,block_size,0.0,NULL,NULL))
+			continue;
+		if (!cholesky_qr(results,source,block_size,
+				 block_size*DBL_EPSILON*100,NULL,NULL))
+			error("The filtered block is numerically rank"
+			      " deficient, try a lower filter degree\n");
+		num_rounds = 3;
+	}
+}
+
+/* Rotates the orthonormal block to the Ritz vectors of its projection and
+ * sets the Ritz values and the residual norms. The products of the block
+ * with the matrix are kept in the first scratch block.
+ */
+static
+void rayleigh_ritz(chebyshev_filter_environment_t environment,
+		   double *residual_norms)
+{
+	const size_t block_size = environment->block_size;
+	vector_t *vectors = basis_get_all_vectors(environment->block);
+	vector_t *products = basis_get_all_vectors(environment->first_scratch);
+	matrix_block_multiplication(products,
+				    environment->settings.matrix,
+				    vectors,
+				    block_size);
+	environment->num_multiplications += block_size;
+	double *projection =
+		(double*)malloc(block_size*block_size*sizeof(double));
+	compute_gram_matrix(projection,
+			    vectors,block_size,
+			    products,block_size);
+	for (size_t j = 0; j<block_size; j++)
+		for (size_t i = 0; i<j; i++)
+			projection[j*block_size+i] =
+				projection[i*block_size+j] =
+				(projection[j*block_size+i] +
+				 projection[i*block_size+j])/2;
+	eigensystem_t projected_system =
+		diagonalize_dense_symmetric_matrix(projection,block_size);
+	for (size_t i = 0; i<block_size; i++)
+	{
+		environment->ritz_values[i] =
+			get_eigenvalue(projected_system,i);
+		memcpy(projection + i*block_size,
+		       get_eigenvector_amplitudes(projected_system,i),
+		       block_size*sizeof(double));
+	}
+	free_eigensystem(projected_system);
+	combine_vectors(vectors,block_size,
+			vectors,block_size,
+			projection);
+	combine_vectors(products,block_size,
+			products,block_size,
+			projection);
+	for (size_t i = 0; i<block_size; i++)
+	{
+		vector_add_scaled(products[i],
+				  -environment->ritz_values[i],
+				  vectors[i]);
+		residual_norms[i] = norm(products[i]);
+	}
+	free(projection);
+}
+
+new_test(lanczos_steps_bound_the_spectrum_from_above,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension,
+			 .storage = MEMORY_STORAGE
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 1000,
+		 .target_eigenvalue = 0,
+		 .matrix = matrix
+	 };
+	 chebyshev_filter_environment_t environment =
+		 new_chebyshev_filter_environment(settings,2,10);
+	 const double upper_bound = estimate_upper_bound(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 const double largest_eigenvalue =
+		 get_eigenvalue(lapack_eigensystem,dimension-1);
+	 printf("Upper bound: %lg, largest eigenvalue: %lg\n",
+		upper_bound,
+		largest_eigenvalue);
+	 assert_that(upper_bound >= largest_eigenvalue);
+	 assert_that(upper_bound < 2*largest_eigenvalue);
+	 free_chebyshev_filter_environment(environment);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
+
+new_test(chebyshev_filter_finds_lowest_eigenvalues,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension,
+			 .storage = MEMORY_STORAGE
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 2000,
+		 .target_eigenvalue = 5,
+		 .eigenvalue_tolerance = 1e-8,
+		 .convergence_critera = converge_residuals,
+		 .matrix = matrix
+	 };
+	 chebyshev_filter_environment_t environment =
+		 new_chebyshev_filter_environment(settings,10,10);
+	 chebyshev_filter_diagonalize(environment);
+	 assert_that(environment->num_multiplications <=
+		     settings.max_num_iterations);
+	 eigensystem_t chebyshev_eigensystem =
+		 get_chebyshev_filter_eigensystem(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 for (size_t i = 0; i<6; i++)
+	 {
+		 printf("(%lu) chebyshev filter: %.15lg, lapack: %.15lg\n",
+			i,
+			get_eigenvalue(chebyshev_eigensystem,i),
+			get_eigenvalue(lapack_eigensystem,i));
+		 assert_that(fabs(get_eigenvalue(chebyshev_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) < 1e-8);
+	 }
+	 free_chebyshev_filter_environment(environment);
+	 free_eigensystem(chebyshev_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
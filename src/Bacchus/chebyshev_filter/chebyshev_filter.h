@@ -0,0 +1,41 @@
+#ifndef __CHEBYSHEV_FILTER__
+#define __CHEBYSHEV_FILTER__
+
+#include <stdlib.h>
+#include <lanczos/lanczos.h>
+#include <eigensystem/eigensystem.h>
+
+/* Chebyshev filtered subspace iteration keeps a fixed block of block_size
+ * vectors. Every iteration applies a Chebyshev polynomial of the matrix of
+ * degree filter_degree to the block, which damps the spectrum between the
+ * largest Ritz value of the block and an upper bound of the matrix and
+ * amplifies everything below. The filtered block is orthonormalized with a
+ * Cholesky QR and the Ritz pairs follow from the projection of the matrix
+ * on it. The upper bound comes from a few Lanczos steps at the start.
+ *
+ * The memory does not grow with the number of iterations, which suits many
+ * wanted eigenvectors, and the orthonormalization only needs the scalar
+ * products within the block. The block size has to exceed the number of
+ * wanted eigenvectors, a few more vectors speed up the convergence.
+ * max_num_iterations bounds the number of matrix vector multiplications,
+ * the reorthogonalization and restart settings of Lanczos are not used and
+ * the eigenvector criterion converges the residuals.
+ */
+
+struct _chebyshev_filter_environment_;
+typedef struct _chebyshev_filter_environment_ *chebyshev_filter_environment_t;
+
+chebyshev_filter_environment_t
+new_chebyshev_filter_environment(lanczos_settings_t settings,
+				 size_t block_size,
+				 size_t filter_degree);
+
+void chebyshev_filter_diagonalize(chebyshev_filter_environment_t environment);
+
+eigensystem_t
+get_chebyshev_filter_eigensystem(chebyshev_filter_environment_t environment);
+
+void
+free_chebyshev_filter_environment(chebyshev_filter_environment_t environment);
+
+#endif
@@ -0,0 +1,601 @@
+#include <davidson/davidson.h>
+#include <basis/basis.h>
+#include <vector/vector.h>
+#include <diagonalization/diagonalization.h>
+#include <string_tools/string_tools.h>
+#include <directory_tools/directory_tools.h>
+#include <math_tools/math_tools.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <log/log.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+// Differences of the diagonal and a Ritz value below this are clipped in
+// the preconditioner, which would otherwise blow up single components
+static const double min_preconditioner_difference = 1e-4;
+
+// A new search vector is dropped when orthogonalization leaves less than
+// this fraction of its norm
+static const double min_remaining_norm = 1e-8;
+
+struct _davidson_environment_
+{
+	lanczos_settings_t settings;
+	size_t num_wanted;
+	size_t max_basis_dimension;
+	size_t num_restart_vectors;
+	vector_t diagonal;
+	basis_t search_basis;
+	// The matrix times the vectors of the search basis
+	basis_t products;
+	basis_t residuals;
+	// The column major projection of the matrix on the search basis,
+	// with room for the whole basis in every column
+	double *projected_matrix;
+	size_t num_iterations;
+	size_t num_restarts;
+	size_t num_multiplications;
+};
+
+static
+size_t get_max_basis_dimension(lanczos_settings_t settings);
+
+static
+double *projected_element(davidson_environment_t environment,
+			  size_t row,
+			  size_t column);
+
+static
+void initialize_search_basis(davidson_environment_t environment);
+
+static
+void multiply_new_vectors(davidson_environment_t environment,
+			  size_t first);
+
+static
+void compute_residuals(davidson_environment_t environment,
+		       const eigensystem_t projected_system,
+		       size_t num_pairs,
+		       double *ritz_vectors,
+		       double *residual_norms);
+
+static
+void restart(davidson_environment_t environment,
+	     const eigensystem_t projected_system,
+	     const double *ritz_vectors);
+
+static
+int append_search_vector(davidson_environment_t environment,
+			 const vector_t direction);
+
+size_t davidson_num_vectors(lanczos_settings_t settings)
+{
+	// The search basis, its products, the residuals and the diagonal
+	return 2*get_max_basis_dimension(settings) +
+		settings.target_eigenvalue + 2;
+}
+
+davidson_environment_t new_davidson_environment(lanczos_settings_t settings)
+{
+	const size_t num_wanted = settings.target_eigenvalue+1;
+	if (num_wanted >= settings.dimension)
+		error("Davidson needs a dimension, %lu, above the number of"
+		      " wanted eigenvalues, %lu\n",
+		      settings.dimension,
+		      num_wanted);
+	davidson_environment_t environment =
+		(davidson_environment_t)
+		malloc(sizeof(struct _davidson_environment_));
+	environment->settings = settings;
+	environment->num_wanted = num_wanted;
+	environment->max_basis_dimension = get_max_basis_dimension(settings);
+	environment->num_restart_vectors =
+		settings.num_restart_vectors > num_wanted ?
+		settings.num_restart_vectors : num_wanted;
+	if (environment->num_restart_vectors + num_wanted >
+	    environment->max_basis_dimension)
+		error("The maximum basis dimension of Davidson, %lu, has to"
+		      " leave room for %lu new vectors after a restart with"
+		      " %lu vectors\n",
+		      environment->max_basis_dimension,
+		      num_wanted,
+		      environment->num_restart_vectors);
+	if (!directory_exists(settings.krylow_vectors_directory_name) &&
+		create_directory(settings.krylow_vectors_directory_name) != 0)
+		error("Could not create krylow vector directory \"%s\". %s\n",
+		      settings.krylow_vectors_directory_name,
+		      strerror(errno));
+	char *search_directory =
+		new_subdirectory_name(settings.krylow_vectors_directory_name,
+				      "search");
+	char *products_directory =
+		new_subdirectory_name(settings.krylow_vectors_directory_name,
+				      "products");
+	char *residuals_directory =
+		new_subdirectory_name(settings.krylow_vectors_directory_name,
+				      "residuals");
+	environment->search_basis =
+		new_basis_empty(settings.vector_settings,
+				search_directory,
+				environment->max_basis_dimension);
+	environment->products =
+		new_basis_empty(settings.vector_settings,
+				products_directory,
+				environment->max_basis_dimension);
+	environment->residuals =
+		new_basis_empty(settings.vector_settings,
+				residuals_directory,
+				num_wanted);
+	free(search_directory);
+	free(products_directory);
+	free(residuals_directory);
+	for (size_t i = 0; i<num_wanted; i++)
+		basis_append_vector(environment->residuals);
+	vector_settings_t diagonal_settings = settings.vector_settings;
+	diagonal_settings.directory_name =
+		new_subdirectory_name(settings.krylow_vectors_directory_name,
+				      "diagonal");
+	environment->diagonal = new_zero_vector(diagonal_settings);
+	environment->projected_matrix =
+		(double*)calloc(environment->max_basis_dimension*
+				environment->max_basis_dimension,
+				sizeof(double));
+	environment->num_iterations = 0;
+	environment->num_restarts = 0;
+	environment->num_multiplications = 0;
+	return environment;
+}
+
+void davidson_diagonalize(davidson_environment_t environment)
+{
+	struct timespec t_start,t_end;
+	printf("Davidson diagonalization start:\n");
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const lanczos_settings_t settings = environment->settings;
+	const size_t num_wanted = environment->num_wanted;
+	// The eigenvector criterion converges the residuals
+	const convergence_critera_t criteria =
+		settings.convergence_critera == converge_eigenvectors ?
+		converge_residuals : settings.convergence_critera;
+	get_matrix_diagonal(environment->diagonal,settings.matrix);
+	initialize_search_basis(environment);
+	double *ritz_vectors =
+		(double*)malloc(environment->max_basis_dimension*num_wanted*
+				sizeof(double));
+	double *residual_norms = (double*)malloc(num_wanted*sizeof(double));
+	double *previous_eigenvalues =
+		(double*)malloc(num_wanted*sizeof(double));
+	for (size_t i = 0; i<num_wanted; i++)
+		previous_eigenvalues[i] = INFINITY;
+	vector_t *residuals = basis_get_all_vectors(environment->residuals);
+	while (1)
+	{
+		const size_t dimension =
+			basis_get_dimension(environment->search_basis);
+		eigensystem_t projected_system =
+			diagonalize_leading_submatrix
+			(environment->projected_matrix,
+			 environment->max_basis_dimension,
+			 dimension);
+		compute_residuals(environment,
+				  projected_system,
+				  num_wanted,
+				  ritz_vectors,
+				  residual_norms);
+		double difference = 0.0;
+		for (size_t i = 0; i<num_wanted; i++)
+		{
+			double eigenvalue_difference = residual_norms[i];
+			if (criteria == converge_eigenvalues)
+				eigenvalue_difference =
+					fabs(get_eigenvalue(projected_system,
+							    i) -
+					     previous_eigenvalues[i]);
+			else if (criteria == no_convergence)
+				eigenvalue_difference =
+					settings.eigenvalue_tolerance*2;
+			if (eigenvalue_difference > difference)
+				difference = eigenvalue_difference;
+			previous_eigenvalues[i] =
+				get_eigenvalue(projected_system,i);
+		}
+		environment->num_iterations++;
+		print_convergence_progress(previous_eigenvalues,
+					   num_wanted,
+					   num_wanted,
+					   criteria,
+					   difference,
+					   settings.eigenvalue_tolerance);
+		if (difference < settings.eigenvalue_tolerance ||
+		    environment->num_multiplications >=
+		    settings.max_num_iterations ||
+		    dimension + num_wanted > settings.dimension)
+		{
+			free_eigensystem(projected_system);
+			break;
+		}
+		if (dimension + num_wanted > environment->max_basis_dimension)
+			restart(environment,projected_system,ritz_vectors);
+		const size_t first =
+			basis_get_dimension(environment->search_basis);
+		for (size_t i = 0; i<num_wanted; i++)
+		{
+			if (residual_norms[i] < settings.eigenvalue_tolerance)
+				continue;
+			divide_by_shifted_diagonal
+				(residuals[i],
+				 environment->diagonal,
+				 get_eigenvalue(projected_system,i),
+				 min_preconditioner_difference);
+			append_search_vector(environment,residuals[i]);
+		}
+		free_eigensystem(projected_system);
+		if (basis_get_dimension(environment->search_basis) == first)
+		{
+			printf("Davidson cannot extend the search basis any"
+			       " more\n");
+			break;
+		}
+		multiply_new_vectors(environment,first);
+	}
+	free(ritz_vectors);
+	free(residual_norms);
+	free(previous_eigenvalues);
+	printf("Davidson iterations: %lu, restarts: %lu, matrix vector"
+	       " multiplications: %lu\n",
+	       environment->num_iterations,
+	       environment->num_restarts,
+	       environment->num_multiplications);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double diagonalization_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("Davidson diagonalization end after %lg µs\n",
+	       diagonalization_time);
+}
+
+eigensystem_t get_davidson_eigensystem(davidson_environment_t environment)
+{
+	eigensystem_t diagonalized_system =
+		diagonalize_leading_submatrix
+		(environment->projected_matrix,
+		 environment->max_basis_dimension,
+		 basis_get_dimension(environment->search_basis));
+	set_basis(diagonalized_system,
+		  environment->search_basis);
+	return diagonalized_system;
+}
+
+void free_davidson_environment(davidson_environment_t environment)
+{
+	free_basis(environment->search_basis);
+	free_basis(environment->products);
+	free_basis(environment->residuals);
+	free_vector(environment->diagonal);
+	free(environment->projected_matrix);
+	free(environment);
+}
+
+static
+size_t get_max_basis_dimension(lanczos_settings_t settings)
+{
+	size_t max_basis_dimension = settings.max_basis_dimension;
+	if (max_basis_dimension == 0)
+		max_basis_dimension =
+			settings.max_num_iterations +
+			settings.target_eigenvalue + 1;
+	return max_basis_dimension < settings.dimension ?
+		max_basis_dimension : settings.dimension;
+}
+
+static
+double *projected_element(davidson_environment_t environment,
+			  size_t row,
+			  size_t column)
+{
+	return environment->projected_matrix +
+		column*environment->max_basis_dimension + row;
+}
+
+/* Starts from the initial vectors, or else from the basis states of the
+ * lowest diagonal elements, which are the best guesses for the lowest
+ * eigenvectors of a diagonally dominant matrix.
+ */
+static
+void initialize_search_basis(davidson_environment_t environment)
+{
+	const lanczos_settings_t settings = environment->settings;
+	if (settings.num_initial_vectors > 0)
+	{
+		for (size_t i = 0; i<settings.num_initial_vectors; i++)
+			append_search_vector(environment,
+					     settings.initial_vectors[i]);
+		if (basis_get_dimension(environment->search_basis) == 0)
+			error("The initial vectors are zero\n");
+	}
+	else
+	{
+		double *diagonal =
+			(double*)malloc(settings.dimension*sizeof(double));
+		copy_vector_elements(diagonal,environment->diagonal);
+		for (size_t i = 0; i<environment->num_wanted; i++)
+		{
+			size_t lowest = 0;
+			for (size_t j = 1; j<settings.dimension; j++)
+				if (diagonal[j] < diagonal[lowest])
+					lowest = j;
+			diagonal[lowest] = INFINITY;
+			basis_append_vector(environment->search_basis);
+			vector_t unit_vector =
+				basis_get_vector(environment->search_basis,i);
+			set_element(unit_vector,lowest,1.0);
+			save_vector(unit_vector);
+		}
+		free(diagonal);
+	}
+	multiply_new_vectors(environment,0);
+}
+
+/* Multiplies the search vectors from first on with the matrix and adds
+ * their rows and columns to the projected matrix, which is kept symmetric.
+ */
+static
+void multiply_new_vectors(davidson_environment_t environment,
+			  size_t first)
+{
+	const size_t dimension = basis_get_dimension(environment->search_basis);
+	const size_t num_new = dimension - first;
+	vector_t *vectors = basis_get_all_vectors(environment->search_basis);
+	for (size_t i = first; i<dimension; i++)
+		basis_append_vector(environment->products);
+	vector_t *products = basis_get_all_vectors(environment->products);
+	matrix_block_multiplication(products + first,
+				    environment->settings.matrix,
+				    vectors + first,
+				    num_new);
+	environment->num_multiplications += num_new;
+	double *gram = (double*)malloc(dimension*num_new*sizeof(double));
+	compute_gram_matrix(gram,
+			    vectors,dimension,
+			    products + first,
+			    num_new);
+	for (size_t j = 0; j<num_new; j++)
+		for (size_t r = 0; r<dimension; r++)
+		{
+			double element = gram[j*dimension+r];
+			if (r >= first && r < first+j)
+				element = (element +
+					   *projected_element(environment,
+							      first+j,r))/2;
+			*projected_element(environment,r,first+j) =
+				*projected_element(environment,first+j,r) =
+				element;
+		}
+	free(gram);
+}
+
+/* Sets the residuals to A y_i - theta_i y_i for the lowest Ritz pairs, with
+ * one pass over the products and one over the search basis. The amplitudes
+ * of the Ritz vectors are copied to the column major ritz_vectors.
+ */
+static
+void compute_residuals(davidson_environment_t environment,
+		       const eigensystem_t projected_system,
+		       size_t num_pairs,
+		       double *ritz_vectors,
+		       double *residual_norms)
+{
+	const size_t dimension = basis_get_dimension(environment->search_basis);
+	double *scaled_ritz_vectors =
+		(double*)malloc(dimension*num_pairs*sizeof(double));
+	for (size_t i = 0; i<num_pairs; i++)
+	{
+		const double *amplitudes =
+			get_eigenvector_amplitudes(projected_system,i);
+		const double ritz_value = get_eigenvalue(projected_system,i);
+		for (size_t j = 0; j<dimension; j++)
+		{
+			ritz_vectors[i*dimension+j] = amplitudes[j];
+			scaled_ritz_vectors[i*dimension+j] =
+				ritz_value*amplitudes[j];
+		}
+	}
+	vector_t *residuals = basis_get_all_vectors(environment->residuals);
+	combine_vectors(residuals,num_pairs,
+			basis_get_all_vectors(environment->products),
+			dimension,
+			ritz_vectors);
+	subtract_combinations(residuals,num_pairs,
+			      basis_get_all_vectors(environment->search_basis),
+			      dimension,
+			      scaled_ritz_vectors);
+	for (size_t i = 0; i<num_pairs; i++)
+		residual_norms[i] = norm(residuals[i]);
+	free(scaled_ritz_vectors);
+}
+
+/* Replaces the search basis and its products by the lowest Ritz vectors
+ * and their products, the projected matrix becomes diagonal.
+ */
+static
+void restart(davidson_environment_t environment,
+	     const eigensystem_t projected_system,
+	     const double *ritz_vectors)
+{
+	const size_t dimension = basis_get_dimension(environment->search_basis);
+	const size_t num_kept = environment->num_restart_vectors;
+	double *coefficients = (double*)malloc(dimension*num_kept*sizeof(double));
+	memcpy(coefficients,
+	       ritz_vectors,
+	       dimension*environment->num_wanted*sizeof(double));
+	for (size_t i = environment->num_wanted; i<num_kept; i++)
+		memcpy(coefficients + i*dimension,
+		       get_eigenvector_amplitudes(projected_system,i),
+		       dimension*sizeof(double));
+	basis_restart(environment->search_basis,coefficients,num_kept);
+	basis_restart(environment->products,coefficients,num_kept);
+	free(coefficients);
+	memset(environment->projected_matrix,
+	       0,
+	       environment->max_basis_dimension*
+	       environment->max_basis_dimension*sizeof(double));
+	for (size_t i = 0; i<num_kept; i++)
+		*projected_element(environment,i,i) =
+			get_eigenvalue(projected_system,i);
+	environment->num_restarts++;
+	printf("Davidson restarted with %lu Ritz vectors\n",num_kept);
+}
+
+/* Appends the direction orthonormalized against the search basis, twice,
+ * unless too little of it remains. Returns whether it was appended.
+ */
+static
+int append_search_vector(davidson_environment_t environment,
+			 const vector_t direction)
+{
+	const size_t dimension = basis_get_dimension(environment->search_basis);
+	basis_append_vector(environment->search_basis);
+	vector_t *vectors = basis_get_all_vectors(environment->search_basis);
+	vector_t new_vector = vectors[dimension];
+	const double one = 1.0;
+	combine_vectors(&new_vector,1,(vector_t*)&direction,1,&one);
+	const double initial_norm = norm(new_vector);
+	if (dimension > 0)
+	{
+		double *projections =
+			(double*)malloc(dimension*sizeof(double));
+		for (size_t round = 0; round<2; round++)
+		{
+			compute_gram_matrix(projections,
+					    vectors,dimension,
+					    &new_vector,1);
+			subtract_combinations(&new_vector,1,
+					      vectors,dimension,
+					      projections);
+		}
+		free(projections);
+	}
+	const double remaining_norm = norm(new_vector);
+	if (initial_norm == 0 ||
+	    remaining_norm < min_remaining_norm*initial_norm)
+	{
+		basis_remove_last(environment->search_basis);
+		return 0;
+	}
+	scale(new_vector,1.0/remaining_norm);
+	return 1;
+}
+
+new_test(davidson_finds_lowest_eigenvalues_with_fewer_multiplications,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 150,
+		 .target_eigenvalue = 2,
+		 .eigenvalue_tolerance = 1e-8,
+		 .convergence_critera = converge_residuals,
+		 .matrix = matrix
+	 };
+	 davidson_environment_t environment =
+		 new_davidson_environment(settings);
+	 davidson_diagonalize(environment);
+	 const size_t num_multiplications = environment->num_multiplications;
+	 assert_that(num_multiplications < settings.max_num_iterations);
+	 eigensystem_t davidson_eigensystem =
+		 get_davidson_eigensystem(environment);
+	 // Lanczos with as many multiplications is not converged yet
+	 lanczos_settings_t lanczos_settings = settings;
+	 lanczos_settings.max_num_iterations = num_multiplications;
+	 lanczos_settings.krylow_vectors_directory_name =
+		 copy_string(get_test_file_path("lanczos_vectors"));
+	 lanczos_environment_t lanczos_environment =
+		 new_lanczos_environment(lanczos_settings);
+	 diagonalize(lanczos_environment);
+	 eigensystem_t lanczos_eigensystem =
+		 get_eigensystem(lanczos_environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 double lanczos_difference = 0.0;
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 printf("(%lu) davidson: %.15lg, lanczos: %.15lg,"
+			" lapack: %.15lg\n",
+			i,
+			get_eigenvalue(davidson_eigensystem,i),
+			get_eigenvalue(lanczos_eigensystem,i),
+			get_eigenvalue(lapack_eigensystem,i));
+		 assert_that(fabs(get_eigenvalue(davidson_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) < 1e-8);
+		 lanczos_difference =
+			 fmax(lanczos_difference,
+			      fabs(get_eigenvalue(lanczos_eigensystem,i) -
+				   get_eigenvalue(lapack_eigensystem,i)));
+	 }
+	 printf("Davidson needed %lu matrix vector multiplications, Lanczos"
+		" with as many is off by %lg\n",
+		num_multiplications,
+		lanczos_difference);
+	 assert_that(lanczos_difference > 1e-8);
+	 free_davidson_environment(environment);
+	 free_lanczos_environment(lanczos_environment);
+	 free_eigensystem(davidson_eigensystem);
+	 free_eigensystem(lanczos_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	 free(lanczos_settings.krylow_vectors_directory_name);
+	);
+
+new_test(davidson_restarts_in_a_small_search_basis,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 150,
+		 .target_eigenvalue = 2,
+		 .eigenvalue_tolerance = 1e-8,
+		 .convergence_critera = converge_residuals,
+		 .max_basis_dimension = 9,
+		 .num_restart_vectors = 4,
+		 .matrix = matrix
+	 };
+	 davidson_environment_t environment =
+		 new_davidson_environment(settings);
+	 davidson_diagonalize(environment);
+	 assert_that(environment->num_restarts > 0);
+	 eigensystem_t davidson_eigensystem =
+		 get_davidson_eigensystem(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 for (size_t i = 0; i<3; i++)
+		 assert_that(fabs(get_eigenvalue(davidson_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) < 1e-8);
+	 free_davidson_environment(environment);
+	 free_eigensystem(davidson_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
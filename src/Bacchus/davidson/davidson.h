@@ -0,0 +1,37 @@
+#ifndef __DAVIDSON__
+#define __DAVIDSON__
+
+#include <stdlib.h>
+#include <lanczos/lanczos.h>
+#include <eigensystem/eigensystem.h>
+
+/* Generalized Davidson extends its search basis with the residuals of the
+ * unconverged Ritz pairs, each divided elementwise by the diagonal of the
+ * matrix minus the Ritz value. For the diagonally dominant Hamiltonians of
+ * NCSM this needs far fewer matrix vector multiplications than Lanczos. The
+ * diagonal is extracted once, see get_matrix_diagonal. Davidson starts from
+ * the initial vectors, or else from the basis states of the lowest diagonal
+ * elements, and restarts with num_restart_vectors Ritz vectors, at least
+ * the wanted ones, when the search basis would exceed max_basis_dimension.
+ * Without a maximum basis dimension it does not restart. The
+ * reorthogonalization settings of Lanczos are not used and the eigenvector
+ * criterion converges the residuals, since the search basis changes at
+ * every restart.
+ */
+
+struct _davidson_environment_;
+typedef struct _davidson_environment_ *davidson_environment_t;
+
+/* The number of vectors Davidson keeps, for selecting the vector storage.
+ */
+size_t davidson_num_vectors(lanczos_settings_t settings);
+
+davidson_environment_t new_davidson_environment(lanczos_settings_t settings);
+
+void davidson_diagonalize(davidson_environment_t environment);
+
+eigensystem_t get_davidson_eigensystem(davidson_environment_t environment);
+
+void free_davidson_environment(davidson_environment_t environment);
+
+#endif
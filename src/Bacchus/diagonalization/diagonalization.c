@@ -3,6 +3,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <math.h>
 
 extern void dsteqr_(char *compz,
 		    int *matrix_side,
@@ -67,6 +68,169 @@ eigensystem_t diagonalize_tridiagonal_matrix(
 	return eigensystem;
 }
 
+extern void dstebz_(char *range,
+		    char *order,
+		    int *matrix_side,
+		    double *lower_bound,
+		    double *upper_bound,
+		    int *lower_index,
+		    int *upper_index,
+		    double *absolute_tolerance,
+		    const double *diagonal,
+		    const double *off_diagonal,
+		    int *num_found,
+		    int *num_split_blocks,
+		    double *eigenvalues,
+		    int *block_indices,
+		    int *split_points,
+		    double *work_array,
+		    int *integer_work_array,
+		    int *info);
+
+extern void dstein_(int *matrix_side,
+		    const double *diagonal,
+		    const double *off_diagonal,
+		    int *num_eigenvalues,
+		    double *eigenvalues,
+		    int *block_indices,
+		    int *split_points,
+		    double *eigenvectors,
+		    int *leading_dimension,
+		    double *work_array,
+		    int *integer_work_array,
+		    int *failures,
+		    int *info);
+
+extern double dlamch_(char *cmach);
+
+void lowest_tridiagonal_eigenvalues(
+	double *eigenvalues,
+	double *last_components,
+	const double *diagonal_elements,
+	const double *off_diagonal_elements,
+	size_t dimension,
+	size_t num_eigenvalues)
+{
+	if (last_components == NULL)
+	{
+		lowest_tridiagonal_eigenpairs(eigenvalues,
+					      NULL,
+					      diagonal_elements,
+					      off_diagonal_elements,
+					      dimension,
+					      num_eigenvalues);
+		return;
+	}
+	double *eigenvectors =
+		(double*)malloc(dimension*num_eigenvalues*sizeof(double));
+	lowest_tridiagonal_eigenpairs(eigenvalues,
+				      eigenvectors,
+				      diagonal_elements,
+				      off_diagonal_elements,
+				      dimension,
+				      num_eigenvalues);
+	for (size_t i = 0; i<num_eigenvalues; i++)
+		last_components[i] = eigenvectors[i*dimension+dimension-1];
+	free(eigenvectors);
+}
+
+void lowest_tridiagonal_eigenpairs(
+	double *eigenvalues,
+	double *eigenvectors,
+	const double *diagonal_elements,
+	const double *off_diagonal_elements,
+	size_t dimension,
+	size_t num_eigenvalues)
+{
+	assert(num_eigenvalues > 0 && num_eigenvalues <= dimension);
+	int matrix_side = (int)dimension;
+	int lower_index = 1;
+	int upper_index = (int)num_eigenvalues;
+	double unused_bound = 0;
+	// Twice the underflow threshold gives the most accurate eigenvalues,
+	// which inverse iteration needs
+	double absolute_tolerance = 2*dlamch_("S");
+	int num_found = 0;
+	int num_split_blocks = 0;
+	int *block_indices = (int*)malloc(dimension*sizeof(int));
+	int *split_points = (int*)malloc(dimension*sizeof(int));
+	double *work_array = (double*)malloc(5*dimension*sizeof(double));
+	int *integer_work_array = (int*)malloc(3*dimension*sizeof(int));
+	double *found_eigenvalues = (double*)malloc(dimension*sizeof(double));
+	int info = 0;
+	// Block ordering, which dstein expects
+	dstebz_("I","B",
+		&matrix_side,
+		&unused_bound,
+		&unused_bound,
+		&lower_index,
+		&upper_index,
+		&absolute_tolerance,
+		diagonal_elements,
+		off_diagonal_elements,
+		&num_found,
+		&num_split_blocks,
+		found_eigenvalues,
+		block_indices,
+		split_points,
+		work_array,
+		integer_work_array,
+		&info);
+	log_entry("info = %d",info);
+	assert(info == 0);
+	assert(num_found == (int)num_eigenvalues);
+	double *found_eigenvectors = NULL;
+	if (eigenvectors != NULL)
+	{
+		found_eigenvectors =
+			(double*)malloc(dimension*num_eigenvalues*
+					sizeof(double));
+		int *failures = (int*)malloc(num_eigenvalues*sizeof(int));
+		dstein_(&matrix_side,
+			diagonal_elements,
+			off_diagonal_elements,
+			&num_found,
+			found_eigenvalues,
+			block_indices,
+			split_points,
+			found_eigenvectors,
+			&matrix_side,
+			work_array,
+			integer_work_array,
+			failures,
+			&info);
+		log_entry("info = %d",info);
+		assert(info == 0);
+		free(failures);
+	}
+	// The eigenvalues are ordered by split block, so they are sorted
+	for (size_t i = 0; i<num_eigenvalues; i++)
+	{
+		size_t lowest = i;
+		for (size_t j = i+1; j<num_eigenvalues; j++)
+			if (found_eigenvalues[j] < found_eigenvalues[lowest])
+				lowest = j;
+		eigenvalues[i] = found_eigenvalues[lowest];
+		found_eigenvalues[lowest] = found_eigenvalues[i];
+		found_eigenvalues[i] = eigenvalues[i];
+		if (eigenvectors == NULL)
+			continue;
+		memcpy(eigenvectors + i*dimension,
+		       found_eigenvectors + lowest*dimension,
+		       dimension*sizeof(double));
+		if (lowest != i)
+			memcpy(found_eigenvectors + lowest*dimension,
+			       found_eigenvectors + i*dimension,
+			       dimension*sizeof(double));
+	}
+	free(found_eigenvectors);
+	free(found_eigenvalues);
+	free(integer_work_array);
+	free(work_array);
+	free(split_points);
+	free(block_indices);
+}
+
 extern void dsyev_(char *jobz,
 		char *uplo,
 		int *side,
@@ -106,3 +270,263 @@ eigensystem_t diagonalize_symmetric_matrix(
 	free(work);
 	return eigensystem;	
 }
+
+eigensystem_t diagonalize_dense_symmetric_matrix(
+	const double *elements,
+	size_t dimension)
+{
+	int side = (int)dimension;
+	eigensystem_t eigensystem = new_empty_eigensystem(dimension);
+	double *eigenvalues = get_eigenvalues(eigensystem);
+	// dsyev overwrites the matrix with the eigenvectors
+	double *eigenvectors = (double*)malloc(dimension*dimension*
+					       sizeof(double));
+	memcpy(eigenvectors,elements,dimension*dimension*sizeof(double));
+	int lwork = 3*side-1;
+	double *work = (double*)calloc(lwork,
+			sizeof(double));
+	int info = 0;
+	dsyev_("V","U",
+		&side,
+		eigenvectors,
+		&side,
+		eigenvalues,
+		work,
+		&lwork,
+		&info);
+	log_entry("info = %d",info);
+	assert(info == 0);
+	for (size_t i = 0; i<dimension; i++)
+		if (eigenvectors[i*dimension]<0)
+			for (size_t j = 0; j<dimension; j++)
+				eigenvectors[i*dimension+j]*=-1;
+	set_eigenvalues(eigensystem,eigenvalues);
+	set_raw_eigenvectors(eigensystem,eigenvectors);
+	free(eigenvalues);
+	free(eigenvectors);
+	free(work);
+	return eigensystem;
+}
+
+eigensystem_t diagonalize_leading_submatrix(
+	const double *elements,
+	size_t leading_dimension,
+	size_t dimension)
+{
+	double *submatrix =
+		(double*)malloc(dimension*dimension*sizeof(double));
+	for (size_t j = 0; j<dimension; j++)
+		memcpy(submatrix + j*dimension,
+		       elements + j*leading_dimension,
+		       dimension*sizeof(double));
+	eigensystem_t eigensystem =
+		diagonalize_dense_symmetric_matrix(submatrix,dimension);
+	free(submatrix);
+	return eigensystem;
+}
+
+double difference_eigenvectors(const double *current_amplitudes,
+			       size_t current_dimension,
+			       const double *previous_amplitudes,
+			       size_t previous_dimension)
+{
+	double norm_difference_square = 0.0;
+	for (size_t i = 0; i<current_dimension; i++)
+	{
+		double difference = current_amplitudes[i] -
+			(i < previous_dimension ? previous_amplitudes[i] : 0.0);
+		norm_difference_square += difference*difference;
+	}
+	return sqrt(norm_difference_square);
+}
+
+extern void dpotrf_(char *uplo,
+		    int *side,
+		    double *matrix,
+		    int *leading_dimension,
+		    int *info);
+
+extern void dtrtri_(char *uplo,
+		    char *diagonal,
+		    int *side,
+		    double *matrix,
+		    int *leading_dimension,
+		    int *info);
+
+int cholesky_factorize(double *matrix,
+		       size_t dimension)
+{
+	char upper = 'U';
+	int side = (int)dimension;
+	int info = 0;
+	dpotrf_(&upper,&side,matrix,&side,&info);
+	if (info != 0)
+		return 0;
+	for (size_t j = 0; j<dimension; j++)
+		for (size_t i = j+1; i<dimension; i++)
+			matrix[j*dimension+i] = 0.0;
+	return 1;
+}
+
+void invert_upper_triangular_matrix(double *matrix,
+				    size_t dimension)
+{
+	char upper = 'U';
+	char non_unit = 'N';
+	int side = (int)dimension;
+	int info = 0;
+	dtrtri_(&upper,&non_unit,&side,matrix,&side,&info);
+	assert(info == 0);
+}
+
+int cholesky_qr(vector_t *results,
+		vector_t *vectors,
+		size_t num_vectors,
+		double relative_shift,
+		const double *min_diagonal,
+		double *triangular)
+{
+	const size_t num_elements = num_vectors*num_vectors;
+	double *factor = triangular != NULL ? triangular :
+		(double*)malloc(num_elements*sizeof(double));
+	compute_symmetric_gram_matrix(factor,vectors,num_vectors);
+	double trace = 0.0;
+	for (size_t i = 0; i<num_vectors; i++)
+		trace += factor[i*num_vectors+i];
+	for (size_t i = 0; i<num_vectors; i++)
+		factor[i*num_vectors+i] += relative_shift*trace;
+	int is_factorized = cholesky_factorize(factor,num_vectors);
+	for (size_t k = 0; is_factorized && min_diagonal != NULL &&
+	     k<num_vectors; k++)
+		if (factor[k*num_vectors+k] <= min_diagonal[k])
+			is_factorized = 0;
+	if (is_factorized)
+	{
+		double *inverse = (double*)malloc(num_elements*sizeof(double));
+		memcpy(inverse,factor,num_elements*sizeof(double));
+		invert_upper_triangular_matrix(inverse,num_vectors);
+		combine_vectors(results,num_vectors,
+				vectors,num_vectors,
+				inverse);
+		free(inverse);
+	}
+	if (factor != triangular)
+		free(factor);
+	return is_factorized;
+}
+
+extern void dsyevr_(char *jobz,
+		    char *range,
+		    char *uplo,
+		    int *side,
+		    double *matrix,
+		    int *lda,
+		    double *lower_bound,
+		    double *upper_bound,
+		    int *lower_index,
+		    int *upper_index,
+		    double *absolute_tolerance,
+		    int *num_found,
+		    double *eigenvalues,
+		    double *eigenvectors,
+		    int *ldz,
+		    int *support,
+		    double *work,
+		    int *lwork,
+		    int *integer_work,
+		    int *liwork,
+		    int *info);
+
+// Lanczos catches up at about 3000 on a matrix with well separated low
+// eigenvalues, which it converges on in few iterations
+const size_t max_direct_solve_dimension = 2000;
+
+void lowest_symmetric_eigenpairs(double *eigenvalues,
+				 vector_t *eigenvectors,
+				 matrix_t matrix,
+				 size_t num_eigenvalues)
+{
+	assert(is_explicit_matrix(matrix));
+	assert(get_num_rows(matrix) == get_num_columns(matrix));
+	const size_t dimension = get_num_rows(matrix);
+	assert(num_eigenvalues > 0 && num_eigenvalues <= dimension);
+	int side = (int)dimension;
+	// dsyevr destroys the copy, the matrix is symmetric so its row major
+	// elements are also column major
+	double *matrix_elements = get_matrix_elements(matrix);
+	double unused_bound = 0;
+	int lower_index = 1;
+	int upper_index = (int)num_eigenvalues;
+	double absolute_tolerance = 0;
+	int num_found = 0;
+	double *found_eigenvalues = (double*)malloc(dimension*sizeof(double));
+	double *found_eigenvectors =
+		eigenvectors != NULL ?
+		(double*)malloc(dimension*num_eigenvalues*sizeof(double)) :
+		NULL;
+	int *support = (int*)malloc(2*num_eigenvalues*sizeof(int));
+	char *jobz = eigenvectors != NULL ? "V" : "N";
+	// Asks for the sizes of the workspaces first
+	double optimal_lwork = 0;
+	int optimal_liwork = 0;
+	int lwork = -1;
+	int liwork = -1;
+	int info = 0;
+	dsyevr_(jobz,"I","U",
+		&side,
+		matrix_elements,
+		&side,
+		&unused_bound,
+		&unused_bound,
+		&lower_index,
+		&upper_index,
+		&absolute_tolerance,
+		&num_found,
+		found_eigenvalues,
+		found_eigenvectors,
+		&side,
+		support,
+		&optimal_lwork,
+		&lwork,
+		&optimal_liwork,
+		&liwork,
+		&info);
+	assert(info == 0);
+	lwork = (int)optimal_lwork;
+	liwork = optimal_liwork;
+	double *work = (double*)malloc(lwork*sizeof(double));
+	int *integer_work = (int*)malloc(liwork*sizeof(int));
+	dsyevr_(jobz,"I","U",
+		&side,
+		matrix_elements,
+		&side,
+		&unused_bound,
+		&unused_bound,
+		&lower_index,
+		&upper_index,
+		&absolute_tolerance,
+		&num_found,
+		found_eigenvalues,
+		found_eigenvectors,
+		&side,
+		support,
+		work,
+		&lwork,
+		integer_work,
+		&liwork,
+		&info);
+	log_entry("info = %d",info);
+	assert(info == 0);
+	assert(num_found == (int)num_eigenvalues);
+	memcpy(eigenvalues,found_eigenvalues,num_eigenvalues*sizeof(double));
+	if (eigenvectors != NULL)
+		for (size_t i = 0; i<num_eigenvalues; i++)
+			set_vector_elements(eigenvectors[i],
+					    found_eigenvectors + i*dimension);
+	free(integer_work);
+	free(work);
+	free(support);
+	free(found_eigenvectors);
+	free(found_eigenvalues);
+	free(matrix_elements);
+}
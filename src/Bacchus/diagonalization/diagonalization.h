@@ -10,6 +10,102 @@ eigensystem_t diagonalize_tridiagonal_matrix(
 	const double *off_diagonal_elements,
 	size_t dimension);
 
+/* Finds the lowest num_eigenvalues eigenvalues of the tridiagonal matrix by
+ * bisection and, unless last_components is NULL, the last components of
+ * their normalized eigenvectors by inverse iteration. This costs
+ * O(dimension*num_eigenvalues) instead of the O(dimension^2) of computing
+ * all eigenvectors.
+ */
+void lowest_tridiagonal_eigenvalues(
+	double *eigenvalues,
+	double *last_components,
+	const double *diagonal_elements,
+	const double *off_diagonal_elements,
+	size_t dimension,
+	size_t num_eigenvalues);
+
+/* Like lowest_tridiagonal_eigenvalues, but with the whole eigenvectors by
+ * inverse iteration unless eigenvectors is NULL. Column i of the column
+ * major dimension x num_eigenvalues eigenvectors belongs to eigenvalue i.
+ */
+void lowest_tridiagonal_eigenpairs(
+	double *eigenvalues,
+	double *eigenvectors,
+	const double *diagonal_elements,
+	const double *off_diagonal_elements,
+	size_t dimension,
+	size_t num_eigenvalues);
+
 eigensystem_t diagonalize_symmetric_matrix(
 	matrix_t matrix);
+
+/* Diagonalizes the symmetric matrix with the given column major elements
+ * and computes its eigenvectors.
+ */
+eigensystem_t diagonalize_dense_symmetric_matrix(
+	const double *elements,
+	size_t dimension);
+
+/* Diagonalizes the leading dimension x dimension part of the symmetric
+ * column major matrix, whose columns are leading_dimension elements apart,
+ * and computes its eigenvectors. The eigensolvers keep their projected
+ * matrices like this, with room for the largest basis.
+ */
+eigensystem_t diagonalize_leading_submatrix(
+	const double *elements,
+	size_t leading_dimension,
+	size_t dimension);
+
+/* The norm of the difference of the amplitudes of an eigenvector and those
+ * of the previous one, which are padded with zeros when the basis has
+ * grown since.
+ */
+double difference_eigenvectors(const double *current_amplitudes,
+			       size_t current_dimension,
+			       const double *previous_amplitudes,
+			       size_t previous_dimension);
+
+/* Overwrites the symmetric column major matrix with its upper triangular
+ * Cholesky factor, with zeros below the diagonal. Returns 0 if the matrix
+ * is not numerically positive definite.
+ */
+int cholesky_factorize(double *matrix,
+		       size_t dimension);
+
+/* Inverts the upper triangular column major matrix in place.
+ */
+void invert_upper_triangular_matrix(double *matrix,
+				    size_t dimension);
+
+/* One round of Cholesky QR of the vectors, one pass for their Gram matrix
+ * and one for the combinations. The results, which may be the vectors, are
+ * set to the orthonormal factor and, unless it is NULL, triangular to the
+ * column major upper triangular factor. The relative shift times the trace
+ * of the Gram matrix is added to its diagonal, as in shifted Cholesky QR
+ * of ill conditioned vectors. Returns 0, leaving the results unchanged, if
+ * the factorization fails or, unless min_diagonal is NULL, diagonal
+ * element k of the triangular factor is not above min_diagonal[k].
+ */
+int cholesky_qr(vector_t *results,
+		vector_t *vectors,
+		size_t num_vectors,
+		double relative_shift,
+		const double *min_diagonal,
+		double *triangular);
+
+/* Below this dimension the lowest eigenpairs of an explicit matrix are found
+ * faster directly than with Lanczos, see
+ * benchmark_direct_solve_against_lanczos in lanczos.c.
+ */
+extern const size_t max_direct_solve_dimension;
+
+/* Finds the lowest num_eigenvalues eigenvalues of the explicit symmetric
+ * matrix and, unless eigenvectors is NULL, sets eigenvectors[i] to the
+ * eigenvector of the i:th one. Only these eigenpairs are computed, by
+ * dsyevr.
+ */
+void lowest_symmetric_eigenpairs(double *eigenvalues,
+				 vector_t *eigenvectors,
+				 matrix_t matrix,
+				 size_t num_eigenvalues);
 #endif
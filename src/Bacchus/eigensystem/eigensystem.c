@@ -96,6 +96,18 @@ void get_eigenvector(vector_t result,
 			       eigensystem->num_eigenvalues);
 }
 
+void get_eigenvectors(vector_t *results,
+		      eigensystem_t eigensystem,
+		      size_t num_eigenvectors)
+{
+	assert(num_eigenvectors <= eigensystem->num_eigenvalues);
+	basis_construct_vectors(results,
+				num_eigenvectors,
+				eigensystem->vector_space_basis,
+				eigensystem->eigenvector_amplitudes,
+				eigensystem->num_eigenvalues);
+}
+
 void print_eigensystem(const eigensystem_t eigensystem)
 {
 	printf("eigensystem:\n"
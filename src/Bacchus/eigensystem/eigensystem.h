@@ -32,6 +32,13 @@ void  get_eigenvector(vector_t result,
 		       eigensystem_t eigensystem,
 		       size_t eigenvector_index);
 
+/* Sets the results to the lowest num_eigenvectors eigenvectors, reading
+ * the basis once instead of once per eigenvector.
+ */
+void get_eigenvectors(vector_t *results,
+		      eigensystem_t eigensystem,
+		      size_t num_eigenvectors);
+
 void print_eigensystem(const eigensystem_t eigensystem);
 
 void free_eigensystem(eigensystem_t eigensystem);
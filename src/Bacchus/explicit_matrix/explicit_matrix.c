@@ -5,16 +5,66 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <string_tools/string_tools.h>
 #include <unit_testing/test.h>
 #include <math.h>
 
+extern void dgemm_(char *transpose_a,
+		   char *transpose_b,
+		   int *num_rows,
+		   int *num_columns,
+		   int *num_terms,
+		   double *alpha,
+		   double *a,
+		   int *leading_dimension_a,
+		   double *b,
+		   int *leading_dimension_b,
+		   double *beta,
+		   double *c,
+		   int *leading_dimension_c);
+
+extern void dgemv_(char *transpose,
+		   int *num_rows,
+		   int *num_columns,
+		   double *alpha,
+		   double *a,
+		   int *leading_dimension_a,
+		   double *x,
+		   int *increment_x,
+		   double *beta,
+		   double *y,
+		   int *increment_y);
+
+extern void dsymv_(char *upper_or_lower,
+		   int *side,
+		   double *alpha,
+		   double *a,
+		   int *leading_dimension_a,
+		   double *x,
+		   int *increment_x,
+		   double *beta,
+		   double *y,
+		   int *increment_y);
+
+typedef enum
+{
+	UNKNOWN_SYMMETRY,
+	SYMMETRIC,
+	NOT_SYMMETRIC
+} symmetry_t;
+
 struct _explicit_matrix_
 {
 	size_t num_rows;
 	size_t num_columns;
 	double *elements;
+	// Checked on the first multiplication after the elements changed
+	symmetry_t symmetry;
 };
 
+static
+int is_symmetric(explicit_matrix_t explicit_matrix);
+
 static
 void write_numpy_header(FILE* file,
 			size_t num_rows,
@@ -33,6 +83,7 @@ explicit_matrix_t new_zero_explicit_matrix(size_t num_rows,
 	explicit_matrix->num_columns = num_columns;
 	explicit_matrix->elements = (double*)calloc(num_rows*num_columns,
 					   sizeof(double));
+	explicit_matrix->symmetry = UNKNOWN_SYMMETRY;
 	return explicit_matrix;
 }
 
@@ -46,6 +97,7 @@ explicit_matrix_t new_random_symmetric_explicit_matrix(size_t side_length)
 			explicit_matrix->elements[j*side_length+i] = 
 				explicit_matrix->elements[i*side_length+j] =
 				2*drand48()-1;
+	explicit_matrix->symmetry = SYMMETRIC;
 	return explicit_matrix;
 }
 
@@ -60,6 +112,7 @@ explicit_matrix_t new_explicit_matrix_from_numpy(FILE* explicit_matrix_file)
 	explicit_matrix->num_rows = header.num_rows;
 	explicit_matrix->num_columns = header.num_columns;
 	explicit_matrix->elements = elements;
+	explicit_matrix->symmetry = UNKNOWN_SYMMETRY;
 	return explicit_matrix;
 }
 
@@ -73,22 +126,102 @@ void explicit_matrix_vector_multiplication(vector_t result_vector,
 	assert(explicit_matrix->num_columns == vector_dimension(vector));
 	assert(explicit_matrix->num_rows == vector_dimension(result_vector));
 	log_entry("explicit_matrix_vector_multiplication");
-	for (size_t i = 0; i < explicit_matrix->num_rows; i++)
+	double *vector_elements =
+		(double*)malloc(explicit_matrix->num_columns*sizeof(double));
+	double *result_elements =
+		(double*)malloc(explicit_matrix->num_rows*sizeof(double));
+	copy_vector_elements(vector_elements,vector);
+	int num_rows = (int)explicit_matrix->num_rows;
+	int num_columns = (int)explicit_matrix->num_columns;
+	int increment = 1;
+	double one = 1.0;
+	double zero = 0.0;
+	if (is_symmetric(explicit_matrix))
+	{
+		// Reads only half of the matrix
+		char upper = 'U';
+		dsymv_(&upper,
+		       &num_rows,
+		       &one,
+		       explicit_matrix->elements,
+		       &num_rows,
+		       vector_elements,
+		       &increment,
+		       &zero,
+		       result_elements,
+		       &increment);
+	}
+	else
 	{
-		double accumulator = 0.0;
-		for (size_t j = 0; j < explicit_matrix->num_columns; j++)
-		{
-			size_t I = i*explicit_matrix->num_columns + j;
-			double element = explicit_matrix->elements[I];
-			double v_element = get_element(vector,j);
-			log_entry("element = %lg",element);
-			log_entry("v_element = %lg",v_element);
-			accumulator += v_element*element;
-		}
-		log_entry("accumulator = %lg",accumulator);
-		set_element(result_vector,i,accumulator);
+		// The row major elements are the transpose of a column major
+		// matrix
+		char transpose = 'T';
+		dgemv_(&transpose,
+		       &num_columns,
+		       &num_rows,
+		       &one,
+		       explicit_matrix->elements,
+		       &num_columns,
+		       vector_elements,
+		       &increment,
+		       &zero,
+		       result_elements,
+		       &increment);
 	}
-	save_vector(result_vector);
+	set_vector_elements(result_vector,result_elements);
+	free(result_elements);
+	free(vector_elements);
+}
+
+void explicit_matrix_block_multiplication
+	(vector_t *result_vectors,
+	 const explicit_matrix_t explicit_matrix,
+	 vector_t *vectors,
+	 size_t num_vectors)
+{
+	assert(explicit_matrix != NULL);
+	assert(explicit_matrix->elements != NULL);
+	log_entry("explicit_matrix_block_multiplication of %lu vectors",
+		  num_vectors);
+	const size_t num_rows = explicit_matrix->num_rows;
+	const size_t num_columns = explicit_matrix->num_columns;
+	double *vector_elements =
+		(double*)malloc(num_columns*num_vectors*sizeof(double));
+	double *result_elements =
+		(double*)malloc(num_rows*num_vectors*sizeof(double));
+	for (size_t k = 0; k<num_vectors; k++)
+	{
+		assert(num_columns == vector_dimension(vectors[k]));
+		assert(num_rows == vector_dimension(result_vectors[k]));
+		copy_vector_elements(vector_elements + k*num_columns,
+				     vectors[k]);
+	}
+	// The row major elements are the transpose of a column major matrix
+	char transpose = 'T';
+	char no_transpose = 'N';
+	int m = (int)num_rows;
+	int n = (int)num_vectors;
+	int k = (int)num_columns;
+	double one = 1.0;
+	double zero = 0.0;
+	dgemm_(&transpose,
+	       &no_transpose,
+	       &m,
+	       &n,
+	       &k,
+	       &one,
+	       explicit_matrix->elements,
+	       &k,
+	       vector_elements,
+	       &k,
+	       &zero,
+	       result_elements,
+	       &m);
+	for (size_t l = 0; l<num_vectors; l++)
+		set_vector_elements(result_vectors[l],
+				    result_elements + l*num_rows);
+	free(vector_elements);
+	free(result_elements);
 }
 
 size_t get_explicit_matrix_num_rows(explicit_matrix_t explicit_matrix)
@@ -111,6 +244,7 @@ void set_explicit_matrix_elements(explicit_matrix_t explicit_matrix,
 	       elements,
 	       sizeof(double)*explicit_matrix->num_rows*
 	       explicit_matrix->num_columns);
+	explicit_matrix->symmetry = UNKNOWN_SYMMETRY;
 }
 
 void set_explicit_matrix_element(explicit_matrix_t explicit_matrix,
@@ -120,6 +254,7 @@ void set_explicit_matrix_element(explicit_matrix_t explicit_matrix,
 {
 	size_t I = i*explicit_matrix->num_columns + j;
 	explicit_matrix->elements[I] = element;
+	explicit_matrix->symmetry = UNKNOWN_SYMMETRY;
 }
 
 double *get_explicit_matrix_elements(explicit_matrix_t explicit_matrix)
@@ -136,6 +271,15 @@ double *get_explicit_matrix_elements(explicit_matrix_t explicit_matrix)
 	return elements;
 }
 
+void get_explicit_matrix_diagonal(double *diagonal,
+				  const explicit_matrix_t explicit_matrix)
+{
+	assert(explicit_matrix->num_rows == explicit_matrix->num_columns);
+	for (size_t i = 0; i<explicit_matrix->num_rows; i++)
+		diagonal[i] =
+			explicit_matrix->elements[i*explicit_matrix->num_columns+i];
+}
+
 void save_numpy_explicit_matrix(FILE *file,
 		       const explicit_matrix_t explicit_matrix)
 {
@@ -171,6 +315,27 @@ void free_explicit_matrix(explicit_matrix_t explicit_matrix)
 	free(explicit_matrix);
 }
 
+static
+int is_symmetric(explicit_matrix_t explicit_matrix)
+{
+	if (explicit_matrix->symmetry == UNKNOWN_SYMMETRY)
+	{
+		const size_t side = explicit_matrix->num_rows;
+		const double *elements = explicit_matrix->elements;
+		int symmetric = side == explicit_matrix->num_columns;
+		for (size_t i = 0; i<side && symmetric; i++)
+			for (size_t j = i+1; j<side; j++)
+				if (elements[i*side+j] != elements[j*side+i])
+				{
+					symmetric = 0;
+					break;
+				}
+		explicit_matrix->symmetry =
+			symmetric ? SYMMETRIC : NOT_SYMMETRIC;
+	}
+	return explicit_matrix->symmetry == SYMMETRIC;
+}
+
 static
 void write_numpy_header(FILE* file,
 			size_t num_rows,
@@ -220,3 +385,107 @@ new_test(save_explicit_matrix_to_numpy_file,
 	 free_explicit_matrix(explicit_matrix);
 	 free_explicit_matrix(loaded_explicit_matrix);
 	);
+
+new_test(block_multiplication_matches_vector_multiplication,
+	 size_t num_rows = 7;
+	 size_t num_columns = 5;
+	 explicit_matrix_t explicit_matrix =
+	 new_zero_explicit_matrix(num_rows,num_columns);
+	 for (size_t i = 0; i<num_rows; i++)
+		 for (size_t j = 0; j<num_columns; j++)
+			 set_explicit_matrix_element(explicit_matrix,i,j,
+						     2*drand48()-1);
+	 vector_settings_t input_settings =
+	 {
+		 .directory_name = NULL,
+		 .num_blocks = 1,
+		 .block_sizes = &num_columns
+	 };
+	 vector_settings_t output_settings = input_settings;
+	 output_settings.block_sizes = &num_rows;
+	 vector_t vectors[3];
+	 vector_t results[3];
+	 vector_t expected_result;
+	 char name[64];
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 sprintf(name,"input_%lu",i);
+		 input_settings.directory_name =
+			 copy_string(get_test_file_path(name));
+		 vectors[i] = new_random_vector(input_settings);
+		 free(input_settings.directory_name);
+		 sprintf(name,"result_%lu",i);
+		 output_settings.directory_name =
+			 copy_string(get_test_file_path(name));
+		 results[i] = new_zero_vector(output_settings);
+		 free(output_settings.directory_name);
+	 }
+	 output_settings.directory_name =
+		 copy_string(get_test_file_path("expected_result"));
+	 expected_result = new_zero_vector(output_settings);
+	 free(output_settings.directory_name);
+	 explicit_matrix_block_multiplication(results,explicit_matrix,
+					      vectors,3);
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 explicit_matrix_vector_multiplication(expected_result,
+						       explicit_matrix,
+						       vectors[i]);
+		 for (size_t j = 0; j<num_rows; j++)
+			 assert_that(fabs(get_element(results[i],j) -
+					  get_element(expected_result,j))
+				     < 1e-12);
+	 }
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 free_vector(vectors[i]);
+		 free_vector(results[i]);
+	 }
+	 free_vector(expected_result);
+	 free_explicit_matrix(explicit_matrix);
+	);
+
+new_test(vector_multiplication_matches_the_row_sums,
+	 size_t side = 6;
+	 explicit_matrix_t symmetric_matrix =
+	 new_random_symmetric_explicit_matrix(side);
+	 explicit_matrix_t general_matrix =
+	 new_zero_explicit_matrix(side,side);
+	 for (size_t i = 0; i<side; i++)
+		 for (size_t j = 0; j<side; j++)
+			 set_explicit_matrix_element(general_matrix,i,j,
+						     2*drand48()-1);
+	 vector_settings_t settings =
+	 {
+		 .directory_name = copy_string(get_test_file_path("input")),
+		 .num_blocks = 2,
+		 .block_sizes = (size_t[]){2,4}
+	 };
+	 vector_t vector = new_random_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name = copy_string(get_test_file_path("result"));
+	 vector_t result = new_zero_vector(settings);
+	 free(settings.directory_name);
+	 explicit_matrix_t matrices[2] = {symmetric_matrix,general_matrix};
+	 for (size_t k = 0; k<2; k++)
+	 {
+		 explicit_matrix_vector_multiplication(result,
+						       matrices[k],
+						       vector);
+		 for (size_t i = 0; i<side; i++)
+		 {
+			 double expected = 0;
+			 for (size_t j = 0; j<side; j++)
+				 expected += matrices[k]->elements[i*side+j]*
+					 get_element(vector,j);
+			 assert_that(fabs(get_element(result,i) - expected)
+				     < 1e-12);
+		 }
+	 }
+	 assert_that(symmetric_matrix->symmetry == SYMMETRIC);
+	 assert_that(general_matrix->symmetry == NOT_SYMMETRIC);
+	 free_vector(vector);
+	 free_vector(result);
+	 free_explicit_matrix(symmetric_matrix);
+	 free_explicit_matrix(general_matrix);
+	);
@@ -20,6 +20,14 @@ void explicit_matrix_vector_multiplication(vector_t result_vector,
 				  const explicit_matrix_t explicit_matrix,
 				  const vector_t vector);
 
+/* Multiplies the matrix with all vectors in one matrix matrix product.
+ */
+void explicit_matrix_block_multiplication
+	(vector_t *result_vectors,
+	 const explicit_matrix_t explicit_matrix,
+	 vector_t *vectors,
+	 size_t num_vectors);
+
 size_t get_explicit_matrix_num_rows(explicit_matrix_t explicit_matrix);
 
 size_t get_explicit_matrix_num_columns(explicit_matrix_t explicit_matrix);
@@ -34,6 +42,9 @@ void set_explicit_matrix_element(explicit_matrix_t explicit_matrix,
 
 double* get_explicit_matrix_elements(explicit_matrix_t explicit_matrix);
 
+void get_explicit_matrix_diagonal(double *diagonal,
+				  const explicit_matrix_t explicit_matrix);
+
 void save_numpy_explicit_matrix(FILE *file,
 		       const explicit_matrix_t explicit_matrix);
 
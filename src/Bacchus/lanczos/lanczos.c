@@ -10,12 +10,31 @@
 #include <unit_testing/test.h>
 #include <log/log.h>
 #include <math.h>
+#include <float.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
 
 
 const size_t first = 0;
 
+static const char checkpoint_magic[8] = "BACCHKPT";
+static const uint32_t checkpoint_version = 1;
+
+/* The results of the last full diagnostics.
+ */
+typedef struct
+{
+	double normalization_error;
+	double max_overlap;
+	double residual_norm;
+	double estimated_residual_norm;
+} lanczos_diagnostics_t;
+
 struct _lanczos_environment_
 {
 	lanczos_settings_t settings;
@@ -23,17 +42,140 @@ struct _lanczos_environment_
 	double *diagonal_elements;
 	double *off_diagonal_elements;
 	size_t dimension_krylow_space;
+	// Estimates of the scalar products of the last three Krylow vectors
+	// with all older ones, for partial reorthogonalization
+	double *previous_orthogonality;
+	double *current_orthogonality;
+	double *next_orthogonality;
+	int reorthogonalize_next;
+	// The converged Ritz vectors, for selective reorthogonalization
+	basis_t ritz_basis;
+	double *ritz_values;
+	size_t num_reorthogonalizations;
+	size_t num_skipped_reorthogonalizations;
+	size_t num_ritz_orthogonalizations;
+	// After a thick restart the basis starts with num_locked Ritz vectors,
+	// which are coupled to the next Krylow vector by the couplings
+	size_t num_locked;
+	double *couplings;
+	size_t num_iterations;
+	size_t num_restarts;
+	// The checksums of the basis vectors in the checkpoint. The vectors
+	// before the recorded ones have not changed since they were recorded.
+	uint64_t *krylow_checksums;
+	size_t num_recorded_krylow_vectors;
+	uint64_t *ritz_checksums;
+	size_t num_recorded_ritz_vectors;
+	// How much the norm of the new Krylow vector differs from the one
+	// estimated from the scalar products
+	double normalization_drift;
+	lanczos_diagnostics_t diagnostics;
+	// Scratch vectors of the full diagnostics, made by the first pass
+	vector_t diagnostics_ritz_vector;
+	vector_t diagnostics_residual;
 };
 
+/* The state of the diagonalization loop that is not in the environment.
+ */
+typedef struct
+{
+	size_t iteration;
+	size_t position;
+	double previous_eigenvalue;
+	double *previous_eigenvector_amplitudes;
+} lanczos_loop_state_t;
+
+static
+void free_diagnostics_vector(vector_t vector);
+
+static
+vector_t new_diagnostics_vector(lanczos_environment_t environment,
+				const char *name);
+
+
+static
+double convergence_difference(lanczos_environment_t environment,
+			      size_t position,
+			      double *previous_eigenvalue,
+			      double *previous_eigenvector_amplitudes);
+
+static
+void run_diagnostics(lanczos_environment_t environment,
+		     size_t iteration,
+		     size_t position);
+
 static
-double difference_eigenvectors(const double *current_amplitudes,
-			       const double *previous_amplitudes,
-			       size_t num_current_amplitudes);
+double elapsed_microseconds(struct timespec t_start);
 
+static
+const char *convergence_criteria_name(convergence_critera_t criteria);
 
 static
 size_t min(size_t a, size_t b);
 
+static
+void estimate_orthogonality(lanczos_environment_t environment,
+			    size_t iteration);
+
+static
+void orthogonalize_against_locked_vectors(lanczos_environment_t environment,
+					  size_t iteration);
+
+static
+double max_estimated_overlap(lanczos_environment_t environment,
+			     size_t iteration);
+
+static
+void add_converged_ritz_vectors(lanczos_environment_t environment,
+				size_t iteration);
+
+static
+void normalize(vector_t vector);
+
+static
+eigensystem_t diagonalize_projected_matrix(lanczos_environment_t environment,
+					   size_t dimension);
+
+static
+void restart_krylow_basis(lanczos_environment_t environment,
+			  size_t position);
+
+static
+void round_old_krylow_vectors(lanczos_environment_t environment,
+			      size_t position);
+
+static
+void release_krylow_vectors(lanczos_environment_t environment,
+			    size_t num_vectors);
+
+static
+uint64_t hash_lanczos_settings(lanczos_settings_t settings);
+
+static
+void record_basis_vectors(basis_t basis,
+			  uint64_t *checksums,
+			  size_t *num_recorded_vectors);
+
+static
+void write_checkpoint(lanczos_environment_t environment,
+		      lanczos_loop_state_t state);
+
+static
+void read_checkpoint(lanczos_environment_t environment,
+		     lanczos_loop_state_t *state);
+
+static
+void write_checkpoint_values(FILE *file,
+			     const void *values,
+			     size_t value_size,
+			     size_t num_values);
+
+static
+void read_checkpoint_values(FILE *file,
+			    void *values,
+			    size_t value_size,
+			    size_t num_values);
+
 lanczos_environment_t new_lanczos_environment(lanczos_settings_t settings)
 {
 	lanczos_environment_t environment = 
@@ -54,28 +196,102 @@ lanczos_environment_t new_lanczos_environment(lanczos_settings_t settings)
 		error("Could not create krylow vector directory \"%s\". %s\n",
 		      settings.krylow_vectors_directory_name,
 		      strerror(errno));
+	const size_t num_orthogonalities = settings.max_num_iterations+2;
+	environment->previous_orthogonality =
+		(double*)calloc(num_orthogonalities,sizeof(double));
+	environment->current_orthogonality =
+		(double*)calloc(num_orthogonalities,sizeof(double));
+	environment->next_orthogonality =
+		(double*)calloc(num_orthogonalities,sizeof(double));
+	environment->current_orthogonality[0] = 1;
+	environment->reorthogonalize_next = 0;
+	environment->ritz_basis = NULL;
+	environment->ritz_values = NULL;
+	if (settings.reorthogonalization == selective_reorthogonalization)
+	{
+		char *ritz_directory_name =
+			new_subdirectory_name
+			(settings.krylow_vectors_directory_name,
+			 "ritz_vectors");
+		environment->ritz_basis =
+			new_basis_empty(settings.vector_settings,
+					ritz_directory_name,
+					settings.max_num_iterations);
+		free(ritz_directory_name);
+		environment->ritz_values =
+			(double*)malloc(settings.max_num_iterations*
+					sizeof(double));
+	}
+	environment->num_reorthogonalizations = 0;
+	environment->num_skipped_reorthogonalizations = 0;
+	environment->num_ritz_orthogonalizations = 0;
+	environment->num_locked = 0;
+	environment->couplings = NULL;
+	environment->num_iterations = 0;
+	environment->num_restarts = 0;
+	environment->krylow_checksums =
+		(uint64_t*)calloc(settings.max_num_iterations+1,
+				  sizeof(uint64_t));
+	environment->num_recorded_krylow_vectors = 0;
+	environment->ritz_checksums =
+		(uint64_t*)calloc(settings.max_num_iterations,
+				  sizeof(uint64_t));
+	environment->num_recorded_ritz_vectors = 0;
+	environment->normalization_drift = 0;
+	environment->diagnostics = (lanczos_diagnostics_t){0};
+	environment->diagnostics_ritz_vector = NULL;
+	environment->diagnostics_residual = NULL;
+	if (settings.max_basis_dimension > 0)
+	{
+		if (settings.num_restart_vectors <= settings.target_eigenvalue ||
+		    settings.num_restart_vectors+3 > settings.max_basis_dimension)
+			error("The number of restart vectors, %lu, has to be"
+			      " larger than the target eigenvalue, %lu, and"
+			      " at least three less than the maximum basis"
+			      " dimension, %lu\n",
+			      settings.num_restart_vectors,
+			      settings.target_eigenvalue,
+			      settings.max_basis_dimension);
+		environment->couplings =
+			(double*)calloc(settings.num_restart_vectors,
+					sizeof(double));
+	}
 	return environment;
 }
 
 void initialize_first_krylow_vector(lanczos_environment_t environment)
 {
 	/* The first Krylow vector for lanczos is a choice. 
-	 * In this early version we choose to set the first component of the 
-	 * Krylow vector to 1 and the rest to 0.
-	 * However, better choices exists and for the future this might change
+	 * Without initial vectors, e.g. eigenvectors of a smaller model space,
+	 * we choose to set the first component of the Krylow vector to 1 and
+	 * the rest to 0.
 	 */
 	basis_append_vector(environment->krylow_basis);
 	vector_t first_krylow_vector =
 	       	basis_get_vector(environment->krylow_basis,0);
-	set_element(first_krylow_vector,0,1.0);
-	save_vector(first_krylow_vector);
+	const lanczos_settings_t settings = environment->settings;
+	if (settings.num_initial_vectors == 0)
+	{
+		set_element(first_krylow_vector,0,1.0);
+		save_vector(first_krylow_vector);
+		return;
+	}
+	combine_vectors(&first_krylow_vector,1,
+			settings.initial_vectors,
+			settings.num_initial_vectors,
+			settings.initial_coefficients);
+	double initial_norm = norm(first_krylow_vector);
+	if (initial_norm == 0)
+		error("The combination of the initial vectors is zero\n");
+	scale(first_krylow_vector,1.0/initial_norm);
 }
 
 void lanczos_iteration(lanczos_environment_t environment,
 		       size_t iteration)
 {
 	struct timespec t_start,t_end;
-	printf("Lanczos iteration %lu start:\n",iteration+1);
+	environment->num_iterations++;
+	printf("Lanczos iteration %lu start:\n",environment->num_iterations);
 	clock_gettime(CLOCK_REALTIME,&t_start);
 	/* Before the Lanczos iteration can begin, it is necessary
 	 * initialize the new Krylow-vector.
@@ -93,78 +309,171 @@ void lanczos_iteration(lanczos_environment_t environment,
 	vector_t next_krylow_vector =
 		basis_get_vector(environment->krylow_basis,
 				 iteration+1);
-	log_entry("norm of current krylow vector is %lg\n",
-		  norm(current_krylow_vector));
+	/* With asynchronous basis writes, the current and the next Krylow
+	 * vector are kept in memory, the previous one still is, so the step
+	 * does not touch the files of the Krylow basis.
+	 */
+	if (environment->settings.asynchronous_basis_writes)
+	{
+		keep_vector_in_memory(current_krylow_vector);
+		keep_vector_in_memory(next_krylow_vector);
+	}
 	matrix_vector_multiplication(next_krylow_vector,
 				     environment->settings.matrix,
 				     current_krylow_vector);
-	log_entry("norm of w is %lg\n",
-		  norm(next_krylow_vector));
 	log_entry("Has created a new krylow vector at index %lu",
 		  iteration+1);
 	/* The diagonal coefficients are the projections of the w_k on the k:th
-	 * Krylow vector.
+	 * Krylow vector. All scalar products needed for the step are computed
+	 * in the same pass over the vectors.
 	 */
-	double alpha = scalar_multiplication(current_krylow_vector,
-					     next_krylow_vector);
-	log_entry("alpha[%lu] = %lg\n",iteration,alpha);
+	/* Right after a restart, the current Krylow vector is coupled to all
+	 * the Ritz vectors instead of a previous Krylow vector. These
+	 * couplings are removed by orthogonalizing against the Ritz vectors.
+	 */
+	const int is_restart_step = iteration > first &&
+		iteration == environment->num_locked;
+	vector_t previous_krylow_vector =
+		iteration == first || is_restart_step ? NULL :
+		basis_get_vector(environment->krylow_basis,
+				 iteration-1);
+	double beta_previous = previous_krylow_vector == NULL ? 0.0 :
+		environment->off_diagonal_elements[iteration-1];
+	lanczos_products_t products;
+	vector_traffic_t traffic =
+		lanczos_step_products(&products,
+				      next_krylow_vector,
+				      current_krylow_vector,
+				      previous_krylow_vector);
+	printf("Lanczos products pass read %lu bytes\n",
+	       traffic.bytes_read);
+	double alpha = products.v_w;
+	log_entry("alpha[%lu] = %lg, norm of current krylow vector %lg, "
+		  "norm of w %lg",
+		  iteration,alpha,sqrt(products.v_v),sqrt(products.w_w));
 	environment->diagonal_elements[iteration] = alpha;
 
 	/* Since all Krylow vectors are orthogonal, Lanczos removes
 	 * the projection of the new Krylow vector on the plane (line) of the 
-	 * two (one) previous ones.
+	 * two (one) previous ones. The norm of the result follows from the
+	 * scalar products, which lets the new Krylow vector be normalized in
+	 * the same pass.
 	 */ 
-	if (iteration == first)
-		subtract_line_projection
-			(next_krylow_vector,
-			 alpha,
-			 current_krylow_vector);
-	else
+	double estimated_square_norm =
+		products.w_w - 2*alpha*products.v_w + square(alpha)*products.v_v;
+	if (previous_krylow_vector != NULL)
+		estimated_square_norm +=
+			-2*beta_previous*products.previous_w +
+			square(beta_previous)*products.previous_previous +
+			2*alpha*beta_previous*products.v_previous;
+	double scaling = estimated_square_norm > 0 && !is_restart_step ?
+		1.0/sqrt(estimated_square_norm) : 1.0;
+	double square_norm = 0.0;
+	traffic = lanczos_step_update(next_krylow_vector,
+				      alpha,
+				      current_krylow_vector,
+				      beta_previous,
+				      previous_krylow_vector,
+				      scaling,
+				      &square_norm);
+	printf("Lanczos update pass read %lu bytes and wrote %lu bytes\n",
+	       traffic.bytes_read,traffic.bytes_written);
+	if (is_restart_step)
 	{
-		double beta_previous = 
-			environment->off_diagonal_elements[iteration-1];
-		vector_t previous_krylow_vector =
-			basis_get_vector(environment->krylow_basis,
-					 iteration-1);
-		subtract_plane_projection
-			(next_krylow_vector,
-			 alpha,
-			 current_krylow_vector,
-			 beta_previous,
-			 previous_krylow_vector);
+		reorthogonalize_vector(next_krylow_vector,
+				       basis_get_all_vectors
+				       (environment->krylow_basis),
+				       environment->num_locked);
+		square_norm = square(norm(next_krylow_vector));
 	}
-
-	double beta_new = norm(next_krylow_vector);
+	double beta_new = sqrt(square_norm);
 	environment->off_diagonal_elements[iteration] = beta_new;
-	/* Normalizeing the new Krylow vector.
-	*/
-	scale(next_krylow_vector, 1.0 / beta_new);
-	log_entry("norm of new krylow vector is %lg",
-		  norm(next_krylow_vector));
-	log_entry("scale %lg",
-		  scalar_multiplication(next_krylow_vector,
-					current_krylow_vector));
+	/* The estimated norm suffers from cancellation when the new Krylow
+	 * vector is much shorter than w_k, then it is normalized again with
+	 * the norm computed during the update.
+	 */
+	if (fabs(beta_new*scaling - 1) > sqrt(DBL_EPSILON))
+	{
+		printf("Lanczos iteration %lu renormalizes the new Krylow"
+		       " vector\n",environment->num_iterations);
+		scale(next_krylow_vector, 1.0 / (beta_new*scaling));
+	}
+	environment->normalization_drift = fabs(beta_new*scaling - 1);
 	clock_gettime(CLOCK_REALTIME,&t_end);
 	double iteration_time = 
 		(t_end.tv_sec-t_start.tv_sec)*1e6 +
 		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
 	printf("Lanczos iteration %lu end after %lg µs\n", 
-	       iteration+1, iteration_time);
+	       environment->num_iterations, iteration_time);
 }
 
 void orthogonalize_krylow_basis(lanczos_environment_t environment,
 				size_t iteration)
 {
-	if (iteration > 2)
+	vector_t next_vector =
+		basis_get_vector(environment->krylow_basis,
+				 iteration + 1);
+	vector_t *all_krylow_vectors =
+		basis_get_all_vectors(environment->krylow_basis);
+	switch (environment->settings.reorthogonalization)
 	{
-		vector_t current_vector =
-		       	basis_get_vector(environment->krylow_basis,
-					 iteration + 1);
-		vector_t *all_krylow_vectors =
-		       	basis_get_all_vectors(environment->krylow_basis);
-		reorthogonalize_vector(current_vector, 
-				       all_krylow_vectors,
-				       iteration-2);
+		case full_reorthogonalization:
+			if (iteration > 2)
+			{
+				reorthogonalize_vector(next_vector, 
+						       all_krylow_vectors,
+						       iteration-2);
+				environment->num_reorthogonalizations++;
+			}
+			break;
+		case partial_reorthogonalization:
+			estimate_orthogonality(environment,iteration);
+			/* When the orthogonality is lost, the next Krylow
+			 * vector is also reorthogonalized, since it is built
+			 * from the current one.
+			 */
+			if (environment->reorthogonalize_next ||
+			    max_estimated_overlap(environment,iteration) >
+			    sqrt(DBL_EPSILON))
+			{
+				reorthogonalize_vector(next_vector,
+						       all_krylow_vectors,
+						       iteration+1);
+				normalize(next_vector);
+				const double reset_overlap =
+					DBL_EPSILON*
+					sqrt(environment->settings.dimension);
+				for (size_t k = 0; k<=iteration; k++)
+					environment->current_orthogonality[k] =
+						reset_overlap;
+				environment->reorthogonalize_next =
+					!environment->reorthogonalize_next;
+				environment->num_reorthogonalizations++;
+			}
+			else
+			{
+				orthogonalize_against_locked_vectors
+					(environment,iteration);
+				environment->num_skipped_reorthogonalizations++;
+			}
+			break;
+		case selective_reorthogonalization:
+			add_converged_ritz_vectors(environment,iteration);
+			size_t num_ritz_vectors =
+				basis_get_dimension(environment->ritz_basis);
+			if (num_ritz_vectors > 0)
+			{
+				reorthogonalize_vector
+					(next_vector,
+					 basis_get_all_vectors
+					 (environment->ritz_basis),
+					 num_ritz_vectors);
+				normalize(next_vector);
+				environment->num_ritz_orthogonalizations++;
+			}
+			else
+				environment->num_skipped_reorthogonalizations++;
+			break;
 	}
 }
 
@@ -173,77 +482,90 @@ void diagonalize(lanczos_environment_t environment)
 	struct timespec t_start,t_end;
 	printf("Diagonalzation start:\n");
 	clock_gettime(CLOCK_REALTIME,&t_start);
-	initialize_first_krylow_vector(environment);
 	log_entry("environment->settings.max_num_iterations = %lu",
 		  environment->settings.max_num_iterations);
 	size_t max_num_iterations =
 	       	min(environment->settings.dimension,
 		    environment->settings.max_num_iterations);
-	double previous_eigenvalue = 0;
-	double *previous_eigenvector_amplitudes = 
-		(double*)calloc(max_num_iterations+1,sizeof(double));
+	lanczos_loop_state_t state =
+	{
+		.iteration = 0,
+		// The index of the current Krylow vector, which differs from
+		// the iteration after a restart
+		.position = 0,
+		// Nothing has converged before the first iteration
+		.previous_eigenvalue = INFINITY,
+		.previous_eigenvector_amplitudes =
+			(double*)calloc(max_num_iterations+1,sizeof(double))
+	};
+	if (environment->settings.resume)
+		read_checkpoint(environment,&state);
+	else
+		initialize_first_krylow_vector(environment);
+	double *previous_eigenvector_amplitudes =
+		state.previous_eigenvector_amplitudes;
+	double previous_eigenvalue = state.previous_eigenvalue;
+	size_t position = state.position;
 	size_t target_eigenvalue = environment->settings.target_eigenvalue;
-	for (size_t iteration = 0;
+	const size_t max_basis_dimension =
+		environment->settings.max_basis_dimension;
+	for (size_t iteration = state.iteration;
 	     iteration < max_num_iterations;
 	     iteration++)
 	{
-		lanczos_iteration(environment, iteration);
-		orthogonalize_krylow_basis(environment, iteration);
-		eigensystem_t diagonalized_system = 
-			diagonalize_tridiagonal_matrix
-			(environment->diagonal_elements,
-			 environment->off_diagonal_elements,
-			 iteration+1);
-		double *current_eigenvector_amplitudes =
-			get_eigenvector_amplitudes(diagonalized_system,
-						    target_eigenvalue);
-		double current_eigenvalue = 
-			get_eigenvalue(diagonalized_system,
-					target_eigenvalue);
-		double difference = 0.0;
-		switch (environment->settings.convergence_critera)
-		{
-			case converge_eigenvalues:
-				difference = fabs(current_eigenvalue -
-						  previous_eigenvalue);
-				break;
-			case converge_eigenvectors:
-				difference =
-					difference_eigenvectors
-					(current_eigenvector_amplitudes,
-					 previous_eigenvector_amplitudes,
-					 iteration+1);
-				break;
-			case no_convergence:
-				difference = 
-					environment->settings.eigenvalue_tolerance*2;
-				break;
-		}
-		print_eigensystem(diagonalized_system);
+		lanczos_iteration(environment, position);
+		orthogonalize_krylow_basis(environment, position);
+		run_diagnostics(environment,iteration,position);
+		/* The new Krylow vector is complete, its write overlaps with
+		 * the rest of the iteration and with the next matrix vector
+		 * multiplication, which takes it from memory.
+		 */
+		if (environment->settings.asynchronous_basis_writes)
+			write_vector_in_background
+				(basis_get_vector(environment->krylow_basis,
+						  position+1));
+		double difference =
+			convergence_difference(environment,position,
+					       &previous_eigenvalue,
+					       previous_eigenvector_amplitudes);
 		printf("Converging %s: difference %lg, tolerance %lg\n",
-			environment->settings.convergence_critera ==
-				converge_eigenvalues ?
-				"eigenvalues" :
-				(environment->settings.convergence_critera ==
-				converge_eigenvectors ?
-				"eigenvectors" :
-				"nothing"),
+			convergence_criteria_name
+			(environment->settings.convergence_critera),
 			difference,
 			environment->settings.eigenvalue_tolerance);
-		free_eigensystem(diagonalized_system);
 		if (difference < environment->settings.eigenvalue_tolerance)
 			break;
-		else
+		// The previous Krylow vector leaves the recurrence
+		release_krylow_vectors(environment,position);
+		round_old_krylow_vectors(environment,position);
+		position++;
+		if (max_basis_dimension > 0 &&
+		    position+1 >= max_basis_dimension)
 		{
-			memcpy(previous_eigenvector_amplitudes,
-			       current_eigenvector_amplitudes,
-			       sizeof(double)*(iteration+1));
-			previous_eigenvalue = current_eigenvalue;
+			restart_krylow_basis(environment,position-1);
+			position = environment->num_locked;
+			// The target eigenvector is now a basis vector
+			memset(previous_eigenvector_amplitudes,0,
+			       sizeof(double)*(max_num_iterations+1));
+			previous_eigenvector_amplitudes[target_eigenvalue] = 1;
 		}
-
+		state.iteration = iteration+1;
+		state.position = position;
+		state.previous_eigenvalue = previous_eigenvalue;
+		if (environment->settings.write_checkpoints)
+			write_checkpoint(environment,state);
 	}
 	free(previous_eigenvector_amplitudes);
 	basis_remove_last(environment->krylow_basis);
+	release_krylow_vectors(environment,
+			       basis_get_dimension(environment->krylow_basis));
+	printf("Reorthogonalizations done: %lu, skipped: %lu, "
+	       "against Ritz vectors: %lu\n",
+	       environment->num_reorthogonalizations,
+	       environment->num_skipped_reorthogonalizations,
+	       environment->num_ritz_orthogonalizations);
+	if (max_basis_dimension > 0)
+		printf("Restarts: %lu\n",environment->num_restarts);
 	clock_gettime(CLOCK_REALTIME,&t_end);
 	double diagonalzation_time =
 		(t_end.tv_sec-t_start.tv_sec)*1e6 +
@@ -255,9 +577,8 @@ void diagonalize(lanczos_environment_t environment)
 eigensystem_t get_eigensystem(lanczos_environment_t environment)
 {
 	eigensystem_t diagonalized_system =
-		diagonalize_tridiagonal_matrix
-		(environment->diagonal_elements,
-		 environment->off_diagonal_elements,
+		diagonalize_projected_matrix
+		(environment,
 		 basis_get_dimension(environment->krylow_basis));
 	set_basis(diagonalized_system,
 		  environment->krylow_basis);
@@ -269,21 +590,280 @@ void free_lanczos_environment(lanczos_environment_t environment)
 	free_basis(environment->krylow_basis);
 	free(environment->diagonal_elements);
 	free(environment->off_diagonal_elements);
+	free(environment->previous_orthogonality);
+	free(environment->current_orthogonality);
+	free(environment->next_orthogonality);
+	if (environment->ritz_basis != NULL)
+	{
+		free_basis(environment->ritz_basis);
+		free(environment->ritz_values);
+	}
+	if (environment->couplings != NULL)
+		free(environment->couplings);
+	free(environment->krylow_checksums);
+	free(environment->ritz_checksums);
+	free_diagnostics_vector(environment->diagnostics_ritz_vector);
+	free_diagnostics_vector(environment->diagnostics_residual);
 	free(environment);
 }
 
+/* Frees a scratch vector of the diagnostics and removes its directory.
+ */
+static
+void free_diagnostics_vector(vector_t vector)
+{
+	if (vector == NULL)
+		return;
+	char *directory_name = copy_string(get_vector_path(vector));
+	free_vector(vector);
+	clear_directory(directory_name);
+	free(directory_name);
+}
+
+static
+vector_t new_diagnostics_vector(lanczos_environment_t environment,
+				const char *name)
+{
+	vector_settings_t vector_settings =
+		environment->settings.vector_settings;
+	vector_settings.directory_name =
+		new_subdirectory_name
+		(environment->settings.krylow_vectors_directory_name,name);
+	vector_t vector = new_zero_vector(vector_settings);
+	free(vector_settings.directory_name);
+	return vector;
+}
+
+/* How far the target Ritz pairs are from convergence after the iteration
+ * at position. Only the eigenvector criterion, and the arrow shaped
+ * projection after a restart, need all eigenvectors of the projected
+ * matrix. Otherwise the lowest Ritz values are found by bisection and the
+ * last components of their eigenvectors, which give the residual norms,
+ * by inverse iteration.
+ */
+static
+double convergence_difference(lanczos_environment_t environment,
+			      size_t position,
+			      double *previous_eigenvalue,
+			      double *previous_eigenvector_amplitudes)
+{
+	const size_t dimension = position+1;
+	const size_t target = environment->settings.target_eigenvalue;
+	const convergence_critera_t criteria =
+		environment->settings.convergence_critera;
+	const size_t num_ritz_values = min(target+1,dimension);
+	double *ritz_values =
+		(double*)malloc(num_ritz_values*sizeof(double));
+	double *last_components =
+		(double*)malloc(num_ritz_values*sizeof(double));
+	eigensystem_t diagonalized_system = NULL;
+	if (criteria == converge_eigenvectors || environment->num_locked > 0)
+	{
+		diagonalized_system =
+			diagonalize_projected_matrix(environment,dimension);
+		for (size_t i = 0; i<num_ritz_values; i++)
+		{
+			ritz_values[i] = get_eigenvalue(diagonalized_system,i);
+			last_components[i] =
+				get_eigenvector_amplitudes(diagonalized_system,
+							   i)[position];
+		}
+	}
+	else
+		lowest_tridiagonal_eigenvalues
+			(ritz_values,
+			 criteria == converge_residuals ?
+			 last_components : NULL,
+			 environment->diagonal_elements,
+			 environment->off_diagonal_elements,
+			 dimension,
+			 num_ritz_values);
+	printf("Ritz values:");
+	for (size_t i = 0; i<num_ritz_values; i++)
+		printf(" %.17lg",ritz_values[i]);
+	printf("\n");
+	// The target Ritz value does not exist yet
+	double difference = INFINITY;
+	if (target < dimension)
+	{
+		switch (criteria)
+		{
+			case converge_eigenvalues:
+				difference = fabs(ritz_values[target] -
+						  *previous_eigenvalue);
+				break;
+			case converge_eigenvectors:
+				difference =
+					difference_eigenvectors
+					(get_eigenvector_amplitudes
+					 (diagonalized_system,target),
+					 dimension,
+					 previous_eigenvector_amplitudes,
+					 dimension-1);
+				memcpy(previous_eigenvector_amplitudes,
+				       get_eigenvector_amplitudes
+				       (diagonalized_system,target),
+				       dimension*sizeof(double));
+				break;
+			case converge_residuals:
+				difference = 0;
+				const double beta =
+					environment->
+					off_diagonal_elements[position];
+				for (size_t i = 0; i<num_ritz_values; i++)
+					if (fabs(beta*last_components[i]) >
+					    difference)
+						difference =
+							fabs(beta*
+							     last_components[i]);
+				break;
+			case no_convergence:
+				difference =
+					environment->settings.
+					eigenvalue_tolerance*2;
+				break;
+		}
+		*previous_eigenvalue = ritz_values[target];
+	}
+	if (diagonalized_system != NULL)
+		free_eigensystem(diagonalized_system);
+	free(last_components);
+	free(ritz_values);
+	return difference;
+}
+
+/* Diagnostics of the iteration at position. The full ones read the whole
+ * Krylow basis, so they only run every diagnostics interval.
+ */
+static
+void run_diagnostics(lanczos_environment_t environment,
+		     size_t iteration,
+		     size_t position)
+{
+	const lanczos_settings_t settings = environment->settings;
+	if (settings.diagnostics == no_diagnostics)
+		return;
+	const double beta = environment->off_diagonal_elements[position];
+	printf("Lanczos iteration %lu: alpha %.17lg, beta %.17lg, "
+	       "normalization drift %lg\n",
+	       iteration+1,
+	       environment->diagonal_elements[position],
+	       beta,
+	       environment->normalization_drift);
+	const size_t interval = settings.diagnostics_interval > 0 ?
+		settings.diagnostics_interval : 1;
+	if (settings.diagnostics != full_diagnostics ||
+	    (iteration+1) % interval != 0)
+		return;
+	lanczos_diagnostics_t *diagnostics = &environment->diagnostics;
+	vector_t *krylow_vectors =
+		basis_get_all_vectors(environment->krylow_basis);
+	const size_t num_previous = position+1;
+	vector_t next_krylow_vector = krylow_vectors[num_previous];
+	struct timespec t_start;
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	diagnostics->normalization_error = fabs(norm(next_krylow_vector) - 1);
+	printf("Diagnostics: normalization error %lg"
+	       " (1 vector pass, %lg µs)\n",
+	       diagnostics->normalization_error,
+	       elapsed_microseconds(t_start));
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	double *overlaps = (double*)malloc(num_previous*sizeof(double));
+	compute_gram_matrix(overlaps,
+			    krylow_vectors,num_previous,
+			    &next_krylow_vector,1);
+	diagnostics->max_overlap = 0;
+	for (size_t i = 0; i<num_previous; i++)
+		if (fabs(overlaps[i]) > diagnostics->max_overlap)
+			diagnostics->max_overlap = fabs(overlaps[i]);
+	free(overlaps);
+	printf("Diagnostics: largest overlap with the Krylow basis %lg"
+	       " (%lu vector passes, %lg µs)\n",
+	       diagnostics->max_overlap,
+	       num_previous+1,
+	       elapsed_microseconds(t_start));
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	eigensystem_t projected_system =
+		diagonalize_projected_matrix(environment,num_previous);
+	const double *amplitudes =
+		get_eigenvector_amplitudes(projected_system,0);
+	if (environment->diagnostics_ritz_vector == NULL)
+	{
+		environment->diagnostics_ritz_vector =
+			new_diagnostics_vector(environment,
+					       "diagnostics_ritz_vector");
+		environment->diagnostics_residual =
+			new_diagnostics_vector(environment,
+					       "diagnostics_residual");
+	}
+	vector_t ritz_vector = environment->diagnostics_ritz_vector;
+	vector_t residual = environment->diagnostics_residual;
+	basis_construct_vectors(&ritz_vector,1,
+				environment->krylow_basis,
+				amplitudes,num_previous);
+	matrix_vector_multiplication(residual,settings.matrix,ritz_vector);
+	vector_add_scaled(residual,
+			  -get_eigenvalue(projected_system,0),
+			  ritz_vector);
+	diagnostics->residual_norm = norm(residual);
+	diagnostics->estimated_residual_norm =
+		fabs(beta*amplitudes[position]);
+	printf("Diagnostics: residual of the lowest Ritz pair %lg,"
+	       " estimated %lg (1 matrix vector multiplication and %lu"
+	       " vector passes, %lg µs)\n",
+	       diagnostics->residual_norm,
+	       diagnostics->estimated_residual_norm,
+	       num_previous+4,
+	       elapsed_microseconds(t_start));
+	free_eigensystem(projected_system);
+}
+
+static
+double elapsed_microseconds(struct timespec t_start)
+{
+	struct timespec t_end;
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	return (t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+}
+
 static
-double difference_eigenvectors(const double *current_amplitudes,
-			       const double *previous_amplitudes,
-			       size_t num_current_amplitudes)
+const char *convergence_criteria_name(convergence_critera_t criteria)
 {
-	double norm_differnce_square = 0.0;
-	for (size_t i = 0; i<num_current_amplitudes-1; i++)
-		norm_differnce_square+=
-			square(current_amplitudes[i] - previous_amplitudes[i]);
-	norm_differnce_square+=
-		square(current_amplitudes[num_current_amplitudes-1]);
-	return sqrt(norm_differnce_square);
+	switch (criteria)
+	{
+		case converge_eigenvalues:
+			return "eigenvalues";
+		case converge_eigenvectors:
+			return "eigenvectors";
+		case converge_residuals:
+			return "residuals";
+		case no_convergence:
+			return "nothing";
+	}
+	return "nothing";
+}
+
+void print_convergence_progress(const double *ritz_values,
+				size_t num_ritz_values,
+				size_t num_wanted,
+				convergence_critera_t criteria,
+				double difference,
+				double tolerance)
+{
+	if (ritz_values != NULL)
+	{
+		printf("Ritz values:");
+		for (size_t i = 0; i<num_ritz_values; i++)
+			printf(" %.17lg",ritz_values[i]);
+		printf("\n");
+	}
+	printf("Converging the %lu lowest %s: difference %lg,"
+	       " tolerance %lg\n",
+	       num_wanted,
+	       convergence_criteria_name(criteria),
+	       difference,
+	       tolerance);
 }
 
 static
@@ -292,6 +872,874 @@ size_t min(size_t a, size_t b)
 	return a<b ? a : b;
 }
 
+/* Simon's recurrence for the scalar products of the new Krylow vector with
+ * the older ones, which follows from the three term recurrence of both.
+ * The rounding errors are modelled by a term of the size of the machine
+ * epsilon. After a restart the locked Ritz vectors are coupled to the
+ * first Krylow vector after them instead of to their neighbours, the off
+ * diagonal elements between them are 0.
+ */
+static
+void estimate_orthogonality(lanczos_environment_t environment,
+			    size_t iteration)
+{
+	const size_t j = iteration;
+	const size_t num_locked = environment->num_locked;
+	const double *alpha = environment->diagonal_elements;
+	const double *beta = environment->off_diagonal_elements;
+	const double *couplings = environment->couplings;
+	const double *previous = environment->previous_orthogonality;
+	const double *current = environment->current_orthogonality;
+	double *next = environment->next_orthogonality;
+	for (size_t k = 0; k<j; k++)
+	{
+		double overlap = beta[k]*current[k+1] +
+			(alpha[k] - alpha[j])*current[k];
+		if (k > 0)
+			overlap += beta[k-1]*current[k-1];
+		if (k < num_locked)
+			overlap += couplings[k]*current[num_locked];
+		else if (k == num_locked)
+			for (size_t i = 0; i<num_locked; i++)
+				overlap += couplings[i]*current[i];
+		if (j > 0)
+			overlap -= beta[j-1]*previous[k];
+		// The first Krylow vector after the locked ones is built from
+		// all of them, which are orthonormal
+		if (j == num_locked && k < num_locked)
+			overlap -= couplings[k];
+		double rounding = DBL_EPSILON*(beta[k] + beta[j]);
+		overlap += overlap >= 0 ? rounding : -rounding;
+		next[k] = overlap/beta[j];
+	}
+	next[j] = DBL_EPSILON*sqrt(environment->settings.dimension);
+	next[j+1] = 1;
+	environment->previous_orthogonality = environment->current_orthogonality;
+	environment->current_orthogonality = environment->next_orthogonality;
+	environment->next_orthogonality = (double*)previous;
+}
+
+/* The recurrence only sees the locked Ritz vectors through their
+ * couplings, not through the residuals they carry over from the Krylow
+ * basis they were built from. The new Krylow vector loses its
+ * orthogonality to them fastest, so it is orthogonalized against them in
+ * every iteration.
+ */
+static
+void orthogonalize_against_locked_vectors(lanczos_environment_t environment,
+					  size_t iteration)
+{
+	const size_t num_locked = environment->num_locked;
+	if (num_locked == 0)
+		return;
+	vector_t next_vector =
+		basis_get_vector(environment->krylow_basis,iteration+1);
+	reorthogonalize_vector(next_vector,
+			       basis_get_all_vectors(environment->krylow_basis),
+			       num_locked);
+	normalize(next_vector);
+	for (size_t k = 0; k<num_locked; k++)
+		environment->current_orthogonality[k] =
+			DBL_EPSILON*sqrt(environment->settings.dimension);
+}
+
+/* The largest estimated overlap of the new Krylow vector with the vectors
+ * that the three term recurrence does not orthogonalize it against.
+ */
+static
+double max_estimated_overlap(lanczos_environment_t environment,
+			     size_t iteration)
+{
+	double max_overlap = 0;
+	for (size_t k = 0; k<iteration; k++)
+		if (fabs(environment->current_orthogonality[k]) > max_overlap)
+			max_overlap = fabs(environment->current_orthogonality[k]);
+	return max_overlap;
+}
+
+/* A Ritz pair has converged when its residual norm, the last off diagonal
+ * element times the last component of the eigenvector of the tridiagonal
+ * matrix, is below the square root of the machine epsilon times the norm
+ * of the matrix. Its Ritz vector is then computed and stored, unless it has
+ * been stored before. The Ritz pairs of the tridiagonal matrix come from
+ * bisection and inverse iteration, after a restart the arrow matrix is
+ * diagonalized. All new Ritz vectors are built in one pass over the
+ * Krylow basis.
+ */
+static
+void add_converged_ritz_vectors(lanczos_environment_t environment,
+				size_t iteration)
+{
+	const size_t num_ritz_pairs = iteration+1;
+	double *ritz_values = (double*)malloc(num_ritz_pairs*sizeof(double));
+	double *amplitudes =
+		(double*)malloc(num_ritz_pairs*num_ritz_pairs*sizeof(double));
+	if (environment->num_locked > 0)
+	{
+		eigensystem_t projected_system =
+			diagonalize_projected_matrix(environment,
+						     num_ritz_pairs);
+		for (size_t i = 0; i<num_ritz_pairs; i++)
+		{
+			ritz_values[i] = get_eigenvalue(projected_system,i);
+			memcpy(amplitudes + i*num_ritz_pairs,
+			       get_eigenvector_amplitudes(projected_system,i),
+			       num_ritz_pairs*sizeof(double));
+		}
+		free_eigensystem(projected_system);
+	}
+	else
+		lowest_tridiagonal_eigenpairs(ritz_values,
+					      amplitudes,
+					      environment->diagonal_elements,
+					      environment->off_diagonal_elements,
+					      num_ritz_pairs,
+					      num_ritz_pairs);
+	double matrix_norm = 0;
+	for (size_t i = 0; i<num_ritz_pairs; i++)
+		if (fabs(ritz_values[i]) > matrix_norm)
+			matrix_norm = fabs(ritz_values[i]);
+	const double tolerance = sqrt(DBL_EPSILON)*matrix_norm;
+	const double beta = environment->off_diagonal_elements[iteration];
+	const size_t num_old_ritz_vectors =
+		basis_get_dimension(environment->ritz_basis);
+	size_t num_ritz_vectors = num_old_ritz_vectors;
+	// The amplitudes of the new Ritz vectors are moved to the front
+	for (size_t i = 0; i<num_ritz_pairs; i++)
+	{
+		const double *ritz_amplitudes = amplitudes + i*num_ritz_pairs;
+		if (fabs(beta*ritz_amplitudes[iteration]) > tolerance)
+			continue;
+		int is_stored = 0;
+		for (size_t k = 0; k<num_ritz_vectors; k++)
+			if (fabs(environment->ritz_values[k] - ritz_values[i]) <=
+			    tolerance)
+				is_stored = 1;
+		if (is_stored ||
+		    num_ritz_vectors == environment->settings.max_num_iterations)
+			continue;
+		log_entry("Ritz value %lg has converged",ritz_values[i]);
+		memmove(amplitudes +
+			(num_ritz_vectors-num_old_ritz_vectors)*num_ritz_pairs,
+			ritz_amplitudes,
+			num_ritz_pairs*sizeof(double));
+		environment->ritz_values[num_ritz_vectors++] = ritz_values[i];
+	}
+	const size_t num_new_ritz_vectors =
+		num_ritz_vectors - num_old_ritz_vectors;
+	if (num_new_ritz_vectors > 0)
+	{
+		for (size_t i = 0; i<num_new_ritz_vectors; i++)
+			basis_append_vector(environment->ritz_basis);
+		vector_t *new_ritz_vectors =
+			basis_get_all_vectors(environment->ritz_basis) +
+			num_old_ritz_vectors;
+		basis_construct_vectors(new_ritz_vectors,
+					num_new_ritz_vectors,
+					environment->krylow_basis,
+					amplitudes,
+					num_ritz_pairs);
+		for (size_t i = 0; i<num_new_ritz_vectors; i++)
+			normalize(new_ritz_vectors[i]);
+	}
+	free(amplitudes);
+	free(ritz_values);
+}
+
+static
+void normalize(vector_t vector)
+{
+	scale(vector,1.0/norm(vector));
+}
+
+/* The projected matrix is tridiagonal, except after a restart when the
+ * Ritz values of the kept Ritz vectors are on the diagonal and their
+ * couplings to the following Krylow vector form an arrow.
+ */
+static
+eigensystem_t diagonalize_projected_matrix(lanczos_environment_t environment,
+					   size_t dimension)
+{
+	const size_t num_locked = environment->num_locked;
+	if (num_locked == 0)
+		return diagonalize_tridiagonal_matrix
+			(environment->diagonal_elements,
+			 environment->off_diagonal_elements,
+			 dimension);
+	double *elements = (double*)calloc(dimension*dimension,
+					   sizeof(double));
+	for (size_t i = 0; i<dimension; i++)
+		elements[i*dimension+i] = environment->diagonal_elements[i];
+	if (num_locked < dimension)
+		for (size_t i = 0; i<num_locked; i++)
+			elements[i*dimension+num_locked] =
+				elements[num_locked*dimension+i] =
+				environment->couplings[i];
+	for (size_t i = num_locked; i+1<dimension; i++)
+		elements[i*dimension+i+1] =
+			elements[(i+1)*dimension+i] =
+			environment->off_diagonal_elements[i];
+	eigensystem_t eigensystem =
+		diagonalize_dense_symmetric_matrix(elements,dimension);
+	free(elements);
+	return eigensystem;
+}
+
+/* Thick restart: the Krylow vectors up to position are replaced by the
+ * Ritz vectors of the lowest Ritz values and the Krylow vector after
+ * position is kept as the next vector. The Ritz vectors are coupled to it
+ * by the last off diagonal element times their last amplitudes.
+ */
+static
+void restart_krylow_basis(lanczos_environment_t environment,
+			  size_t position)
+{
+	const size_t num_kept = environment->settings.num_restart_vectors;
+	const size_t dimension = position+1;
+	assert(num_kept < dimension);
+	printf("Restarting Lanczos with %lu Ritz vectors\n",num_kept);
+	eigensystem_t projected_system =
+		diagonalize_projected_matrix(environment,dimension);
+	const double beta = environment->off_diagonal_elements[position];
+	double *coefficients =
+		(double*)calloc((dimension+1)*(num_kept+1),sizeof(double));
+	for (size_t i = 0; i<num_kept; i++)
+	{
+		double *amplitudes =
+			get_eigenvector_amplitudes(projected_system,i);
+		memcpy(coefficients + i*(dimension+1),
+		       amplitudes,
+		       dimension*sizeof(double));
+		environment->diagonal_elements[i] =
+			get_eigenvalue(projected_system,i);
+		environment->off_diagonal_elements[i] = 0;
+		environment->couplings[i] = beta*amplitudes[position];
+	}
+	coefficients[num_kept*(dimension+1) + dimension] = 1;
+	// The kept Krylow vector becomes the current one, which Minerva reads
+	// in double precision, and the Ritz vectors are not rounded
+	for (size_t i = 0; i<=num_kept; i++)
+		set_single_precision_storage
+			(basis_get_vector(environment->krylow_basis,i),0);
+	basis_restart(environment->krylow_basis,coefficients,num_kept+1);
+	// All Krylow vectors have changed
+	environment->num_recorded_krylow_vectors = 0;
+	environment->num_locked = num_kept;
+	environment->num_restarts++;
+	/* The omega recurrence does not hold across a restart, the estimates
+	 * start over and the next two Krylow vectors are reorthogonalized.
+	 */
+	const double reset_overlap =
+		DBL_EPSILON*sqrt(environment->settings.dimension);
+	for (size_t k = 0; k<=num_kept; k++)
+	{
+		environment->previous_orthogonality[k] = reset_overlap;
+		environment->current_orthogonality[k] = reset_overlap;
+	}
+	environment->previous_orthogonality[num_kept-1] = 1;
+	environment->current_orthogonality[num_kept] = 1;
+	environment->reorthogonalize_next = 1;
+	free(coefficients);
+	free_eigensystem(projected_system);
+}
+
+/* After the iteration at position, the Krylow vectors before it are only
+ * read by reorthogonalizations and by the eigenvectors, so they can be
+ * stored in single precision. The current and previous vectors of the next
+ * iteration stay in double precision.
+ */
+static
+void round_old_krylow_vectors(lanczos_environment_t environment,
+			      size_t position)
+{
+	if (!environment->settings.single_precision_basis)
+		return;
+	for (size_t i = 0; i<position; i++)
+	{
+		vector_t vector = basis_get_vector(environment->krylow_basis,i);
+		if (has_single_precision_storage(vector))
+			continue;
+		set_single_precision_storage(vector,1);
+		// The rounded vector has another checksum
+		if (has_single_precision_storage(vector) &&
+		    environment->num_recorded_krylow_vectors > i)
+			environment->num_recorded_krylow_vectors = i;
+	}
+}
+
+/* Writes the changes of the first num_vectors Krylow vectors that are
+ * kept in memory to their files, after waiting for their background
+ * writes, and frees their memory.
+ */
+static
+void release_krylow_vectors(lanczos_environment_t environment,
+			    size_t num_vectors)
+{
+	if (!environment->settings.asynchronous_basis_writes)
+		return;
+	for (size_t i = 0; i<num_vectors; i++)
+		release_vector_memory(basis_get_vector(environment->krylow_basis,
+						       i));
+}
+
+/* Only the settings that change the Krylow basis enter the hash, so a
+ * resumed run may use more iterations or another tolerance.
+ */
+static
+uint64_t hash_lanczos_settings(lanczos_settings_t settings)
+{
+	uint64_t hash = initial_hash;
+	hash = hash_bytes(hash,&settings.dimension,sizeof(size_t));
+	hash = hash_bytes(hash,
+			  &settings.vector_settings.num_blocks,
+			  sizeof(size_t));
+	hash = hash_bytes(hash,
+			  settings.vector_settings.block_sizes,
+			  settings.vector_settings.num_blocks*sizeof(size_t));
+	hash = hash_bytes(hash,&settings.target_eigenvalue,sizeof(size_t));
+	hash = hash_bytes(hash,
+			  &settings.reorthogonalization,
+			  sizeof(reorthogonalization_t));
+	hash = hash_bytes(hash,&settings.max_basis_dimension,sizeof(size_t));
+	hash = hash_bytes(hash,&settings.num_restart_vectors,sizeof(size_t));
+	return hash;
+}
+
+/* Computes the checksums of the basis vectors that are not recorded yet.
+ * Vectors kept in memory are also written to their block files, which a
+ * resumed run reads them from.
+ */
+static
+void record_basis_vectors(basis_t basis,
+			  uint64_t *checksums,
+			  size_t *num_recorded_vectors)
+{
+	for (size_t i = *num_recorded_vectors; i<basis_get_dimension(basis); i++)
+	{
+		vector_t vector = basis_get_vector(basis,i);
+		write_vector_block_files(vector);
+		checksums[i] = vector_checksum(vector);
+	}
+	*num_recorded_vectors = basis_get_dimension(basis);
+}
+
+/* The checkpoint is written to a temporary file, which is synchronized to
+ * disk and then renamed over the previous checkpoint. A crash therefore
+ * leaves either the old or the new checkpoint.
+ */
+static
+void write_checkpoint(lanczos_environment_t environment,
+		      lanczos_loop_state_t state)
+{
+	record_basis_vectors(environment->krylow_basis,
+			     environment->krylow_checksums,
+			     &environment->num_recorded_krylow_vectors);
+	size_t num_ritz_vectors = 0;
+	if (environment->ritz_basis != NULL)
+	{
+		record_basis_vectors(environment->ritz_basis,
+				     environment->ritz_checksums,
+				     &environment->num_recorded_ritz_vectors);
+		num_ritz_vectors = basis_get_dimension(environment->ritz_basis);
+	}
+	const char *directory_name =
+		environment->settings.krylow_vectors_directory_name;
+	char file_name[2048];
+	char temporary_file_name[2048];
+	sprintf(file_name,"%s/checkpoint",directory_name);
+	sprintf(temporary_file_name,"%s/checkpoint.tmp",directory_name);
+	FILE *file = fopen(temporary_file_name,"w");
+	if (file == NULL)
+		error("Could not open checkpoint file \"%s\". %s\n",
+		      temporary_file_name,
+		      strerror(errno));
+	const uint64_t settings_hash =
+		hash_lanczos_settings(environment->settings);
+	const size_t num_basis_vectors =
+		basis_get_dimension(environment->krylow_basis);
+	const size_t num_orthogonalities = state.position+2;
+	write_checkpoint_values(file,checkpoint_magic,1,sizeof(checkpoint_magic));
+	write_checkpoint_values(file,&checkpoint_version,sizeof(uint32_t),1);
+	write_checkpoint_values(file,&settings_hash,sizeof(uint64_t),1);
+	write_checkpoint_values(file,&state.iteration,sizeof(size_t),1);
+	write_checkpoint_values(file,&state.position,sizeof(size_t),1);
+	write_checkpoint_values(file,&state.previous_eigenvalue,
+				sizeof(double),1);
+	write_checkpoint_values(file,&num_basis_vectors,sizeof(size_t),1);
+	write_checkpoint_values(file,&num_ritz_vectors,sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->num_locked,sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->num_iterations,
+				sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->num_restarts,
+				sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->num_reorthogonalizations,
+				sizeof(size_t),1);
+	write_checkpoint_values(file,
+				&environment->num_skipped_reorthogonalizations,
+				sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->num_ritz_orthogonalizations,
+				sizeof(size_t),1);
+	write_checkpoint_values(file,&environment->reorthogonalize_next,
+				sizeof(int),1);
+	write_checkpoint_values(file,environment->diagonal_elements,
+				sizeof(double),state.position);
+	write_checkpoint_values(file,environment->off_diagonal_elements,
+				sizeof(double),state.position);
+	write_checkpoint_values(file,state.previous_eigenvector_amplitudes,
+				sizeof(double),state.position+1);
+	write_checkpoint_values(file,environment->previous_orthogonality,
+				sizeof(double),num_orthogonalities);
+	write_checkpoint_values(file,environment->current_orthogonality,
+				sizeof(double),num_orthogonalities);
+	if (environment->couplings != NULL)
+		write_checkpoint_values(file,environment->couplings,
+					sizeof(double),
+					environment->settings.
+					num_restart_vectors);
+	write_checkpoint_values(file,environment->ritz_values,
+				sizeof(double),num_ritz_vectors);
+	write_checkpoint_values(file,environment->krylow_checksums,
+				sizeof(uint64_t),num_basis_vectors);
+	write_checkpoint_values(file,environment->ritz_checksums,
+				sizeof(uint64_t),num_ritz_vectors);
+	if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+		error("Could not write checkpoint file \"%s\". %s\n",
+		      temporary_file_name,
+		      strerror(errno));
+	fclose(file);
+	if (rename(temporary_file_name,file_name) != 0)
+		error("Could not replace checkpoint file \"%s\". %s\n",
+		      file_name,
+		      strerror(errno));
+	// The rename is durable once the directory is synchronized
+	int directory_descriptor = open(directory_name,O_RDONLY);
+	if (directory_descriptor >= 0)
+	{
+		fsync(directory_descriptor);
+		close(directory_descriptor);
+	}
+	log_entry("Wrote checkpoint after iteration %lu",state.iteration);
+}
+
+/* Restores the environment and the loop state from the checkpoint and
+ * checks that the settings and all basis vectors match it.
+ */
+static
+void read_checkpoint(lanczos_environment_t environment,
+		     lanczos_loop_state_t *state)
+{
+	char file_name[2048];
+	sprintf(file_name,"%s/checkpoint",
+		environment->settings.krylow_vectors_directory_name);
+	FILE *file = fopen(file_name,"r");
+	if (file == NULL)
+		error("Could not open checkpoint file \"%s\". %s\n",
+		      file_name,
+		      strerror(errno));
+	char magic[sizeof(checkpoint_magic)];
+	uint32_t version = 0;
+	uint64_t settings_hash = 0;
+	read_checkpoint_values(file,magic,1,sizeof(magic));
+	read_checkpoint_values(file,&version,sizeof(uint32_t),1);
+	if (memcmp(magic,checkpoint_magic,sizeof(magic)) != 0 ||
+	    version != checkpoint_version)
+		error("\"%s\" is not a version %u Lanczos checkpoint\n",
+		      file_name,
+		      checkpoint_version);
+	read_checkpoint_values(file,&settings_hash,sizeof(uint64_t),1);
+	if (settings_hash != hash_lanczos_settings(environment->settings))
+		error("The checkpoint \"%s\" was written with other Lanczos"
+		      " settings\n",
+		      file_name);
+	size_t num_basis_vectors = 0;
+	size_t num_ritz_vectors = 0;
+	read_checkpoint_values(file,&state->iteration,sizeof(size_t),1);
+	read_checkpoint_values(file,&state->position,sizeof(size_t),1);
+	read_checkpoint_values(file,&state->previous_eigenvalue,
+			       sizeof(double),1);
+	read_checkpoint_values(file,&num_basis_vectors,sizeof(size_t),1);
+	read_checkpoint_values(file,&num_ritz_vectors,sizeof(size_t),1);
+	if (state->position >= environment->settings.max_num_iterations ||
+	    num_basis_vectors != state->position+1)
+		error("The checkpoint \"%s\" needs more than %lu iterations\n",
+		      file_name,
+		      environment->settings.max_num_iterations);
+	read_checkpoint_values(file,&environment->num_locked,sizeof(size_t),1);
+	read_checkpoint_values(file,&environment->num_iterations,
+			       sizeof(size_t),1);
+	read_checkpoint_values(file,&environment->num_restarts,
+			       sizeof(size_t),1);
+	read_checkpoint_values(file,&environment->num_reorthogonalizations,
+			       sizeof(size_t),1);
+	read_checkpoint_values(file,
+			       &environment->num_skipped_reorthogonalizations,
+			       sizeof(size_t),1);
+	read_checkpoint_values(file,&environment->num_ritz_orthogonalizations,
+			       sizeof(size_t),1);
+	read_checkpoint_values(file,&environment->reorthogonalize_next,
+			       sizeof(int),1);
+	read_checkpoint_values(file,environment->diagonal_elements,
+			       sizeof(double),state->position);
+	read_checkpoint_values(file,environment->off_diagonal_elements,
+			       sizeof(double),state->position);
+	read_checkpoint_values(file,state->previous_eigenvector_amplitudes,
+			       sizeof(double),state->position+1);
+	read_checkpoint_values(file,environment->previous_orthogonality,
+			       sizeof(double),state->position+2);
+	read_checkpoint_values(file,environment->current_orthogonality,
+			       sizeof(double),state->position+2);
+	if (environment->couplings != NULL)
+		read_checkpoint_values(file,environment->couplings,
+				       sizeof(double),
+				       environment->settings.
+				       num_restart_vectors);
+	read_checkpoint_values(file,environment->ritz_values,
+			       sizeof(double),num_ritz_vectors);
+	read_checkpoint_values(file,environment->krylow_checksums,
+			       sizeof(uint64_t),num_basis_vectors);
+	read_checkpoint_values(file,environment->ritz_checksums,
+			       sizeof(uint64_t),num_ritz_vectors);
+	fclose(file);
+	for (size_t i = 0; i<num_basis_vectors; i++)
+	{
+		basis_append_existing_vector(environment->krylow_basis);
+		if (vector_checksum(basis_get_vector(environment->krylow_basis,
+						     i)) !=
+		    environment->krylow_checksums[i])
+			error("Krylow vector %lu does not match the checkpoint"
+			      " \"%s\"\n",
+			      i,
+			      file_name);
+	}
+	environment->num_recorded_krylow_vectors = num_basis_vectors;
+	for (size_t i = 0; i<num_ritz_vectors; i++)
+	{
+		basis_append_existing_vector(environment->ritz_basis);
+		if (vector_checksum(basis_get_vector(environment->ritz_basis,
+						     i)) !=
+		    environment->ritz_checksums[i])
+			error("Ritz vector %lu does not match the checkpoint"
+			      " \"%s\"\n",
+			      i,
+			      file_name);
+	}
+	environment->num_recorded_ritz_vectors = num_ritz_vectors;
+	printf("Resuming Lanczos at iteration %lu\n",state->iteration+1);
+}
+
+static
+void write_checkpoint_values(FILE *file,
+			     const void *values,
+			     size_t value_size,
+			     size_t num_values)
+{
+	if (num_values > 0 &&
+	    fwrite(values,value_size,num_values,file) != num_values)
+		error("Could not write to the checkpoint file. %s\n",
+		      strerror(errno));
+}
+
+static
+void read_checkpoint_values(FILE *file,
+			    void *values,
+			    size_t value_size,
+			    size_t num_values)
+{
+	if (num_values > 0 &&
+	    fread(values,value_size,num_values,file) != num_values)
+		error("The checkpoint file is truncated\n");
+}
+
+#ifdef TEST
+/* Runs Lanczos on a matrix with well separated low eigenvalues and compares
+ * the lowest eigenvalues to LAPACK. Lanczos runs long enough for the
+ * lowest Ritz values to converge, so that without orthogonalization ghost
+ * copies of them would appear.
+ */
+static
+int lowest_eigenvalues_agree_with_lapack
+	(reorthogonalization_t reorthogonalization,
+	 size_t max_basis_dimension,
+	 size_t *num_skipped_reorthogonalizations,
+	 size_t *num_ritz_orthogonalizations)
+{
+	size_t dimension = 200;
+	matrix_t matrix = new_well_separated_matrix(dimension);
+	lanczos_settings_t settings =
+	{
+		.dimension = dimension,
+		.vector_settings =
+		{
+			.directory_name = NULL,
+			.num_blocks = 1,
+			.block_sizes = &dimension
+		},
+		.krylow_vectors_directory_name =
+			copy_string(get_test_file_path("krylow_vectors")),
+		.max_num_iterations = 100,
+		.target_eigenvalue = 0,
+		.eigenvalue_tolerance = 0,
+		.convergence_critera = no_convergence,
+		.reorthogonalization = reorthogonalization,
+		.max_basis_dimension = max_basis_dimension,
+		.num_restart_vectors = max_basis_dimension/2,
+		.matrix = matrix
+	};
+	lanczos_environment_t environment =
+		new_lanczos_environment(settings);
+	diagonalize(environment);
+	*num_skipped_reorthogonalizations =
+		environment->num_skipped_reorthogonalizations;
+	*num_ritz_orthogonalizations =
+		environment->num_ritz_orthogonalizations;
+	if (max_basis_dimension > 0 &&
+	    (environment->num_restarts == 0 ||
+	     basis_get_dimension(environment->krylow_basis) >=
+	     max_basis_dimension))
+		return 0;
+	eigensystem_t lanczos_eigensystem = get_eigensystem(environment);
+	eigensystem_t lapack_eigensystem = diagonalize_symmetric_matrix(matrix);
+	int agree = 1;
+	for (size_t i = 0; i<3; i++)
+	{
+		printf("(%lu) lanczos: %lg, lapack: %lg\n",
+		       i,
+		       get_eigenvalue(lanczos_eigensystem,i),
+		       get_eigenvalue(lapack_eigensystem,i));
+		if (fabs(get_eigenvalue(lanczos_eigensystem,i) -
+			 get_eigenvalue(lapack_eigensystem,i)) > 1e-8)
+			agree = 0;
+	}
+	free_lanczos_environment(environment);
+	free_eigensystem(lanczos_eigensystem);
+	free_eigensystem(lapack_eigensystem);
+	free_matrix(matrix);
+	free(settings.krylow_vectors_directory_name);
+	return agree;
+}
+
+/* Runs Lanczos once for all iterations and once stopped after a part of
+ * them and resumed from the checkpoint, which should give the same
+ * eigenvalues.
+ */
+static
+int resumed_lanczos_matches_uninterrupted_lanczos
+	(reorthogonalization_t reorthogonalization,
+	 size_t max_basis_dimension,
+	 vector_storage_t storage,
+	 int single_precision_basis,
+	 int asynchronous_basis_writes)
+{
+	size_t dimension = 200;
+	matrix_t matrix = new_well_separated_matrix(dimension);
+	lanczos_settings_t settings =
+	{
+		.dimension = dimension,
+		.vector_settings =
+		{
+			.directory_name = NULL,
+			.num_blocks = 1,
+			.block_sizes = &dimension,
+			.storage = storage
+		},
+		.krylow_vectors_directory_name =
+			copy_string(get_test_file_path("uninterrupted")),
+		.max_num_iterations = 60,
+		.target_eigenvalue = 0,
+		.eigenvalue_tolerance = 0,
+		.convergence_critera = no_convergence,
+		.reorthogonalization = reorthogonalization,
+		.max_basis_dimension = max_basis_dimension,
+		.num_restart_vectors = max_basis_dimension/2,
+		.single_precision_basis = single_precision_basis,
+		.asynchronous_basis_writes = asynchronous_basis_writes,
+		.matrix = matrix
+	};
+	lanczos_environment_t environment =
+		new_lanczos_environment(settings);
+	diagonalize(environment);
+	eigensystem_t uninterrupted_eigensystem = get_eigensystem(environment);
+	free_lanczos_environment(environment);
+	free(settings.krylow_vectors_directory_name);
+	settings.krylow_vectors_directory_name =
+		copy_string(get_test_file_path("interrupted"));
+	settings.max_num_iterations = 25;
+	settings.write_checkpoints = 1;
+	environment = new_lanczos_environment(settings);
+	diagonalize(environment);
+	free_lanczos_environment(environment);
+	settings.max_num_iterations = 60;
+	settings.resume = 1;
+	environment = new_lanczos_environment(settings);
+	diagonalize(environment);
+	eigensystem_t resumed_eigensystem = get_eigensystem(environment);
+	int agree = get_num_eigenvalues(resumed_eigensystem) ==
+		get_num_eigenvalues(uninterrupted_eigensystem);
+	for (size_t i = 0; agree && i<get_num_eigenvalues(resumed_eigensystem);
+	     i++)
+		if (fabs(get_eigenvalue(resumed_eigensystem,i) -
+			 get_eigenvalue(uninterrupted_eigensystem,i)) > 1e-12)
+			agree = 0;
+	free_lanczos_environment(environment);
+	free_eigensystem(uninterrupted_eigensystem);
+	free_eigensystem(resumed_eigensystem);
+	free_matrix(matrix);
+	free(settings.krylow_vectors_directory_name);
+	return agree;
+}
+
+/* Runs Lanczos until the lowest eigenvalue has converged and returns the
+ * number of iterations it needed.
+ */
+static
+size_t lanczos_iterations_to_converge(matrix_t matrix,
+				      size_t dimension,
+				      vector_t *initial_vectors,
+				      size_t num_initial_vectors,
+				      double *lowest_eigenvalue)
+{
+	double coefficient = 1;
+	lanczos_settings_t settings =
+	{
+		.dimension = dimension,
+		.vector_settings =
+		{
+			.directory_name = NULL,
+			.num_blocks = 1,
+			.block_sizes = &dimension
+		},
+		.krylow_vectors_directory_name =
+			copy_string(get_test_file_path("krylow_vectors")),
+		.max_num_iterations = 100,
+		.target_eigenvalue = 0,
+		.eigenvalue_tolerance = 1e-10,
+		.convergence_critera = converge_eigenvalues,
+		.initial_vectors = initial_vectors,
+		.num_initial_vectors = num_initial_vectors,
+		.initial_coefficients = &coefficient,
+		.matrix = matrix
+	};
+	lanczos_environment_t environment =
+		new_lanczos_environment(settings);
+	diagonalize(environment);
+	size_t num_iterations = environment->num_iterations;
+	eigensystem_t eigensystem = get_eigensystem(environment);
+	*lowest_eigenvalue = get_eigenvalue(eigensystem,0);
+	free_eigensystem(eigensystem);
+	free_lanczos_environment(environment);
+	free(settings.krylow_vectors_directory_name);
+	return num_iterations;
+}
+
+/* Runs Lanczos for a fixed number of iterations, with the old Krylow
+ * vectors stored in double or single precision and written synchronously
+ * or in the background, and returns the lowest eigenvalue.
+ */
+static
+double ground_state_energy(int single_precision_basis,
+			   int asynchronous_basis_writes,
+			   reorthogonalization_t reorthogonalization,
+			   size_t max_basis_dimension)
+{
+	size_t dimension = 200;
+	// Both precisions see the same random matrix
+	srand48(1);
+	matrix_t matrix = new_well_separated_matrix(dimension);
+	lanczos_settings_t settings =
+	{
+		.dimension = dimension,
+		.vector_settings =
+		{
+			.directory_name = NULL,
+			.num_blocks = 1,
+			.block_sizes = &dimension,
+			.storage = BLOCK_FILE_STORAGE
+		},
+		.krylow_vectors_directory_name =
+			copy_string(get_test_file_path("krylow_vectors")),
+		.max_num_iterations = 100,
+		.target_eigenvalue = 0,
+		.eigenvalue_tolerance = 0,
+		.convergence_critera = no_convergence,
+		.reorthogonalization = reorthogonalization,
+		.max_basis_dimension = max_basis_dimension,
+		.num_restart_vectors = max_basis_dimension/2,
+		.single_precision_basis = single_precision_basis,
+		.asynchronous_basis_writes = asynchronous_basis_writes,
+		.matrix = matrix
+	};
+	lanczos_environment_t environment =
+		new_lanczos_environment(settings);
+	diagonalize(environment);
+	eigensystem_t eigensystem = get_eigensystem(environment);
+	double energy = get_eigenvalue(eigensystem,0);
+	free_eigensystem(eigensystem);
+	free_lanczos_environment(environment);
+	free_matrix(matrix);
+	free(settings.krylow_vectors_directory_name);
+	return energy;
+}
+
+static
+double elapsed_seconds(struct timespec start,struct timespec end)
+{
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9;
+}
+
+/* Finds the three lowest eigenvalues of a random explicit matrix with
+ * Lanczos and with dsyevr, sets how many seconds each took and returns
+ * whether they agree.
+ */
+static
+int direct_solve_agrees_with_lanczos(size_t dimension,
+				     double *lanczos_seconds,
+				     double *direct_seconds)
+{
+	const size_t num_eigenvalues = 3;
+	matrix_t matrix = new_well_separated_matrix(dimension);
+	lanczos_settings_t settings =
+	{
+		.dimension = dimension,
+		.vector_settings =
+		{
+			.directory_name = NULL,
+			.num_blocks = 1,
+			.block_sizes = &dimension,
+			.storage = MEMORY_STORAGE
+		},
+		.krylow_vectors_directory_name =
+			copy_string(get_test_file_path("krylow_vectors")),
+		.max_num_iterations = dimension,
+		.target_eigenvalue = num_eigenvalues-1,
+		.eigenvalue_tolerance = 1e-10,
+		.convergence_critera = converge_residuals,
+		.reorthogonalization = full_reorthogonalization,
+		.matrix = matrix
+	};
+	struct timespec t_start,t_lanczos,t_direct;
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	lanczos_environment_t environment =
+		new_lanczos_environment(settings);
+	diagonalize(environment);
+	eigensystem_t eigensystem = get_eigensystem(environment);
+	clock_gettime(CLOCK_REALTIME,&t_lanczos);
+	double eigenvalues[3];
+	lowest_symmetric_eigenpairs(eigenvalues,NULL,matrix,num_eigenvalues);
+	clock_gettime(CLOCK_REALTIME,&t_direct);
+	*lanczos_seconds = elapsed_seconds(t_start,t_lanczos);
+	*direct_seconds = elapsed_seconds(t_lanczos,t_direct);
+	int agree = 1;
+	for (size_t i = 0; i<num_eigenvalues; i++)
+		if (fabs(get_eigenvalue(eigensystem,i) - eigenvalues[i]) > 1e-8)
+			agree = 0;
+	free_eigensystem(eigensystem);
+	free_lanczos_environment(environment);
+	free_matrix(matrix);
+	free(settings.krylow_vectors_directory_name);
+	return agree;
+}
+#endif
+
 new_test(diagonalize_3x3_matrix,
 	 {
 	 double matrix_elements[9] = 
@@ -404,6 +1852,45 @@ new_test(diagonalize_50x50_random_matrix_and_compare_to_lapack,
 	 });
 
 
+new_test(tridiagonal_eigenpairs_by_inverse_iteration_match_dsteqr,
+	 const size_t dimension = 60;
+	 double diagonal_elements[dimension];
+	 double off_diagonal_elements[dimension];
+	 srand48(3);
+	 for (size_t i = 0; i<dimension; i++)
+	 {
+		diagonal_elements[i] = drand48();
+		off_diagonal_elements[i] = 0.5+drand48();
+	 }
+	 eigensystem_t dense_system =
+		diagonalize_tridiagonal_matrix(diagonal_elements,
+					       off_diagonal_elements,
+					       dimension);
+	 double eigenvalues[dimension];
+	 double *eigenvectors =
+		(double*)malloc(dimension*dimension*sizeof(double));
+	 lowest_tridiagonal_eigenpairs(eigenvalues,
+				       eigenvectors,
+				       diagonal_elements,
+				       off_diagonal_elements,
+				       dimension,
+				       dimension);
+	 for (size_t i = 0; i<dimension; i++)
+	 {
+		assert_that(fabs(eigenvalues[i] -
+				 get_eigenvalue(dense_system,i)) < 1e-12);
+		// The eigenvectors agree up to their sign
+		const double *amplitudes =
+			get_eigenvector_amplitudes(dense_system,i);
+		double overlap = 0;
+		for (size_t j = 0; j<dimension; j++)
+			overlap += amplitudes[j]*eigenvectors[i*dimension+j];
+		assert_that(fabs(fabs(overlap)-1) < 1e-10);
+	 }
+	 free(eigenvectors);
+	 free_eigensystem(dense_system);
+	);
+
 new_test_silent(diagonalize_500x500_random_matrix_and_compare_to_lapack,
 	 matrix_t matrix_500x500 = new_random_symmetric_matrix(500);
 	 size_t dimension = 500;
@@ -452,3 +1939,348 @@ new_test_silent(diagonalize_500x500_random_matrix_and_compare_to_lapack,
 	 free_eigensystem(lapack_eigensystem);
 	 free_matrix(matrix_500x500);
 	 );
+
+new_test(partial_reorthogonalization_finds_lowest_eigenvalues,
+	 size_t num_skipped = 0;
+	 size_t num_ritz = 0;
+	 assert_that(lowest_eigenvalues_agree_with_lapack
+		     (partial_reorthogonalization,0,&num_skipped,&num_ritz));
+	 assert_that(num_skipped > 0);
+	);
+
+new_test(selective_reorthogonalization_finds_lowest_eigenvalues,
+	 size_t num_skipped = 0;
+	 size_t num_ritz = 0;
+	 assert_that(lowest_eigenvalues_agree_with_lapack
+		     (selective_reorthogonalization,0,&num_skipped,&num_ritz));
+	 // Each of the 100 iterations either orthogonalizes against the
+	 // converged Ritz vectors or skips it, before the first one converges
+	 assert_that(num_ritz > 0);
+	 assert_that(num_skipped > 0);
+	 assert_that(num_ritz + num_skipped == 100);
+	);
+
+new_test(thick_restart_finds_lowest_eigenvalues_in_a_small_basis,
+	 size_t num_skipped = 0;
+	 size_t num_ritz = 0;
+	 assert_that(lowest_eigenvalues_agree_with_lapack
+		     (full_reorthogonalization,20,&num_skipped,&num_ritz));
+	 assert_that(lowest_eigenvalues_agree_with_lapack
+		     (partial_reorthogonalization,20,&num_skipped,&num_ritz));
+	);
+
+new_test(resumed_lanczos_continues_from_the_checkpoint,
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (partial_reorthogonalization,20,MEMORY_STORAGE,0,0));
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (selective_reorthogonalization,0,BLOCK_FILE_STORAGE,0,0));
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (full_reorthogonalization,20,BLOCK_FILE_STORAGE,1,0));
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (full_reorthogonalization,20,SINGLE_FILE_STORAGE,1,0));
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (partial_reorthogonalization,20,BLOCK_FILE_STORAGE,0,1));
+	 assert_that(resumed_lanczos_matches_uninterrupted_lanczos
+		     (full_reorthogonalization,20,SINGLE_FILE_STORAGE,1,1));
+	);
+
+new_test(direct_solve_agrees_with_lanczos_on_small_matrices,
+	 double lanczos_seconds = 0;
+	 double direct_seconds = 0;
+	 assert_that(direct_solve_agrees_with_lanczos(200,
+						      &lanczos_seconds,
+						      &direct_seconds));
+	);
+
+/* Where max_direct_solve_dimension comes from, too slow for the unit
+ * tests.
+ */
+new_test_silent(benchmark_direct_solve_against_lanczos,
+	 const size_t dimensions[] = {500,1000,2000,3000,4000};
+	 for (size_t i = 0; i<sizeof(dimensions)/sizeof(size_t); i++)
+	 {
+		 double lanczos_seconds = 0;
+		 double direct_seconds = 0;
+		 assert_that(direct_solve_agrees_with_lanczos(dimensions[i],
+							      &lanczos_seconds,
+							      &direct_seconds));
+		 printf("Dimension %lu: Lanczos %lg s, dsyevr %lg s\n",
+			dimensions[i],
+			lanczos_seconds,
+			direct_seconds);
+	 }
+	);
+
+new_test(single_precision_basis_barely_changes_the_ground_state_energy,
+	 reorthogonalization_t reorthogonalizations[3] =
+	 {
+	 full_reorthogonalization,
+	 partial_reorthogonalization,
+	 full_reorthogonalization
+	 };
+	 size_t max_basis_dimensions[3] = {0,0,20};
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 double double_energy =
+			 ground_state_energy(0,0,reorthogonalizations[i],
+					     max_basis_dimensions[i]);
+		 double single_energy =
+			 ground_state_energy(1,0,reorthogonalizations[i],
+					     max_basis_dimensions[i]);
+		 printf("ground state energy with double precision basis: "
+			"%.15lg, single precision basis: %.15lg, "
+			"difference: %lg\n",
+			double_energy,single_energy,
+			single_energy - double_energy);
+		 assert_that(fabs(single_energy - double_energy) < 1e-10);
+	 }
+	);
+
+new_test(asynchronous_basis_writes_give_the_same_ground_state_energy,
+	 reorthogonalization_t reorthogonalizations[3] =
+	 {
+	 full_reorthogonalization,
+	 partial_reorthogonalization,
+	 full_reorthogonalization
+	 };
+	 size_t max_basis_dimensions[3] = {0,0,20};
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 double synchronous_energy =
+			 ground_state_energy(0,0,reorthogonalizations[i],
+					     max_basis_dimensions[i]);
+		 double asynchronous_energy =
+			 ground_state_energy(0,1,reorthogonalizations[i],
+					     max_basis_dimensions[i]);
+		 printf("ground state energy with synchronous writes: %.15lg,"
+			" asynchronous writes: %.15lg\n",
+			synchronous_energy,asynchronous_energy);
+		 assert_that(fabs(asynchronous_energy - synchronous_energy) <
+			     1e-12);
+	 }
+	);
+
+new_test(lanczos_warm_started_from_a_nearby_eigenvector_converges_faster,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 // The lowest eigenvector of a slightly different matrix, like that
+	 // of a nearby LEC set
+	 double *elements = get_matrix_elements(matrix);
+	 for (size_t i = 0; i<dimension; i++)
+		 elements[i*dimension+i] += 0.01*(2*drand48()-1);
+	 eigensystem_t nearby_eigensystem =
+		 diagonalize_dense_symmetric_matrix(elements,dimension);
+	 free(elements);
+	 double *amplitudes =
+		 get_eigenvector_amplitudes(nearby_eigensystem,0);
+	 vector_settings_t vector_settings =
+	 {
+		 .directory_name = copy_string(get_test_file_path("initial")),
+		 .num_blocks = 1,
+		 .block_sizes = &dimension
+	 };
+	 vector_t initial_vector = new_zero_vector(vector_settings);
+	 for (size_t i = 0; i<dimension; i++)
+		 set_element(initial_vector,i,amplitudes[i]);
+	 save_vector(initial_vector);
+	 double cold_eigenvalue = 0;
+	 double warm_eigenvalue = 0;
+	 size_t cold_iterations =
+		 lanczos_iterations_to_converge(matrix,dimension,NULL,0,
+						&cold_eigenvalue);
+	 size_t warm_iterations =
+		 lanczos_iterations_to_converge(matrix,dimension,
+						&initial_vector,1,
+						&warm_eigenvalue);
+	 printf("cold start: %lu iterations, warm start: %lu iterations\n",
+		cold_iterations,warm_iterations);
+	 assert_that(warm_iterations < cold_iterations);
+	 assert_that(fabs(warm_eigenvalue - cold_eigenvalue) < 1e-8);
+	 free_vector(initial_vector);
+	 free(vector_settings.directory_name);
+	 free_eigensystem(nearby_eigensystem);
+	 free_matrix(matrix);
+	);
+
+new_test(streamed_eigenvectors_match_eigenvectors_built_one_at_a_time,
+	 size_t dimension = 100;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 30,
+		 .target_eigenvalue = 0,
+		 .eigenvalue_tolerance = 1e-10,
+		 .convergence_critera = converge_eigenvalues,
+		 .matrix = matrix
+	 };
+	 lanczos_environment_t environment =
+		 new_lanczos_environment(settings);
+	 diagonalize(environment);
+	 eigensystem_t eigensystem = get_eigensystem(environment);
+	 const size_t num_eigenvectors = 3;
+	 vector_settings_t vector_settings = settings.vector_settings;
+	 vector_settings.directory_name =
+		 (char*)calloc(strlen(get_test_file_path("eigenvector"))+256,
+			       sizeof(char));
+	 vector_t streamed_eigenvectors[num_eigenvectors];
+	 for (size_t i = 0; i<num_eigenvectors; i++)
+	 {
+		 sprintf(vector_settings.directory_name,"%s_%lu",
+			 get_test_file_path("streamed_eigenvector"),i);
+		 streamed_eigenvectors[i] = new_zero_vector(vector_settings);
+	 }
+	 get_eigenvectors(streamed_eigenvectors,eigensystem,
+			  num_eigenvectors);
+	 for (size_t i = 0; i<num_eigenvectors; i++)
+	 {
+		 sprintf(vector_settings.directory_name,"%s_%lu",
+			 get_test_file_path("eigenvector"),i);
+		 vector_t eigenvector = new_zero_vector(vector_settings);
+		 get_eigenvector(eigenvector,eigensystem,i);
+		 vector_add_scaled(eigenvector,-1,streamed_eigenvectors[i]);
+		 printf("Eigenvector %lu differs by %lg\n",i,norm(eigenvector));
+		 assert_that(norm(eigenvector) < 1e-12);
+		 free_vector(eigenvector);
+		 free_vector(streamed_eigenvectors[i]);
+	 }
+	 free(vector_settings.directory_name);
+	 free_eigensystem(eigensystem);
+	 free_lanczos_environment(environment);
+	 free(settings.krylow_vectors_directory_name);
+	 free_matrix(matrix);
+	);
+
+new_test(residual_convergence_converges_all_target_eigenvalues,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 const size_t num_targets = 3;
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 150,
+		 .target_eigenvalue = num_targets-1,
+		 .eigenvalue_tolerance = 1e-8,
+		 .convergence_critera = converge_residuals,
+		 .matrix = matrix
+	 };
+	 lanczos_environment_t environment =
+		 new_lanczos_environment(settings);
+	 diagonalize(environment);
+	 printf("Converged after %lu iterations\n",
+		environment->num_iterations);
+	 assert_that(environment->num_iterations <
+		     settings.max_num_iterations);
+	 eigensystem_t lanczos_eigensystem = get_eigensystem(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 // The eigenvalue errors are bounded by the residual norms
+	 for (size_t i = 0; i<num_targets; i++)
+	 {
+		 printf("%lg %lg\n",
+			get_eigenvalue(lanczos_eigensystem,i),
+			get_eigenvalue(lapack_eigensystem,i));
+		 assert_that(fabs(get_eigenvalue(lanczos_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) <
+			     settings.eigenvalue_tolerance);
+	 }
+	 free_eigensystem(lanczos_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_lanczos_environment(environment);
+	 free(settings.krylow_vectors_directory_name);
+	 free_matrix(matrix);
+	);
+
+new_test(full_diagnostics_confirm_an_orthonormal_basis_and_the_residual,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 30,
+		 .target_eigenvalue = 0,
+		 .eigenvalue_tolerance = 0,
+		 .convergence_critera = no_convergence,
+		 .diagnostics = full_diagnostics,
+		 .diagnostics_interval = 10,
+		 .matrix = matrix
+	 };
+	 lanczos_environment_t environment =
+		 new_lanczos_environment(settings);
+	 diagonalize(environment);
+	 lanczos_diagnostics_t diagnostics = environment->diagnostics;
+	 assert_that(diagnostics.normalization_error < 1e-12);
+	 assert_that(diagnostics.max_overlap < 1e-12);
+	 assert_that(diagnostics.residual_norm > 0);
+	 assert_that(fabs(diagnostics.residual_norm -
+			  diagnostics.estimated_residual_norm) <
+		     1e-10*diagnostics.residual_norm + 1e-14);
+	 char *residual_directory_name =
+		 copy_string(get_vector_path
+			     (environment->diagnostics_residual));
+	 assert_that(directory_exists(residual_directory_name));
+	 free_lanczos_environment(environment);
+	 assert_that(!directory_exists(residual_directory_name));
+	 free(residual_directory_name);
+	 free(settings.krylow_vectors_directory_name);
+	 free_matrix(matrix);
+	);
+
+new_test(partial_reorthogonalization_keeps_the_restarted_basis_orthogonal,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 150,
+		 .target_eigenvalue = 0,
+		 .eigenvalue_tolerance = 0,
+		 .convergence_critera = no_convergence,
+		 .reorthogonalization = partial_reorthogonalization,
+		 .max_basis_dimension = 20,
+		 .num_restart_vectors = 10,
+		 .diagnostics = full_diagnostics,
+		 .diagnostics_interval = 1,
+		 .matrix = matrix
+	 };
+	 lanczos_environment_t environment =
+		 new_lanczos_environment(settings);
+	 diagonalize(environment);
+	 assert_that(environment->num_restarts > 0);
+	 assert_that(environment->diagnostics.max_overlap < sqrt(DBL_EPSILON));
+	 free_lanczos_environment(environment);
+	 free(settings.krylow_vectors_directory_name);
+	 free_matrix(matrix);
+	);
@@ -8,13 +8,48 @@
 struct _lanczos_environment_;
 typedef struct _lanczos_environment_ *lanczos_environment_t;
 
+/* With converge_residuals, Lanczos stops when the residual norms of all the
+ * Ritz pairs up to the target eigenvalue are below the tolerance. The
+ * other criteria compare the target eigenvalue or eigenvector to that of
+ * the previous iteration.
+ */
 typedef enum
 {
 	converge_eigenvalues,
 	converge_eigenvectors,
+	converge_residuals,
 	no_convergence
 } convergence_critera_t;
 
+/* How the Krylow vectors are kept orthogonal. Full reorthogonalization
+ * orthogonalizes every new Krylow vector against all older ones. Partial
+ * reorthogonalization estimates the loss of orthogonality with Simon's
+ * omega recurrence and only reorthogonalizes when it exceeds the square root
+ * of the machine epsilon, after a thick restart the Krylow vectors are
+ * still orthogonalized against the locked Ritz vectors. Selective
+ * reorthogonalization orthogonalizes the new Krylow vectors against the
+ * converged Ritz vectors only.
+ */
+typedef enum
+{
+	full_reorthogonalization,
+	partial_reorthogonalization,
+	selective_reorthogonalization
+} reorthogonalization_t;
+
+/* Cheap diagnostics print what every Lanczos iteration computes anyway.
+ * Full diagnostics also measure, every diagnostics_interval iterations,
+ * the normalization and orthogonality of the new Krylow vector and the
+ * residual of the lowest Ritz pair. These cost passes over the whole
+ * Krylow basis and a matrix vector multiplication, which are reported.
+ */
+typedef enum
+{
+	no_diagnostics,
+	cheap_diagnostics,
+	full_diagnostics
+} diagnostics_level_t;
+
 typedef struct
 {
 	size_t dimension;
@@ -24,9 +59,45 @@ typedef struct
 	size_t target_eigenvalue;
 	double eigenvalue_tolerance; 
 	convergence_critera_t convergence_critera;
+	reorthogonalization_t reorthogonalization;
+	// With a maximum basis dimension other than 0, the Krylow basis is
+	// restarted with num_restart_vectors Ritz vectors when it is full
+	size_t max_basis_dimension;
+	size_t num_restart_vectors;
+	// With write_checkpoints set, a checkpoint is written to the Krylow
+	// vector directory after every iteration. With resume set,
+	// diagonalize continues from it.
+	int write_checkpoints;
+	int resume;
+	diagnostics_level_t diagnostics;
+	size_t diagnostics_interval;
+	// With single_precision_basis set, the Krylow vectors before the
+	// previous one are stored in single precision
+	int single_precision_basis;
+	// With asynchronous_basis_writes set, the Krylow vectors of the
+	// recurrence are kept in memory when the vectors are stored in files,
+	// and a new Krylow vector is written in the background
+	int asynchronous_basis_writes;
+	// Without initial vectors Lanczos starts from the first basis state,
+	// otherwise from their combination with the initial coefficients.
+	// Block Lanczos starts from the initial vectors themselves.
+	vector_t *initial_vectors;
+	size_t num_initial_vectors;
+	const double *initial_coefficients;
 	matrix_t matrix;
 } lanczos_settings_t;
 
+/* Prints the num_ritz_values lowest Ritz values, unless they are NULL, and
+ * how far the num_wanted lowest Ritz pairs are from convergence by the
+ * criteria. The eigensolvers print this after every iteration.
+ */
+void print_convergence_progress(const double *ritz_values,
+				size_t num_ritz_values,
+				size_t num_wanted,
+				convergence_critera_t criteria,
+				double difference,
+				double tolerance);
+
 lanczos_environment_t new_lanczos_environment(lanczos_settings_t settings);
 
 void diagonalize(lanczos_environment_t environment);
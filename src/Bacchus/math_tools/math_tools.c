@@ -1,6 +1,23 @@
 #include <math_tools/math_tools.h>
 #include <math.h>
+#include <string.h>
 #include <unit_testing/test.h>
+#include <omp.h>
+
+/* The reductions sum chunks of this many elements, each with a fixed SIMD
+ * order, and add the chunk sums pairwise. The chunks do not depend on the
+ * number of threads, which makes the results bitwise reproducible.
+ */
+static const size_t reduction_chunk_length = 4096;
+
+static
+size_t get_num_chunks(size_t num_elements);
+
+static
+size_t chunk_end(size_t chunk_begin,size_t num_elements);
+
+static
+double sum_pairwise(double *values,size_t num_values);
 
 size_t sum_sizes(const size_t *sizes,size_t num_sizes)
 {
@@ -14,10 +31,22 @@ double array_scalar_product(const double *first_array,
 			    const double *second_array,
 			    size_t num_elements)
 {
-	double accumulator = 0;
-	for (size_t i = 0; i<num_elements; i++)
-		accumulator += first_array[i]*second_array[i];
-	return accumulator;
+	const size_t num_chunks = get_num_chunks(num_elements);
+	double *chunk_sums = (double*)malloc(num_chunks*sizeof(double));
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+	for (size_t chunk = 0; chunk<num_chunks; chunk++)
+	{
+		const size_t begin = chunk*reduction_chunk_length;
+		const size_t end = chunk_end(begin,num_elements);
+		double accumulator = 0;
+#pragma omp simd reduction(+:accumulator)
+		for (size_t i = begin; i<end; i++)
+			accumulator += first_array[i]*second_array[i];
+		chunk_sums[chunk] = accumulator;
+	}
+	double sum = sum_pairwise(chunk_sums,num_chunks);
+	free(chunk_sums);
+	return sum;
 }
 
 void subtract_array_projection(double *target_array,
@@ -25,6 +54,8 @@ void subtract_array_projection(double *target_array,
 			       const double *direction_array,
 			       size_t num_elements)
 {
+#pragma omp parallel for simd schedule(static) \
+	if(num_elements > reduction_chunk_length)
 	for (size_t i = 0; i<num_elements; i++)
 		target_array[i]-=projection*direction_array[i];
 }
@@ -32,16 +63,30 @@ void subtract_array_projection(double *target_array,
 double array_square_norm(const double *array,
 			 size_t num_elements)
 {
-	double accumulator = 0.0;
-	for (size_t i = 0; i<num_elements; i++)
-		accumulator+=array[i]*array[i];
-	return accumulator;
+	const size_t num_chunks = get_num_chunks(num_elements);
+	double *chunk_sums = (double*)malloc(num_chunks*sizeof(double));
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+	for (size_t chunk = 0; chunk<num_chunks; chunk++)
+	{
+		const size_t begin = chunk*reduction_chunk_length;
+		const size_t end = chunk_end(begin,num_elements);
+		double accumulator = 0;
+#pragma omp simd reduction(+:accumulator)
+		for (size_t i = begin; i<end; i++)
+			accumulator+=array[i]*array[i];
+		chunk_sums[chunk] = accumulator;
+	}
+	double sum = sum_pairwise(chunk_sums,num_chunks);
+	free(chunk_sums);
+	return sum;
 }
 
 void scale_array(double *array,
 		 double scaling,
 		 size_t num_elements)
 {
+#pragma omp parallel for simd schedule(static) \
+	if(num_elements > reduction_chunk_length)
 	for (size_t i = 0; i<num_elements; i++)
 		array[i]*=scaling;
 }
@@ -52,10 +97,161 @@ void array_add_scaled(double *target_array,
 		      const double *term,
 		      size_t num_elements)
 {
+#pragma omp parallel for simd schedule(static) \
+	if(num_elements > reduction_chunk_length)
 	for (size_t i = 0; i<num_elements; i++)
 		target_array[i]+=scaling_factor*term[i];
 }
 
+void add_lanczos_array_products(lanczos_products_t *products,
+				const double *w,
+				const double *v,
+				const double *previous,
+				size_t num_elements)
+{
+	const size_t num_chunks = get_num_chunks(num_elements);
+	const size_t num_products = 6;
+	// The sums of product k are stored at k*num_chunks
+	double *chunk_sums =
+		(double*)calloc(num_products*num_chunks,sizeof(double));
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+	for (size_t chunk = 0; chunk<num_chunks; chunk++)
+	{
+		const size_t begin = chunk*reduction_chunk_length;
+		const size_t end = chunk_end(begin,num_elements);
+		double v_w = 0;
+		double w_w = 0;
+		double v_v = 0;
+		if (previous == NULL)
+		{
+#pragma omp simd reduction(+:v_w,w_w,v_v)
+			for (size_t i = begin; i<end; i++)
+			{
+				v_w += v[i]*w[i];
+				w_w += w[i]*w[i];
+				v_v += v[i]*v[i];
+			}
+		}
+		else
+		{
+			double previous_w = 0;
+			double previous_previous = 0;
+			double v_previous = 0;
+#pragma omp simd reduction(+:v_w,w_w,v_v,previous_w,previous_previous,v_previous)
+			for (size_t i = begin; i<end; i++)
+			{
+				v_w += v[i]*w[i];
+				w_w += w[i]*w[i];
+				v_v += v[i]*v[i];
+				previous_w += previous[i]*w[i];
+				previous_previous += previous[i]*previous[i];
+				v_previous += v[i]*previous[i];
+			}
+			chunk_sums[3*num_chunks + chunk] = previous_w;
+			chunk_sums[4*num_chunks + chunk] = previous_previous;
+			chunk_sums[5*num_chunks + chunk] = v_previous;
+		}
+		chunk_sums[chunk] = v_w;
+		chunk_sums[num_chunks + chunk] = w_w;
+		chunk_sums[2*num_chunks + chunk] = v_v;
+	}
+	products->v_w += sum_pairwise(chunk_sums,num_chunks);
+	products->w_w += sum_pairwise(chunk_sums + num_chunks,num_chunks);
+	products->v_v += sum_pairwise(chunk_sums + 2*num_chunks,num_chunks);
+	if (previous != NULL)
+	{
+		products->previous_w +=
+			sum_pairwise(chunk_sums + 3*num_chunks,num_chunks);
+		products->previous_previous +=
+			sum_pairwise(chunk_sums + 4*num_chunks,num_chunks);
+		products->v_previous +=
+			sum_pairwise(chunk_sums + 5*num_chunks,num_chunks);
+	}
+	free(chunk_sums);
+}
+
+double array_lanczos_update(double *w,
+			    double alpha,
+			    const double *v,
+			    double beta,
+			    const double *previous,
+			    double scaling,
+			    size_t num_elements)
+{
+	const size_t num_chunks = get_num_chunks(num_elements);
+	double *chunk_sums = (double*)malloc(num_chunks*sizeof(double));
+#pragma omp parallel for schedule(static) if(num_chunks > 1)
+	for (size_t chunk = 0; chunk<num_chunks; chunk++)
+	{
+		const size_t begin = chunk*reduction_chunk_length;
+		const size_t end = chunk_end(begin,num_elements);
+		double accumulator = 0.0;
+		if (previous == NULL)
+		{
+#pragma omp simd reduction(+:accumulator)
+			for (size_t i = begin; i<end; i++)
+			{
+				double element = w[i] - alpha*v[i];
+				accumulator += element*element;
+				w[i] = scaling*element;
+			}
+		}
+		else
+		{
+#pragma omp simd reduction(+:accumulator)
+			for (size_t i = begin; i<end; i++)
+			{
+				double element =
+					w[i] - alpha*v[i] - beta*previous[i];
+				accumulator += element*element;
+				w[i] = scaling*element;
+			}
+		}
+		chunk_sums[chunk] = accumulator;
+	}
+	double sum = sum_pairwise(chunk_sums,num_chunks);
+	free(chunk_sums);
+	return sum;
+}
+
+uint64_t hash_bytes(uint64_t hash,
+		    const void *bytes,
+		    size_t num_bytes)
+{
+	const unsigned char *byte = (const unsigned char*)bytes;
+	for (size_t i = 0; i<num_bytes; i++)
+	{
+		hash ^= byte[i];
+		hash *= UINT64_C(1099511628211);
+	}
+	return hash;
+}
+
+static
+size_t get_num_chunks(size_t num_elements)
+{
+	return (num_elements + reduction_chunk_length - 1)/
+		reduction_chunk_length;
+}
+
+static
+size_t chunk_end(size_t chunk_begin,size_t num_elements)
+{
+	return chunk_begin + reduction_chunk_length < num_elements ?
+		chunk_begin + reduction_chunk_length : num_elements;
+}
+
+static
+double sum_pairwise(double *values,size_t num_values)
+{
+	if (num_values == 0)
+		return 0;
+	for (size_t stride = 1; stride<num_values; stride*=2)
+		for (size_t i = 0; i+stride<num_values; i+=2*stride)
+			values[i] += values[i+stride];
+	return values[0];
+}
+
 new_test(summing_1_2_3_expects_6,
 	 const size_t array[3] = {1,2,3};
 	 assert_that(sum_sizes(array,3) == 6);
@@ -67,3 +263,77 @@ new_test(scalar_product_of_1_1_1_and_1_1_1_expects_3,
 	 assert_that(fabs(array_scalar_product(first_array,second_array,3)-3)<1e-10)
 	);
 
+
+new_test(lanczos_update_matches_separate_operations,
+	 const double v[3] = {1,2,3};
+	 const double previous[3] = {0,-1,2};
+	 double w[3] = {4,5,6};
+	 lanczos_products_t products = {0};
+	 add_lanczos_array_products(&products,w,v,previous,3);
+	 assert_that(fabs(products.v_w-32)<1e-12);
+	 assert_that(fabs(products.previous_w-7)<1e-12);
+	 assert_that(fabs(products.w_w-77)<1e-12);
+	 assert_that(fabs(products.v_v-14)<1e-12);
+	 assert_that(fabs(products.previous_previous-5)<1e-12);
+	 assert_that(fabs(products.v_previous-4)<1e-12);
+	 double expected[3] = {4,5,6};
+	 subtract_array_projection(expected,2,v,3);
+	 subtract_array_projection(expected,0.5,previous,3);
+	 double expected_square_norm = array_square_norm(expected,3);
+	 scale_array(expected,0.25,3);
+	 double square_norm = array_lanczos_update(w,2,v,0.5,previous,0.25,3);
+	 assert_that(fabs(square_norm-expected_square_norm)<1e-12);
+	 for (size_t i = 0; i<3; i++)
+	 	assert_that(fabs(w[i]-expected[i])<1e-12);
+	);
+
+new_test(reductions_do_not_depend_on_the_number_of_threads,
+	 const size_t num_elements = 100003;
+	 double *first_array = (double*)malloc(num_elements*sizeof(double));
+	 double *second_array = (double*)malloc(num_elements*sizeof(double));
+	 srand48(3);
+	 for (size_t i = 0; i<num_elements; i++)
+	 {
+		first_array[i] = 2*drand48()-1;
+		second_array[i] = 1e3*(2*drand48()-1);
+	 }
+	 const int max_num_threads = omp_get_max_threads();
+	 omp_set_num_threads(1);
+	 double single_thread_product =
+		array_scalar_product(first_array,second_array,num_elements);
+	 double single_thread_norm =
+		array_square_norm(second_array,num_elements);
+	 lanczos_products_t single_thread_products = {0};
+	 add_lanczos_array_products(&single_thread_products,
+				    first_array,second_array,first_array,
+				    num_elements);
+	 for (int num_threads = 2; num_threads<=7; num_threads++)
+	 {
+		omp_set_num_threads(num_threads);
+		assert_that(array_scalar_product(first_array,
+						 second_array,
+						 num_elements)
+			    == single_thread_product);
+		assert_that(array_square_norm(second_array,num_elements)
+			    == single_thread_norm);
+		lanczos_products_t products = {0};
+		add_lanczos_array_products(&products,
+					   first_array,second_array,
+					   first_array,num_elements);
+		assert_that(memcmp(&products,&single_thread_products,
+				   sizeof(lanczos_products_t)) == 0);
+	 }
+	 omp_set_num_threads(max_num_threads);
+	 free(first_array);
+	 free(second_array);
+	);
+
+new_test(hash_bytes_matches_fnv1a_reference,
+	 assert_that(hash_bytes(initial_hash,"",0) ==
+		     UINT64_C(0xcbf29ce484222325));
+	 assert_that(hash_bytes(initial_hash,"a",1) ==
+		     UINT64_C(0xaf63dc4c8601ec8c));
+	 // Hashing in pieces gives the same hash
+	 assert_that(hash_bytes(hash_bytes(initial_hash,"foo",3),"bar",3) ==
+		     hash_bytes(initial_hash,"foobar",6));
+	);
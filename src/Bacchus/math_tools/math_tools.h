@@ -2,9 +2,27 @@
 #define __MATH_TOOLS__
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #define square(a) (a)*(a)
 
+// The offset basis of the 64 bit FNV-1a hash
+#define initial_hash UINT64_C(14695981039346656037)
+
+/* The scalar products needed by a Lanczos step, where w is the matrix
+ * applied to the current Krylow vector v and previous is the Krylow vector
+ * before v.
+ */
+typedef struct
+{
+	double v_w;
+	double previous_w;
+	double w_w;
+	double v_v;
+	double previous_previous;
+	double v_previous;
+} lanczos_products_t;
+
 size_t sum_sizes(const size_t *sizes,size_t num_sizes);
 
 double array_scalar_product(const double *first_array,
@@ -27,4 +45,31 @@ void array_add_scaled(double *target_array,
 		      double scaling_factor,
 		      const double *term,
 		      size_t num_elements);
+
+/* Adds the products of the arrays to products. previous may be NULL, then
+ * only the products of v and w are added.
+ */
+void add_lanczos_array_products(lanczos_products_t *products,
+				const double *w,
+				const double *v,
+				const double *previous,
+				size_t num_elements);
+
+/* Sets w to scaling*(w - alpha*v - beta*previous) and returns the square
+ * norm of w - alpha*v - beta*previous. previous may be NULL.
+ */
+double array_lanczos_update(double *w,
+			    double alpha,
+			    const double *v,
+			    double beta,
+			    const double *previous,
+			    double scaling,
+			    size_t num_elements);
+
+/* Continues the FNV-1a hash with the bytes, a hash starts at
+ * initial_hash.
+ */
+uint64_t hash_bytes(uint64_t hash,
+		    const void *bytes,
+		    size_t num_bytes);
 #endif
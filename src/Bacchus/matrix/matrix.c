@@ -7,6 +7,7 @@
 #include <string.h>
 #include <unit_testing/test.h>
 #include <scheduler/scheduler.h>
+#include <string_tools/string_tools.h>
 #include <math.h>
 #include <time.h>
 
@@ -20,6 +21,8 @@ struct _matrix_
 	matrix_type_t type;
 	explicit_matrix_t explicit_matrix;
 	scheduler_t scheduler;
+	// Of a generative matrix
+	size_t dimension;
 };
 
 matrix_t new_zero_matrix(size_t num_rows,
@@ -41,6 +44,19 @@ matrix_t new_random_symmetric_matrix(size_t side_length)
 	return matrix;
 }
 
+matrix_t new_well_separated_matrix(size_t side_length)
+{
+	matrix_t matrix = new_random_symmetric_matrix(side_length);
+	double *elements = get_matrix_elements(matrix);
+	for (size_t i = 0; i<side_length; i++)
+		for (size_t j = 0; j<side_length; j++)
+			elements[i*side_length+j] = i == j ? i :
+				0.1*elements[i*side_length+j];
+	set_matrix_elements(matrix,elements);
+	free(elements);
+	return matrix;
+}
+
 matrix_t new_matrix_from_numpy(FILE* matrix_file)
 {
 	matrix_t matrix = (matrix_t)malloc(sizeof(struct _matrix_));
@@ -55,8 +71,9 @@ matrix_t new_generative_matrix(evaluation_order_t evaluation_order,
 			       const char *matrix_file_base_directory,
 			       size_t maximum_loaded_memory)
 {
-	matrix_t matrix = (matrix_t)malloc(sizeof(struct _matrix_));
+	matrix_t matrix = (matrix_t)calloc(1,sizeof(struct _matrix_));
 	matrix->type = GENERATIV_MATRIX;
+	matrix->dimension = get_full_dimension(combination_table);
 	matrix->scheduler = new_scheduler(evaluation_order,
 					  combination_table,
 					  index_lists_base_directory,
@@ -65,6 +82,30 @@ matrix_t new_generative_matrix(evaluation_order_t evaluation_order,
 	return matrix;
 }
 
+void set_generative_matrix_block_generator(matrix_t matrix,
+					   matrix_block_generator_t generator,
+					   void *generator_data)
+{
+	if (matrix->type != GENERATIV_MATRIX)
+		error("Only generative matrices can compute their matrix"
+		      " blocks\n");
+	set_scheduler_matrix_block_generator(matrix->scheduler,
+					     generator,
+					     generator_data);
+}
+
+static
+void generative_block_multiplication(vector_t *result_vectors,
+				     const matrix_t matrix,
+				     vector_t *vectors,
+				     size_t num_vectors);
+
+static
+void run_generative_sweep(vector_t *result_vectors,
+			  const matrix_t matrix,
+			  vector_t *vectors,
+			  size_t num_vectors);
+
 void matrix_vector_multiplication(vector_t result_vector,
 				  const matrix_t matrix,
 				  const vector_t vector)
@@ -81,10 +122,10 @@ void matrix_vector_multiplication(vector_t result_vector,
 				 vector);
 			break;
 		case GENERATIV_MATRIX:
-			run_matrix_vector_multiplication
-				(get_vector_path(result_vector),
-				 get_vector_path(vector),
-				 matrix->scheduler);
+			run_generative_sweep(&result_vector,
+					     matrix,
+					     (vector_t*)&vector,
+					     1);
 			break;
 	}
 	clock_gettime(CLOCK_REALTIME,&t_end);
@@ -95,15 +136,130 @@ void matrix_vector_multiplication(vector_t result_vector,
 	       multiplication_time);
 }
 
+void matrix_block_multiplication(vector_t *result_vectors,
+				 const matrix_t matrix,
+				 vector_t *vectors,
+				 size_t num_vectors)
+{
+	switch (matrix->type)
+	{
+		case EXPLICIT_MATRIX:
+			printf("Matrix block multiplication of %lu vectors\n",
+			       num_vectors);
+			explicit_matrix_block_multiplication
+				(result_vectors,
+				 matrix->explicit_matrix,
+				 vectors,
+				 num_vectors);
+			break;
+		case GENERATIV_MATRIX:
+			generative_block_multiplication(result_vectors,
+							matrix,
+							vectors,
+							num_vectors);
+			break;
+	}
+}
+
+/* Minerva adds the products to the block files of the results. Input
+ * vectors in memory are handed to it directly, so their files are not
+ * written first and a background write of them, like that of the newest
+ * Krylow vector, goes on during the sweep.
+ */
+static
+void run_generative_sweep(vector_t *result_vectors,
+			  const matrix_t matrix,
+			  vector_t *vectors,
+			  size_t num_vectors)
+{
+	const char **input_directories =
+		(const char**)malloc(num_vectors*sizeof(char*));
+	const double **input_elements =
+		(const double**)malloc(num_vectors*sizeof(double*));
+	const char **output_directories =
+		(const char**)malloc(num_vectors*sizeof(char*));
+	for (size_t i = 0; i<num_vectors; i++)
+	{
+		input_elements[i] = get_vector_elements_in_memory(vectors[i]);
+		if (input_elements[i] == NULL)
+			write_vector_block_files(vectors[i]);
+		write_vector_block_files(result_vectors[i]);
+		input_directories[i] = get_vector_path(vectors[i]);
+		output_directories[i] = get_vector_path(result_vectors[i]);
+	}
+	run_multi_vector_multiplication(output_directories,
+					input_directories,
+					input_elements,
+					num_vectors,
+					matrix->scheduler);
+	for (size_t i = 0; i<num_vectors; i++)
+		read_vector_block_files(result_vectors[i]);
+	free(output_directories);
+	free(input_elements);
+	free(input_directories);
+}
+
+/* All vectors are multiplied in one sweep of Minerva, which loads every
+ * matrix block and index list once for all of them.
+ */
+static
+void generative_block_multiplication(vector_t *result_vectors,
+				     const matrix_t matrix,
+				     vector_t *vectors,
+				     size_t num_vectors)
+{
+	printf("Matrix block multiplication of %lu vectors start:\n",
+	       num_vectors);
+	struct timespec t_start,t_end;
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	run_generative_sweep(result_vectors,matrix,vectors,num_vectors);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	printf("Matrix block multiplication end after %lg µs\n",
+	       (t_end.tv_sec - t_start.tv_sec)*1e6 +
+	       (t_end.tv_nsec - t_start.tv_nsec)*1e-3);
+}
+
+void get_matrix_diagonal(vector_t diagonal,
+			 const matrix_t matrix)
+{
+	double *elements = NULL;
+	switch (matrix->type)
+	{
+		case EXPLICIT_MATRIX:
+			elements = (double*)malloc(vector_dimension(diagonal)*
+						   sizeof(double));
+			get_explicit_matrix_diagonal(elements,
+						     matrix->explicit_matrix);
+			set_vector_elements(diagonal,elements);
+			free(elements);
+			break;
+		case GENERATIV_MATRIX:
+			// Minerva adds to the block files of the diagonal
+			scale(diagonal,0.0);
+			write_vector_block_files(diagonal);
+			run_diagonal_extraction(get_vector_path(diagonal),
+						matrix->scheduler);
+			read_vector_block_files(diagonal);
+			break;
+	}
+}
+
+int is_explicit_matrix(const matrix_t matrix)
+{
+	return matrix->type == EXPLICIT_MATRIX;
+}
+
 size_t get_num_rows(matrix_t matrix)
 {
-	assert(matrix->type == EXPLICIT_MATRIX);
+	if (matrix->type == GENERATIV_MATRIX)
+		return matrix->dimension;
 	return get_explicit_matrix_num_rows(matrix->explicit_matrix);
 }
 
 size_t get_num_columns(matrix_t matrix)
 {
-	assert(matrix->type == EXPLICIT_MATRIX);
+	if (matrix->type == GENERATIV_MATRIX)
+		return matrix->dimension;
 	return get_explicit_matrix_num_columns(matrix->explicit_matrix);
 }
 
@@ -185,3 +341,109 @@ new_test(save_matrix_to_numpy_file,
 	 free_matrix(matrix);
 	 free_matrix(loaded_matrix);
 	);
+
+#define BACCHUS_RUN "bacchus_run_data/he4/"
+
+new_test(generative_block_multiplication_matches_single_vectors,
+	 const size_t num_vectors = 3;
+	 combination_table_t combination_table =
+	 new_combination_table(TEST_DATA BACCHUS_RUN "nmax2/comb.txt",2,2);
+	 evaluation_order_t evaluation_order =
+	 read_evaluation_order(TEST_DATA BACCHUS_RUN "nmax2/greedy_3_16.txt",
+			       combination_table);
+	 matrix_t matrix =
+	 new_generative_matrix(evaluation_order,
+			       combination_table,
+			       TEST_DATA BACCHUS_RUN "nmax2/index_lists",
+			       TEST_DATA BACCHUS_RUN "nmax2/interaction",
+			       (size_t)(16)<<30);
+	 vector_settings_t settings = setup_vector_settings(combination_table);
+	 settings.storage = MEMORY_STORAGE;
+	 vector_t vectors[num_vectors];
+	 vector_t block_products[num_vectors];
+	 vector_t single_products[num_vectors];
+	 char directory_name[32];
+	 for (size_t i = 0; i<num_vectors; i++)
+	 {
+		sprintf(directory_name,"input_%lu",i);
+		settings.directory_name =
+			copy_string(get_test_file_path(directory_name));
+		vectors[i] = new_random_vector(settings);
+		free(settings.directory_name);
+		sprintf(directory_name,"block_output_%lu",i);
+		settings.directory_name =
+			copy_string(get_test_file_path(directory_name));
+		block_products[i] = new_zero_vector(settings);
+		free(settings.directory_name);
+		sprintf(directory_name,"single_output_%lu",i);
+		settings.directory_name =
+			copy_string(get_test_file_path(directory_name));
+		single_products[i] = new_zero_vector(settings);
+		free(settings.directory_name);
+	 }
+	 matrix_block_multiplication(block_products,
+				     matrix,
+				     vectors,
+				     num_vectors);
+	 for (size_t i = 0; i<num_vectors; i++)
+	 {
+		matrix_vector_multiplication(single_products[i],
+					     matrix,
+					     vectors[i]);
+		for (size_t j = 0; j<vector_dimension(vectors[i]); j++)
+			assert_that(fabs(get_element(block_products[i],j) -
+					 get_element(single_products[i],j)) <
+				    1e-12*(1+fabs(get_element(single_products[i],
+								j))));
+		free_vector(single_products[i]);
+		free_vector(block_products[i]);
+		free_vector(vectors[i]);
+	 }
+	 free(settings.block_sizes);
+	 free_matrix(matrix);
+	 free_evaluation_order(evaluation_order);
+	 free_combination_table(combination_table);
+	);
+
+new_test(generative_multiplication_reads_vectors_kept_in_memory,
+	 combination_table_t combination_table =
+	 new_combination_table(TEST_DATA BACCHUS_RUN "nmax2/comb.txt",2,2);
+	 evaluation_order_t evaluation_order =
+	 read_evaluation_order(TEST_DATA BACCHUS_RUN "nmax2/greedy_3_16.txt",
+			       combination_table);
+	 matrix_t matrix =
+	 new_generative_matrix(evaluation_order,
+			       combination_table,
+			       TEST_DATA BACCHUS_RUN "nmax2/index_lists",
+			       TEST_DATA BACCHUS_RUN "nmax2/interaction",
+			       (size_t)(16)<<30);
+	 vector_settings_t settings = setup_vector_settings(combination_table);
+	 settings.directory_name = copy_string(get_test_file_path("input"));
+	 vector_t vector = new_random_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name =
+	 copy_string(get_test_file_path("file_product"));
+	 vector_t file_product = new_zero_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name =
+	 copy_string(get_test_file_path("memory_product"));
+	 vector_t memory_product = new_zero_vector(settings);
+	 free(settings.directory_name);
+	 matrix_vector_multiplication(file_product,matrix,vector);
+	 // The change is only in memory, the block files of the input still
+	 // hold the old elements
+	 keep_vector_in_memory(vector);
+	 scale(vector,2.0);
+	 matrix_vector_multiplication(memory_product,matrix,vector);
+	 for (size_t i = 0; i<vector_dimension(vector); i++)
+		assert_that(fabs(get_element(memory_product,i) -
+				 2*get_element(file_product,i)) <
+			    1e-12*(1+fabs(get_element(memory_product,i))));
+	 free_vector(memory_product);
+	 free_vector(file_product);
+	 free_vector(vector);
+	 free(settings.block_sizes);
+	 free_matrix(matrix);
+	 free_evaluation_order(evaluation_order);
+	 free_combination_table(combination_table);
+	);
@@ -5,6 +5,7 @@
 #include <equality_status/equality_status.h>
 #include <evaluation_order/evaluation_order.h>
 #include <combination_table/combination_table.h>
+#include <matrix_block/matrix_block.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -16,6 +17,12 @@ matrix_t new_zero_matrix(size_t num_rows,
 
 matrix_t new_random_symmetric_matrix(size_t side_length);
 
+/* A random symmetric matrix with diagonal 0, 1, 2, ... and off diagonal
+ * elements scaled by 0.1, so that its low eigenvalues are well separated.
+ * Used by the eigensolver tests.
+ */
+matrix_t new_well_separated_matrix(size_t side_length);
+
 matrix_t new_matrix_from_numpy(FILE* matrix_file);
 
 matrix_t new_generative_matrix(evaluation_order_t evaluation_order,
@@ -24,10 +31,37 @@ matrix_t new_generative_matrix(evaluation_order_t evaluation_order,
 			       const char *matrix_file_base_directory,
 			       size_t maximum_loaded_memory);
 
+/* The generator computes matrix blocks of the generative matrix in memory
+ * instead of them being read from the matrix files, see
+ * set_scheduler_matrix_block_generator. The generator data has to outlive
+ * the multiplications with the matrix.
+ */
+void set_generative_matrix_block_generator(matrix_t matrix,
+					   matrix_block_generator_t generator,
+					   void *generator_data);
+
 void matrix_vector_multiplication(vector_t result_vector,
 				  const matrix_t matrix,
 				  const vector_t vector);
 
+/* Sets result_vectors[i] to the matrix times vectors[i]. An explicit
+ * matrix is applied to all vectors at once, a generative matrix in one
+ * sweep of Minerva for all vectors, whose blocks then have to fit in the
+ * loaded memory together.
+ */
+void matrix_block_multiplication(vector_t *result_vectors,
+				 const matrix_t matrix,
+				 vector_t *vectors,
+				 size_t num_vectors);
+
+int is_explicit_matrix(const matrix_t matrix);
+
+/* Sets the vector to the diagonal of the matrix. Minerva only runs the
+ * instructions of the diagonal blocks for it.
+ */
+void get_matrix_diagonal(vector_t diagonal,
+			 const matrix_t matrix);
+
 size_t get_num_rows(matrix_t matrix);
 
 size_t get_num_columns(matrix_t matrix);
@@ -11,96 +11,359 @@
 #include <combination_table/combination_table.h>
 #include <evaluation_order/evaluation_order.h>
 #include <scheduler/scheduler.h>
+#include <directory_tools/directory_tools.h>
+#include <omp.h>
+#include <math.h>
 
 struct _matrix_builder_
 {
-	matrix_builder_settings_t settings;
 	combination_table_t combination_table;	
 	evaluation_order_t evaluation_order;
-	scheduler_t scheduler;
+	matrix_t matrix;
+	char *vector_directory;
+	size_t maximum_loaded_memory;
+	// Whether the matrix and the tables were read by the builder
+	int owns_matrix;
 };
 
+static
+char *new_block_couplings(evaluation_order_t evaluation_order,
+			  size_t num_blocks);
+
+static
+size_t group_basis_blocks(size_t *batch_ids,
+			  const size_t *block_sizes,
+			  const char *couplings,
+			  size_t num_blocks);
+
 matrix_builder_t new_matrix_builder(matrix_builder_settings_t settings)
 {
-	matrix_builder_t builder =
-		(matrix_builder_t)malloc(sizeof(struct _matrix_builder_));
-	builder->settings = settings;
-	builder->combination_table =
+	combination_table_t combination_table =
 		new_combination_table(settings.combination_file_path,
 				      settings.num_protons,
 				      settings.num_neutrons);
-	builder->evaluation_order =
+	evaluation_order_t evaluation_order =
 		read_evaluation_order(settings.minerva_instruction_path,
-				     builder->combination_table);
-
-	const size_t max_load_memory = (size_t)(16)<<30;
-	builder->scheduler = 
-		new_scheduler(builder->evaluation_order,
-			      builder->combination_table,
-			      settings.index_list_path,
-			      settings.interaction_path,
-			      max_load_memory);		
+				     combination_table);
+	matrix_t matrix = 
+		new_generative_matrix(evaluation_order,
+				      combination_table,
+				      settings.index_list_path,
+				      settings.interaction_path,
+				      settings.maximum_loaded_memory);		
+	matrix_builder_t builder =
+		new_generative_matrix_builder(matrix,
+					      evaluation_order,
+					      combination_table,
+					      settings.vector_directory,
+					      settings.maximum_loaded_memory);
+	builder->owns_matrix = 1;
 	return builder;	
 }
 
+matrix_builder_t new_generative_matrix_builder
+(matrix_t matrix,
+ evaluation_order_t evaluation_order,
+ combination_table_t combination_table,
+ const char *vector_directory,
+ size_t maximum_loaded_memory)
+{
+	if (is_explicit_matrix(matrix))
+		error("Only a generative matrix can be made explicit\n");
+	if (!directory_exists(vector_directory) &&
+	    create_directory(vector_directory) != 0)
+		error("Could not create directory \"%s\". %s\n",
+		      vector_directory,
+		      strerror(errno));
+	matrix_builder_t builder =
+		(matrix_builder_t)malloc(sizeof(struct _matrix_builder_));
+	builder->combination_table = combination_table;
+	builder->evaluation_order = evaluation_order;
+	builder->matrix = matrix;
+	builder->vector_directory = copy_string(vector_directory);
+	builder->maximum_loaded_memory = maximum_loaded_memory;
+	builder->owns_matrix = 0;
+	return builder;
+}
+
+/* The input and output blocks of an instruction, with the thread copies of
+ * the output, have to fit in the loaded memory for all vectors of a sweep.
+ * Half of it is left for the matrix blocks and index lists.
+ */
+static
+size_t get_num_vectors_per_sweep(size_t dimension,
+				 size_t maximum_loaded_memory)
+{
+	const size_t vector_memory =
+		2*dimension*sizeof(double)*(omp_get_max_threads()+1);
+	const size_t num_vectors = maximum_loaded_memory/(2*vector_memory);
+	return num_vectors < 1 ? 1 : num_vectors;
+}
+
 matrix_t generate_matrix(matrix_builder_t builder)
 {
-	vector_settings_t settings_template =
+	vector_settings_t vector_settings =
 		setup_vector_settings(builder->combination_table);
-	vector_settings_t input_vector_settings = settings_template;
-	vector_settings_t output_vector_settings = settings_template;
-	input_vector_settings.directory_name =
-	       	copy_string(builder->settings.input_vector_path);
-	output_vector_settings.directory_name =
-	       	copy_string(builder->settings.output_vector_path);
-	vector_t input_vector = new_zero_vector(input_vector_settings);
-	matrix_t matrix = new_zero_matrix(vector_dimension(input_vector),
-					  vector_dimension(input_vector));
-	for (size_t i = 0; i < vector_dimension(input_vector); i++)
+	// Only the block files of the products are read by Minerva, the unit
+	// vectors are handed to it from memory
+	vector_settings.storage = MEMORY_STORAGE;
+	const size_t dimension = get_num_rows(builder->matrix);
+	const size_t num_blocks = vector_settings.num_blocks;
+	const size_t *block_sizes = vector_settings.block_sizes;
+	size_t *block_starts = (size_t*)malloc(num_blocks*sizeof(size_t));
+	for (size_t i = 0, start = 0; i<num_blocks; i++)
+	{
+		block_starts[i] = start;
+		start += block_sizes[i];
+	}
+	char *couplings = new_block_couplings(builder->evaluation_order,
+					      num_blocks);
+	size_t *batch_ids = (size_t*)malloc(num_blocks*sizeof(size_t));
+	const size_t num_batches = group_basis_blocks(batch_ids,
+						      block_sizes,
+						      couplings,
+						      num_blocks);
+	// The k:th unit vectors of all blocks of a batch make up one unit
+	// vector group
+	size_t *group_batches = (size_t*)malloc(dimension*sizeof(size_t));
+	size_t *group_offsets = (size_t*)malloc(dimension*sizeof(size_t));
+	size_t num_groups = 0;
+	for (size_t batch = 0; batch<num_batches; batch++)
 	{
-		vector_t output_vector =
-		       	new_zero_vector(output_vector_settings);
-		set_element(input_vector,i,1.0);
-		save_vector(input_vector);
-		run_matrix_vector_multiplication(output_vector_settings.directory_name,
-						 input_vector_settings.directory_name,
-						 builder->scheduler);
-		set_element(input_vector,i,0.0);	
-		for (size_t j = 0; j < vector_dimension(output_vector); j++)
+		size_t max_block_size = 0;
+		for (size_t i = 0; i<num_blocks; i++)
+			if (batch_ids[i] == batch &&
+			    block_sizes[i] > max_block_size)
+				max_block_size = block_sizes[i];
+		for (size_t k = 0; k<max_block_size; k++)
 		{
-			log_entry("element[%lu] = %lg",
-				  j,
-				  get_element(output_vector,j));
-			set_matrix_element(matrix,
-					   j,
-					   i,
-					   get_element(output_vector,j));
+			group_batches[num_groups] = batch;
+			group_offsets[num_groups] = k;
+			num_groups++;
 		}
-		free_vector(output_vector);
 	}
-	free_vector(input_vector);
-	free(settings_template.block_sizes);
-	free(input_vector_settings.directory_name);
-	free(output_vector_settings.directory_name);
+	size_t num_vectors =
+		get_num_vectors_per_sweep(dimension,
+					  builder->maximum_loaded_memory);
+	num_vectors = num_vectors > num_groups ? num_groups : num_vectors;
+	vector_settings.directory_name =
+		(char*)calloc(strlen(builder->vector_directory)+64,
+			      sizeof(char));
+	vector_t *unit_vectors =
+		(vector_t*)malloc(num_vectors*sizeof(vector_t));
+	vector_t *products = (vector_t*)malloc(num_vectors*sizeof(vector_t));
+	for (size_t i = 0; i<num_vectors; i++)
+	{
+		sprintf(vector_settings.directory_name,
+			"%s/unit_vector_%lu",builder->vector_directory,i);
+		unit_vectors[i] = new_zero_vector(vector_settings);
+		sprintf(vector_settings.directory_name,
+			"%s/product_%lu",builder->vector_directory,i);
+		products[i] = new_zero_vector(vector_settings);
+	}
+	double *elements = (double*)calloc(dimension*dimension,sizeof(double));
+	double *product = (double*)malloc(dimension*sizeof(double));
+	size_t num_sweeps = 0;
+	for (size_t first = 0; first<num_groups; first += num_vectors)
+	{
+		const size_t num_sweep_vectors =
+			first+num_vectors <= num_groups ?
+			num_vectors : num_groups-first;
+		for (size_t n = 0; n<num_sweep_vectors; n++)
+		{
+			const size_t batch = group_batches[first+n];
+			const size_t k = group_offsets[first+n];
+			for (size_t i = 0; i<num_blocks; i++)
+				if (batch_ids[i] == batch && k < block_sizes[i])
+					set_element(unit_vectors[n],
+						    block_starts[i] + k,
+						    1.0);
+			scale(products[n],0.0);
+		}
+		matrix_block_multiplication(products,
+					    builder->matrix,
+					    unit_vectors,
+					    num_sweep_vectors);
+		num_sweeps++;
+		// Each column is taken from the output blocks its block is
+		// coupled to, which no other block of the batch reaches
+		for (size_t n = 0; n<num_sweep_vectors; n++)
+		{
+			const size_t batch = group_batches[first+n];
+			const size_t k = group_offsets[first+n];
+			copy_vector_elements(product,products[n]);
+			for (size_t i = 0; i<num_blocks; i++)
+			{
+				if (batch_ids[i] != batch || k >= block_sizes[i])
+					continue;
+				const size_t column = block_starts[i] + k;
+				set_element(unit_vectors[n],column,0.0);
+				for (size_t j = 0; j<num_blocks; j++)
+				{
+					if (!couplings[i*num_blocks + j])
+						continue;
+					for (size_t row = block_starts[j];
+					     row < block_starts[j] + block_sizes[j];
+					     row++)
+						elements[row*dimension + column] =
+							product[row];
+				}
+			}
+		}
+	}
+	matrix_t matrix = new_zero_matrix(dimension,dimension);
+	set_matrix_elements(matrix,elements);
+	printf("Built the %lu x %lu matrix from %lu unit vector groups of %lu"
+	       " block batches in %lu sweeps\n",
+	       dimension,dimension,
+	       num_groups,
+	       num_batches,
+	       num_sweeps);
+	free(product);
+	free(elements);
+	for (size_t i = 0; i<num_vectors; i++)
+	{
+		free_vector(products[i]);
+		free_vector(unit_vectors[i]);
+	}
+	free(products);
+	free(unit_vectors);
+	free(group_offsets);
+	free(group_batches);
+	free(batch_ids);
+	free(couplings);
+	free(block_starts);
+	free(vector_settings.block_sizes);
+	free(vector_settings.directory_name);
 	return matrix;
 }
 
 void free_matrix_builder(matrix_builder_t builder)
 {
-	free_combination_table(builder->combination_table);
-	free_evaluation_order(builder->evaluation_order);
-	free_scheduler(builder->scheduler);
+	if (builder->owns_matrix)
+	{
+		free_matrix(builder->matrix);
+		free_evaluation_order(builder->evaluation_order);
+		free_combination_table(builder->combination_table);
+	}
+	free(builder->vector_directory);
 	free(builder);
 }
 
+/* Sets couplings[i*num_blocks + j] when the matrix may have elements between
+ * the blocks with ids i+1 and j+1. An instruction between two different
+ * blocks works in both directions, and every block is coupled to itself.
+ */
+static
+char *new_block_couplings(evaluation_order_t evaluation_order,
+			  size_t num_blocks)
+{
+	char *couplings = (char*)calloc(num_blocks*num_blocks,sizeof(char));
+	for (size_t i = 0; i<num_blocks; i++)
+		couplings[i*num_blocks + i] = 1;
+	evaluation_order_iterator_t iterator =
+		get_evaluation_order_iterator(evaluation_order);
+	while (has_next_instruction(iterator))
+	{
+		evaluation_instruction_t instruction =
+			next_instruction(iterator);
+		if (instruction.type == unload ||
+		    instruction.type == unknown)
+			continue;
+		const size_t in = instruction.vector_block_in - 1;
+		const size_t out = instruction.vector_block_out - 1;
+		if (in >= num_blocks || out >= num_blocks)
+			error("Instruction %lu refers to block %lu or %lu of "
+			      "only %lu blocks\n",
+			      instruction.instruction_index,
+			      in+1,out+1,num_blocks);
+		couplings[in*num_blocks + out] = 1;
+		couplings[out*num_blocks + in] = 1;
+	}
+	free_evaluation_order_iterator(iterator);
+	return couplings;
+}
+
+/* Greedily puts the blocks, largest first, in the first batch where none of
+ * the blocks they are coupled to is reached by another block of the batch.
+ * Sets batch_ids[i] to the batch of block i and returns the number of
+ * batches.
+ */
+static
+size_t group_basis_blocks(size_t *batch_ids,
+			  const size_t *block_sizes,
+			  const char *couplings,
+			  size_t num_blocks)
+{
+	// reached[batch*num_blocks + j] is set when block j is coupled to a
+	// block of the batch, at most num_blocks batches are needed
+	char *reached = (char*)calloc(num_blocks*num_blocks,sizeof(char));
+	char *grouped = (char*)calloc(num_blocks,sizeof(char));
+	size_t num_batches = 0;
+	for (size_t n = 0; n<num_blocks; n++)
+	{
+		size_t block = num_blocks;
+		for (size_t i = 0; i<num_blocks; i++)
+			if (!grouped[i] &&
+			    (block == num_blocks ||
+			     block_sizes[i] > block_sizes[block]))
+				block = i;
+		const char *block_couplings = couplings + block*num_blocks;
+		size_t batch = 0;
+		for (; batch<num_batches; batch++)
+		{
+			const char *batch_reached = reached + batch*num_blocks;
+			size_t j = 0;
+			while (j<num_blocks &&
+			       !(block_couplings[j] && batch_reached[j]))
+				j++;
+			if (j == num_blocks)
+				break;
+		}
+		if (batch == num_batches)
+			num_batches++;
+		char *batch_reached = reached + batch*num_blocks;
+		for (size_t j = 0; j<num_blocks; j++)
+			batch_reached[j] |= block_couplings[j];
+		batch_ids[block] = batch;
+		grouped[block] = 1;
+	}
+	free(grouped);
+	free(reached);
+	return num_batches;
+}
+
 #define BACCHUS_RUN "bacchus_run_data/he4/"
+new_test(batched_blocks_reach_disjoint_output_blocks,
+	 // A chain of blocks, each coupled to its neighbours
+	 const size_t num_blocks = 6;
+	 const size_t block_sizes[6] = {3,3,3,3,3,3};
+	 char couplings[36] = {0};
+	 for (size_t i = 0; i<num_blocks; i++)
+	 	for (size_t j = 0; j<num_blocks; j++)
+	 		couplings[i*num_blocks + j] = i <= j+1 && j <= i+1;
+	 size_t batch_ids[6];
+	 const size_t num_batches = group_basis_blocks(batch_ids,
+						       block_sizes,
+						       couplings,
+						       num_blocks);
+	 assert_that(num_batches == 3);
+	 for (size_t i = 0; i<num_blocks; i++)
+	 	for (size_t j = i+1; j<num_blocks; j++)
+	 	{
+	 		if (batch_ids[i] != batch_ids[j])
+	 			continue;
+	 		for (size_t k = 0; k<num_blocks; k++)
+	 			assert_that(!(couplings[i*num_blocks + k] &&
+	 				      couplings[j*num_blocks + k]));
+	 	}
+	);
+
 new_test(explicit_matrix_nmax0,
 	 const char *matrix_out_path =
 	 get_test_file_path("hamiltonian.npy");
-	 const char *input_vector_path =
-	 	get_test_file_path("input");
-	 const char *output_vector_path =
-	 	get_test_file_path("output");
+	 const char *vector_directory =
+	 	get_test_file_path("vectors");
 	 matrix_builder_settings_t settings =
 	 {
 		.combination_file_path = 
@@ -111,10 +374,9 @@ new_test(explicit_matrix_nmax0,
 		TEST_DATA BACCHUS_RUN "nmax0/index_lists",
 		.interaction_path = 
 		TEST_DATA BACCHUS_RUN "nmax0/interaction",
-		.input_vector_path =
-			copy_string(input_vector_path),
-		.output_vector_path =
-			copy_string(output_vector_path)
+		.vector_directory =
+			copy_string(vector_directory),
+		.maximum_loaded_memory = (size_t)(16)<<30
 	 };
 	 matrix_builder_t matrix_builder = new_matrix_builder(settings);
 	 matrix_t matrix = generate_matrix(matrix_builder);
@@ -129,17 +391,14 @@ new_test(explicit_matrix_nmax0,
 		       get_eigenvalue(eigensystem,i));
 	 free_eigensystem(eigensystem);
 	 free_matrix(matrix);
-	 free(settings.input_vector_path);
-	 free(settings.output_vector_path);
+	 free(settings.vector_directory);
 	 );
 
 new_test(explicit_matrix_nmax2,
 	 const char *matrix_out_path =
 	 	get_test_file_path("hamiltonian.npy");
-	 const char *input_vector_path =
-	 	get_test_file_path("input");
-	 const char *output_vector_path =
-	 	get_test_file_path("output");
+	 const char *vector_directory =
+	 	get_test_file_path("vectors");
 	 matrix_builder_settings_t settings =
 	 {
 		.combination_file_path = TEST_DATA BACCHUS_RUN "nmax2/comb.txt",
@@ -149,10 +408,9 @@ new_test(explicit_matrix_nmax2,
 		TEST_DATA BACCHUS_RUN "nmax2/index_lists",
 		.interaction_path = 
 		TEST_DATA BACCHUS_RUN "nmax2/interaction",
-		.input_vector_path =
-			copy_string(input_vector_path),
-		.output_vector_path =
-			copy_string(output_vector_path)
+		.vector_directory =
+			copy_string(vector_directory),
+		.maximum_loaded_memory = (size_t)(16)<<30
 	 };
 	 matrix_builder_t matrix_builder = new_matrix_builder(settings);
 	 matrix_t matrix = generate_matrix(matrix_builder);
@@ -167,17 +425,14 @@ new_test(explicit_matrix_nmax2,
 		       get_eigenvalue(eigensystem,i));
 	 free_eigensystem(eigensystem);
 	 free_matrix(matrix);
-	 free(settings.input_vector_path);
-	 free(settings.output_vector_path);
+	 free(settings.vector_directory);
 	 );
 
 new_test_silent(explicit_matrix_nmax4,
 	 const char *matrix_out_path =
 	 	get_test_file_path("hamiltonian.npy");
-	 const char *input_vector_path =
-	 	get_test_file_path("input");
-	 const char *output_vector_path =
-	 	get_test_file_path("output");
+	 const char *vector_directory =
+	 	get_test_file_path("vectors");
 	 matrix_builder_settings_t settings =
 	 {
 		.combination_file_path = TEST_DATA BACCHUS_RUN "nmax4/comb.txt",
@@ -187,10 +442,9 @@ new_test_silent(explicit_matrix_nmax4,
 		TEST_DATA BACCHUS_RUN "nmax4/index_lists",
 		.interaction_path = 
 		TEST_DATA BACCHUS_RUN "nmax4/interaction",
-		.input_vector_path =
-			copy_string(input_vector_path),
-		.output_vector_path =
-			copy_string(output_vector_path)
+		.vector_directory =
+			copy_string(vector_directory),
+		.maximum_loaded_memory = (size_t)(16)<<30
 	 };
 	 matrix_builder_t matrix_builder = new_matrix_builder(settings);
 	 matrix_t matrix = generate_matrix(matrix_builder);
@@ -205,10 +459,59 @@ new_test_silent(explicit_matrix_nmax4,
 		       get_eigenvalue(eigensystem,i));
 	 free_eigensystem(eigensystem);
 	 free_matrix(matrix);
-	 free(settings.input_vector_path);
-	 free(settings.output_vector_path);
+	 free(settings.vector_directory);
 	 );
 
+new_test(built_matrix_gives_the_products_of_the_generative_matrix,
+	 combination_table_t combination_table =
+	 new_combination_table(TEST_DATA BACCHUS_RUN "nmax2/comb.txt",2,2);
+	 evaluation_order_t evaluation_order =
+	 read_evaluation_order(TEST_DATA BACCHUS_RUN "nmax2/greedy_3_16.txt",
+			       combination_table);
+	 // Room for only a few unit vector groups per sweep
+	 const size_t maximum_loaded_memory = (size_t)(64)<<20;
+	 matrix_t matrix =
+	 new_generative_matrix(evaluation_order,
+			       combination_table,
+			       TEST_DATA BACCHUS_RUN "nmax2/index_lists",
+			       TEST_DATA BACCHUS_RUN "nmax2/interaction",
+			       maximum_loaded_memory);
+	 matrix_builder_t matrix_builder =
+	 new_generative_matrix_builder(matrix,
+				       evaluation_order,
+				       combination_table,
+				       get_test_file_path("vectors"),
+				       maximum_loaded_memory);
+	 matrix_t explicit_matrix = generate_matrix(matrix_builder);
+	 free_matrix_builder(matrix_builder);
+	 assert_that(get_num_rows(explicit_matrix) == get_num_rows(matrix));
+	 vector_settings_t settings = setup_vector_settings(combination_table);
+	 settings.storage = MEMORY_STORAGE;
+	 settings.directory_name = copy_string(get_test_file_path("input"));
+	 vector_t vector = new_random_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name = copy_string(get_test_file_path("output"));
+	 vector_t generative_product = new_zero_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name = copy_string(get_test_file_path("explicit"));
+	 vector_t explicit_product = new_zero_vector(settings);
+	 free(settings.directory_name);
+	 matrix_vector_multiplication(generative_product,matrix,vector);
+	 matrix_vector_multiplication(explicit_product,explicit_matrix,vector);
+	 for (size_t i = 0; i<vector_dimension(vector); i++)
+		 assert_that(fabs(get_element(explicit_product,i) -
+				  get_element(generative_product,i)) <
+			     1e-12*(1+fabs(get_element(generative_product,i))));
+	 free_vector(explicit_product);
+	 free_vector(generative_product);
+	 free_vector(vector);
+	 free(settings.block_sizes);
+	 free_matrix(explicit_matrix);
+	 free_matrix(matrix);
+	 free_evaluation_order(evaluation_order);
+	 free_combination_table(combination_table);
+	);
+
 new_test(single_matrix_vector_multiplication,
 	 const char *input_vector_path =
 	 	get_test_file_path("input");
@@ -2,6 +2,8 @@
 #define __MATRIX_BUILDER__
 
 #include <matrix/matrix.h>
+#include <evaluation_order/evaluation_order.h>
+#include <combination_table/combination_table.h>
 
 struct _matrix_builder_;
 typedef struct _matrix_builder_ *matrix_builder_t;
@@ -12,14 +14,36 @@ typedef struct
 	char *minerva_instruction_path;
 	char *index_list_path;
 	char *interaction_path;
-	char *input_vector_path;
-	char *output_vector_path;
+	// The products with the unit vectors are written to subdirectories
+	// of this directory, which is created if it does not exist
+	char *vector_directory;
 	size_t num_protons;
 	size_t num_neutrons;
+	// The memory Minerva may use for index lists, matrix blocks and the
+	// vectors of a sweep
+	size_t maximum_loaded_memory;
 } matrix_builder_settings_t;
 
 matrix_builder_t new_matrix_builder(matrix_builder_settings_t settings);
 
+/* Builds the explicit matrix of a generative matrix of the evaluation order
+ * and combination table, which the builder only refers to. Its block
+ * generator, if any, is used as well.
+ */
+matrix_builder_t new_generative_matrix_builder
+(matrix_t matrix,
+ evaluation_order_t evaluation_order,
+ combination_table_t combination_table,
+ const char *vector_directory,
+ size_t maximum_loaded_memory);
+
+/* Builds the matrix column by column from products with unit vectors. The
+ * unit vectors of basis blocks that reach no common output block are added
+ * into one vector, so there are about the largest block dimension times the
+ * number of batches of blocks of these vectors, not the dimension of the
+ * matrix. As many of them as fit in the loaded memory are multiplied in
+ * each sweep of Minerva with matrix_block_multiplication.
+ */
 matrix_t generate_matrix(matrix_builder_t builder);
 
 void free_matrix_builder(matrix_builder_t builder);
@@ -7,8 +7,17 @@
 #include <combination_table/combination_table.h>
 #include <evaluation_order/evaluation_order.h>
 #include <lanczos/lanczos.h>
+#include <block_lanczos/block_lanczos.h>
+#include <s_step_lanczos/s_step_lanczos.h>
+#include <davidson/davidson.h>
+#include <chebyshev_filter/chebyshev_filter.h>
 #include <eigensystem/eigensystem.h>
+#include <diagonalization/diagonalization.h>
+#include <matrix_builder/matrix_builder.h>
+#include <matrix_free_2nf/matrix_free_2nf.h>
 #include <string_tools/string_tools.h>
+#include <error/error.h>
+#include <directory_tools/directory_tools.h>
 #include <string.h>
 #include <time.h>
 
@@ -20,6 +29,117 @@ void setting_up_log()
 			 "bacchus.log");
 }
 
+/* Maps the eigenvectors of a previous calculation to the current model
+ * space, into the krylow vector directory, so that Lanczos can start from
+ * them.
+ */
+static
+vector_t *load_initial_vectors(const settings_t settings,
+			       combination_table_t combination_table,
+			       lanczos_settings_t lanczos_settings)
+{
+	const size_t num_initial_vectors =
+		get_num_initial_vectors_setting(settings);
+	combination_table_t source_combination_table =
+		new_combination_table
+		(get_initial_combination_table_path_setting(settings),
+		 get_num_protons_setting(settings),
+		 get_num_neutrons_setting(settings));
+	vector_settings_t source_settings =
+		setup_vector_settings(source_combination_table);
+	source_settings.storage = BLOCK_FILE_STORAGE;
+	vector_settings_t initial_settings = lanczos_settings.vector_settings;
+	initial_settings.directory_name =
+		(char*)calloc(strlen(lanczos_settings
+				     .krylow_vectors_directory_name)+256,
+			      sizeof(char));
+	vector_t *initial_vectors =
+		(vector_t*)malloc(num_initial_vectors*sizeof(vector_t));
+	for (size_t i = 0; i<num_initial_vectors; i++)
+	{
+		source_settings.directory_name =
+			(char*)get_initial_vector_directory_setting(settings,i);
+		if (!directory_exists(source_settings.directory_name))
+			error("Could not find the initial vector \"%s\"\n",
+			      source_settings.directory_name);
+		vector_t source = new_existing_vector(source_settings);
+		sprintf(initial_settings.directory_name,
+			"%s/initial_vector_%lu",
+			lanczos_settings.krylow_vectors_directory_name,
+			i+1);
+		initial_vectors[i] = new_zero_vector(initial_settings);
+		map_vector(initial_vectors[i],combination_table,
+			   source,source_combination_table);
+		free_vector(source);
+	}
+	free(initial_settings.directory_name);
+	free(source_settings.block_sizes);
+	free_combination_table(source_combination_table);
+	return initial_vectors;
+}
+
+/* Builds the explicit matrix and finds its lowest eigenpairs with dsyevr,
+ * which for small dimensions is faster than any of the iterative
+ * eigensolvers. The products with the unit vectors are written to the
+ * krylow vector directory.
+ */
+static
+eigensystem_t solve_directly(vector_t *eigenvectors,
+			     size_t num_eigenvectors,
+			     lanczos_settings_t lanczos_settings,
+			     evaluation_order_t evaluation_order,
+			     combination_table_t combination_table,
+			     size_t maximum_loaded_memory)
+{
+	if (lanczos_settings.dimension > max_direct_solve_dimension)
+		printf("Warning: the direct eigensolver is usually slower than"
+		       " the iterative ones above dimension %lu\n",
+		       max_direct_solve_dimension);
+	printf("Solving the dimension %lu problem directly\n",
+	       lanczos_settings.dimension);
+	matrix_builder_t matrix_builder =
+		new_generative_matrix_builder
+		(lanczos_settings.matrix,
+		 evaluation_order,
+		 combination_table,
+		 lanczos_settings.krylow_vectors_directory_name,
+		 maximum_loaded_memory);
+	matrix_t matrix = generate_matrix(matrix_builder);
+	free_matrix_builder(matrix_builder);
+	double *eigenvalues =
+		(double*)malloc(num_eigenvectors*sizeof(double));
+	lowest_symmetric_eigenpairs(eigenvalues,
+				    eigenvectors,
+				    matrix,
+				    num_eigenvectors);
+	eigensystem_t eigensystem = new_empty_eigensystem(num_eigenvectors);
+	set_eigenvalues(eigensystem,eigenvalues);
+	free(eigenvalues);
+	free_matrix(matrix);
+	return eigensystem;
+}
+
+static
+const char *eigensolver_name(eigensolver_t eigensolver)
+{
+	switch (eigensolver)
+	{
+		case lanczos_eigensolver:
+			return "Lanczos";
+		case block_lanczos_eigensolver:
+			return "block Lanczos";
+		case s_step_lanczos_eigensolver:
+			return "s-step Lanczos";
+		case davidson_eigensolver:
+			return "Davidson";
+		case chebyshev_filtered_eigensolver:
+			return "Chebyshev filtered subspace iteration";
+		case direct_eigensolver:
+			return "direct";
+	}
+	return "unknown";
+}
+
 int main(int num_arguments, char **argument_list)
 {
 	struct timespec t_start,t_end;
@@ -52,7 +172,23 @@ int main(int num_arguments, char **argument_list)
 		.eigenvalue_tolerance = get_tolerance_setting(settings),
 		.convergence_critera = 
 			get_convergece_criteria_setting(settings),
-		.target_eigenvalue = 0,
+		.reorthogonalization =
+			get_reorthogonalization_setting(settings),
+		.max_basis_dimension =
+			get_max_basis_dimension_setting(settings),
+		.num_restart_vectors =
+			get_num_restart_vectors_setting(settings),
+		.diagnostics = get_diagnostics_setting(settings),
+		.diagnostics_interval =
+			get_diagnostics_interval_setting(settings),
+		.single_precision_basis =
+			get_single_precision_basis_setting(settings),
+		.asynchronous_basis_writes =
+			get_asynchronous_basis_writes_setting(settings),
+		.write_checkpoints = get_write_checkpoints_setting(settings),
+		.resume = get_resume_setting(settings),
+		// All the desired eigenvectors are converged
+		.target_eigenvalue = get_target_eigenvector_setting(settings),
 		.matrix = new_generative_matrix
 			(evaluation_order,
 			 combination_table,
@@ -60,34 +196,180 @@ int main(int num_arguments, char **argument_list)
 			 get_matrix_file_base_directory_setting(settings),
 			 get_maximum_loaded_memory_setting(settings))
 	};
-	lanczos_environment_t lanczos_environment =
-		new_lanczos_environment(lanczos_settings);
-	diagonalize(lanczos_environment);
-	eigensystem_t eigensystem = get_eigensystem(lanczos_environment);
-	print_eigensystem(eigensystem);
+	matrix_free_2nf_t matrix_free_2nf = NULL;
+	if (use_matrix_free_2nf_setting(settings))
+	{
+		matrix_free_2nf =
+			new_matrix_free_2nf
+			(combination_table,
+			 get_matrix_free_2nf_setting(settings));
+		set_generative_matrix_block_generator
+			(lanczos_settings.matrix,
+			 generate_matrix_free_2nf_block,
+			 matrix_free_2nf);
+	}
+	const eigensolver_t eigensolver = get_eigensolver_setting(settings);
+	printf("Eigensolver: %s\n",eigensolver_name(eigensolver));
+	const size_t block_size = get_block_size_setting(settings);
+	const size_t step_size = get_step_size_setting(settings);
+	const size_t filter_degree = get_filter_degree_setting(settings);
+	lanczos_settings.vector_settings.storage =
+		get_vector_storage_setting(settings);
+	if (lanczos_settings.vector_settings.storage == AUTOMATIC_STORAGE)
+	{
+		lanczos_settings.vector_settings.storage =
+			select_vector_storage
+			(lanczos_settings.dimension,
+			 eigensolver == block_lanczos_eigensolver ?
+			 lanczos_settings.max_num_iterations+2*block_size :
+			 (eigensolver == s_step_lanczos_eigensolver ?
+			  lanczos_settings.max_num_iterations+step_size+1 :
+			  (eigensolver == davidson_eigensolver ?
+			   davidson_num_vectors(lanczos_settings) :
+			   (eigensolver == chebyshev_filtered_eigensolver ?
+			    3*block_size :
+			    lanczos_settings.max_num_iterations+1))),
+			 get_maximum_loaded_memory_setting(settings));
+		// Not even the vectors of a vector operation fit in memory
+		if (lanczos_settings.vector_settings.storage ==
+		    SINGLE_FILE_STORAGE)
+			lanczos_settings.asynchronous_basis_writes = 0;
+	}
+	if (get_num_initial_vectors_setting(settings) > 0 &&
+	    !lanczos_settings.resume)
+	{
+		lanczos_settings.initial_vectors =
+			load_initial_vectors(settings,
+					     combination_table,
+					     lanczos_settings);
+		lanczos_settings.num_initial_vectors =
+			get_num_initial_vectors_setting(settings);
+		lanczos_settings.initial_coefficients =
+			get_initial_vector_coefficients_setting(settings);
+	}
+	lanczos_environment_t lanczos_environment = NULL;
+	block_lanczos_environment_t block_lanczos_environment = NULL;
+	s_step_lanczos_environment_t s_step_lanczos_environment = NULL;
+	davidson_environment_t davidson_environment = NULL;
+	chebyshev_filter_environment_t chebyshev_filter_environment = NULL;
 	const char *eigenvector_directory =
 	       	get_eigenvector_directory_setting(settings);
-	for (size_t i = 0; i<=get_target_eigenvector_setting(settings); i++)
+	const size_t num_eigenvectors =
+		get_target_eigenvector_setting(settings)+1;
+	vector_t *eigenvectors =
+		(vector_t*)malloc(num_eigenvectors*sizeof(vector_t));
+	vector_settings_t vector_setting = lanczos_settings.vector_settings;
+	// The eigenvectors are read from their block files later
+	vector_setting.storage = BLOCK_FILE_STORAGE;
+	vector_setting.directory_name =
+		(char*)calloc(strlen(eigenvector_directory)+256,
+			      sizeof(char));
+	for (size_t i = 0; i<num_eigenvectors; i++)
 	{
-		vector_settings_t vector_setting =
-		       	lanczos_settings.vector_settings;
-		vector_setting.directory_name =
-		       	(char*)calloc(strlen(eigenvector_directory)+256,
-				      sizeof(char));
 		sprintf(vector_setting.directory_name,
 			"%s/eigenvector_%lu",
 			eigenvector_directory,
 			i+1);
-		vector_t eigenvector = new_zero_vector(vector_setting);
-		get_eigenvector(eigenvector,
-				 eigensystem,i);
-		save_vector(eigenvector);
-		free_vector(eigenvector);
-		free(vector_setting.directory_name);
+		eigenvectors[i] = new_zero_vector(vector_setting);
+	}
+	free(vector_setting.directory_name);
+	eigensystem_t eigensystem = NULL;
+	switch (eigensolver)
+	{
+		case direct_eigensolver:
+			if (lanczos_settings.resume)
+				error("--resume is only supported by the"
+				      " Lanczos eigensolver\n");
+			eigensystem =
+				solve_directly(eigenvectors,
+					       num_eigenvectors,
+					       lanczos_settings,
+					       evaluation_order,
+					       combination_table,
+					       get_maximum_loaded_memory_setting
+					       (settings));
+			break;
+		case lanczos_eigensolver:
+			lanczos_environment =
+				new_lanczos_environment(lanczos_settings);
+			diagonalize(lanczos_environment);
+			eigensystem = get_eigensystem(lanczos_environment);
+			break;
+		case block_lanczos_eigensolver:
+			if (lanczos_settings.resume)
+				error("--resume is only supported by the"
+				      " Lanczos eigensolver\n");
+			block_lanczos_environment =
+				new_block_lanczos_environment(lanczos_settings,
+							      block_size);
+			block_diagonalize(block_lanczos_environment);
+			eigensystem =
+				get_block_eigensystem(block_lanczos_environment);
+			break;
+		case s_step_lanczos_eigensolver:
+			if (lanczos_settings.resume)
+				error("--resume is only supported by the"
+				      " Lanczos eigensolver\n");
+			s_step_lanczos_environment =
+				new_s_step_lanczos_environment
+				(lanczos_settings,step_size);
+			s_step_diagonalize(s_step_lanczos_environment);
+			eigensystem =
+				get_s_step_eigensystem
+				(s_step_lanczos_environment);
+			break;
+		case davidson_eigensolver:
+			if (lanczos_settings.resume)
+				error("--resume is only supported by the"
+				      " Lanczos eigensolver\n");
+			davidson_environment =
+				new_davidson_environment(lanczos_settings);
+			davidson_diagonalize(davidson_environment);
+			eigensystem =
+				get_davidson_eigensystem(davidson_environment);
+			break;
+		case chebyshev_filtered_eigensolver:
+			if (lanczos_settings.resume)
+				error("--resume is only supported by the"
+				      " Lanczos eigensolver\n");
+			chebyshev_filter_environment =
+				new_chebyshev_filter_environment
+				(lanczos_settings,block_size,filter_degree);
+			chebyshev_filter_diagonalize
+				(chebyshev_filter_environment);
+			eigensystem =
+				get_chebyshev_filter_eigensystem
+				(chebyshev_filter_environment);
+			break;
+	}
+	print_eigensystem(eigensystem);
+	// The direct solve has already set the eigenvectors
+	if (eigensolver != direct_eigensolver)
+		get_eigenvectors(eigenvectors,eigensystem,num_eigenvectors);
+	for (size_t i = 0; i<num_eigenvectors; i++)
+	{
+		save_vector(eigenvectors[i]);
+		free_vector(eigenvectors[i]);
 	}
+	free(eigenvectors);
 	free_eigensystem(eigensystem);
-	free_lanczos_environment(lanczos_environment);
+	if (lanczos_environment != NULL)
+		free_lanczos_environment(lanczos_environment);
+	if (block_lanczos_environment != NULL)
+		free_block_lanczos_environment(block_lanczos_environment);
+	if (s_step_lanczos_environment != NULL)
+		free_s_step_lanczos_environment(s_step_lanczos_environment);
+	if (davidson_environment != NULL)
+		free_davidson_environment(davidson_environment);
+	if (chebyshev_filter_environment != NULL)
+		free_chebyshev_filter_environment
+			(chebyshev_filter_environment);
+	for (size_t i = 0; i<lanczos_settings.num_initial_vectors; i++)
+		free_vector(lanczos_settings.initial_vectors[i]);
+	free(lanczos_settings.initial_vectors);
 	free_matrix(lanczos_settings.matrix);
+	if (matrix_free_2nf != NULL)
+		free_matrix_free_2nf(matrix_free_2nf);
 	free_evaluation_order(evaluation_order);
 	free_combination_table(combination_table);
 	free_settings(settings);
@@ -0,0 +1,557 @@
+#include <s_step_lanczos/s_step_lanczos.h>
+#include <basis/basis.h>
+#include <vector/vector.h>
+#include <diagonalization/diagonalization.h>
+#include <string_tools/string_tools.h>
+#include <directory_tools/directory_tools.h>
+#include <math_tools/math_tools.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <log/log.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+struct _s_step_lanczos_environment_
+{
+	lanczos_settings_t settings;
+	size_t step_size;
+	basis_t krylow_basis;
+	// The column major projection of the matrix on the Krylow basis, with
+	// room for the whole basis in every column. The column of the last
+	// Krylow vector is only known after the next step.
+	double *projected_matrix;
+	size_t max_basis_dimension;
+	// The Newton basis of a step is p_i+1 = (A - shift_i)p_i/scaling,
+	// starting from the last Krylow vector
+	double *shifts;
+	double scaling;
+	size_t previous_step_size;
+	size_t num_steps;
+	size_t num_multiplications;
+};
+
+static
+double *projected_element(s_step_lanczos_environment_t environment,
+			  size_t row,
+			  size_t column);
+
+static
+void initialize_first_vector(s_step_lanczos_environment_t environment);
+
+static
+void s_step(s_step_lanczos_environment_t environment);
+
+static
+void orthonormalize_newton_basis(s_step_lanczos_environment_t environment,
+				 size_t first,
+				 size_t step_size,
+				 double *coordinates);
+
+static
+void project_newton_basis(s_step_lanczos_environment_t environment,
+			  size_t first,
+			  size_t step_size,
+			  const double *coordinates);
+
+static
+void choose_shifts(s_step_lanczos_environment_t environment,
+		   const eigensystem_t projected_system);
+
+static
+double residual_norm(s_step_lanczos_environment_t environment,
+		     const double *amplitudes,
+		     size_t dimension);
+
+s_step_lanczos_environment_t
+new_s_step_lanczos_environment(lanczos_settings_t settings,
+			       size_t step_size)
+{
+	if (step_size == 0 || step_size >= settings.dimension)
+		error("The step size, %lu, has to be between 1 and the"
+		      " dimension, %lu\n",
+		      step_size,
+		      settings.dimension);
+	s_step_lanczos_environment_t environment =
+		(s_step_lanczos_environment_t)
+		malloc(sizeof(struct _s_step_lanczos_environment_));
+	environment->settings = settings;
+	environment->step_size = step_size;
+	environment->max_basis_dimension =
+		settings.max_num_iterations + step_size + 1;
+	if (!directory_exists(settings.krylow_vectors_directory_name) &&
+		create_directory(settings.krylow_vectors_directory_name) != 0)
+		error("Could not create krylow vector directory \"%s\". %s\n",
+		      settings.krylow_vectors_directory_name,
+		      strerror(errno));
+	environment->krylow_basis =
+		new_basis_empty(settings.vector_settings,
+				settings.krylow_vectors_directory_name,
+				environment->max_basis_dimension);
+	environment->projected_matrix =
+		(double*)calloc(environment->max_basis_dimension*
+				environment->max_basis_dimension,
+				sizeof(double));
+	// The first step is a monomial basis
+	environment->shifts = (double*)calloc(step_size,sizeof(double));
+	environment->scaling = 1.0;
+	environment->previous_step_size = 0;
+	environment->num_steps = 0;
+	environment->num_multiplications = 0;
+	return environment;
+}
+
+void s_step_diagonalize(s_step_lanczos_environment_t environment)
+{
+	struct timespec t_start,t_end;
+	printf("s-step Lanczos diagonalization start:\n");
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const size_t step_size = environment->step_size;
+	const size_t num_converged = environment->settings.target_eigenvalue+1;
+	initialize_first_vector(environment);
+	double *previous_eigenvalues =
+		(double*)malloc(num_converged*sizeof(double));
+	for (size_t i = 0; i<num_converged; i++)
+		previous_eigenvalues[i] = INFINITY;
+	double *previous_amplitudes =
+		(double*)calloc(num_converged*environment->max_basis_dimension,
+				sizeof(double));
+	size_t previous_dimension = 0;
+	while (environment->num_multiplications <
+	       environment->settings.max_num_iterations &&
+	       basis_get_dimension(environment->krylow_basis) + step_size <=
+	       environment->settings.dimension)
+	{
+		s_step(environment);
+		// The last Krylow vector is the direction of the residuals
+		const size_t dimension =
+			basis_get_dimension(environment->krylow_basis) - 1;
+		eigensystem_t projected_system =
+			diagonalize_leading_submatrix
+			(environment->projected_matrix,
+			 environment->max_basis_dimension,
+			 dimension);
+		double difference = num_converged > dimension ? INFINITY : 0.0;
+		for (size_t i = 0; i<num_converged && i<dimension; i++)
+		{
+			const double *amplitudes =
+				get_eigenvector_amplitudes(projected_system,i);
+			double eigenvalue_difference = 0.0;
+			switch (environment->settings.convergence_critera)
+			{
+				case converge_eigenvalues:
+					eigenvalue_difference =
+						fabs(get_eigenvalue
+						     (projected_system,i) -
+						     previous_eigenvalues[i]);
+					break;
+				case converge_eigenvectors:
+					eigenvalue_difference =
+						difference_eigenvectors
+						(amplitudes,
+						 dimension,
+						 previous_amplitudes +
+						 i*environment->
+						 max_basis_dimension,
+						 previous_dimension);
+					break;
+				case converge_residuals:
+					eigenvalue_difference =
+						residual_norm(environment,
+							      amplitudes,
+							      dimension);
+					break;
+				case no_convergence:
+					eigenvalue_difference =
+						environment->settings.
+						eigenvalue_tolerance*2;
+					break;
+			}
+			if (eigenvalue_difference > difference)
+				difference = eigenvalue_difference;
+			previous_eigenvalues[i] =
+				get_eigenvalue(projected_system,i);
+			memcpy(previous_amplitudes +
+			       i*environment->max_basis_dimension,
+			       amplitudes,
+			       dimension*sizeof(double));
+		}
+		previous_dimension = dimension;
+		choose_shifts(environment,projected_system);
+		double *ritz_values = get_eigenvalues(projected_system);
+		print_convergence_progress(ritz_values,
+					   num_converged < dimension ?
+					   num_converged : dimension,
+					   num_converged,
+					   environment->settings.
+					   convergence_critera,
+					   difference,
+					   environment->settings.
+					   eigenvalue_tolerance);
+		free(ritz_values);
+		free_eigensystem(projected_system);
+		if (difference < environment->settings.eigenvalue_tolerance)
+			break;
+	}
+	basis_remove_last(environment->krylow_basis);
+	free(previous_eigenvalues);
+	free(previous_amplitudes);
+	printf("s-step Lanczos steps: %lu, matrix vector multiplications:"
+	       " %lu\n",
+	       environment->num_steps,
+	       environment->num_multiplications);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double diagonalization_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("s-step Lanczos diagonalization end after %lg µs\n",
+	       diagonalization_time);
+}
+
+eigensystem_t
+get_s_step_eigensystem(s_step_lanczos_environment_t environment)
+{
+	eigensystem_t diagonalized_system =
+		diagonalize_leading_submatrix
+		(environment->projected_matrix,
+		 environment->max_basis_dimension,
+		 basis_get_dimension(environment->krylow_basis));
+	set_basis(diagonalized_system,
+		  environment->krylow_basis);
+	return diagonalized_system;
+}
+
+void free_s_step_lanczos_environment(s_step_lanczos_environment_t environment)
+{
+	free_basis(environment->krylow_basis);
+	free(environment->projected_matrix);
+	free(environment->shifts);
+	free(environment);
+}
+
+static
+double *projected_element(s_step_lanczos_environment_t environment,
+			  size_t row,
+			  size_t column)
+{
+	return environment->projected_matrix +
+		column*environment->max_basis_dimension + row;
+}
+
+/* Starts from the combination of the initial vectors, or else from the
+ * first basis state, like Lanczos.
+ */
+static
+void initialize_first_vector(s_step_lanczos_environment_t environment)
+{
+	const lanczos_settings_t settings = environment->settings;
+	basis_append_vector(environment->krylow_basis);
+	vector_t first_vector = basis_get_vector(environment->krylow_basis,0);
+	if (settings.num_initial_vectors == 0)
+	{
+		set_element(first_vector,0,1.0);
+		save_vector(first_vector);
+		return;
+	}
+	combine_vectors(&first_vector,1,
+			settings.initial_vectors,
+			settings.num_initial_vectors,
+			settings.initial_coefficients);
+	double first_norm = norm(first_vector);
+	if (first_norm == 0)
+		error("The combination of the initial vectors is zero\n");
+	scale(first_vector,1.0/first_norm);
+}
+
+/* Appends step_size Krylow vectors. The Newton basis is built from the
+ * last Krylow vector with step_size matrix vector multiplications in a
+ * row, then it is orthonormalized and projected. Until there are enough
+ * Ritz values for the shifts, the steps are shorter.
+ */
+static
+void s_step(s_step_lanczos_environment_t environment)
+{
+	struct timespec t_start,t_end;
+	printf("s-step Lanczos step %lu start:\n",environment->num_steps+1);
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	const size_t first = basis_get_dimension(environment->krylow_basis);
+	const size_t step_size = environment->step_size < first ?
+		environment->step_size : first;
+	for (size_t i = 0; i<step_size; i++)
+		basis_append_vector(environment->krylow_basis);
+	vector_t *vectors = basis_get_all_vectors(environment->krylow_basis);
+	for (size_t i = 0; i<step_size; i++)
+	{
+		vector_t previous = vectors[first+i-1];
+		matrix_vector_multiplication(vectors[first+i],
+					     environment->settings.matrix,
+					     previous);
+		if (environment->shifts[i] != 0)
+			vector_add_scaled(vectors[first+i],
+					  -environment->shifts[i],
+					  previous);
+		if (environment->scaling != 1)
+			scale(vectors[first+i],1.0/environment->scaling);
+	}
+	environment->num_multiplications += step_size;
+	// Column i holds the coordinates of p_i+1 in the new Krylow basis
+	double *coordinates =
+		(double*)calloc((first+step_size)*step_size,sizeof(double));
+	orthonormalize_newton_basis(environment,first,step_size,coordinates);
+	project_newton_basis(environment,first,step_size,coordinates);
+	free(coordinates);
+	environment->previous_step_size = step_size;
+	environment->num_steps++;
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double step_time =
+		(t_end.tv_sec-t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec-t_start.tv_nsec)*1e-3;
+	printf("s-step Lanczos step %lu end after %lg µs\n",
+	       environment->num_steps, step_time);
+}
+
+/* Orthonormalizes the Newton basis starting at first against the Krylow
+ * basis and itself, twice. Every round is one fused pass for the scalar
+ * products with the basis and within the Newton basis, a subtraction and
+ * a Cholesky QR. The coordinates of the original Newton basis in the new
+ * Krylow basis are accumulated.
+ */
+static
+void orthonormalize_newton_basis(s_step_lanczos_environment_t environment,
+				 size_t first,
+				 size_t step_size,
+				 double *coordinates)
+{
+	const size_t dimension = first + step_size;
+	vector_t *vectors = basis_get_all_vectors(environment->krylow_basis);
+	vector_t *newton_basis = vectors + first;
+	// The coordinates start as the identity in the Newton basis
+	for (size_t i = 0; i<step_size; i++)
+		coordinates[i*dimension+first+i] = 1.0;
+	double *gram = (double*)malloc(dimension*step_size*sizeof(double));
+	double *projections =
+		(double*)malloc(first*step_size*sizeof(double));
+	double *triangular =
+		(double*)malloc(step_size*step_size*sizeof(double));
+	double *new_coordinates =
+		(double*)malloc(dimension*step_size*sizeof(double));
+	for (size_t round = 0; round<2; round++)
+	{
+		compute_gram_matrix(gram,vectors,dimension,
+				    newton_basis,step_size);
+		for (size_t j = 0; j<step_size; j++)
+			memcpy(projections + j*first,
+			       gram + j*dimension,
+			       first*sizeof(double));
+		subtract_combinations(newton_basis,step_size,
+				      vectors,first,
+				      projections);
+		// The Gram matrix of the orthogonalized Newton basis
+		for (size_t j = 0; j<step_size; j++)
+			for (size_t i = 0; i<step_size; i++)
+			{
+				double overlap = gram[j*dimension+first+i];
+				for (size_t k = 0; k<first; k++)
+					overlap -= projections[i*first+k]*
+						projections[j*first+k];
+				triangular[j*step_size+i] = overlap;
+			}
+		if (!cholesky_factorize(triangular,step_size))
+			error("The Newton basis of s-step Lanczos step %lu is"
+			      " numerically rank deficient, try a smaller step"
+			      " size\n",
+			      environment->num_steps+1);
+		/* The Newton basis is W*projections + Q*triangular, so the
+		 * coordinates C;R become C + projections*R;triangular*R.
+		 */
+		memset(new_coordinates,0,dimension*step_size*sizeof(double));
+		for (size_t j = 0; j<step_size; j++)
+		{
+			double *column = new_coordinates + j*dimension;
+			const double *old_column = coordinates + j*dimension;
+			memcpy(column,old_column,first*sizeof(double));
+			for (size_t l = 0; l<=j; l++)
+			{
+				const double r = old_column[first+l];
+				for (size_t k = 0; k<first; k++)
+					column[k] += projections[l*first+k]*r;
+				for (size_t i = 0; i<=l; i++)
+					column[first+i] +=
+						triangular[l*step_size+i]*r;
+			}
+		}
+		memcpy(coordinates,new_coordinates,
+		       dimension*step_size*sizeof(double));
+		invert_upper_triangular_matrix(triangular,step_size);
+		combine_vectors(newton_basis,step_size,
+				newton_basis,step_size,
+				triangular);
+	}
+	free(new_coordinates);
+	free(triangular);
+	free(projections);
+	free(gram);
+}
+
+/* With the coordinates z_i of the Newton basis, A p_i = scaling*z_i+1 +
+ * shift_i*z_i gives the column of the previously last Krylow vector, p_0,
+ * and then those of the new Krylow vectors except the last one, by
+ * subtracting the known columns and dividing by the diagonal of the
+ * triangular coordinates. The projected matrix is kept symmetric.
+ */
+static
+void project_newton_basis(s_step_lanczos_environment_t environment,
+			  size_t first,
+			  size_t step_size,
+			  const double *coordinates)
+{
+	const size_t dimension = first + step_size;
+	const size_t last = first - 1;
+	// The row of the previously last Krylow vector is known from the
+	// columns of the previous step
+	const size_t previous_first = first - environment->previous_step_size;
+	const double scaling = environment->scaling;
+	const double *shifts = environment->shifts;
+	double *column = (double*)malloc(dimension*sizeof(double));
+	for (size_t i = 0; i<step_size; i++)
+	{
+		const size_t index = last + i;
+		const size_t first_known_row = i == 0 ? previous_first-1 : last;
+		const double *next = coordinates + i*dimension;
+		for (size_t r = 0; r<dimension; r++)
+			column[r] = scaling*next[r];
+		if (i == 0)
+			column[last] += shifts[0];
+		else
+		{
+			const double *current = coordinates + (i-1)*dimension;
+			for (size_t r = 0; r<dimension; r++)
+				column[r] += shifts[i]*current[r];
+			// The known columns of the Krylow basis, the last
+			// one included
+			for (size_t k = 0; k<first; k++)
+				if (current[k] != 0)
+					for (size_t r = 0; r<dimension; r++)
+						column[r] -= current[k]*
+							*projected_element
+							(environment,r,k);
+			for (size_t l = 0; l+1<i; l++)
+				for (size_t r = 0; r<dimension; r++)
+					column[r] -= current[first+l]*
+						*projected_element
+						(environment,r,first+l);
+			for (size_t r = 0; r<dimension; r++)
+				column[r] /= current[first+i-1];
+		}
+		for (size_t r = 0; r<dimension; r++)
+		{
+			double element = column[r];
+			if (r >= first_known_row && r < index)
+				element = (element +
+					   *projected_element(environment,
+							      index,r))/2;
+			*projected_element(environment,r,index) =
+				*projected_element(environment,index,r) =
+				element;
+		}
+	}
+	free(column);
+}
+
+/* The shifts of the next Newton basis are Ritz values in Leja order, each
+ * as far as possible from the previous ones, and the scaling is half the
+ * width of the Ritz spectrum. This keeps the Newton basis far better
+ * conditioned than the monomial one.
+ */
+static
+void choose_shifts(s_step_lanczos_environment_t environment,
+		   const eigensystem_t projected_system)
+{
+	const size_t num_ritz_values = get_num_eigenvalues(projected_system);
+	double *ritz_values = get_eigenvalues(projected_system);
+	double *distances = (double*)malloc(num_ritz_values*sizeof(double));
+	for (size_t k = 0; k<num_ritz_values; k++)
+		distances[k] = fabs(ritz_values[k]);
+	for (size_t i = 0; i<environment->step_size; i++)
+	{
+		size_t farthest = 0;
+		for (size_t k = 1; k<num_ritz_values; k++)
+			if (distances[k] > distances[farthest])
+				farthest = k;
+		// With fewer Ritz values than shifts, they are reused
+		if (distances[farthest] == 0)
+			for (size_t k = 0; k<num_ritz_values; k++)
+				distances[k] = 1.0;
+		environment->shifts[i] = ritz_values[farthest];
+		for (size_t k = 0; k<num_ritz_values; k++)
+			distances[k] *= fabs(ritz_values[k] -
+					     ritz_values[farthest]);
+	}
+	double width = (ritz_values[num_ritz_values-1] - ritz_values[0])/2;
+	environment->scaling = width > 0 ? width : 1.0;
+	free(distances);
+	free(ritz_values);
+}
+
+/* The residual of a Ritz vector is the last Krylow vector times the
+ * coupling of the Ritz vector to it.
+ */
+static
+double residual_norm(s_step_lanczos_environment_t environment,
+		     const double *amplitudes,
+		     size_t dimension)
+{
+	double coupling = 0.0;
+	for (size_t j = 0; j<dimension; j++)
+		coupling += *projected_element(environment,dimension,j)*
+			amplitudes[j];
+	return fabs(coupling);
+}
+
+new_test(s_step_lanczos_finds_lowest_eigenvalues,
+	 size_t dimension = 200;
+	 matrix_t matrix = new_well_separated_matrix(dimension);
+	 lanczos_settings_t settings =
+	 {
+		 .dimension = dimension,
+		 .vector_settings =
+		 {
+			 .directory_name = NULL,
+			 .num_blocks = 1,
+			 .block_sizes = &dimension
+		 },
+		 .krylow_vectors_directory_name =
+			 copy_string(get_test_file_path("krylow_vectors")),
+		 .max_num_iterations = 150,
+		 .target_eigenvalue = 2,
+		 .eigenvalue_tolerance = 1e-8,
+		 .convergence_critera = converge_residuals,
+		 .matrix = matrix
+	 };
+	 s_step_lanczos_environment_t environment =
+		 new_s_step_lanczos_environment(settings,5);
+	 s_step_diagonalize(environment);
+	 assert_that(environment->num_multiplications <
+		     settings.max_num_iterations);
+	 eigensystem_t s_step_eigensystem =
+		 get_s_step_eigensystem(environment);
+	 eigensystem_t lapack_eigensystem =
+		 diagonalize_symmetric_matrix(matrix);
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 printf("(%lu) s-step lanczos: %.15lg, lapack: %.15lg\n",
+			i,
+			get_eigenvalue(s_step_eigensystem,i),
+			get_eigenvalue(lapack_eigensystem,i));
+		 assert_that(fabs(get_eigenvalue(s_step_eigensystem,i) -
+				  get_eigenvalue(lapack_eigensystem,i)) < 1e-8);
+	 }
+	 free_s_step_lanczos_environment(environment);
+	 free_eigensystem(s_step_eigensystem);
+	 free_eigensystem(lapack_eigensystem);
+	 free_matrix(matrix);
+	 free(settings.krylow_vectors_directory_name);
+	);
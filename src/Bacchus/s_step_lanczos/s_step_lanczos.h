@@ -0,0 +1,31 @@
+#ifndef __S_STEP_LANCZOS__
+#define __S_STEP_LANCZOS__
+
+#include <stdlib.h>
+#include <lanczos/lanczos.h>
+#include <eigensystem/eigensystem.h>
+
+/* s-step Lanczos builds step_size Krylow vectors per step from a Newton
+ * basis, the matrix vector multiplications of a step follow each other
+ * without any scalar products in between. The new vectors are then
+ * orthonormalized against the whole Krylow basis with a few fused passes
+ * that compute all their scalar products at once, and the projected matrix
+ * follows from the Newton recurrence. Like block Lanczos it does not use
+ * the reorthogonalization and restart settings of Lanczos.
+ */
+
+struct _s_step_lanczos_environment_;
+typedef struct _s_step_lanczos_environment_ *s_step_lanczos_environment_t;
+
+s_step_lanczos_environment_t
+new_s_step_lanczos_environment(lanczos_settings_t settings,
+			       size_t step_size);
+
+void s_step_diagonalize(s_step_lanczos_environment_t environment);
+
+eigensystem_t
+get_s_step_eigensystem(s_step_lanczos_environment_t environment);
+
+void free_s_step_lanczos_environment(s_step_lanczos_environment_t environment);
+
+#endif
@@ -9,6 +9,8 @@ struct _settings_
 {
 	char *program_name;
 	int show_help;
+	int resume;
+	int write_checkpoints;
 	char *combination_table_path;
 	char *evaluation_order_path;
 	char *index_lists_base_directory;
@@ -21,14 +23,130 @@ struct _settings_
 	size_t target_eigenvector;
 	size_t maximum_loaded_memory;
 	convergence_critera_t convergence_critera;
+	vector_storage_t vector_storage;
+	reorthogonalization_t reorthogonalization;
+	size_t max_basis_dimension;
+	size_t num_restart_vectors;
+	eigensolver_t eigensolver;
+	size_t block_size;
+	size_t step_size;
+	size_t filter_degree;
+	diagnostics_level_t diagnostics;
+	size_t diagnostics_interval;
+	int single_precision_basis;
+	int asynchronous_basis_writes;
+	char *initial_combination_table_path;
+	char **initial_vector_directories;
+	double *initial_vector_coefficients;
+	size_t num_initial_vectors;
+	int matrix_free_2nf;
+	char *interaction_path_2nf;
+	char *index_list_path_2nf;
+	int single_particle_energy;
+	int two_particle_energy;
+	int exclude_kinetic_energy;
 	double tolerance;
 };
 
+static
+void parse_matrix_free_2nf_setting(settings_t settings,
+				   config_setting_t *matrix_free_2nf_setting,
+				   const char *settings_file_name)
+{
+	const char *string_buffer = NULL;
+	if (config_setting_lookup_string(matrix_free_2nf_setting,
+					 "interaction_file",
+					 &string_buffer)
+	    == CONFIG_FALSE)
+		error("No interaction.matrix_free_2nf.interaction_file found"
+		      " in \"%s\"\n",
+		      settings_file_name);
+	settings->interaction_path_2nf = copy_string(string_buffer);
+	if (config_setting_lookup_string(matrix_free_2nf_setting,
+					 "index_lists_directory",
+					 &string_buffer)
+	    == CONFIG_FALSE)
+		error("No interaction.matrix_free_2nf.index_lists_directory"
+		      " found in \"%s\"\n",
+		      settings_file_name);
+	settings->index_list_path_2nf = copy_string(string_buffer);
+	if (config_setting_lookup_int(matrix_free_2nf_setting,
+				      "single_particle_energy",
+				      &settings->single_particle_energy)
+	    == CONFIG_FALSE)
+		error("No interaction.matrix_free_2nf.single_particle_energy"
+		      " found in \"%s\"\n",
+		      settings_file_name);
+	if (config_setting_lookup_int(matrix_free_2nf_setting,
+				      "two_particle_energy",
+				      &settings->two_particle_energy)
+	    == CONFIG_FALSE)
+		error("No interaction.matrix_free_2nf.two_particle_energy"
+		      " found in \"%s\"\n",
+		      settings_file_name);
+	if (config_setting_lookup_bool(matrix_free_2nf_setting,
+				       "exclude_kinetic_energy",
+				       &settings->exclude_kinetic_energy)
+	    == CONFIG_FALSE)
+		settings->exclude_kinetic_energy = 0;
+	settings->matrix_free_2nf = 1;
+}
+
+static
+void parse_initial_vectors_setting(settings_t settings,
+				   config_setting_t *initial_vectors_setting,
+				   const char *settings_file_name)
+{
+	const char *string_buffer = NULL;
+	if (config_setting_lookup_string(initial_vectors_setting,
+					 "combination_table_file",
+					 &string_buffer)
+	    == CONFIG_FALSE)
+		string_buffer = settings->combination_table_path;
+	settings->initial_combination_table_path = copy_string(string_buffer);
+	config_setting_t *directories_setting =
+		config_setting_get_member(initial_vectors_setting,"directories");
+	if (directories_setting == NULL ||
+	    config_setting_length(directories_setting) == 0)
+		error("No lanczos.initial_vectors.directories found in"
+		      " \"%s\"\n",
+		      settings_file_name);
+	settings->num_initial_vectors =
+		config_setting_length(directories_setting);
+	settings->initial_vector_directories =
+		(char**)malloc(settings->num_initial_vectors*sizeof(char*));
+	settings->initial_vector_coefficients =
+		(double*)malloc(settings->num_initial_vectors*sizeof(double));
+	config_setting_t *coefficients_setting =
+		config_setting_get_member(initial_vectors_setting,"coefficients");
+	if (coefficients_setting != NULL &&
+	    config_setting_length(coefficients_setting) !=
+	    (int)settings->num_initial_vectors)
+		error("lanczos.initial_vectors has %d coefficients for"
+		      " %lu directories\n",
+		      config_setting_length(coefficients_setting),
+		      settings->num_initial_vectors);
+	for (size_t i = 0; i<settings->num_initial_vectors; i++)
+	{
+		string_buffer =
+			config_setting_get_string_elem(directories_setting,i);
+		if (string_buffer == NULL)
+			error("lanczos.initial_vectors.directories should"
+			      " only contain strings\n");
+		settings->initial_vector_directories[i] =
+			copy_string(string_buffer);
+		settings->initial_vector_coefficients[i] =
+			coefficients_setting == NULL ? 1 :
+			config_setting_get_float_elem(coefficients_setting,i);
+	}
+}
+
 settings_t parse_settings(size_t num_arguments,
 			  char **argument_list)
 {
 	char *settings_file_name = "bacchus.conf";
 	int show_help = 0;
+	int resume = 0;
 	size_t maximum_loaded_memory = 0;
 	for (size_t i = 1; i<num_arguments; i++)
 	{
@@ -47,6 +165,10 @@ settings_t parse_settings(size_t num_arguments,
 		{
 			show_help = 1;	
 		}
+		else if (strcmp(argument_list[i],"--resume") == 0)
+		{
+			resume = 1;
+		}
 		else if (strcmp(argument_list[i],"--max-memory-load") == 0)
 		{
 			char *memory_string = argument_list[++i];
@@ -66,6 +188,7 @@ settings_t parse_settings(size_t num_arguments,
 	settings_t settings = (settings_t)malloc(sizeof(struct _settings_));
 	settings->program_name = argument_list[0];
 	settings->show_help = show_help;
+	settings->resume = resume;
 	if (show_help)
 	{
 		return settings;
@@ -183,8 +306,19 @@ settings_t parse_settings(size_t num_arguments,
 				       (int*)&converge_eigenvector_status) 
 	    == CONFIG_FALSE)
 		converge_eigenvector_status = 0;
+	int converge_residual_status = 0;
+	if (config_setting_lookup_bool(lanczos_setting,
+				       "converge_residuals",
+				       &converge_residual_status)
+	    == CONFIG_FALSE)
+		converge_residual_status = 0;
+	if (converge_eigenvector_status && converge_residual_status)
+		error("Only one of lanczos.converge_eigenvectors and"
+		      " lanczos.converge_residuals can be set\n");
 	if (converge_eigenvector_status)
 		settings->convergence_critera = converge_eigenvectors;
+	else if (converge_residual_status)
+		settings->convergence_critera = converge_residuals;
 	else
 		settings->convergence_critera = converge_eigenvalues;
 	if (config_setting_lookup_string(lanczos_setting,
@@ -206,6 +340,147 @@ settings_t parse_settings(size_t num_arguments,
 		       	parse_memory_string(string_buffer);
 	else
 		error("max_memory_load is not set to correct memory string\n");
+	if (config_setting_lookup_string(lanczos_setting,
+					 "vector_storage",
+					 (const char **)
+					 &string_buffer) == CONFIG_FALSE ||
+	    strcmp(string_buffer,"auto") == 0)
+		settings->vector_storage = AUTOMATIC_STORAGE;
+	else if (strcmp(string_buffer,"memory") == 0)
+		settings->vector_storage = MEMORY_STORAGE;
+	else if (strcmp(string_buffer,"mmap") == 0)
+		settings->vector_storage = MAPPED_FILE_STORAGE;
+	else if (strcmp(string_buffer,"files") == 0)
+		settings->vector_storage = BLOCK_FILE_STORAGE;
+	else if (strcmp(string_buffer,"single_file") == 0)
+		settings->vector_storage = SINGLE_FILE_STORAGE;
+	else
+		error("Unknown lanczos.vector_storage \"%s\", expected"
+		      " \"auto\", \"memory\", \"mmap\", \"files\" or"
+		      " \"single_file\"\n",
+		      string_buffer);
+	if (config_setting_lookup_string(lanczos_setting,
+					 "reorthogonalization",
+					 (const char **)
+					 &string_buffer) == CONFIG_FALSE ||
+	    strcmp(string_buffer,"full") == 0)
+		settings->reorthogonalization = full_reorthogonalization;
+	else if (strcmp(string_buffer,"partial") == 0)
+		settings->reorthogonalization = partial_reorthogonalization;
+	else if (strcmp(string_buffer,"selective") == 0)
+		settings->reorthogonalization = selective_reorthogonalization;
+	else
+		error("Unknown lanczos.reorthogonalization \"%s\", expected"
+		      " \"full\", \"partial\" or \"selective\"\n",
+		      string_buffer);
+	if (config_setting_lookup_int64(lanczos_setting,
+					"max_basis_dimension",
+					(long long*)
+					&settings->max_basis_dimension)
+	    == CONFIG_FALSE)
+		settings->max_basis_dimension = 0;
+	if (config_setting_lookup_int64(lanczos_setting,
+					"num_restart_vectors",
+					(long long*)
+					&settings->num_restart_vectors)
+	    == CONFIG_FALSE)
+		settings->num_restart_vectors =
+			settings->max_basis_dimension/2;
+	if (config_setting_lookup_string(lanczos_setting,
+					 "eigensolver",
+					 (const char **)
+					 &string_buffer) == CONFIG_FALSE ||
+	    strcmp(string_buffer,"lanczos") == 0)
+		settings->eigensolver = lanczos_eigensolver;
+	else if (strcmp(string_buffer,"block_lanczos") == 0)
+		settings->eigensolver = block_lanczos_eigensolver;
+	else if (strcmp(string_buffer,"s_step_lanczos") == 0)
+		settings->eigensolver = s_step_lanczos_eigensolver;
+	else if (strcmp(string_buffer,"davidson") == 0)
+		settings->eigensolver = davidson_eigensolver;
+	else if (strcmp(string_buffer,"chebyshev_filtered") == 0)
+		settings->eigensolver = chebyshev_filtered_eigensolver;
+	else if (strcmp(string_buffer,"direct") == 0)
+		settings->eigensolver = direct_eigensolver;
+	else
+		error("Unknown lanczos.eigensolver \"%s\", expected"
+		      " \"lanczos\", \"block_lanczos\","
+		      " \"s_step_lanczos\", \"davidson\","
+		      " \"chebyshev_filtered\" or \"direct\"\n",
+		      string_buffer);
+	if (config_setting_lookup_int64(lanczos_setting,
+					"block_size",
+					(long long*)
+					&settings->block_size)
+	    == CONFIG_FALSE)
+		settings->block_size = 4;
+	if (config_setting_lookup_int64(lanczos_setting,
+					"step_size",
+					(long long*)
+					&settings->step_size)
+	    == CONFIG_FALSE)
+		settings->step_size = 4;
+	if (config_setting_lookup_int64(lanczos_setting,
+					"filter_degree",
+					(long long*)
+					&settings->filter_degree)
+	    == CONFIG_FALSE)
+		settings->filter_degree = 10;
+	if (config_setting_lookup_string(lanczos_setting,
+					 "diagnostics",
+					 (const char **)
+					 &string_buffer) == CONFIG_FALSE ||
+	    strcmp(string_buffer,"off") == 0)
+		settings->diagnostics = no_diagnostics;
+	else if (strcmp(string_buffer,"cheap") == 0)
+		settings->diagnostics = cheap_diagnostics;
+	else if (strcmp(string_buffer,"full") == 0)
+		settings->diagnostics = full_diagnostics;
+	else
+		error("Unknown lanczos.diagnostics \"%s\", expected"
+		      " \"off\", \"cheap\" or \"full\"\n",
+		      string_buffer);
+	if (config_setting_lookup_int64(lanczos_setting,
+					"diagnostics_interval",
+					(long long*)
+					&settings->diagnostics_interval)
+	    == CONFIG_FALSE)
+		settings->diagnostics_interval = 10;
+	if (config_setting_lookup_bool(lanczos_setting,
+				       "single_precision_basis",
+				       &settings->single_precision_basis)
+	    == CONFIG_FALSE)
+		settings->single_precision_basis = 0;
+	if (config_setting_lookup_bool(lanczos_setting,
+				       "asynchronous_basis_writes",
+				       &settings->asynchronous_basis_writes)
+	    == CONFIG_FALSE)
+		settings->asynchronous_basis_writes = 1;
+	if (config_setting_lookup_bool(lanczos_setting,
+				       "write_checkpoints",
+				       &settings->write_checkpoints)
+	    == CONFIG_FALSE)
+		settings->write_checkpoints = 1;
+	config_setting_t *initial_vectors_setting =
+		config_setting_get_member(lanczos_setting,"initial_vectors");
+	settings->initial_combination_table_path = NULL;
+	settings->initial_vector_directories = NULL;
+	settings->initial_vector_coefficients = NULL;
+	settings->num_initial_vectors = 0;
+	if (initial_vectors_setting != NULL)
+		parse_initial_vectors_setting(settings,
+					      initial_vectors_setting,
+					      settings_file_name);
+	config_setting_t *matrix_free_2nf_setting =
+		config_setting_get_member(interaction_setting,
+					  "matrix_free_2nf");
+	settings->matrix_free_2nf = 0;
+	settings->interaction_path_2nf = NULL;
+	settings->index_list_path_2nf = NULL;
+	if (matrix_free_2nf_setting != NULL)
+		parse_matrix_free_2nf_setting(settings,
+					      matrix_free_2nf_setting,
+					      settings_file_name);
 	// Command argument has presidence over settings file
 	if (maximum_loaded_memory > 0)
 		settings->maximum_loaded_memory = maximum_loaded_memory;
@@ -221,7 +496,7 @@ int should_show_help_text(const settings_t settings)
 void show_help_text(const settings_t settings)
 {
 	printf("Usage: %s [--settings-file <file-path>] [-h/--help] "
-	       "[--max-memory-load <memory size>\n"
+	       "[--max-memory-load <memory size>] [--resume]\n"
 	       "Flags:\n"
 	       "\t--settings-file <file-path>: To provide %s with an "
 	       "alternative settings file than \"bacchus.conf\".\n"
@@ -229,6 +504,8 @@ void show_help_text(const settings_t settings)
 	       "\t--max-memory-load <memory size>: To provide a different "
 	       "limit on how much memory the matrix vector multiplication "
 	       "uses\n"
+	       "\t--resume: To continue an interrupted Lanczos run from the "
+	       "checkpoint in the krylow vector directory\n"
 	       "The settings file:\n"
 	       "The settings file is read using the libconfig library."
 	       "Therefore, the user is referred to the libconfig documentation"
@@ -249,6 +526,13 @@ void show_help_text(const settings_t settings)
 	       " the nucleus of interest.\n"
 	       "\tnum_protons: An integer giving the number of protons in"
 	       " the nucleus of interest.\n"
+	       "\tmatrix_free_2nf: Optional, a group for computing the 2NF "
+	       "matrix blocks in memory instead of reading them, for matrix "
+	       "files made by mercury_J_scheme_to_internal --matrix-free-2nf."
+	       " It contains interaction_file, the coupled 2NF interaction, "
+	       "index_lists_directory, the index lists given to mercury, the "
+	       "integers single_particle_energy and two_particle_energy and "
+	       "optionally exclude_kinetic_energy, as given to mercury\n"
 	       "The lanczos group should contain the following fileds:\n"
 	       "\tkrylow_vector_directory: A string containing the path to"
 	       " where the Lanczos algorithm can store the krylow vectors on"
@@ -258,10 +542,83 @@ void show_help_text(const settings_t settings)
 	       "\tconvergence_tolerance: If the lowest eigenvalue differ with" 
 	       " less than this number from the previous lowest eigenvalue,"
 	       " the Lanczos algorithm is assumed to be converged\n"
+	       "\tconverge_residuals: Optional, when true the residual norms"
+	       " of all the desired eigenvectors have to be below the "
+	       "convergence tolerance instead, which bounds the errors of "
+	       "their eigenvalues\n"
 	       "\teigenvector_directory: The path to the directory where the"
 	       " desired eigenvectors should be saved\n"
 	       "\ttarget_eigenvector: Should be the highest excited "
-	       "eigenvector desired by the user\n",
+	       "eigenvector desired by the user\n"
+	       "\tvector_storage: Optional, where the Krylow vectors are "
+	       "kept. \"memory\" keeps them in RAM, \"mmap\" in one mapped "
+	       "file per vector, \"files\" in one file per basis block and "
+	       "\"single_file\" in one file per vector with a table of block "
+	       "offsets, which is read and written in place. The default, "
+	       "\"auto\", chooses from the available memory and uses "
+	       "\"single_file\" when the vectors do not fit\n"
+	       "\treorthogonalization: Optional, \"full\" (default) "
+	       "reorthogonalizes every Krylow vector against all previous "
+	       "ones, \"partial\" only when the estimated loss of "
+	       "orthogonality is too large and \"selective\" only against "
+	       "converged Ritz vectors\n"
+	       "\tmax_basis_dimension: Optional, when set the Lanczos "
+	       "algorithm is restarted whenever the Krylow basis reaches this "
+	       "dimension\n"
+	       "\tnum_restart_vectors: Optional, the number of Ritz vectors "
+	       "kept at a restart, half the maximum basis dimension by "
+	       "default\n"
+	       "\teigensolver: Optional, \"lanczos\" (default), "
+	       "\"block_lanczos\", which multiplies the matrix with "
+	       "block_size Krylow vectors at a time and finds block_size "
+	       "eigenvectors, also degenerate ones, in fewer steps, "
+	       "\"s_step_lanczos\", which does step_size matrix vector "
+	       "multiplications in a row and orthogonalizes their results "
+	       "together in a few passes over the Krylow basis, "
+	       "\"davidson\", which extends its search basis with the "
+	       "residuals divided by the shifted Hamiltonian diagonal and "
+	       "usually needs far fewer matrix vector multiplications, "
+	       "restarting at max_basis_dimension, "
+	       "\"chebyshev_filtered\", which repeatedly applies a "
+	       "Chebyshev polynomial of degree filter_degree to a fixed block "
+	       "of block_size vectors and suits many eigenvectors, or "
+	       "\"direct\", which builds the explicit matrix and "
+	       "diagonalizes it with LAPACK, faster than the others for "
+	       "dimensions up to about 2000\n"
+	       "\tblock_size: Optional, the number of Krylow vectors in a "
+	       "block of block Lanczos or of Chebyshev filtered subspace "
+	       "iteration, 4 by default\n"
+	       "\tstep_size: Optional, the number of Krylow vectors per step"
+	       " of s-step Lanczos, 4 by default\n"
+	       "\tfilter_degree: Optional, the degree of the Chebyshev "
+	       "filter, 10 by default\n"
+	       "\twrite_checkpoints: Optional, true by default, a checkpoint "
+	       "that --resume continues from is written to the krylow "
+	       "vector directory after every Lanczos iteration\n"
+	       "\tdiagnostics: Optional, \"off\" (default), \"cheap\", "
+	       "which prints the Lanczos coefficients of every iteration, or "
+	       "\"full\", which also checks the normalization and "
+	       "orthogonality of the Krylow basis and the residual of the "
+	       "lowest Ritz pair every diagnostics_interval iterations, 10 by"
+	       " default, at the cost of passes over the whole basis and a "
+	       "matrix vector multiplication\n"
+	       "\tsingle_precision_basis: Optional, false by default, when "
+	       "true the Krylow vectors before the previous one are stored "
+	       "in single precision, which halves the disk space and the "
+	       "reorthogonalization I/O of the Krylow basis. All arithmetic "
+	       "stays in double precision\n"
+	       "\tasynchronous_basis_writes: Optional, true by default, "
+	       "keeps the current and the next Krylow vector of vectors "
+	       "stored in files in memory and writes the new Krylow vector "
+	       "in the background. It is turned off when the automatic "
+	       "vector storage chooses \"single_file\" for lack of memory\n"
+	       "\tinitial_vectors: Optional group, starts the Lanczos "
+	       "algorithm from eigenvectors of a previous calculation, e.g. "
+	       "a smaller Nmax. It contains directories, a list of the "
+	       "eigenvector directories, coefficients, an optional list of "
+	       "the weights of the vectors in the starting vector, and "
+	       "combination_table_file, the comb.txt of the previous model "
+	       "space if it differs from the current one\n",
 		settings->program_name,
 		settings->program_name);
 }
@@ -316,11 +673,124 @@ size_t get_maximum_loaded_memory_setting(const settings_t settings)
 	return settings->maximum_loaded_memory;
 }
 
+size_t get_max_basis_dimension_setting(const settings_t settings)
+{
+	return settings->max_basis_dimension;
+}
+
+size_t get_num_restart_vectors_setting(const settings_t settings)
+{
+	return settings->num_restart_vectors;
+}
+
+reorthogonalization_t
+get_reorthogonalization_setting(const settings_t settings)
+{
+	return settings->reorthogonalization;
+}
+
+vector_storage_t get_vector_storage_setting(const settings_t settings)
+{
+	return settings->vector_storage;
+}
+
+eigensolver_t get_eigensolver_setting(const settings_t settings)
+{
+	return settings->eigensolver;
+}
+
+size_t get_block_size_setting(const settings_t settings)
+{
+	return settings->block_size;
+}
+
+size_t get_step_size_setting(const settings_t settings)
+{
+	return settings->step_size;
+}
+
+size_t get_filter_degree_setting(const settings_t settings)
+{
+	return settings->filter_degree;
+}
+
+diagnostics_level_t get_diagnostics_setting(const settings_t settings)
+{
+	return settings->diagnostics;
+}
+
+size_t get_diagnostics_interval_setting(const settings_t settings)
+{
+	return settings->diagnostics_interval;
+}
+
+int get_single_precision_basis_setting(const settings_t settings)
+{
+	return settings->single_precision_basis;
+}
+
+int get_asynchronous_basis_writes_setting(const settings_t settings)
+{
+	return settings->asynchronous_basis_writes;
+}
+
+int get_resume_setting(const settings_t settings)
+{
+	return settings->resume;
+}
+
+int get_write_checkpoints_setting(const settings_t settings)
+{
+	return settings->write_checkpoints;
+}
+
+size_t get_num_initial_vectors_setting(const settings_t settings)
+{
+	return settings->num_initial_vectors;
+}
+
+const char *get_initial_vector_directory_setting(const settings_t settings,
+						 size_t index)
+{
+	return settings->initial_vector_directories[index];
+}
+
+const double *get_initial_vector_coefficients_setting(const settings_t settings)
+{
+	return settings->initial_vector_coefficients;
+}
+
+const char *
+get_initial_combination_table_path_setting(const settings_t settings)
+{
+	return settings->initial_combination_table_path;
+}
+
 size_t get_target_eigenvector_setting(const settings_t settings)
 {
 	return settings->target_eigenvector;
 }
 
+int use_matrix_free_2nf_setting(const settings_t settings)
+{
+	return settings->matrix_free_2nf;
+}
+
+matrix_free_2nf_settings_t
+get_matrix_free_2nf_setting(const settings_t settings)
+{
+	matrix_free_2nf_settings_t matrix_free_2nf_settings =
+	{
+		.interaction_path = settings->interaction_path_2nf,
+		.index_list_path = settings->index_list_path_2nf,
+		.num_particles = settings->num_protons + settings->num_neutrons,
+		.single_particle_energy = settings->single_particle_energy,
+		.two_particle_energy = settings->two_particle_energy,
+		.include_kinetic_energy = !settings->exclude_kinetic_energy
+	};
+	return matrix_free_2nf_settings;
+}
+
 double get_tolerance_setting(const settings_t settings)
 {
 	return settings->tolerance;
@@ -339,5 +809,12 @@ void free_settings(settings_t settings)
 	free(settings->index_lists_base_directory);
 	free(settings->matrix_file_base_directory);
 	free(settings->krylow_vector_directory);
+	for (size_t i = 0; i<settings->num_initial_vectors; i++)
+		free(settings->initial_vector_directories[i]);
+	free(settings->initial_vector_directories);
+	free(settings->initial_vector_coefficients);
+	free(settings->initial_combination_table_path);
+	free(settings->interaction_path_2nf);
+	free(settings->index_list_path_2nf);
 	free(settings);
 }
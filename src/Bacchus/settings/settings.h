@@ -3,10 +3,21 @@
 
 #include <stdlib.h>
 #include <lanczos/lanczos.h>
+#include <matrix_free_2nf/matrix_free_2nf.h>
 
 struct _settings_;
 typedef struct _settings_ *settings_t;
 
+typedef enum
+{
+	lanczos_eigensolver,
+	block_lanczos_eigensolver,
+	s_step_lanczos_eigensolver,
+	davidson_eigensolver,
+	chebyshev_filtered_eigensolver,
+	direct_eigensolver
+} eigensolver_t;
+
 settings_t parse_settings(size_t num_arguments,
 			  char **argument_list);
 
@@ -34,6 +45,56 @@ size_t get_max_num_lanczos_iterations_setting(const settings_t settings);
 
 size_t get_maximum_loaded_memory_setting(const settings_t settings);
 
+size_t get_max_basis_dimension_setting(const settings_t settings);
+
+size_t get_num_restart_vectors_setting(const settings_t settings);
+
+reorthogonalization_t
+get_reorthogonalization_setting(const settings_t settings);
+
+vector_storage_t get_vector_storage_setting(const settings_t settings);
+
+eigensolver_t get_eigensolver_setting(const settings_t settings);
+
+size_t get_block_size_setting(const settings_t settings);
+
+size_t get_step_size_setting(const settings_t settings);
+
+size_t get_filter_degree_setting(const settings_t settings);
+
+diagnostics_level_t get_diagnostics_setting(const settings_t settings);
+
+size_t get_diagnostics_interval_setting(const settings_t settings);
+
+int get_single_precision_basis_setting(const settings_t settings);
+
+int get_asynchronous_basis_writes_setting(const settings_t settings);
+
+int get_resume_setting(const settings_t settings);
+
+int get_write_checkpoints_setting(const settings_t settings);
+
+/* The eigenvectors of a previous calculation that Lanczos starts from,
+ * none unless lanczos.initial_vectors is set.
+ */
+size_t get_num_initial_vectors_setting(const settings_t settings);
+
+const char *get_initial_vector_directory_setting(const settings_t settings,
+						 size_t index);
+
+const double *get_initial_vector_coefficients_setting(const settings_t settings);
+
+const char *
+get_initial_combination_table_path_setting(const settings_t settings);
+
+/* Whether the 2NF matrix blocks are computed in memory, as set by the
+ * optional interaction.matrix_free_2nf group.
+ */
+int use_matrix_free_2nf_setting(const settings_t settings);
+
+matrix_free_2nf_settings_t
+get_matrix_free_2nf_setting(const settings_t settings);
+
 size_t get_target_eigenvector_setting(const settings_t settings);
 
 double get_tolerance_setting(const settings_t settings);
@@ -1,6 +1,8 @@
 #include <vector/vector.h>
 #include <array_builder/array_builder.h>
+#include <batch_reader/batch_reader.h>
 #include <directory_tools/directory_tools.h>
+#include <vector_file/vector_file.h>
 #include <math_tools/math_tools.h>
 #include <string_tools/string_tools.h>
 #include <log/log.h>
@@ -11,6 +13,11 @@
 #include <errno.h>
 #include <string.h>
 #include <omp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 typedef struct
 {
@@ -19,6 +26,15 @@ typedef struct
 	size_t block_id;
 } vector_block_t;
 
+/* Consecutive blocks whose elements are read together.
+ */
+typedef struct
+{
+	size_t first_block;
+	size_t num_blocks;
+	size_t length;
+} block_group_t;
+
 struct _vector_
 {
 	size_t dimension;
@@ -28,10 +44,89 @@ struct _vector_
 	vector_block_t loaded_block;
 	double *element_buffer;
 	size_t element_buffer_length;
+	vector_storage_t storage;
+	// All elements when the vector is not stored in block files
+	double *elements;
+	// The file of all blocks with single file storage
+	vector_file_t vector_file;
+	// The block files hold floats instead of doubles
+	int single_precision;
+	// The elements of a vector stored in files are kept in memory too,
+	// the files lack the changes since they were last written
+	int kept_in_memory;
+	int has_unwritten_changes;
+	// The background thread writes a copy of the elements
+	int is_writing;
+	pthread_t writer_thread;
+	double *written_elements;
 };
 
 const size_t no_index = -1;
 
+// The vector operations read at most this many elements of each vector in
+// one batch, unless a single block is larger
+static const size_t max_block_group_length = 1<<20;
+
+// The basis vectors used in a reorthogonalization are read in panels of at
+// most this many elements, unless a single block group is larger. The
+// tests lower it to split small vectors into several panels.
+static size_t max_panel_length = 1<<24;
+
+extern void dgemv_(char *transpose,
+		   int *num_rows,
+		   int *num_columns,
+		   double *alpha,
+		   double *matrix,
+		   int *leading_dimension,
+		   double *x,
+		   int *x_increment,
+		   double *beta,
+		   double *y,
+		   int *y_increment);
+
+extern void dgemm_(char *transpose_a,
+		   char *transpose_b,
+		   int *num_rows,
+		   int *num_columns,
+		   int *num_terms,
+		   double *alpha,
+		   double *a,
+		   int *leading_dimension_a,
+		   double *b,
+		   int *leading_dimension_b,
+		   double *beta,
+		   double *c,
+		   int *leading_dimension_c);
+
+extern void dsyrk_(char *upper_or_lower,
+		   char *transpose,
+		   int *order,
+		   int *num_terms,
+		   double *alpha,
+		   double *a,
+		   int *leading_dimension_a,
+		   double *beta,
+		   double *c,
+		   int *leading_dimension_c);
+
+static
+vector_t allocate_vector(vector_settings_t vector_settings);
+
+static
+void allocate_vector_elements(vector_t vector);
+
+static
+void map_vector_file(vector_t vector,int keep_contents);
+
+static
+int has_mapped_vector_file(vector_t vector);
+
+static
+int has_vector_block_files(vector_t vector);
+
+static
+void read_mapped_vector_file(vector_t vector);
+
 static
 void initiate_vector_file(vector_t vector,
 			  vector_block_t vector_block);
@@ -65,17 +160,110 @@ static
 void save_vector_elements(double *vector_elements,
 			  vector_t vector,
 			  vector_block_t vector_block);
+
+static
+void get_precision_marker_path(char *file_name,vector_t vector);
+
+static
+void *write_elements_in_background(void *argument);
+
+static
+block_group_t get_block_group(vector_t vector,size_t first_block);
+
+static
+block_group_t get_block_group_of_length(vector_t vector,
+					size_t first_block,
+					size_t max_length);
+
+static
+int compare_block_groups(vector_t first_vector,
+			 vector_t second_vector,
+			 block_group_t group);
+
+static
+void queue_group_elements(batch_reader_t reader,
+			  double *group_elements,
+			  vector_t vector,
+			  block_group_t group);
+
+static
+void widen_group_elements(double *group_elements,
+			  vector_t vector,
+			  block_group_t group);
+
+static
+double *get_group_elements(batch_reader_t reader,
+			   double *group_buffer,
+			   vector_t vector,
+			   block_group_t group);
+
+static
+void save_group_elements(double *group_elements,
+			 vector_t vector,
+			 block_group_t group);
+
+static
+void store_group_elements(double *group_elements,
+			  vector_t vector,
+			  block_group_t group);
+
+static
+size_t get_panel_size(block_group_t group,size_t num_basis_states);
+
+static
+size_t get_combination_panel_size(block_group_t group,
+				  size_t num_results,
+				  size_t num_vectors);
+
+static
+void accumulate_combinations(vector_t *results,
+			     size_t num_results,
+			     vector_t *vectors,
+			     size_t num_vectors,
+			     const double *coefficients,
+			     int add_to_results,
+			     double factor);
+
+static
+void read_basis_panel(double *panel,
+		      batch_reader_t reader,
+		      vector_t *basis,
+		      size_t num_panel_vectors,
+		      block_group_t group);
+
+static
+basis_block_t *get_basis_blocks(combination_table_t combination_table,
+				size_t *num_basis_blocks);
+
+static
+int same_basis_block_states(basis_block_t first_block,
+			    basis_block_t second_block);
+
+static
+void project_on_basis(double *projections,
+		      vector_t vector,
+		      vector_t *basis,
+		      size_t num_basis_states);
+
+static
+void subtract_basis_projections(vector_t vector,
+				double *projections,
+				vector_t *basis,
+				size_t num_basis_states);
+
 vector_settings_t setup_vector_settings(combination_table_t combination_table)
 {
 #ifndef DEBUG
 	(void)(compare_blocks);
+	(void)(compare_block_groups);
 #endif
 	reset_basis_block_iterator(combination_table);
 	vector_settings_t settings = 
 	{
 		.directory_name = NULL,
 		.num_blocks = 0,	
-		.block_sizes = NULL
+		.block_sizes = NULL,
+		.storage = BLOCK_FILE_STORAGE
 	};
 	array_builder_t block_sizes_builder =
 		new_array_builder((void**)&settings.block_sizes,
@@ -95,6 +283,28 @@ vector_settings_t setup_vector_settings(combination_table_t combination_table)
 	return settings;
 }
 
+vector_storage_t select_vector_storage(size_t dimension,
+				       size_t num_vectors,
+				       size_t reserved_memory)
+{
+	const size_t available_memory =
+		sysconf(_SC_AVPHYS_PAGES)*sysconf(_SC_PAGESIZE);
+	const size_t vector_memory = dimension*sizeof(double);
+	log_entry("Available memory %lu, vector memory %lu, %lu vectors",
+		  available_memory,vector_memory,num_vectors);
+	if (available_memory <= reserved_memory)
+		return SINGLE_FILE_STORAGE;
+	const size_t free_memory = available_memory - reserved_memory;
+	if (num_vectors*vector_memory <= free_memory)
+		return MEMORY_STORAGE;
+	// The vector operations use at most three vectors at once, as long as
+	// these fit the page cache can keep the touched parts of the mapped
+	// files
+	if (3*vector_memory <= free_memory)
+		return MAPPED_FILE_STORAGE;
+	return SINGLE_FILE_STORAGE;
+}
+
 vector_t new_zero_vector(vector_settings_t vector_settings)
 {
 	if (!directory_exists(vector_settings.directory_name) &&
@@ -102,37 +312,35 @@ vector_t new_zero_vector(vector_settings_t vector_settings)
 		error("Could not create directory \"%s\". %s\n",
 		      vector_settings.directory_name,
 		      strerror(errno));
-	vector_t vector = (vector_t)calloc(1,sizeof(struct _vector_));
-	vector->dimension = sum_sizes(vector_settings.block_sizes,
-				      vector_settings.num_blocks);
-	vector->num_vector_blocks = vector_settings.num_blocks;
-	vector->vector_blocks =
-		(vector_block_t*)calloc(vector->num_vector_blocks,
-					sizeof(vector_block_t));
-	size_t start_index = 0;
-	vector->directory_name = copy_string(vector_settings.directory_name);
-	for (size_t i = 0; i<vector->num_vector_blocks; i++)
-	{
-		vector_block_t vector_block =
-		{
-			.start_index = start_index,
-			.block_length = vector_settings.block_sizes[i],
-			.block_id = i+1
-		};
-		vector->vector_blocks[i] = vector_block;
-		start_index += vector_settings.block_sizes[i];
-		initiate_vector_file(vector,vector_block);
-	}
-	vector->loaded_block.block_id = -1;
+	vector_t vector = allocate_vector(vector_settings);
+	// A vector that used the directory before may have been rounded, or
+	// stored in a single file
+	char file_name[2049];
+	get_precision_marker_path(file_name,vector);
+	if (unlink(file_name) != 0 && errno != ENOENT)
+		error("Could not remove %s. %s\n",file_name,strerror(errno));
+	sprintf(file_name,"%s/%s",vector->directory_name,vector_file_name);
+	if (vector->storage != SINGLE_FILE_STORAGE &&
+	    unlink(file_name) != 0 && errno != ENOENT)
+		error("Could not remove %s. %s\n",file_name,strerror(errno));
+	if (vector->storage == BLOCK_FILE_STORAGE)
+		for (size_t i = 0; i<vector->num_vector_blocks; i++)
+			initiate_vector_file(vector,vector->vector_blocks[i]);
+	else if (vector->storage == SINGLE_FILE_STORAGE)
+		vector->vector_file =
+			new_vector_file(vector->directory_name,
+					vector_settings.block_sizes,
+					vector_settings.num_blocks,
+					sizeof(double));
+	else
+		allocate_vector_elements(vector);
 	return vector;
 }
 
 vector_t new_random_vector(vector_settings_t vector_settings)
 {
 	vector_t vector = new_zero_vector(vector_settings);
-	for (size_t i = 0; i<vector->dimension; i++)
-		set_element(vector,i,2*drand48()-1);
-	save_vector(vector);
+	fill_random(vector);
 	return vector;
 }
 
@@ -140,28 +348,58 @@ vector_t new_existing_vector(vector_settings_t vector_settings)
 {
 	if (!directory_exists(vector_settings.directory_name))
 		return new_zero_vector(vector_settings);
-	vector_t vector = (vector_t)calloc(1,sizeof(struct _vector_));
-	vector->dimension = sum_sizes(vector_settings.block_sizes,
-				      vector_settings.num_blocks);
-	vector->num_vector_blocks = vector_settings.num_blocks;
-	vector->vector_blocks =
-		(vector_block_t*)calloc(vector->num_vector_blocks,
-					sizeof(vector_block_t));
-	size_t start_index = 0;
-	vector->directory_name = copy_string(vector_settings.directory_name);
-	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	vector_t vector = allocate_vector(vector_settings);
+	// A vector in a single file stays there, whatever the settings
+	if (has_vector_file(vector->directory_name))
 	{
-		vector_block_t vector_block =
-		{
-			.start_index = start_index,
-			.block_length = vector_settings.block_sizes[i],
-			.block_id = i+1
-		};
-		vector->vector_blocks[i] = vector_block;
-		start_index += vector_settings.block_sizes[i];
-		// We want to use the old vector files so no initialization
+		vector->storage = SINGLE_FILE_STORAGE;
+		vector->vector_file = open_vector_file(vector->directory_name);
+		if (get_vector_file_num_blocks(vector->vector_file) !=
+		    vector->num_vector_blocks)
+			error("The vector file of %s has %lu blocks, expected"
+			      " %lu\n",
+			      vector->directory_name,
+			      get_vector_file_num_blocks(vector->vector_file),
+			      vector->num_vector_blocks);
+		vector->single_precision =
+			get_vector_file_element_size(vector->vector_file) ==
+			sizeof(float);
+		return vector;
 	}
-	vector->loaded_block.block_id = -1;
+	// A rounded vector stays in its single precision block files
+	char marker_name[2049];
+	get_precision_marker_path(marker_name,vector);
+	if (access(marker_name,F_OK) == 0)
+	{
+		vector->storage = BLOCK_FILE_STORAGE;
+		vector->single_precision = 1;
+		return vector;
+	}
+	// A vector written in block files is read from them
+	if (vector->storage == SINGLE_FILE_STORAGE)
+		vector->storage = BLOCK_FILE_STORAGE;
+	// We want to use the old vector files so no initialization
+	if (vector->storage == BLOCK_FILE_STORAGE)
+		return vector;
+	// The mapped file of a mapped vector is newer than its block files,
+	// which are only written when they are asked for
+	if (vector->storage == MAPPED_FILE_STORAGE &&
+	    has_mapped_vector_file(vector))
+		map_vector_file(vector,1);
+	else if (has_vector_block_files(vector))
+	{
+		allocate_vector_elements(vector);
+		read_vector_block_files(vector);
+	}
+	else if (has_mapped_vector_file(vector))
+	{
+		allocate_vector_elements(vector);
+		read_mapped_vector_file(vector);
+	}
+	else
+		error("Vector %s has neither block files nor a mapped vector"
+		      " file\n",
+		      vector->directory_name);
 	return vector;
 }
 
@@ -171,6 +409,12 @@ void set_element(vector_t vector,
 {
 	log_entry("Setting element %lu of vector %s to %lg",
 		  index,vector->directory_name,value);
+	if (vector->elements != NULL)
+	{
+		vector->elements[index] = value;
+		vector->has_unwritten_changes = 1;
+		return;
+	}
 	vector_block_t vector_block = find_block(vector,index);
 	if (vector_block.block_id != vector->loaded_block.block_id)
 	{
@@ -190,6 +434,8 @@ double get_element(vector_t vector,
 {
 	log_entry("Getting element %lu of vector %s",
 		  index,vector->directory_name);
+	if (vector->elements != NULL)
+		return vector->elements[index];
 	vector_block_t vector_block = find_block(vector,index);
 	if (vector_block.block_id != vector->loaded_block.block_id)
 	{
@@ -209,6 +455,233 @@ const char *get_vector_path(vector_t vector)
 	return vector->directory_name;
 }
 
+void copy_vector_elements(double *elements,const vector_t vector)
+{
+	if (vector->elements != NULL)
+	{
+		memcpy(elements,
+		       vector->elements,
+		       vector->dimension*sizeof(double));
+		return;
+	}
+	// A block changed by set_element is written first
+	save_vector(vector);
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		// The group is read straight into its part of the array
+		get_group_elements(reader,
+				   elements + vector->vector_blocks[i].start_index,
+				   vector,
+				   group);
+		submit_read_requests(reader);
+	}
+	free_batch_reader(reader);
+}
+
+void set_vector_elements(vector_t vector,const double *elements)
+{
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		store_group_elements((double*)elements +
+				     vector->vector_blocks[i].start_index,
+				     vector,
+				     group);
+	}
+}
+
+void write_vector_block_files(vector_t vector)
+{
+	if (vector->elements == NULL)
+		return;
+	if (vector->kept_in_memory)
+	{
+		wait_for_vector_write(vector);
+		if (!vector->has_unwritten_changes)
+			return;
+		vector->has_unwritten_changes = 0;
+	}
+	log_entry("Writing the block files of vector %s",
+		  vector->directory_name);
+	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	{
+		vector_block_t vector_block = vector->vector_blocks[i];
+		save_vector_elements(vector->elements +
+				     vector_block.start_index,
+				     vector,
+				     vector_block);
+	}
+}
+
+void read_vector_block_files(vector_t vector)
+{
+	if (vector->elements == NULL)
+		return;
+	wait_for_vector_write(vector);
+	vector->has_unwritten_changes = 0;
+	log_entry("Reading the block files of vector %s",
+		  vector->directory_name);
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group =
+	{
+		.first_block = 0,
+		.num_blocks = vector->num_vector_blocks,
+		.length = vector->dimension
+	};
+	queue_group_elements(reader,vector->elements,vector,group);
+	submit_read_requests(reader);
+	free_batch_reader(reader);
+}
+
+void set_single_precision_storage(vector_t vector,int single_precision)
+{
+	if (vector->storage == MEMORY_STORAGE ||
+	    vector->single_precision == single_precision)
+		return;
+	log_entry("Storing vector %s in %s precision",
+		  vector->directory_name,
+		  single_precision ? "single" : "double");
+	release_vector_memory(vector);
+	save_vector(vector);
+	if (vector->storage == MAPPED_FILE_STORAGE)
+	{
+		vector->single_precision = single_precision;
+		write_vector_block_files(vector);
+		if (munmap(vector->elements,
+			   vector->dimension*sizeof(double)) != 0)
+			error("Could not unmap vector %s. %s\n",
+			      vector->directory_name,
+			      strerror(errno));
+		char file_name[2049];
+		sprintf(file_name,"%s/vector",vector->directory_name);
+		if (unlink(file_name) != 0)
+			error("Could not remove %s. %s\n",
+			      file_name,
+			      strerror(errno));
+		vector->elements = NULL;
+		vector->storage = BLOCK_FILE_STORAGE;
+	}
+	else if (vector->storage == SINGLE_FILE_STORAGE)
+	{
+		vector->single_precision = single_precision;
+		convert_vector_file_precision(vector->vector_file,
+					      single_precision ?
+					      sizeof(float) : sizeof(double));
+		// The vector file records its precision itself
+		return;
+	}
+	else
+	{
+		for (size_t i = 0; i<vector->num_vector_blocks; i++)
+		{
+			vector_block_t vector_block = vector->vector_blocks[i];
+			prepare_element_buffer(vector,vector_block);
+			vector->single_precision = !single_precision;
+			load_vector_elements(vector->element_buffer,
+					     vector,
+					     vector_block);
+			vector->single_precision = single_precision;
+			save_vector_elements(vector->element_buffer,
+					     vector,
+					     vector_block);
+		}
+	}
+	// The marker tells a resumed run how to read the block files
+	char marker_name[2049];
+	get_precision_marker_path(marker_name,vector);
+	if (single_precision)
+	{
+		FILE *marker = fopen(marker_name,"w");
+		if (marker == NULL)
+			error("Could not create %s. %s\n",
+			      marker_name,
+			      strerror(errno));
+		fclose(marker);
+	}
+	else if (unlink(marker_name) != 0)
+		error("Could not remove %s. %s\n",marker_name,strerror(errno));
+}
+
+int has_single_precision_storage(vector_t vector)
+{
+	return vector->single_precision;
+}
+
+void keep_vector_in_memory(vector_t vector)
+{
+	if (vector->elements != NULL || vector->single_precision)
+		return;
+	log_entry("Keeping vector %s in memory",vector->directory_name);
+	double *elements =
+		(double*)malloc(vector->dimension*sizeof(double));
+	if (elements == NULL)
+		error("Could not allocate %lu elements for vector %s\n",
+		      vector->dimension,
+		      vector->directory_name);
+	copy_vector_elements(elements,vector);
+	vector->elements = elements;
+	vector->kept_in_memory = 1;
+	vector->has_unwritten_changes = 0;
+}
+
+void write_vector_in_background(vector_t vector)
+{
+	if (!vector->kept_in_memory)
+		return;
+	wait_for_vector_write(vector);
+	if (!vector->has_unwritten_changes)
+		return;
+	log_entry("Writing vector %s in the background",
+		  vector->directory_name);
+	vector->written_elements =
+		(double*)malloc(vector->dimension*sizeof(double));
+	if (vector->written_elements == NULL)
+		error("Could not allocate %lu elements for vector %s\n",
+		      vector->dimension,
+		      vector->directory_name);
+	memcpy(vector->written_elements,
+	       vector->elements,
+	       vector->dimension*sizeof(double));
+	vector->has_unwritten_changes = 0;
+	vector->is_writing = 1;
+	if (pthread_create(&vector->writer_thread,
+			   NULL,
+			   write_elements_in_background,
+			   vector) != 0)
+		error("Could not start the writer thread of vector %s\n",
+		      vector->directory_name);
+}
+
+void wait_for_vector_write(vector_t vector)
+{
+	if (!vector->is_writing)
+		return;
+	pthread_join(vector->writer_thread,NULL);
+	free(vector->written_elements);
+	vector->written_elements = NULL;
+	vector->is_writing = 0;
+}
+
+const double *get_vector_elements_in_memory(vector_t vector)
+{
+	return vector->elements;
+}
+
+void release_vector_memory(vector_t vector)
+{
+	if (!vector->kept_in_memory)
+		return;
+	log_entry("Releasing vector %s from memory",vector->directory_name);
+	write_vector_block_files(vector);
+	free(vector->elements);
+	vector->elements = NULL;
+	vector->kept_in_memory = 0;
+}
+
 void save_vector(vector_t vector)
 {
 	log_entry("Saving vector %s",
@@ -251,30 +724,33 @@ double scalar_multiplication(const vector_t first_vector,
 	double accumulator = 0.0;
 	double *element_buffer = NULL;
 	size_t element_buffer_length = 0;
-	for (size_t i = 0; i <first_vector->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<first_vector->num_vector_blocks;
+	     i += group.num_blocks)
 	{
 		log_entry("block_id = %lu",i);
-		vector_block_t vector_block = first_vector->vector_blocks[i];
-		assert(compare_blocks(vector_block,
-				      second_vector->vector_blocks[i]));
+		group = get_block_group(first_vector,i);
+		assert(compare_block_groups(first_vector,second_vector,group));
 		expand_element_buffer(&element_buffer,
 				      &element_buffer_length,
-				      2*vector_block.block_length);
-		double *first_vector_elements = element_buffer;
+				      2*group.length);
+		double *first_vector_elements =
+			get_group_elements(reader,element_buffer,
+					   first_vector,group);
 		double *second_vector_elements =
-			element_buffer + vector_block.block_length;
-		load_vector_elements(first_vector_elements,
-				     first_vector,vector_block);
-		load_vector_elements(second_vector_elements,
-				     second_vector,vector_block);
+			get_group_elements(reader,element_buffer + group.length,
+					   second_vector,group);
+		submit_read_requests(reader);
 		double block_scalar_product = array_scalar_product(first_vector_elements,
 						    second_vector_elements,
-						    vector_block.block_length);
+						    group.length);
 		log_entry("block_scalar_product = %lg",
 			  block_scalar_product);
 		log_entry("accumulator = %lg",accumulator);
 		accumulator += block_scalar_product;
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 	log_entry("accumulator = %lg",accumulator);
 	return accumulator;
@@ -293,31 +769,38 @@ void subtract_line_projection(vector_t target_vector,
 	       line_direction->num_vector_blocks);
 	double *element_buffer = NULL;
 	size_t buffer_length = 0;
-	for (size_t i = 0; i<target_vector->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<target_vector->num_vector_blocks;
+	     i += group.num_blocks)
 	{
-		vector_block_t vector_block = target_vector->vector_blocks[i];
-		assert(compare_blocks(vector_block,
-				      line_direction->vector_blocks[i]));
+		group = get_block_group(target_vector,i);
+		assert(compare_block_groups(target_vector,
+					    line_direction,
+					    group));
 		expand_element_buffer(&element_buffer,
 				      &buffer_length,
-				      2*vector_block.block_length);
-		double *target_vector_elements = element_buffer;
+				      2*group.length);
+		double *target_vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   target_vector,
+					   group);
 		double *line_direction_elements =
-			element_buffer + vector_block.block_length;
-		load_vector_elements(target_vector_elements,
-				     target_vector,
-				     vector_block);
-		load_vector_elements(line_direction_elements,
-				     line_direction,
-				     vector_block);
+			get_group_elements(reader,
+					   element_buffer + group.length,
+					   line_direction,
+					   group);
+		submit_read_requests(reader);
 		subtract_array_projection(target_vector_elements,
 					  projection,
 					  line_direction_elements,
-					  vector_block.block_length);
-		save_vector_elements(target_vector_elements,
-				     target_vector,
-				     vector_block);
+					  group.length);
+		save_group_elements(target_vector_elements,
+				    target_vector,
+				    group);
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 }
 
@@ -339,43 +822,51 @@ void subtract_plane_projection(vector_t target_vector,
 	       second_direction->num_vector_blocks);
 	double *element_buffer = NULL;
 	size_t buffer_length = 0;
-	for (size_t i = 0; i<target_vector->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<target_vector->num_vector_blocks;
+	     i += group.num_blocks)
 	{
-		vector_block_t vector_block = target_vector->vector_blocks[i];
-		assert(compare_blocks(vector_block,
-				      first_direction->vector_blocks[i]));
-		assert(compare_blocks(vector_block,
-				      second_direction->vector_blocks[i]));
+		group = get_block_group(target_vector,i);
+		assert(compare_block_groups(target_vector,
+					    first_direction,
+					    group));
+		assert(compare_block_groups(target_vector,
+					    second_direction,
+					    group));
 		expand_element_buffer(&element_buffer,
 				      &buffer_length,
-				      3*vector_block.block_length);
-		double *target_vector_elements = element_buffer;
+				      3*group.length);
+		double *target_vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   target_vector,
+					   group);
 		double *first_direction_elements =
-			element_buffer + vector_block.block_length;
+			get_group_elements(reader,
+					   element_buffer + group.length,
+					   first_direction,
+					   group);
 		double *second_direction_elements =
-			element_buffer + 
-			2*vector_block.block_length;
-		load_vector_elements(target_vector_elements,
-				     target_vector,
-				     vector_block);
-		load_vector_elements(first_direction_elements,
-				     first_direction,
-				     vector_block);
-		load_vector_elements(second_direction_elements,
-				     second_direction,
-				     vector_block);
+			get_group_elements(reader,
+					   element_buffer + 
+					   2*group.length,
+					   second_direction,
+					   group);
+		submit_read_requests(reader);
 		subtract_array_projection(target_vector_elements,
 					  first_projection,
 					  first_direction_elements,
-					  vector_block.block_length);
+					  group.length);
 		subtract_array_projection(target_vector_elements,
 					  second_projection,
 					  second_direction_elements,
-					  vector_block.block_length);
-		save_vector_elements(target_vector_elements,
-				     target_vector,
-				     vector_block);
+					  group.length);
+		save_group_elements(target_vector_elements,
+				    target_vector,
+				    group);
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 }
 
@@ -387,50 +878,92 @@ double norm(const vector_t vector)
 	double *element_buffer = NULL;
 	size_t element_buffer_size = 0;
 	double accumulator = 0.0;
-	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
 	{
-		vector_block_t vector_block = vector->vector_blocks[i];
+		group = get_block_group(vector,i);
 		expand_element_buffer(&element_buffer,
 				      &element_buffer_size,
-				      vector_block.block_length);
-		load_vector_elements(element_buffer,
-				     vector,
-				     vector_block);
-		accumulator+=array_square_norm(element_buffer,
-					       vector_block.block_length);
+				      group.length);
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		submit_read_requests(reader);
+		accumulator+=array_square_norm(vector_elements,
+					       group.length);
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 	return sqrt(accumulator);
 }
 
+uint64_t vector_checksum(const vector_t vector)
+{
+	log_entry("Computing checksum of vector %s",
+		  vector->directory_name);
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	uint64_t checksum = initial_hash;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      group.length);
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		submit_read_requests(reader);
+		checksum = hash_bytes(checksum,
+				      vector_elements,
+				      group.length*sizeof(double));
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+	return checksum;
+}
+
 void vector_add_scaled(vector_t result,
 		       double scaling_factor,
 		       const vector_t term)
 {
 	double *element_buffer = NULL;
 	size_t element_buffer_size = 0;
-	for (size_t i = 0; i<result->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<result->num_vector_blocks; i += group.num_blocks)
 	{
-		vector_block_t vector_block = result->vector_blocks[i];
+		group = get_block_group(result,i);
 		expand_element_buffer(&element_buffer,
 				      &element_buffer_size,
-				      vector_block.block_length*2);
-		double *result_block = element_buffer;
-		double *term_block = element_buffer+vector_block.block_length;
-		load_vector_elements(result_block,
-				     result,
-				     vector_block);
-		load_vector_elements(term_block,
-				     term,
-				     vector_block);
+				      group.length*2);
+		double *result_block =
+			get_group_elements(reader,
+					   element_buffer,
+					   result,
+					   group);
+		double *term_block =
+			get_group_elements(reader,
+					   element_buffer+group.length,
+					   term,
+					   group);
+		submit_read_requests(reader);
 		array_add_scaled(result_block,
 				 scaling_factor,
 				 term_block,
-				 vector_block.block_length);
-		save_vector_elements(result_block,
-				     result,
-				     vector_block);
+				 group.length);
+		save_group_elements(result_block,
+				    result,
+				    group);
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 }
 
@@ -441,48 +974,605 @@ void scale(vector_t vector,double scaling)
 	assert(vector != NULL);
 	double *element_buffer = NULL;
 	size_t element_buffer_size = 0;
-	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
 	{
-		vector_block_t vector_block = vector->vector_blocks[i];
+		group = get_block_group(vector,i);
 		expand_element_buffer(&element_buffer,
 				      &element_buffer_size,
-				      vector_block.block_length);
-		load_vector_elements(element_buffer,
-				     vector,
-				     vector_block);
-		scale_array(element_buffer,scaling,vector_block.block_length);
-		save_vector_elements(element_buffer,
-				     vector,
-				     vector_block);
+				      group.length);
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		submit_read_requests(reader);
+		scale_array(vector_elements,scaling,group.length);
+		save_group_elements(vector_elements,
+				    vector,
+				    group);
 	}
+	free_batch_reader(reader);
 	free(element_buffer);
 }
 
-void reorthogonalize_vector(vector_t vector_to_orthogonalize,
-			    vector_t *basis,
-			    size_t num_basis_states)
+void divide_by_shifted_diagonal(vector_t vector,
+				const vector_t diagonal,
+				double shift,
+				double min_difference)
+{
+	log_entry("Dividing vector %s by the shifted diagonal %s",
+		  vector->directory_name,
+		  diagonal->directory_name);
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      group.length*2);
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		const double *diagonal_elements =
+			get_group_elements(reader,
+					   element_buffer + group.length,
+					   diagonal,
+					   group);
+		submit_read_requests(reader);
+		for (size_t j = 0; j<group.length; j++)
+		{
+			double difference = diagonal_elements[j] - shift;
+			if (fabs(difference) < min_difference)
+				difference = difference < 0 ?
+					-min_difference : min_difference;
+			vector_elements[j] /= difference;
+		}
+		save_group_elements(vector_elements,
+				    vector,
+				    group);
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+}
+
+vector_traffic_t lanczos_step_products(lanczos_products_t *products,
+				       const vector_t w,
+				       const vector_t v,
+				       const vector_t previous)
+{
+	log_entry("Lanczos step products of %s and %s",
+		  w->directory_name,
+		  v->directory_name);
+	assert(w->dimension == v->dimension);
+	assert(previous == NULL || w->dimension == previous->dimension);
+	lanczos_products_t zero_products = {0};
+	*products = zero_products;
+	const size_t num_vectors = previous == NULL ? 2 : 3;
+	vector_traffic_t traffic = {0,0};
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<w->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(w,i);
+		assert(compare_block_groups(w,v,group));
+		assert(previous == NULL ||
+		       compare_block_groups(w,previous,group));
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      num_vectors*group.length);
+		double *w_elements =
+			get_group_elements(reader,element_buffer,w,group);
+		double *v_elements =
+			get_group_elements(reader,
+					   element_buffer + group.length,
+					   v,group);
+		double *previous_elements = previous == NULL ? NULL :
+			get_group_elements(reader,
+					   element_buffer + 2*group.length,
+					   previous,group);
+		submit_read_requests(reader);
+		add_lanczos_array_products(products,
+					   w_elements,
+					   v_elements,
+					   previous_elements,
+					   group.length);
+		traffic.bytes_read += num_vectors*group.length*sizeof(double);
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+	return traffic;
+}
+
+vector_traffic_t lanczos_step_update(vector_t w,
+				     double alpha,
+				     const vector_t v,
+				     double beta,
+				     const vector_t previous,
+				     double scaling,
+				     double *square_norm)
+{
+	log_entry("Lanczos step update of %s",
+		  w->directory_name);
+	assert(w->dimension == v->dimension);
+	assert(previous == NULL || w->dimension == previous->dimension);
+	const size_t num_vectors = previous == NULL ? 2 : 3;
+	vector_traffic_t traffic = {0,0};
+	*square_norm = 0.0;
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<w->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(w,i);
+		assert(compare_block_groups(w,v,group));
+		assert(previous == NULL ||
+		       compare_block_groups(w,previous,group));
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      num_vectors*group.length);
+		double *w_elements =
+			get_group_elements(reader,element_buffer,w,group);
+		double *v_elements =
+			get_group_elements(reader,
+					   element_buffer + group.length,
+					   v,group);
+		double *previous_elements = previous == NULL ? NULL :
+			get_group_elements(reader,
+					   element_buffer + 2*group.length,
+					   previous,group);
+		submit_read_requests(reader);
+		*square_norm += array_lanczos_update(w_elements,
+						     alpha,
+						     v_elements,
+						     beta,
+						     previous_elements,
+						     scaling,
+						     group.length);
+		save_group_elements(w_elements,w,group);
+		traffic.bytes_read += num_vectors*group.length*sizeof(double);
+		traffic.bytes_written += group.length*sizeof(double);
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+	return traffic;
+}
+
+void reorthogonalize_vector(vector_t vector_to_orthogonalize,
+			    vector_t *basis,
+			    size_t num_basis_states)
+{
+	log_entry("reorthogonalize vector %s",
+		  vector_to_orthogonalize->directory_name);
+	if (num_basis_states == 0)
+		return;
+	double *projections =
+		(double*)malloc(num_basis_states*sizeof(double));
+	// Classical Gram-Schmidt done twice is as stable as modified
+	// Gram-Schmidt, but needs only two passes over the basis each time
+	for (int round = 0; round<2; round++)
+	{
+		project_on_basis(projections,
+				 vector_to_orthogonalize,
+				 basis,
+				 num_basis_states);
+		subtract_basis_projections(vector_to_orthogonalize,
+					   projections,
+					   basis,
+					   num_basis_states);
+	}
+	free(projections);
+}
+
+void combine_vectors(vector_t *results,
+		     size_t num_results,
+		     vector_t *vectors,
+		     size_t num_vectors,
+		     const double *coefficients)
+{
+	log_entry("Combining %lu vectors into %lu vectors",
+		  num_vectors,num_results);
+	accumulate_combinations(results,num_results,
+				vectors,num_vectors,
+				coefficients,0,1.0);
+}
+
+void subtract_combinations(vector_t *targets,
+			   size_t num_targets,
+			   vector_t *vectors,
+			   size_t num_vectors,
+			   const double *coefficients)
+{
+	log_entry("Subtracting combinations of %lu vectors from %lu vectors",
+		  num_vectors,num_targets);
+	accumulate_combinations(targets,num_targets,
+				vectors,num_vectors,
+				coefficients,1,-1.0);
+}
+
+void compute_gram_matrix(double *gram_matrix,
+			 vector_t *first_vectors,
+			 size_t num_first_vectors,
+			 vector_t *second_vectors,
+			 size_t num_second_vectors)
+{
+	log_entry("Computing a %lux%lu Gram matrix",
+		  num_first_vectors,num_second_vectors);
+	memset(gram_matrix,0,
+	       num_first_vectors*num_second_vectors*sizeof(double));
+	if (num_first_vectors == 0 || num_second_vectors == 0)
+		return;
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	// The second vectors of a group and at least one panel vector have
+	// to fit
+	size_t max_group_length = max_panel_length/(num_second_vectors+1);
+	if (max_group_length > max_block_group_length)
+		max_group_length = max_block_group_length;
+	block_group_t group;
+	for (size_t i = 0; i<first_vectors[0]->num_vector_blocks;
+	     i += group.num_blocks)
+	{
+		group = get_block_group_of_length(first_vectors[0],i,
+						  max_group_length);
+		size_t panel_size =
+			get_combination_panel_size(group,
+						   num_second_vectors,
+						   num_first_vectors);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      (num_second_vectors+panel_size)*
+				      group.length);
+		double *second_elements = element_buffer;
+		double *panel = element_buffer +
+			num_second_vectors*group.length;
+		read_basis_panel(second_elements,reader,second_vectors,
+				 num_second_vectors,group);
+		for (size_t j = 0; j<num_first_vectors; j += panel_size)
+		{
+			size_t num_panel_vectors =
+				num_first_vectors - j < panel_size ?
+				num_first_vectors - j : panel_size;
+			assert(compare_block_groups(first_vectors[0],
+						    first_vectors[j],
+						    group));
+			read_basis_panel(panel,reader,first_vectors + j,
+					 num_panel_vectors,group);
+			char transpose = 'T';
+			char no_transpose = 'N';
+			int num_rows = (int)num_panel_vectors;
+			int num_columns = (int)num_second_vectors;
+			int num_terms = (int)group.length;
+			int leading_dimension = (int)num_first_vectors;
+			double one = 1.0;
+			dgemm_(&transpose,
+			       &no_transpose,
+			       &num_rows,
+			       &num_columns,
+			       &num_terms,
+			       &one,
+			       panel,
+			       &num_terms,
+			       second_elements,
+			       &num_terms,
+			       &one,
+			       gram_matrix + j,
+			       &leading_dimension);
+		}
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+}
+
+void compute_symmetric_gram_matrix(double *gram_matrix,
+				   vector_t *vectors,
+				   size_t num_vectors)
+{
+	log_entry("Computing a symmetric %lux%lu Gram matrix",
+		  num_vectors,num_vectors);
+	memset(gram_matrix,0,num_vectors*num_vectors*sizeof(double));
+	if (num_vectors == 0)
+		return;
+	double *panel = NULL;
+	size_t panel_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	size_t max_group_length = max_panel_length/num_vectors;
+	if (max_group_length > max_block_group_length)
+		max_group_length = max_block_group_length;
+	block_group_t group;
+	for (size_t i = 0; i<vectors[0]->num_vector_blocks;
+	     i += group.num_blocks)
+	{
+		group = get_block_group_of_length(vectors[0],i,
+						  max_group_length);
+		for (size_t j = 1; j<num_vectors; j++)
+			assert(compare_block_groups(vectors[0],vectors[j],group));
+		expand_element_buffer(&panel,
+				      &panel_buffer_size,
+				      num_vectors*group.length);
+		read_basis_panel(panel,reader,vectors,num_vectors,group);
+		char upper = 'U';
+		char transpose = 'T';
+		int order = (int)num_vectors;
+		int num_terms = (int)group.length;
+		double one = 1.0;
+		dsyrk_(&upper,
+		       &transpose,
+		       &order,
+		       &num_terms,
+		       &one,
+		       panel,
+		       &num_terms,
+		       &one,
+		       gram_matrix,
+		       &order);
+	}
+	// dsyrk only updates the upper triangle
+	for (size_t j = 0; j<num_vectors; j++)
+		for (size_t k = j+1; k<num_vectors; k++)
+			gram_matrix[j*num_vectors+k] =
+				gram_matrix[k*num_vectors+j];
+	free_batch_reader(reader);
+	free(panel);
+}
+
+void fill_random(vector_t vector)
+{
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      group.length);
+		for (size_t j = 0; j<group.length; j++)
+			element_buffer[j] = 2*drand48()-1;
+		store_group_elements(element_buffer,vector,group);
+	}
+	free(element_buffer);
+}
+
+void map_vector(vector_t result,
+		combination_table_t result_combination_table,
+		vector_t source,
+		combination_table_t source_combination_table)
+{
+	log_entry("Mapping vector %s to %s",
+		  source->directory_name,
+		  result->directory_name);
+	size_t num_result_blocks = 0;
+	size_t num_source_blocks = 0;
+	basis_block_t *result_blocks =
+		get_basis_blocks(result_combination_table,&num_result_blocks);
+	basis_block_t *source_blocks =
+		get_basis_blocks(source_combination_table,&num_source_blocks);
+	assert(num_result_blocks == result->num_vector_blocks);
+	assert(num_source_blocks == source->num_vector_blocks);
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	size_t num_mapped_blocks = 0;
+	for (size_t i = 0; i<num_result_blocks; i++)
+	{
+		block_group_t result_group =
+		{
+			.first_block = i,
+			.num_blocks = 1,
+			.length = result->vector_blocks[i].block_length
+		};
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      result_group.length);
+		double *elements = element_buffer;
+		size_t j = 0;
+		while (j<num_source_blocks &&
+		       !same_basis_block_states(result_blocks[i],
+						source_blocks[j]))
+			j++;
+		if (j < num_source_blocks)
+		{
+			if (source->vector_blocks[j].block_length !=
+			    result_group.length)
+				error("Basis block %lu of %s has %lu states,"
+				      " but %lu in %s\n",
+				      i+1,
+				      result->directory_name,
+				      result_group.length,
+				      source->vector_blocks[j].block_length,
+				      source->directory_name);
+			block_group_t source_group =
+			{
+				.first_block = j,
+				.num_blocks = 1,
+				.length = result_group.length
+			};
+			elements = get_group_elements(reader,
+						      element_buffer,
+						      source,
+						      source_group);
+			submit_read_requests(reader);
+			num_mapped_blocks++;
+		}
+		else
+			memset(elements,0,result_group.length*sizeof(double));
+		store_group_elements(elements,result,result_group);
+	}
+	printf("Mapped %lu of %lu basis blocks from %s, %lu blocks are new\n",
+	       num_mapped_blocks,
+	       num_source_blocks,
+	       source->directory_name,
+	       num_result_blocks - num_mapped_blocks);
+	free_batch_reader(reader);
+	free(element_buffer);
+	free(result_blocks);
+	free(source_blocks);
+}
+
+void free_vector(vector_t vector)
+{
+	log_entry("free_vector: %p",vector);
+	release_vector_memory(vector);
+	free(vector->directory_name);
+	free(vector->vector_blocks);
+	if (vector->element_buffer != NULL)
+		free(vector->element_buffer);
+	if (vector->vector_file != NULL)
+		free_vector_file(vector->vector_file);
+	if (vector->storage == MEMORY_STORAGE)
+		free(vector->elements);
+	else if (vector->storage == MAPPED_FILE_STORAGE &&
+		 munmap(vector->elements,
+			vector->dimension*sizeof(double)) != 0)
+		error("Could not unmap vector %s. %s\n",
+		      vector->directory_name,
+		      strerror(errno));
+	free(vector);
+}
+
+static
+vector_t allocate_vector(vector_settings_t vector_settings)
+{
+	vector_t vector = (vector_t)calloc(1,sizeof(struct _vector_));
+	vector->dimension = sum_sizes(vector_settings.block_sizes,
+				      vector_settings.num_blocks);
+	vector->num_vector_blocks = vector_settings.num_blocks;
+	vector->vector_blocks =
+		(vector_block_t*)calloc(vector->num_vector_blocks,
+					sizeof(vector_block_t));
+	size_t start_index = 0;
+	vector->directory_name = copy_string(vector_settings.directory_name);
+	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	{
+		vector_block_t vector_block =
+		{
+			.start_index = start_index,
+			.block_length = vector_settings.block_sizes[i],
+			.block_id = i+1
+		};
+		vector->vector_blocks[i] = vector_block;
+		start_index += vector_settings.block_sizes[i];
+	}
+	vector->loaded_block.block_id = -1;
+	assert(vector_settings.storage != AUTOMATIC_STORAGE);
+	vector->storage = vector_settings.storage;
+	vector->elements = NULL;
+	return vector;
+}
+
+static
+void allocate_vector_elements(vector_t vector)
+{
+	if (vector->storage == MEMORY_STORAGE)
+	{
+		vector->elements = (double*)calloc(vector->dimension,
+						   sizeof(double));
+		if (vector->elements == NULL)
+			error("Could not allocate %lu elements for vector %s\n",
+			      vector->dimension,
+			      vector->directory_name);
+		return;
+	}
+	assert(vector->storage == MAPPED_FILE_STORAGE);
+	map_vector_file(vector,0);
+}
+
+/* Maps the vector file of a mapped vector. Unless the contents are kept,
+ * the file is truncated and extended with zeros. A kept file has to hold
+ * the whole vector.
+ */
+static
+void map_vector_file(vector_t vector,int keep_contents)
+{
+	char file_name[2049];
+	sprintf(file_name,"%s/vector",vector->directory_name);
+	int file_descriptor =
+		open(file_name,
+		     O_RDWR | O_CREAT | (keep_contents ? 0 : O_TRUNC),
+		     0644);
+	if (file_descriptor < 0)
+		error("Could not open vector file %s. %s\n",
+		      file_name,
+		      strerror(errno));
+	const size_t num_bytes = vector->dimension*sizeof(double);
+	struct stat file_status;
+	if (keep_contents &&
+	    (fstat(file_descriptor,&file_status) != 0 ||
+	     file_status.st_size != num_bytes))
+		error("Vector file %s does not hold the %lu elements of the"
+		      " vector\n",
+		      file_name,
+		      vector->dimension);
+	if (!keep_contents && ftruncate(file_descriptor,num_bytes) != 0)
+		error("Could not resize vector file %s. %s\n",
+		      file_name,
+		      strerror(errno));
+	void *mapping = mmap(NULL,num_bytes,
+			     PROT_READ | PROT_WRITE,MAP_SHARED,
+			     file_descriptor,0);
+	if (mapping == MAP_FAILED)
+		error("Could not map vector file %s. %s\n",
+		      file_name,
+		      strerror(errno));
+	close(file_descriptor);
+	vector->elements = (double*)mapping;
+}
+
+static
+int has_mapped_vector_file(vector_t vector)
+{
+	char file_name[2049];
+	sprintf(file_name,"%s/vector",vector->directory_name);
+	return access(file_name,F_OK) == 0;
+}
+
+static
+int has_vector_block_files(vector_t vector)
 {
-	log_entry("reorthogonalize vector %s",
-		  vector_to_orthogonalize->directory_name);
-	for (size_t i = 0; i<num_basis_states; i++)
+	char file_name[2049];
+	for (size_t i = 0; i<vector->num_vector_blocks; i++)
 	{
-		double projection =
-			scalar_multiplication(vector_to_orthogonalize,
-					      basis[i]);
-		subtract_line_projection(vector_to_orthogonalize,
-					 projection,
-					 basis[i]);
+		sprintf(file_name,
+			"%s/vec_%lu",
+			vector->directory_name,
+			vector->vector_blocks[i].block_id);
+		if (access(file_name,F_OK) != 0)
+			return 0;
 	}
-} 	
+	return 1;
+}
 
-void free_vector(vector_t vector)
+/* Reads the elements of a memory vector from the file of a mapped vector
+ * in the same directory.
+ */
+static
+void read_mapped_vector_file(vector_t vector)
 {
-	log_entry("free_vector: %p",vector);
-	free(vector->directory_name);
-	free(vector->vector_blocks);
-	if (vector->element_buffer != NULL)
-		free(vector->element_buffer);
-	free(vector);
+	char file_name[2049];
+	sprintf(file_name,"%s/vector",vector->directory_name);
+	FILE *vector_file = fopen(file_name,"r");
+	if (vector_file == NULL)
+		error("Could not open vector file %s. %s\n",
+		      file_name,
+		      strerror(errno));
+	if (fread(vector->elements,sizeof(double),vector->dimension,
+		  vector_file) != vector->dimension)
+		error("Vector file %s does not hold the %lu elements of the"
+		      " vector\n",
+		      file_name,
+		      vector->dimension);
+	fclose(vector_file);
 }
 
 	static
@@ -547,6 +1637,10 @@ FILE* open_block_file(vector_t vector,
 	log_entry("Open vector file %s with file mode %s",
 		  file_name,file_mode);	  
 	FILE *vector_file = fopen(file_name,file_mode);
+	// A block file that is overwritten in place may not exist yet
+	if (vector_file == NULL && errno == ENOENT &&
+	    strcmp(file_mode,"r+") == 0)
+		vector_file = fopen(file_name,"w");
 	if (vector_file == NULL)
 		error("Could not open vector file %s. %s\n",
 		      file_name,
@@ -586,15 +1680,31 @@ void load_vector_elements(double *vector_elements,
 			  vector_block_t vector_block)
 {
 	assert(vector_elements != NULL);
-	FILE* vector_file = open_block_file(vector,vector_block,"r");
-	size_t read_length = fread(vector_elements,
-				   sizeof(double),
-				   vector_block.block_length,
-				   vector_file);
-	if (read_length != vector_block.block_length)
-		error("Could not read vector elements. Read %lu elements\n",
-		      read_length);
-	fclose(vector_file);
+	if (vector->vector_file != NULL)
+		read_vector_file_block(vector->vector_file,
+				       vector_block.block_id,
+				       vector_elements);
+	else
+	{
+		FILE* vector_file = open_block_file(vector,vector_block,"r");
+		size_t read_length = fread(vector_elements,
+					   vector->single_precision ?
+					   sizeof(float) : sizeof(double),
+					   vector_block.block_length,
+					   vector_file);
+		if (read_length != vector_block.block_length)
+			error("Could not read vector elements."
+			      " Read %lu elements\n",
+			      read_length);
+		fclose(vector_file);
+	}
+	if (vector->single_precision)
+	{
+		// Widened from the back, where no float has to be kept
+		float *single_elements = (float*)vector_elements;
+		for (size_t i = vector_block.block_length; i-- > 0;)
+			vector_elements[i] = single_elements[i];
+	}
 }
 
 	static
@@ -602,17 +1712,519 @@ void save_vector_elements(double *vector_elements,
 			  vector_t vector,
 			  vector_block_t vector_block)
 {
-	FILE* vector_file = open_block_file(vector,vector_block,"w");
 	log_entry("saving vector %s:%lu with length %lu",
 		  vector->directory_name,
 		  vector_block.block_id,
 		  vector_block.block_length);
-	if (fwrite(vector_elements,
-		   sizeof(double),
-		   vector_block.block_length,
-		   vector_file) != vector_block.block_length)
-		error("Could not read vector elements\n");
-	fclose(vector_file);
+	void *elements = vector_elements;
+	const size_t element_size =
+		vector->single_precision ? sizeof(float) : sizeof(double);
+	if (vector->single_precision)
+	{
+		float *single_elements =
+			(float*)malloc(vector_block.block_length*sizeof(float));
+		for (size_t i = 0; i<vector_block.block_length; i++)
+			single_elements[i] = (float)vector_elements[i];
+		elements = single_elements;
+	}
+	if (vector->vector_file != NULL)
+		write_vector_file_block(vector->vector_file,
+					vector_block.block_id,
+					elements);
+	else
+	{
+		/* The block file is overwritten in place, truncating a file
+		 * that was just written makes the file system flush it
+		 * before the write can continue. Only a file that was longer,
+		 * from double precision or from an earlier run in the same
+		 * directory, is cut to the new length.
+		 */
+		FILE* vector_file = open_block_file(vector,vector_block,"r+");
+		if (fwrite(elements,
+			   element_size,
+			   vector_block.block_length,
+			   vector_file) != vector_block.block_length)
+			error("Could not write vector elements\n");
+		fflush(vector_file);
+		const off_t file_size = vector_block.block_length*element_size;
+		struct stat file_status;
+		if (fstat(fileno(vector_file),&file_status) != 0 ||
+		    (file_status.st_size != file_size &&
+		     ftruncate(fileno(vector_file),file_size) != 0))
+			error("Could not cut block %lu of vector %s. %s\n",
+			      vector_block.block_id,
+			      vector->directory_name,
+			      strerror(errno));
+		fclose(vector_file);
+	}
+	if (elements != vector_elements)
+		free(elements);
+}
+
+/* Writes the copy of the elements block by block, the vector itself is
+ * not touched.
+ */
+static
+void *write_elements_in_background(void *argument)
+{
+	vector_t vector = (vector_t)argument;
+	for (size_t i = 0; i<vector->num_vector_blocks; i++)
+	{
+		vector_block_t vector_block = vector->vector_blocks[i];
+		save_vector_elements(vector->written_elements +
+				     vector_block.start_index,
+				     vector,
+				     vector_block);
+	}
+	return NULL;
+}
+
+static
+void get_precision_marker_path(char *file_name,vector_t vector)
+{
+	sprintf(file_name,"%s/single_precision",vector->directory_name);
+}
+
+static
+block_group_t get_block_group(vector_t vector,size_t first_block)
+{
+	return get_block_group_of_length(vector,
+					 first_block,
+					 max_block_group_length);
+}
+
+static
+block_group_t get_block_group_of_length(vector_t vector,
+					size_t first_block,
+					size_t max_length)
+{
+	block_group_t group =
+	{
+		.first_block = first_block,
+		.num_blocks = 0,
+		.length = 0
+	};
+	while (first_block + group.num_blocks < vector->num_vector_blocks)
+	{
+		size_t block_length =
+			vector->vector_blocks[first_block +
+					      group.num_blocks].block_length;
+		if (group.num_blocks > 0 &&
+		    group.length + block_length > max_length)
+			break;
+		group.length += block_length;
+		group.num_blocks++;
+	}
+	return group;
+}
+
+static
+int compare_block_groups(vector_t first_vector,
+			 vector_t second_vector,
+			 block_group_t group)
+{
+	for (size_t i = group.first_block;
+	     i < group.first_block + group.num_blocks;
+	     i++)
+		if (!compare_blocks(first_vector->vector_blocks[i],
+				    second_vector->vector_blocks[i]))
+			return 0;
+	return 1;
+}
+
+/* Single precision elements are queued to the front of the group elements
+ * and have to be widened by widen_group_elements once they are read.
+ */
+static
+void queue_group_elements(batch_reader_t reader,
+			  double *group_elements,
+			  vector_t vector,
+			  block_group_t group)
+{
+	const size_t element_size =
+		vector->single_precision ? sizeof(float) : sizeof(double);
+	char *destination = (char*)group_elements;
+	char file_name[2049];
+	for (size_t i = group.first_block;
+	     i < group.first_block + group.num_blocks;
+	     i++)
+	{
+		vector_block_t vector_block = vector->vector_blocks[i];
+		size_t offset = 0;
+		if (vector->vector_file != NULL)
+		{
+			strcpy(file_name,
+			       get_vector_file_path(vector->vector_file));
+			offset = get_vector_file_block_offset
+				(vector->vector_file,vector_block.block_id);
+		}
+		else
+			sprintf(file_name,
+				"%s/vec_%lu",
+				vector->directory_name,
+				vector_block.block_id);
+		add_read_request(reader,
+				 file_name,
+				 destination,
+				 vector_block.block_length*element_size,
+				 offset);
+		destination += vector_block.block_length*element_size;
+	}
+}
+
+static
+void widen_group_elements(double *group_elements,
+			  vector_t vector,
+			  block_group_t group)
+{
+	if (!vector->single_precision)
+		return;
+	float *single_elements = (float*)group_elements;
+	for (size_t i = group.length; i-- > 0;)
+		group_elements[i] = single_elements[i];
+}
+
+static
+double *get_group_elements(batch_reader_t reader,
+			   double *group_buffer,
+			   vector_t vector,
+			   block_group_t group)
+{
+	if (vector->elements != NULL)
+		return vector->elements +
+			vector->vector_blocks[group.first_block].start_index;
+	if (vector->single_precision)
+	{
+		// The elements have to be widened before the caller submits
+		// the reader, so they are read right away
+		batch_reader_t single_reader = new_batch_reader();
+		queue_group_elements(single_reader,group_buffer,vector,group);
+		submit_read_requests(single_reader);
+		free_batch_reader(single_reader);
+		widen_group_elements(group_buffer,vector,group);
+		return group_buffer;
+	}
+	queue_group_elements(reader,group_buffer,vector,group);
+	return group_buffer;
+}
+
+static
+void save_group_elements(double *group_elements,
+			 vector_t vector,
+			 block_group_t group)
+{
+	// The elements of vectors not stored in block files are changed in
+	// place
+	if (vector->elements != NULL)
+	{
+		vector->has_unwritten_changes = 1;
+		return;
+	}
+	// A block loaded by get_element or set_element would be out of date
+	vector->loaded_block.block_id = -1;
+	for (size_t i = group.first_block;
+	     i < group.first_block + group.num_blocks;
+	     i++)
+	{
+		vector_block_t vector_block = vector->vector_blocks[i];
+		save_vector_elements(group_elements,
+				     vector,
+				     vector_block);
+		group_elements += vector_block.block_length;
+	}
+}
+
+/* Writes the group elements to the vector, also when it is kept in memory.
+ */
+static
+void store_group_elements(double *group_elements,
+			  vector_t vector,
+			  block_group_t group)
+{
+	if (vector->elements != NULL)
+	{
+		memcpy(vector->elements +
+		       vector->vector_blocks[group.first_block].start_index,
+		       group_elements,
+		       group.length*sizeof(double));
+		vector->has_unwritten_changes = 1;
+	}
+	else
+		save_group_elements(group_elements,vector,group);
+}
+
+static
+size_t get_panel_size(block_group_t group,size_t num_basis_states)
+{
+	size_t panel_size = max_panel_length/group.length;
+	if (panel_size == 0)
+		panel_size = 1;
+	return panel_size < num_basis_states ? panel_size : num_basis_states;
+}
+
+/* The number of vectors read at once next to num_results group sized
+ * arrays.
+ */
+static
+size_t get_combination_panel_size(block_group_t group,
+				  size_t num_results,
+				  size_t num_vectors)
+{
+	size_t panel_size =
+		max_panel_length/group.length > num_results + 1 ?
+		max_panel_length/group.length - num_results : 1;
+	return panel_size < num_vectors ? panel_size : num_vectors;
+}
+
+/* Adds factor times the combinations of the vectors to the results, or
+ * sets the results to them. Since all vectors of a block group are read
+ * before the results are written, the results may be some of the vectors
+ * when they are set.
+ */
+static
+void accumulate_combinations(vector_t *results,
+			     size_t num_results,
+			     vector_t *vectors,
+			     size_t num_vectors,
+			     const double *coefficients,
+			     int add_to_results,
+			     double factor)
+{
+	if (num_results == 0 || num_vectors == 0)
+		return;
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	// The results of a group and at least one panel vector have to fit
+	size_t max_group_length = max_panel_length/(num_results+1);
+	if (max_group_length > max_block_group_length)
+		max_group_length = max_block_group_length;
+	block_group_t group;
+	for (size_t i = 0; i<vectors[0]->num_vector_blocks;
+	     i += group.num_blocks)
+	{
+		group = get_block_group_of_length(vectors[0],i,
+						  max_group_length);
+		size_t panel_size =
+			get_combination_panel_size(group,
+						   num_results,
+						   num_vectors);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      (num_results+panel_size)*group.length);
+		double *result_elements = element_buffer;
+		double *panel = element_buffer + num_results*group.length;
+		if (add_to_results)
+			read_basis_panel(result_elements,reader,results,
+					 num_results,group);
+		else
+			memset(result_elements,0,
+			       num_results*group.length*sizeof(double));
+		for (size_t j = 0; j<num_vectors; j += panel_size)
+		{
+			size_t num_panel_vectors =
+				num_vectors - j < panel_size ?
+				num_vectors - j : panel_size;
+			assert(compare_block_groups(vectors[0],
+						    vectors[j],
+						    group));
+			read_basis_panel(panel,reader,vectors + j,
+					 num_panel_vectors,group);
+			char no_transpose = 'N';
+			int num_rows = (int)group.length;
+			int num_columns = (int)num_results;
+			int num_terms = (int)num_panel_vectors;
+			int leading_dimension = (int)num_vectors;
+			double one = 1.0;
+			dgemm_(&no_transpose,
+			       &no_transpose,
+			       &num_rows,
+			       &num_columns,
+			       &num_terms,
+			       &factor,
+			       panel,
+			       &num_rows,
+			       (double*)coefficients + j,
+			       &leading_dimension,
+			       &one,
+			       result_elements,
+			       &num_rows);
+		}
+		// All vectors of the group have been read, so the results can
+		// overwrite them
+		for (size_t j = 0; j<num_results; j++)
+			store_group_elements(result_elements + j*group.length,
+					     results[j],
+					     group);
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+}
+
+/* Reads the group elements of the basis vectors into the columns of the
+ * panel.
+ */
+static
+void read_basis_panel(double *panel,
+		      batch_reader_t reader,
+		      vector_t *basis,
+		      size_t num_panel_vectors,
+		      block_group_t group)
+{
+	for (size_t i = 0; i<num_panel_vectors; i++)
+	{
+		double *column = panel + i*group.length;
+		if (basis[i]->elements != NULL)
+			memcpy(column,
+			       basis[i]->elements +
+			       basis[i]->vector_blocks[group.first_block].start_index,
+			       group.length*sizeof(double));
+		else
+			queue_group_elements(reader,column,basis[i],group);
+	}
+	submit_read_requests(reader);
+	for (size_t i = 0; i<num_panel_vectors; i++)
+		widen_group_elements(panel + i*group.length,basis[i],group);
+}
+
+/* The basis blocks in the order of the vector blocks.
+ */
+static
+basis_block_t *get_basis_blocks(combination_table_t combination_table,
+				size_t *num_basis_blocks)
+{
+	*num_basis_blocks = get_num_basis_blocks(combination_table);
+	basis_block_t *basis_blocks =
+		(basis_block_t*)malloc(*num_basis_blocks*sizeof(basis_block_t));
+	reset_basis_block_iterator(combination_table);
+	for (size_t i = 0; i<*num_basis_blocks; i++)
+		basis_blocks[i] = next_basis_block(combination_table);
+	return basis_blocks;
+}
+
+/* The proton and neutron states of a basis block are all combinations with
+ * its energies and M, which do not depend on the model space.
+ */
+static
+int same_basis_block_states(basis_block_t first_block,
+			    basis_block_t second_block)
+{
+	return first_block.Ep == second_block.Ep &&
+		first_block.Mp == second_block.Mp &&
+		first_block.En == second_block.En &&
+		first_block.Mn == second_block.Mn;
+}
+
+static
+void project_on_basis(double *projections,
+		      vector_t vector,
+		      vector_t *basis,
+		      size_t num_basis_states)
+{
+	memset(projections,0,num_basis_states*sizeof(double));
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		const size_t panel_size =
+			get_panel_size(group,num_basis_states);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      (panel_size+1)*group.length);
+		double *panel = element_buffer + group.length;
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		submit_read_requests(reader);
+		for (size_t j = 0; j<num_basis_states; j += panel_size)
+		{
+			size_t num_panel_vectors =
+				num_basis_states - j < panel_size ?
+				num_basis_states - j : panel_size;
+			assert(compare_block_groups(vector,basis[j],group));
+			read_basis_panel(panel,reader,basis + j,
+					 num_panel_vectors,group);
+			char transpose = 'T';
+			int num_rows = (int)group.length;
+			int num_columns = (int)num_panel_vectors;
+			double one = 1.0;
+			int increment = 1;
+			dgemv_(&transpose,
+			       &num_rows,
+			       &num_columns,
+			       &one,
+			       panel,
+			       &num_rows,
+			       vector_elements,
+			       &increment,
+			       &one,
+			       projections + j,
+			       &increment);
+		}
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
+}
+
+static
+void subtract_basis_projections(vector_t vector,
+				double *projections,
+				vector_t *basis,
+				size_t num_basis_states)
+{
+	double *element_buffer = NULL;
+	size_t element_buffer_size = 0;
+	batch_reader_t reader = new_batch_reader();
+	block_group_t group;
+	for (size_t i = 0; i<vector->num_vector_blocks; i += group.num_blocks)
+	{
+		group = get_block_group(vector,i);
+		const size_t panel_size =
+			get_panel_size(group,num_basis_states);
+		expand_element_buffer(&element_buffer,
+				      &element_buffer_size,
+				      (panel_size+1)*group.length);
+		double *panel = element_buffer + group.length;
+		double *vector_elements =
+			get_group_elements(reader,
+					   element_buffer,
+					   vector,
+					   group);
+		submit_read_requests(reader);
+		for (size_t j = 0; j<num_basis_states; j += panel_size)
+		{
+			size_t num_panel_vectors =
+				num_basis_states - j < panel_size ?
+				num_basis_states - j : panel_size;
+			read_basis_panel(panel,reader,basis + j,
+					 num_panel_vectors,group);
+			char no_transpose = 'N';
+			int num_rows = (int)group.length;
+			int num_columns = (int)num_panel_vectors;
+			double minus_one = -1.0;
+			double one = 1.0;
+			int increment = 1;
+			dgemv_(&no_transpose,
+			       &num_rows,
+			       &num_columns,
+			       &minus_one,
+			       panel,
+			       &num_rows,
+			       projections + j,
+			       &increment,
+			       &one,
+			       vector_elements,
+			       &increment);
+		}
+		save_group_elements(vector_elements,vector,group);
+	}
+	free_batch_reader(reader);
+	free(element_buffer);
 }
 
 new_test(new_zero_vector,
@@ -811,3 +2423,486 @@ new_test(remove_plane_projection_on_vector,
 	 free(projected_vector_settings.directory_name);
 	);
 
+
+new_test(vector_storages_give_the_same_results,
+	 size_t num_blocks = 4;
+	 size_t block_sizes[4] = {30,1,45,24};
+	 vector_storage_t storages[4] =
+	 {
+	 BLOCK_FILE_STORAGE,
+	 MEMORY_STORAGE,
+	 MAPPED_FILE_STORAGE,
+	 SINGLE_FILE_STORAGE
+	 };
+	 double norms[4];
+	 double projections[4];
+	 for (size_t i = 0; i<4; i++)
+	 {
+		 vector_settings_t first_settings =
+		 {
+			 .directory_name =
+			 copy_string(get_test_file_path("first_vector")),
+			 .num_blocks = num_blocks,
+			 .block_sizes = block_sizes,
+			 .storage = storages[i]
+		 };
+		 vector_settings_t second_settings = first_settings;
+		 second_settings.directory_name =
+			 copy_string(get_test_file_path("second_vector"));
+		 srand48(1);
+		 vector_t first_vector = new_random_vector(first_settings);
+		 vector_t second_vector = new_random_vector(second_settings);
+		 scale(first_vector,1/norm(first_vector));
+		 vector_add_scaled(second_vector,0.5,first_vector);
+		 projections[i] = scalar_multiplication(first_vector,
+							second_vector);
+		 subtract_line_projection(second_vector,
+					  projections[i],
+					  first_vector);
+		 assert_that(fabs(scalar_multiplication(first_vector,
+							second_vector))
+			     < 1e-10);
+		 norms[i] = norm(second_vector);
+		 // The block files written for Minerva are read back
+		 write_vector_block_files(second_vector);
+		 free_vector(second_vector);
+		 second_vector = new_existing_vector(second_settings);
+		 assert_that(fabs(norm(second_vector) - norms[i]) < 1e-12);
+		 free_vector(first_vector);
+		 free_vector(second_vector);
+		 free(first_settings.directory_name);
+		 free(second_settings.directory_name);
+	 }
+	 for (size_t i = 1; i<4; i++)
+	 {
+		 assert_that(fabs(norms[i] - norms[0]) < 1e-12);
+		 assert_that(fabs(projections[i] - projections[0]) < 1e-12);
+	 }
+	);
+
+new_test(reopened_mapped_vector_keeps_its_elements,
+	 size_t num_blocks = 3;
+	 size_t block_sizes[3] = {20,7,13};
+	 vector_settings_t settings =
+	 {
+		 .directory_name =
+		 copy_string(get_test_file_path("mapped_vector")),
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes,
+		 .storage = MAPPED_FILE_STORAGE
+	 };
+	 vector_t vector = new_random_vector(settings);
+	 scale(vector,2.0);
+	 const uint64_t checksum = vector_checksum(vector);
+	 free_vector(vector);
+	 // No block files were written, the mapped file is reopened
+	 vector = new_existing_vector(settings);
+	 assert_that(vector_checksum(vector) == checksum);
+	 free_vector(vector);
+	 settings.storage = MEMORY_STORAGE;
+	 vector = new_existing_vector(settings);
+	 assert_that(vector_checksum(vector) == checksum);
+	 free_vector(vector);
+	 free(settings.directory_name);
+	);
+
+new_test(single_precision_storage_rounds_the_elements,
+	 size_t num_blocks = 4;
+	 size_t block_sizes[4] = {30,1,45,24};
+	 const size_t dimension = 100;
+	 vector_storage_t storages[3] =
+	 {
+	 BLOCK_FILE_STORAGE,
+	 MAPPED_FILE_STORAGE,
+	 SINGLE_FILE_STORAGE
+	 };
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 vector_settings_t settings =
+		 {
+			 .directory_name =
+			 copy_string(get_test_file_path("rounded_vector")),
+			 .num_blocks = num_blocks,
+			 .block_sizes = block_sizes,
+			 .storage = storages[i]
+		 };
+		 vector_settings_t other_settings = settings;
+		 other_settings.directory_name =
+			 copy_string(get_test_file_path("other_vector"));
+		 srand48(1);
+		 vector_t vector = new_random_vector(settings);
+		 vector_t other_vector = new_random_vector(other_settings);
+		 double elements[dimension];
+		 double expected_product = 0;
+		 for (size_t j = 0; j<dimension; j++)
+		 {
+			 elements[j] = (float)get_element(vector,j);
+			 expected_product +=
+				 elements[j]*get_element(other_vector,j);
+		 }
+		 set_single_precision_storage(vector,1);
+		 assert_that(has_single_precision_storage(vector));
+		 if (storages[i] != SINGLE_FILE_STORAGE)
+		 {
+			 char file_name[2049];
+			 sprintf(file_name,"%s/vec_3",settings.directory_name);
+			 FILE *block_file = fopen(file_name,"r");
+			 fseek(block_file,0,SEEK_END);
+			 assert_that(ftell(block_file) == 45*sizeof(float));
+			 fclose(block_file);
+		 }
+		 for (size_t j = 0; j<dimension; j++)
+			 assert_that(get_element(vector,j) == elements[j]);
+		 double product = 0;
+		 compute_gram_matrix(&product,&vector,1,&other_vector,1);
+		 assert_that(fabs(product - expected_product) < 1e-12);
+		 assert_that(fabs(scalar_multiplication(vector,other_vector) -
+				  expected_product) < 1e-12);
+		 // A resumed run finds the rounded block files
+		 free_vector(vector);
+		 vector = new_existing_vector(settings);
+		 assert_that(has_single_precision_storage(vector));
+		 for (size_t j = 0; j<dimension; j++)
+			 assert_that(get_element(vector,j) == elements[j]);
+		 set_single_precision_storage(vector,0);
+		 free_vector(vector);
+		 vector = new_existing_vector(settings);
+		 assert_that(!has_single_precision_storage(vector));
+		 for (size_t j = 0; j<dimension; j++)
+			 assert_that(get_element(vector,j) == elements[j]);
+		 free_vector(vector);
+		 free_vector(other_vector);
+		 free(settings.directory_name);
+		 free(other_settings.directory_name);
+	 }
+	);
+
+new_test(rewritten_block_file_loses_the_tail_of_an_older_file,
+	 size_t num_blocks = 3;
+	 size_t block_sizes[3] = {20,7,13};
+	 vector_settings_t settings =
+	 {
+		 .directory_name = copy_string(get_test_file_path("old_vector")),
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes,
+		 .storage = BLOCK_FILE_STORAGE
+	 };
+	 vector_t vector = new_random_vector(settings);
+	 // A longer block file, as if left by an earlier run
+	 char file_name[2049];
+	 sprintf(file_name,"%s/vec_2",settings.directory_name);
+	 FILE *block_file = fopen(file_name,"a");
+	 const double tail[4] = {1,2,3,4};
+	 fwrite(tail,sizeof(double),4,block_file);
+	 fclose(block_file);
+	 scale(vector,2.0);
+	 block_file = fopen(file_name,"r");
+	 fseek(block_file,0,SEEK_END);
+	 assert_that(ftell(block_file) == 7*sizeof(double));
+	 fclose(block_file);
+	 free_vector(vector);
+	 free(settings.directory_name);
+	);
+
+new_test(vector_kept_in_memory_is_written_in_the_background,
+	 size_t num_blocks = 3;
+	 size_t block_sizes[3] = {20,7,13};
+	 vector_storage_t storages[2] =
+	 {
+	 BLOCK_FILE_STORAGE,
+	 SINGLE_FILE_STORAGE
+	 };
+	 for (size_t i = 0; i<2; i++)
+	 {
+		 vector_settings_t settings =
+		 {
+			 .directory_name =
+			 copy_string(get_test_file_path("kept_vector")),
+			 .num_blocks = num_blocks,
+			 .block_sizes = block_sizes,
+			 .storage = storages[i]
+		 };
+		 vector_t vector = new_random_vector(settings);
+		 keep_vector_in_memory(vector);
+		 scale(vector,2.0);
+		 const uint64_t written_checksum = vector_checksum(vector);
+		 write_vector_in_background(vector);
+		 // A change during the write stays in memory
+		 set_element(vector,25,1.0);
+		 const uint64_t changed_checksum = vector_checksum(vector);
+		 wait_for_vector_write(vector);
+		 vector_t written_vector = new_existing_vector(settings);
+		 assert_that(vector_checksum(written_vector) == written_checksum);
+		 free_vector(written_vector);
+		 release_vector_memory(vector);
+		 written_vector = new_existing_vector(settings);
+		 assert_that(vector_checksum(written_vector) == changed_checksum);
+		 free_vector(written_vector);
+		 free_vector(vector);
+		 free(settings.directory_name);
+	 }
+	);
+
+new_test(lanczos_step_gives_normalized_orthogonal_vector,
+	 size_t num_blocks = 3;
+	 size_t block_sizes[3] = {20,7,13};
+	 vector_settings_t settings =
+	 {
+		 .directory_name = copy_string(get_test_file_path("previous")),
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes
+	 };
+	 vector_t previous = new_random_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name = copy_string(get_test_file_path("current"));
+	 vector_t current = new_random_vector(settings);
+	 free(settings.directory_name);
+	 settings.directory_name = copy_string(get_test_file_path("next"));
+	 vector_t next = new_random_vector(settings);
+	 free(settings.directory_name);
+	 scale(previous,1/norm(previous));
+	 subtract_line_projection(current,
+				  scalar_multiplication(current,previous),
+				  previous);
+	 scale(current,1/norm(current));
+	 lanczos_products_t products;
+	 vector_traffic_t traffic =
+	 	lanczos_step_products(&products,next,current,previous);
+	 assert_that(traffic.bytes_read == 3*40*sizeof(double));
+	 assert_that(traffic.bytes_written == 0);
+	 assert_that(fabs(products.v_w -
+			  scalar_multiplication(current,next)) < 1e-12);
+	 double square_norm = 0;
+	 traffic = lanczos_step_update(next,
+				       products.v_w,current,
+				       products.previous_w,previous,
+				       1.0,&square_norm);
+	 assert_that(traffic.bytes_written == 40*sizeof(double));
+	 assert_that(fabs(sqrt(square_norm) - norm(next)) < 1e-12);
+	 assert_that(fabs(scalar_multiplication(next,current)) < 1e-12);
+	 assert_that(fabs(scalar_multiplication(next,previous)) < 1e-12);
+	 free_vector(previous);
+	 free_vector(current);
+	 free_vector(next);
+	);
+
+new_test(reorthogonalized_vector_is_orthogonal_to_basis,
+	 size_t num_blocks = 4;
+	 size_t block_sizes[4] = {10,25,3,12};
+	 const size_t num_basis_states = 6;
+	 vector_settings_t settings =
+	 {
+		 .directory_name = NULL,
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes
+	 };
+	 vector_t basis[6];
+	 char name[64];
+	 for (size_t i = 0; i<num_basis_states; i++)
+	 {
+		 sprintf(name,"basis_%lu",i);
+		 settings.directory_name = copy_string(get_test_file_path(name));
+		 basis[i] = new_random_vector(settings);
+		 free(settings.directory_name);
+		 reorthogonalize_vector(basis[i],basis,i);
+		 scale(basis[i],1/norm(basis[i]));
+	 }
+	 settings.directory_name = copy_string(get_test_file_path("vector"));
+	 vector_t vector = new_random_vector(settings);
+	 free(settings.directory_name);
+	 reorthogonalize_vector(vector,basis,num_basis_states);
+	 for (size_t i = 0; i<num_basis_states; i++)
+	 {
+		 assert_that(fabs(norm(basis[i]) - 1) < 1e-12);
+		 assert_that(fabs(scalar_multiplication(vector,basis[i]))
+			     < 1e-12);
+		 for (size_t j = 0; j<i; j++)
+			 assert_that(fabs(scalar_multiplication(basis[i],
+								basis[j]))
+				     < 1e-12);
+	 }
+	 for (size_t i = 0; i<num_basis_states; i++)
+		 free_vector(basis[i]);
+	 free_vector(vector);
+	);
+
+new_test(combine_vectors_in_place,
+	 size_t num_blocks = 3;
+	 size_t block_sizes[3] = {5,8,2};
+	 vector_settings_t settings =
+	 {
+		 .directory_name = NULL,
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes
+	 };
+	 vector_t vectors[3];
+	 double elements[3][15];
+	 char name[64];
+	 for (size_t i = 0; i<3; i++)
+	 {
+		 sprintf(name,"combined_%lu",i);
+		 settings.directory_name = copy_string(get_test_file_path(name));
+		 vectors[i] = new_random_vector(settings);
+		 free(settings.directory_name);
+		 for (size_t k = 0; k<15; k++)
+			 elements[i][k] = get_element(vectors[i],k);
+		 save_vector(vectors[i]);
+	 }
+	 // The first two vectors become 2*v0 - v2 and v1 + 3*v2
+	 const double coefficients[6] = {2,0,-1,0,1,3};
+	 combine_vectors(vectors,2,vectors,3,coefficients);
+	 for (size_t k = 0; k<15; k++)
+	 {
+		 assert_that(fabs(get_element(vectors[0],k) -
+				  (2*elements[0][k] - elements[2][k])) < 1e-12);
+		 assert_that(fabs(get_element(vectors[1],k) -
+				  (elements[1][k] + 3*elements[2][k])) < 1e-12);
+	 }
+	 for (size_t i = 0; i<3; i++)
+		 free_vector(vectors[i]);
+	);
+
+new_test(gram_matrix_and_subtracted_combinations,
+	 size_t num_blocks = 2;
+	 size_t block_sizes[2] = {9,4};
+	 vector_settings_t settings =
+	 {
+		 .directory_name = NULL,
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes
+	 };
+	 vector_t vectors[4];
+	 char name[64];
+	 for (size_t i = 0; i<4; i++)
+	 {
+		 sprintf(name,"gram_%lu",i);
+		 settings.directory_name = copy_string(get_test_file_path(name));
+		 vectors[i] = new_random_vector(settings);
+		 free(settings.directory_name);
+	 }
+	 double gram_matrix[4];
+	 compute_gram_matrix(gram_matrix,vectors,2,vectors+2,2);
+	 for (size_t i = 0; i<2; i++)
+		 for (size_t j = 0; j<2; j++)
+			 assert_that(fabs(gram_matrix[j*2+i] -
+					  scalar_multiplication(vectors[i],
+								vectors[2+j]))
+				     < 1e-12);
+	 double symmetric_gram_matrix[16];
+	 compute_symmetric_gram_matrix(symmetric_gram_matrix,vectors,4);
+	 for (size_t i = 0; i<4; i++)
+		 for (size_t j = 0; j<4; j++)
+			 assert_that(fabs(symmetric_gram_matrix[j*4+i] -
+					  scalar_multiplication(vectors[i],
+								vectors[j]))
+				     < 1e-12);
+	 // Removing the projections of the last two vectors on the first two
+	 // orthonormal ones leaves them orthogonal to these
+	 scale(vectors[0],1/norm(vectors[0]));
+	 reorthogonalize_vector(vectors[1],vectors,1);
+	 scale(vectors[1],1/norm(vectors[1]));
+	 compute_gram_matrix(gram_matrix,vectors,2,vectors+2,2);
+	 subtract_combinations(vectors+2,2,vectors,2,gram_matrix);
+	 for (size_t i = 0; i<2; i++)
+		 for (size_t j = 2; j<4; j++)
+			 assert_that(fabs(scalar_multiplication(vectors[i],
+								vectors[j]))
+				     < 1e-12);
+	 for (size_t i = 0; i<4; i++)
+		 free_vector(vectors[i]);
+	);
+
+new_test(symmetric_gram_matrix_of_several_block_groups,
+	 size_t num_blocks = 5;
+	 size_t block_sizes[5] = {30,1,45,24,17};
+	 const size_t num_vectors = 7;
+	 vector_settings_t settings =
+	 {
+		 .directory_name = NULL,
+		 .num_blocks = num_blocks,
+		 .block_sizes = block_sizes,
+		 .storage = MEMORY_STORAGE
+	 };
+	 vector_t vectors[num_vectors];
+	 char name[64];
+	 for (size_t i = 0; i<num_vectors; i++)
+	 {
+		 sprintf(name,"symmetric_gram_%lu",i);
+		 settings.directory_name = copy_string(get_test_file_path(name));
+		 vectors[i] = new_random_vector(settings);
+		 free(settings.directory_name);
+	 }
+	 // The vectors are read in groups of at most 40 elements
+	 const size_t original_max_panel_length = max_panel_length;
+	 max_panel_length = num_vectors*40;
+	 double symmetric_gram_matrix[num_vectors*num_vectors];
+	 compute_symmetric_gram_matrix(symmetric_gram_matrix,
+				       vectors,num_vectors);
+	 double gram_matrix[num_vectors*num_vectors];
+	 compute_gram_matrix(gram_matrix,
+			     vectors,num_vectors,
+			     vectors,num_vectors);
+	 max_panel_length = original_max_panel_length;
+	 for (size_t i = 0; i<num_vectors; i++)
+		 for (size_t j = 0; j<num_vectors; j++)
+		 {
+			 const double product =
+				 scalar_multiplication(vectors[i],vectors[j]);
+			 assert_that(fabs(symmetric_gram_matrix
+					  [j*num_vectors+i] - product)
+				     < 1e-12);
+			 assert_that(fabs(symmetric_gram_matrix
+					  [i*num_vectors+j] - product)
+				     < 1e-12);
+			 assert_that(fabs(symmetric_gram_matrix
+					  [j*num_vectors+i] -
+					  gram_matrix[j*num_vectors+i])
+				     < 1e-12);
+		 }
+	 for (size_t i = 0; i<num_vectors; i++)
+		 free_vector(vectors[i]);
+	);
+
+new_test(map_nmax0_vector_to_nmax2,
+	 const char *nmax0_combination_file =
+	 TEST_DATA "bacchus_run_data/he4/nmax0/comb.txt";
+	 const char *nmax2_combination_file =
+	 TEST_DATA "bacchus_run_data/he4/nmax2/comb.txt";
+	 combination_table_t nmax0_table =
+		 new_combination_table(nmax0_combination_file,2,2);
+	 combination_table_t nmax2_table =
+		 new_combination_table(nmax2_combination_file,2,2);
+	 vector_settings_t nmax0_settings = setup_vector_settings(nmax0_table);
+	 nmax0_settings.directory_name =
+		 copy_string(get_test_file_path("nmax0"));
+	 vector_settings_t nmax2_settings = setup_vector_settings(nmax2_table);
+	 nmax2_settings.directory_name =
+		 copy_string(get_test_file_path("nmax2"));
+	 vector_t nmax0_vector = new_random_vector(nmax0_settings);
+	 vector_t nmax2_vector = new_random_vector(nmax2_settings);
+	 map_vector(nmax2_vector,nmax2_table,nmax0_vector,nmax0_table);
+	 // The Nmax 0 blocks are also in the Nmax 2 space, the rest is zero
+	 assert_that(fabs(norm(nmax2_vector) - norm(nmax0_vector)) < 1e-12);
+	 size_t num_found = 0;
+	 for (size_t i = 0; i<vector_dimension(nmax2_vector); i++)
+	 {
+		 double element = get_element(nmax2_vector,i);
+		 if (element == 0.0)
+			 continue;
+		 int found = 0;
+		 for (size_t j = 0; j<vector_dimension(nmax0_vector); j++)
+			 if (get_element(nmax0_vector,j) == element)
+				 found = 1;
+		 assert_that(found);
+		 num_found++;
+	 }
+	 assert_that(num_found == vector_dimension(nmax0_vector));
+	 free_vector(nmax0_vector);
+	 free_vector(nmax2_vector);
+	 free(nmax0_settings.directory_name);
+	 free(nmax2_settings.directory_name);
+	 free(nmax0_settings.block_sizes);
+	 free(nmax2_settings.block_sizes);
+	 free_combination_table(nmax0_table);
+	 free_combination_table(nmax2_table);
+	);
@@ -3,22 +3,61 @@
 
 #include <stdlib.h>
 #include <combination_table/combination_table.h>
+#include <math_tools/math_tools.h>
 
 struct _vector_;
 typedef struct _vector_ *vector_t;
 
+/* Where the elements of a vector live. With block files every basis block
+ * is a file in the vector directory. With a single file all blocks are in
+ * one vector file, see vector_file.h, which is read and written in place.
+ * Minerva reads and writes both layouts. The memory and mapped file
+ * storages keep the whole vector as one array, in RAM or in a single mmap'd
+ * file, and only write the block files when they are needed by a matrix
+ * vector multiplication.
+ */
+typedef enum
+{
+	BLOCK_FILE_STORAGE,
+	MEMORY_STORAGE,
+	MAPPED_FILE_STORAGE,
+	AUTOMATIC_STORAGE,
+	SINGLE_FILE_STORAGE
+} vector_storage_t;
+
+/* The number of bytes of vector elements that an operation has read and
+ * written.
+ */
+typedef struct
+{
+	size_t bytes_read;
+	size_t bytes_written;
+} vector_traffic_t;
+
 typedef struct {
 	char *directory_name;
 	size_t num_blocks;
 	size_t *block_sizes;
+	vector_storage_t storage;
 } vector_settings_t;
 
 vector_settings_t setup_vector_settings(combination_table_t combination_table);
 
+/* Chooses the storage for num_vectors vectors of the given dimension from
+ * the currently available memory, of which reserved_memory is kept for
+ * other purposes.
+ */
+vector_storage_t select_vector_storage(size_t dimension,
+				       size_t num_vectors,
+				       size_t reserved_memory);
+
 vector_t new_zero_vector(vector_settings_t vector_settings);
 
 vector_t new_random_vector(vector_settings_t vector_settings);
 
+/* Opens the vector in its directory. A vector found in a vector file keeps
+ * single file storage, whatever the storage of the settings.
+ */
 vector_t new_existing_vector(vector_settings_t vector_settings);
 
 void set_element(vector_t vector,
@@ -30,6 +69,67 @@ double get_element(vector_t vector,
 
 const char *get_vector_path(vector_t vector);
 
+/* Copies all elements to the contiguous array, reading the blocks of a
+ * vector in files in groups.
+ */
+void copy_vector_elements(double *elements,const vector_t vector);
+
+/* Sets all elements from the contiguous array.
+ */
+void set_vector_elements(vector_t vector,const double *elements);
+
+/* Writes the elements to the block files in the vector directory, does
+ * nothing if the vector is stored in block files or a vector file. For a
+ * vector kept in memory it waits for the background write and writes the
+ * changes since, to the block files or the vector file.
+ */
+void write_vector_block_files(vector_t vector);
+
+/* Reads the elements from the block files in the vector directory, does
+ * nothing if the vector is stored in block files or a vector file.
+ */
+void read_vector_block_files(vector_t vector);
+
+/* Rounds the stored elements to single precision, which halves the size of
+ * the vector on disk, or stores them in double precision again. Vector
+ * operations still compute in double precision. A mapped vector moves to
+ * block files, a vector kept in memory does not change. Minerva reads double
+ * precision block files, so only vectors that are not multiplied with the
+ * Hamiltonian any more should be rounded.
+ */
+void set_single_precision_storage(vector_t vector,int single_precision);
+
+/* Keeps a copy of the elements of a vector stored in files in memory, so
+ * that the vector operations do not read its files. The changes are
+ * written to the files by write_vector_in_background, by
+ * write_vector_block_files or when the vector leaves memory again with
+ * release_vector_memory. Does nothing for vectors in memory or mapped
+ * files and for single precision vectors.
+ */
+void keep_vector_in_memory(vector_t vector);
+
+/* Starts writing the changes of a vector kept in memory to its files in a
+ * background thread. The thread writes a copy of the elements, so the
+ * vector can still be read and changed meanwhile.
+ */
+void write_vector_in_background(vector_t vector);
+
+/* Waits until the background write of the vector has completed.
+ */
+void wait_for_vector_write(vector_t vector);
+
+/* The elements of a vector in memory or kept in memory, NULL when they are
+ * only in files. They may be newer than the files.
+ */
+const double *get_vector_elements_in_memory(vector_t vector);
+
+/* Writes the remaining changes of a vector kept in memory to its files and
+ * frees the copy of its elements.
+ */
+void release_vector_memory(vector_t vector);
+
+int has_single_precision_storage(vector_t vector);
+
 void save_vector(vector_t vector);
 
 void print_vector(vector_t vector);
@@ -51,15 +151,99 @@ void subtract_plane_projection(vector_t target_vector,
 
 double norm(const vector_t vector);
 
+/* The FNV-1a hash of the elements, which does not depend on the storage.
+ */
+uint64_t vector_checksum(const vector_t vector);
+
 void vector_add_scaled(vector_t result,
 		       double scaling_factor,
 		       const vector_t term);
 
 void scale(vector_t vector,double scaling);
 
+/* Divides every element by the difference of the corresponding element of
+ * the diagonal and the shift. Differences smaller than min_difference in
+ * magnitude are replaced by +-min_difference.
+ */
+void divide_by_shifted_diagonal(vector_t vector,
+				const vector_t diagonal,
+				double shift,
+				double min_difference);
+
+/* Computes all scalar products of w, v and previous in one read pass.
+ * previous may be NULL.
+ */
+vector_traffic_t lanczos_step_products(lanczos_products_t *products,
+				       const vector_t w,
+				       const vector_t v,
+				       const vector_t previous);
+
+/* Sets w to scaling*(w - alpha*v - beta*previous) in one read and one write
+ * pass and stores the square norm of w - alpha*v - beta*previous in
+ * square_norm. previous may be NULL.
+ */
+vector_traffic_t lanczos_step_update(vector_t w,
+				     double alpha,
+				     const vector_t v,
+				     double beta,
+				     const vector_t previous,
+				     double scaling,
+				     double *square_norm);
+
 void reorthogonalize_vector(vector_t vector_to_orthogonalize,
 			    vector_t *basis,
 			    size_t num_basis_states); 	
 
+/* Sets results[i] to the sum over j of
+ * coefficients[i*num_vectors + j]*vectors[j], the coefficients are a column
+ * major num_vectors x num_results matrix. The results may be some of the
+ * vectors.
+ */
+void combine_vectors(vector_t *results,
+		     size_t num_results,
+		     vector_t *vectors,
+		     size_t num_vectors,
+		     const double *coefficients);
+
+/* Subtracts the combinations of the vectors given by the column major
+ * num_vectors x num_targets coefficients from the targets, which must not
+ * be among the vectors.
+ */
+void subtract_combinations(vector_t *targets,
+			   size_t num_targets,
+			   vector_t *vectors,
+			   size_t num_vectors,
+			   const double *coefficients);
+
+/* Sets the column major num_first_vectors x num_second_vectors matrix to
+ * the scalar products of the first and second vectors.
+ */
+void compute_gram_matrix(double *gram_matrix,
+			 vector_t *first_vectors,
+			 size_t num_first_vectors,
+			 vector_t *second_vectors,
+			 size_t num_second_vectors);
+
+/* Sets the num_vectors x num_vectors matrix to the scalar products of the
+ * vectors. Every vector is read once, in block groups that all vectors
+ * fit in, and the products of a group are added with a rank k update.
+ */
+void compute_symmetric_gram_matrix(double *gram_matrix,
+				   vector_t *vectors,
+				   size_t num_vectors);
+
+/* Sets all elements to random numbers between -1 and 1.
+ */
+void fill_random(vector_t vector);
+
+/* Sets the result to the source vector from another model space, the basis
+ * blocks are matched by the energies and M of their protons and neutrons.
+ * Blocks that the source does not have are set to zero.
+ */
+void map_vector(vector_t result,
+		combination_table_t result_combination_table,
+		vector_t source,
+		combination_table_t source_combination_table);
+
 void free_vector(vector_t vector);
 #endif
@@ -8,18 +8,10 @@ void create_norm_matrix(const char *norm_matrix_path,
 	double *matrix_elements = (double*)malloc(num_training_vectors*
 						  num_training_vectors*
 						  sizeof(double));	
-
-	for (size_t i = 0; i<num_training_vectors; i++)
-	{
-		for (size_t j = i; j<num_training_vectors; j++)
-		{
-			double element = 
-				scalar_multiplication(training_vectors[i],
-						      training_vectors[j]);
-			matrix_elements[i*num_training_vectors+j] = element;
-			matrix_elements[j*num_training_vectors+i] = element;
-		}
-	}
+	// The training vectors are streamed once instead of once per pair
+	compute_symmetric_gram_matrix(matrix_elements,
+				      training_vectors,
+				      num_training_vectors);
 	save_as_numpy_matrix(norm_matrix_path,
 			     matrix_elements,
 			     num_training_vectors,
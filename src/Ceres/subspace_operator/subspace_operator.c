@@ -40,18 +40,23 @@ void create_subspace_operator(const char *subspace_operator_path,
 	double *matrix_elements = (double*)malloc(num_training_vectors*
 						  num_training_vectors*
 						  sizeof(double));	
+	/* Element i*n+j is the product of training vector j and
+	 * intermediate vector i. All of them come from one streaming pass,
+	 * the upper triangle is mirrored to keep the matrix symmetric.
+	 */
+	compute_gram_matrix(matrix_elements,
+			    training_vectors,
+			    num_training_vectors,
+			    intermediate_vectors,
+			    num_training_vectors);
 	for (size_t i = 0; i<num_training_vectors; i++)
 	{
-		for (size_t j = i; j<num_training_vectors; j++)
-		{
-			double element =
-				scalar_multiplication(training_vectors[j],
-						      intermediate_vectors[i]);	      
-			matrix_elements[i*num_training_vectors+j] = element;
-			matrix_elements[j*num_training_vectors+i] = element;
-		}
+		for (size_t j = i+1; j<num_training_vectors; j++)
+			matrix_elements[j*num_training_vectors+i] =
+				matrix_elements[i*num_training_vectors+j];
 		free_vector(intermediate_vectors[i]);
 	}
+	free(intermediate_vectors);
 	free_matrix(operator);
 	save_as_numpy_matrix(subspace_operator_path,
 			     matrix_elements,
@@ -13,6 +13,7 @@ struct _arguments_
 	int to_few_arguments;
 	int single_block;
 	int no_2nf;
+	int matrix_free_2nf;
 	int lec_set;
 	int exclude_kinetic_energy;
 	char *program_name;
@@ -22,6 +23,10 @@ struct _arguments_
 	char *index_list_path;
 	char *output_path;
 	char *finished_energy_blocks;
+	char *input_vector_path;
+	char *evaluation_order_path;
+	char *minerva_index_list_path;
+	char *matrix_file_path;
 	size_t block_id;
 	size_t num_protons;
 	size_t num_neutrons;
@@ -128,10 +133,19 @@ arguments_t parse_argument_list(int num_arguments,
 					 max_loaded_memory);
 			MODE_ARGUMENT("--single-block",single_block);
 			MODE_ARGUMENT("--no-2nf",no_2nf);
+			MODE_ARGUMENT("--matrix-free-2nf",matrix_free_2nf);
 			MODE_ARGUMENT("--exclude-kinetic-energy",
 				      exclude_kinetic_energy);
 			STRING_ARGUMENT("--finished-blocks-file",
 					finished_energy_blocks);
+			STRING_ARGUMENT("--input-vector-path",
+					input_vector_path);
+			STRING_ARGUMENT("--evaluation-order-file",
+					evaluation_order_path);
+			STRING_ARGUMENT("--minerva-index-list-path",
+					minerva_index_list_path);
+			STRING_ARGUMENT("--matrix-file-path",
+					matrix_file_path);
 			LEC_ARGUMENT("--LEC-CE",lec_CE);
 			LEC_ARGUMENT("--LEC-CD",lec_CD);
 			LEC_ARGUMENT("--LEC-C1",lec_C1);
@@ -185,7 +199,12 @@ void show_usage(const arguments_t arguments)
 	       "[--single-block] "
 	       "[--block-id <integer>] "
 	       "[--finished-blocks-file <filepath>] "
+	       "[--input-vector-path <directory>] "
+	       "[--evaluation-order-file <filepath>] "
+	       "[--minerva-index-list-path <directory>] "
+	       "[--matrix-file-path <directory>] "
 	       "[--no-2nf] "
+	       "[--matrix-free-2nf] "
 	       "[--LEC-CE <float>] "
 	       "[--LEC-CD <float>] "
 	       "[--LEC-C1 <float>] "
@@ -206,6 +225,11 @@ int no_2nf_argument(const arguments_t arguments)
 	return arguments->no_2nf;
 }
 
+int matrix_free_2nf_argument(const arguments_t arguments)
+{
+	return arguments->matrix_free_2nf;
+}
+
 int lec_arguments_set(const arguments_t arguments)
 {
 	return arguments->lec_set;
@@ -241,6 +265,26 @@ const char *get_finished_energy_blocks_argument(const arguments_t arguments)
 	return arguments->finished_energy_blocks;
 }
 
+const char *get_input_vector_path_argument(const arguments_t arguments)
+{
+	return arguments->input_vector_path;
+}
+
+const char *get_evaluation_order_path_argument(const arguments_t arguments)
+{
+	return arguments->evaluation_order_path;
+}
+
+const char *get_minerva_index_list_path_argument(const arguments_t arguments)
+{
+	return arguments->minerva_index_list_path;
+}
+
+const char *get_matrix_file_path_argument(const arguments_t arguments)
+{
+	return arguments->matrix_file_path;
+}
+
 size_t get_block_id(const arguments_t arguments)
 {
 	return arguments->block_id;
@@ -17,6 +17,12 @@ int single_block_mode(const arguments_t arguments);
 
 int no_2nf_argument(const arguments_t arguments);
 
+/* The 2NF matrix blocks are computed in memory when they are needed, by
+ * mercury_matrix_free_2nf or by Bacchus with interaction.matrix_free_2nf,
+ * instead of being written to disk.
+ */
+int matrix_free_2nf_argument(const arguments_t arguments);
+
 int lec_arguments_set(const arguments_t arguments);
 
 const char *get_interaction_path_2nf_argument(const arguments_t arguments);
@@ -31,6 +37,14 @@ const char *get_output_path_argument(const arguments_t arguments);
 
 const char *get_finished_energy_blocks_argument(const arguments_t arguments);
 
+const char *get_input_vector_path_argument(const arguments_t arguments);
+
+const char *get_evaluation_order_path_argument(const arguments_t arguments);
+
+const char *get_minerva_index_list_path_argument(const arguments_t arguments);
+
+const char *get_matrix_file_path_argument(const arguments_t arguments);
+
 size_t get_block_id(const arguments_t arguments);
 
 size_t get_num_protons_argument(const arguments_t arguments);
@@ -62,35 +62,75 @@ connection_list_t new_connection_list(const char *index_list_path,
 				      single_particle_basis_t basis,
 				      matrix_block_setting_t settings)
 {
-	block_type_t type = settings.type;
-	size_t num_protons = count_protons(type);
-	size_t num_neutrons = count_neutrons(type);
-	char *proton_directory = 
-		create_directory_path(index_list_path,
-				      num_protons,
-				      'p');
-	char *neutron_directory = 
-		create_directory_path(index_list_path,
-				      num_neutrons,
-				      'n');
 	size_t num_proton_connections = 0;
 	short *proton_connections =
-		create_single_particle_connections(proton_directory,
-						   num_protons,				   
-						   settings.difference_energy_protons,
-						   settings.difference_M_protons,
-						   settings.depth_protons,
-						   basis,
-						   &num_proton_connections);
+		new_single_species_connections(index_list_path,
+					       basis,
+					       count_protons(settings.type),
+					       'p',
+					       settings.difference_energy_protons,
+					       settings.difference_M_protons,
+					       settings.depth_protons,
+					       &num_proton_connections);
 	size_t num_neutron_connections = 0;
 	short *neutron_connections =
-		create_single_particle_connections(neutron_directory,
-						   num_neutrons,
-						   settings.difference_energy_neutrons,
-						   settings.difference_M_neutrons,
-						   settings.depth_neutrons,
+		new_single_species_connections(index_list_path,
+					       basis,
+					       count_neutrons(settings.type),
+					       'n',
+					       settings.difference_energy_neutrons,
+					       settings.difference_M_neutrons,
+					       settings.depth_neutrons,
+					       &num_neutron_connections);
+	connection_list_t list =
+		new_combined_connection_list(settings,
+					     proton_connections,
+					     num_proton_connections,
+					     neutron_connections,
+					     num_neutron_connections);
+	free(neutron_connections);
+	free(proton_connections);
+	return list;
+}
+
+short *new_single_species_connections(const char *index_list_path,
+				      single_particle_basis_t basis,
+				      size_t num_particles,
+				      char particle_type,
+				      int difference_energy,
+				      int difference_M,
+				      int depth,
+				      size_t *num_connections)
+{
+	*num_connections = 0;
+	if (num_particles == 0)
+		return NULL;
+	char *directory = 
+		create_directory_path(index_list_path,
+				      num_particles,
+				      particle_type);
+	short *connections =
+		create_single_particle_connections(directory,
+						   num_particles,
+						   difference_energy,
+						   difference_M,
+						   depth,
 						   basis,
-						   &num_neutron_connections);
+						   num_connections);
+	free(directory);
+	return connections;
+}
+
+connection_list_t
+new_combined_connection_list(matrix_block_setting_t settings,
+			     const short *proton_connections,
+			     size_t num_proton_connections,
+			     const short *neutron_connections,
+			     size_t num_neutron_connections)
+{
+	block_type_t type = settings.type;
+	size_t num_protons = count_protons(type);
+	size_t num_neutrons = count_neutrons(type);
 	connection_list_t list =
 		(connection_list_t)calloc(1,sizeof(struct _connection_list_));
 	list->settings = settings;
@@ -172,10 +212,6 @@ connection_list_t new_connection_list(const char *index_list_path,
 			exit(1);
 		}
 	}
-	free(neutron_connections);
-	free(proton_connections);
-	free(neutron_directory);
-	free(proton_directory);
 	return list;
 }
 
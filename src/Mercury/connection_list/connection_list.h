@@ -19,6 +19,30 @@ connection_list_t new_connection_list(const char *index_list_path,
 				      single_particle_basis_t basis,
 				      matrix_block_setting_t settings);
 
+/* The connections of num_particles particles of one species, read from
+ * the index lists. Each connection is the num_particles annihilated states
+ * followed by the num_particles created ones. Returns NULL for no particles.
+ */
+short *new_single_species_connections(const char *index_list_path,
+				      single_particle_basis_t basis,
+				      size_t num_particles,
+				      char particle_type,
+				      int difference_energy,
+				      int difference_M,
+				      int depth,
+				      size_t *num_connections);
+
+/* The connections of a matrix block from those of its protons and
+ * neutrons, without reading the index lists. The arrays stay with the
+ * caller.
+ */
+connection_list_t
+new_combined_connection_list(matrix_block_setting_t settings,
+			     const short *proton_connections,
+			     size_t num_proton_connections,
+			     const short *neutron_connections,
+			     size_t num_neutron_connections);
+
 connection_list_t read_connection_files(const char *index_list_path,
 					matrix_block_setting_t settings);
 
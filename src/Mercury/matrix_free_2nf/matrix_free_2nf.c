@@ -0,0 +1,57 @@
+#include <matrix_free_2nf/matrix_free_2nf.h>
+#include <transform_2nf_block_manager/transform_2nf_block_manager.h>
+#include <input/read_2nf_antoine_format.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <time.h>
+
+struct _matrix_free_2nf_
+{
+	antoine_2nf_file_t coupled_2nf_data;
+	transform_2nf_block_manager_t manager;
+};
+
+matrix_free_2nf_t new_matrix_free_2nf(combination_table_t combination_table,
+				      matrix_free_2nf_settings_t settings)
+{
+	log_entry("Computing the 2NF matrix blocks from %s",
+		  settings.interaction_path);
+	struct timespec t_start,t_end;
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	matrix_free_2nf_t matrix_free_2nf =
+		(matrix_free_2nf_t)malloc(sizeof(struct _matrix_free_2nf_));
+	matrix_free_2nf->coupled_2nf_data =
+		open_antoine_2nf_file(settings.interaction_path,
+				      settings.num_particles,
+				      settings.single_particle_energy,
+				      settings.two_particle_energy,
+				      settings.include_kinetic_energy);
+	matrix_free_2nf->manager =
+		new_transform_2nf_block_manager
+		(matrix_free_2nf->coupled_2nf_data,
+		 settings.index_list_path,
+		 settings.index_list_path,
+		 settings.single_particle_energy);
+	// Once for the whole run, every multiplication reuses the matrices
+	decouple_all_transform_2nf_blocks(matrix_free_2nf->manager,
+					  combination_table);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	printf("Decoupling the 2nf blocks took %lg µs\n",
+	       (t_end.tv_sec - t_start.tv_sec)*1e6 +
+	       (t_end.tv_nsec - t_start.tv_nsec)*1e-3);
+	return matrix_free_2nf;
+}
+
+matrix_block_t generate_matrix_free_2nf_block(size_t block_id,
+					      void *generator_data)
+{
+	matrix_free_2nf_t matrix_free_2nf = (matrix_free_2nf_t)generator_data;
+	return generate_2nf_matrix_block(block_id,matrix_free_2nf->manager);
+}
+
+void free_matrix_free_2nf(matrix_free_2nf_t matrix_free_2nf)
+{
+	free_transform_2nf_block_manager(matrix_free_2nf->manager);
+	free_antoine_2nf_file(matrix_free_2nf->coupled_2nf_data);
+	free(matrix_free_2nf);
+}
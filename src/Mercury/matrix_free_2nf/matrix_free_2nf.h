@@ -0,0 +1,42 @@
+#ifndef __MATRIX_FREE_2NF__
+#define __MATRIX_FREE_2NF__
+
+#include <stdlib.h>
+#include <combination_table/combination_table.h>
+#include <matrix_block/matrix_block.h>
+
+/* Where Mercury finds the coupled 2NF interaction and its own index lists,
+ * with the same meaning as the arguments of mercury_J_scheme_to_internal.
+ */
+typedef struct
+{
+	const char *interaction_path;
+	const char *index_list_path;
+	size_t num_particles;
+	int single_particle_energy;
+	int two_particle_energy;
+	int include_kinetic_energy;
+} matrix_free_2nf_settings_t;
+
+/* Keeps the decoupled 2NF interaction of Mercury, only this module sees
+ * the Mercury and Neptune headers.
+ */
+struct _matrix_free_2nf_;
+typedef struct _matrix_free_2nf_ *matrix_free_2nf_t;
+
+/* Decouples the 2NF interaction for every 2NF block of the combination
+ * table, once for all multiplications.
+ */
+matrix_free_2nf_t new_matrix_free_2nf(combination_table_t combination_table,
+				      matrix_free_2nf_settings_t settings);
+
+/* A matrix_block_generator_t with the matrix_free_2nf as generator data. It
+ * computes the 2NF matrix blocks and leaves all others to be read. The
+ * matrix_free_2nf has to outlive the multiplications it is used in.
+ */
+matrix_block_t generate_matrix_free_2nf_block(size_t block_id,
+					      void *generator_data);
+
+void free_matrix_free_2nf(matrix_free_2nf_t matrix_free_2nf);
+
+#endif
@@ -91,6 +91,8 @@ int main(int num_arguments,
 		generate_2nf_zero_matrix_blocks(combination_table, 
 						single_particle_basis,
 						arguments);
+	else if (matrix_free_2nf_argument(arguments))
+		printf("The 2nf matrix blocks are computed when needed\n");
 	else
 		generate_2nf_matrix_blocks(combination_table, arguments);
 	generate_3nf_matrix_blocks_parallel(combination_table, arguments);
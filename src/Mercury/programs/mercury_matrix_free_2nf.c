@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <arguments/arguments.h>
+#include <input/read_2nf_antoine_format.h>
+#include <transform_2nf_block_manager/transform_2nf_block_manager.h>
+#include <combination_table/combination_table.h>
+#include <evaluation_order/evaluation_order.h>
+#include <scheduler/scheduler.h>
+#include <error/error.h>
+#include <log/log.h>
+#include <time.h>
+
+/* Applies a Hamiltonian to a vector without reading the 2NF matrix blocks
+ * from disk. The 2NF interaction is decoupled once and the transformed
+ * matrices of all shell pairs and M are kept in memory, the 2NF matrix
+ * blocks are then computed from them whenever Minerva loads them. All
+ * other matrix blocks are read from the matrix file path as usual. The
+ * output vector blocks have to exist, they are added to.
+ */
+
+	__attribute__((constructor(101)))
+void initialization()
+{
+	initiate_logging("MERCURY_LOGFILE",
+			 "mercury_matrix_free_2nf.log");
+}
+
+int main(int num_arguments,
+	 char **argument_list)
+{
+	struct timespec t_start,t_end;
+	arguments_t arguments =
+	       	parse_argument_list(num_arguments, argument_list);
+	if (to_few_arguments(arguments) ||
+	    get_input_vector_path_argument(arguments) == NULL ||
+	    get_evaluation_order_path_argument(arguments) == NULL ||
+	    get_minerva_index_list_path_argument(arguments) == NULL ||
+	    get_matrix_file_path_argument(arguments) == NULL)
+	{
+		show_usage(arguments);
+		free_arguments(arguments);
+		return EXIT_SUCCESS;
+	}
+	combination_table_t combination_table =
+		new_combination_table
+		(get_combination_file_path_argument(arguments),
+		 get_num_protons_argument(arguments),
+		 get_num_neutrons_argument(arguments));
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	antoine_2nf_file_t coupled_2nf_data =
+		open_antoine_2nf_file
+		(get_interaction_path_2nf_argument(arguments),
+		 get_num_particles_argument(arguments),
+		 get_single_particle_energy_argument(arguments),
+		 get_two_particle_energy_argument(arguments),
+		 !get_exclude_kinetic_energy_argument(arguments));
+	transform_2nf_block_manager_t manager =
+		new_transform_2nf_block_manager
+		(coupled_2nf_data,
+		 get_index_list_path_argument(arguments),
+		 get_index_list_path_argument(arguments),
+		 get_single_particle_energy_argument(arguments));
+	decouple_all_transform_2nf_blocks(manager,combination_table);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	printf("Decoupling the 2nf blocks took %lg µs\n",
+	       (t_end.tv_sec - t_start.tv_sec)*1e6 +
+	       (t_end.tv_nsec - t_start.tv_nsec)*1e-3);
+	evaluation_order_t evaluation_order =
+		read_evaluation_order
+		(get_evaluation_order_path_argument(arguments),
+		 combination_table);
+	scheduler_t scheduler =
+		new_scheduler(evaluation_order,
+			      combination_table,
+			      get_minerva_index_list_path_argument(arguments),
+			      get_matrix_file_path_argument(arguments),
+			      get_max_loaded_memory_argument(arguments));
+	set_scheduler_matrix_block_generator(scheduler,
+					     generate_2nf_matrix_block,
+					     manager);
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	run_matrix_vector_multiplication
+		(get_output_path_argument(arguments),
+		 get_input_vector_path_argument(arguments),
+		 scheduler);
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	printf("Matrix vector multiplication took %lg µs\n",
+	       (t_end.tv_sec - t_start.tv_sec)*1e6 +
+	       (t_end.tv_nsec - t_start.tv_nsec)*1e-3);
+	free_scheduler(scheduler);
+	free_evaluation_order(evaluation_order);
+	free_transform_2nf_block_manager(manager);
+	free_antoine_2nf_file(coupled_2nf_data);
+	free_combination_table(combination_table);
+	free_arguments(arguments);
+	return EXIT_SUCCESS;
+}
@@ -4,10 +4,13 @@
 #include <block_transform/block_transform.h>
 #include <string_tools/string_tools.h>
 #include <log/log.h>
+#include <error/error.h>
 #include <debug_mode/debug_mode.h>
+#include <unit_testing/test.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 typedef struct
 {
@@ -16,6 +19,39 @@ typedef struct
 	Dens_Matrix *matrix;
 } block_t;
 
+/* All M blocks of one decoupled shell pair, kept by
+ * decouple_all_transform_2nf_blocks.
+ */
+typedef struct
+{
+	block_t *blocks;
+	size_t num_blocks;
+	int min_M;
+} stored_transform_block_t;
+
+/* The index list connections of one particle species, read once by
+ * decouple_all_transform_2nf_blocks and shared by all matrix blocks with
+ * the same differences and depth.
+ */
+typedef struct
+{
+	char particle_type;
+	size_t num_particles;
+	int difference_energy;
+	int difference_M;
+	int depth;
+	short *connections;
+	size_t num_connections;
+} species_connections_t;
+
+typedef struct
+{
+	matrix_block_setting_t settings;
+	size_t stored_block_index;
+	size_t proton_connections_index;
+	size_t neutron_connections_index;
+} stored_matrix_block_t;
+
 struct _transform_2nf_block_manager_
 {
 	m_scheme_2p_basis_t ket_basis;
@@ -31,6 +67,14 @@ struct _transform_2nf_block_manager_
 	int J_max;
 	single_particle_basis_t single_particle_basis;
 	Clebsch_Gordan_Data* clebsch_gordan_data;
+	stored_transform_block_t *stored_blocks;
+	size_t num_stored_blocks;
+	// Indexed by matrix block id, unused entries have settings with
+	// matrix_block_id 0
+	stored_matrix_block_t *stored_matrix_blocks;
+	size_t num_stored_matrix_blocks;
+	species_connections_t *species_connections;
+	size_t num_species_connections;
 };
 
 static
@@ -71,6 +115,24 @@ const size_t get_bra_index(connection_t connection,
 			   m_scheme_2p_basis_t basis,
 			   int *phase);
 
+static
+double *compute_2nf_matrix_elements(transform_2nf_block_manager_t manager,
+				    block_t *blocks,
+				    int min_M,
+				    connection_list_t connection_list,
+				    size_t *num_elements);
+
+static
+size_t store_species_connections(transform_2nf_block_manager_t manager,
+				 size_t num_particles,
+				 char particle_type,
+				 int difference_energy,
+				 int difference_M,
+				 int depth);
+
+static
+void store_decoupled_blocks(transform_2nf_block_manager_t manager);
+
 static
 void expand_block_list(transform_2nf_block_manager_t manager,
 		       size_t num_blocks);
@@ -78,6 +140,9 @@ void expand_block_list(transform_2nf_block_manager_t manager,
 static
 void free_blocks(transform_2nf_block_manager_t manager);
 
+static
+void free_block_list(block_t *blocks, size_t num_blocks);
+
 static inline
 void swap(int *a,int *b);
 
@@ -132,6 +197,7 @@ void decouple_transform_2nf_block(transform_2nf_block_manager_t manager,
 	int Tz = block_settings.total_isospin;
 	size_t num_blocks = (max_M-min_M)/2+1;
 	manager->min_M = min_M;
+	manager->num_blocks = num_blocks;
 	if (num_blocks > manager->num_allocated_blocks)
 		expand_block_list(manager,num_blocks);
 	for (size_t i = 0; i < num_blocks; i++)
@@ -198,10 +264,183 @@ get_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
 		new_connection_list(manager->index_list_path,
 				    manager->single_particle_basis,
 				    settings);
-	size_t num_elements = num_connections(connection_list);
-	double *elements = (double*)calloc(num_elements,sizeof(double));
+	size_t num_elements = 0;
+	double *elements = 
+		compute_2nf_matrix_elements(manager,
+					    manager->blocks,
+					    manager->min_M,
+					    connection_list,
+					    &num_elements);
+	free_connection_list(connection_list);
+	return new_mercury_matrix_block_from_data(elements,
+						  num_elements,
+						  settings);
+}
+
+void decouple_all_transform_2nf_blocks(transform_2nf_block_manager_t manager,
+				       combination_table_t combination_table)
+{
+	transform_block_settings_t transformed_block = {INT_MAX};	
+	reset_2nf_block_iterator(combination_table);
+	while (has_next_2nf_block(combination_table))
+	{
+		matrix_block_setting_t current_matrix_block = 
+			next_2nf_block_iterator(combination_table);
+		transform_block_settings_t current_block =
+			setup_transform_block(current_matrix_block);
+		if (compare_transform_block_settings(&transformed_block,
+						     &current_block) != 0)
+		{
+			decouple_transform_2nf_block(manager,current_block);
+			store_decoupled_blocks(manager);
+			transformed_block = current_block;
+		}
+		size_t block_id = current_matrix_block.matrix_block_id;
+		if (block_id >= manager->num_stored_matrix_blocks)
+		{
+			size_t num_stored_matrix_blocks = 2*block_id+1;
+			manager->stored_matrix_blocks =
+				(stored_matrix_block_t*)
+				realloc(manager->stored_matrix_blocks,
+					num_stored_matrix_blocks*
+					sizeof(stored_matrix_block_t));
+			memset(manager->stored_matrix_blocks +
+			       manager->num_stored_matrix_blocks,
+			       0,
+			       (num_stored_matrix_blocks -
+				manager->num_stored_matrix_blocks)*
+			       sizeof(stored_matrix_block_t));
+			manager->num_stored_matrix_blocks =
+				num_stored_matrix_blocks;
+		}
+		stored_matrix_block_t stored_matrix_block =
+		{
+			.settings = current_matrix_block,
+			.stored_block_index = manager->num_stored_blocks-1,
+			.proton_connections_index =
+				store_species_connections
+				(manager,
+				 count_protons(current_matrix_block.type),
+				 'p',
+				 current_matrix_block.difference_energy_protons,
+				 current_matrix_block.difference_M_protons,
+				 current_matrix_block.depth_protons),
+			.neutron_connections_index =
+				store_species_connections
+				(manager,
+				 count_neutrons(current_matrix_block.type),
+				 'n',
+				 current_matrix_block.difference_energy_neutrons,
+				 current_matrix_block.difference_M_neutrons,
+				 current_matrix_block.depth_neutrons)
+		};
+		manager->stored_matrix_blocks[block_id] = stored_matrix_block;
+	}
+	reset_2nf_block_iterator(combination_table);
+}
+
+int has_stored_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
+					  size_t matrix_block_id)
+{
+	return matrix_block_id > 0 &&
+		matrix_block_id < manager->num_stored_matrix_blocks &&
+		manager->stored_matrix_blocks[matrix_block_id]
+		.settings.matrix_block_id == matrix_block_id;
+}
+
+double *get_stored_transform_2nf_matrix_elements
+(transform_2nf_block_manager_t manager,
+ size_t matrix_block_id,
+ matrix_block_setting_t *settings,
+ size_t *num_elements)
+{
+	if (!has_stored_transform_2nf_matrix_block(manager,matrix_block_id))
+		error("Matrix block %lu is not a stored 2NF block\n",
+		      matrix_block_id);
+	stored_matrix_block_t stored_matrix_block =
+		manager->stored_matrix_blocks[matrix_block_id];
+	stored_transform_block_t stored_block =
+		manager->stored_blocks[stored_matrix_block.stored_block_index];
+	species_connections_t protons =
+		manager->species_connections
+		[stored_matrix_block.proton_connections_index];
+	species_connections_t neutrons =
+		manager->species_connections
+		[stored_matrix_block.neutron_connections_index];
+	*settings = stored_matrix_block.settings;
+	connection_list_t connection_list =
+		new_combined_connection_list(stored_matrix_block.settings,
+					     protons.connections,
+					     protons.num_connections,
+					     neutrons.connections,
+					     neutrons.num_connections);
+	double *elements =
+		compute_2nf_matrix_elements(manager,
+					    stored_block.blocks,
+					    stored_block.min_M,
+					    connection_list,
+					    num_elements);
+	free_connection_list(connection_list);
+	return elements;
+}
+
+matrix_block_t generate_2nf_matrix_block(size_t block_id,
+					 void *generator_data)
+{
+	transform_2nf_block_manager_t manager =
+		(transform_2nf_block_manager_t)generator_data;
+	if (!has_stored_transform_2nf_matrix_block(manager,block_id))
+		return NULL;
+	matrix_block_setting_t settings;
+	size_t num_elements = 0;
+	double *elements =
+		get_stored_transform_2nf_matrix_elements(manager,
+							 block_id,
+							 &settings,
+							 &num_elements);
+	log_entry("Generated 2nf matrix block %lu with %lu elements",
+		  block_id,num_elements);
+	return new_matrix_block_from_elements
+		(block_id,
+		 settings.num_neutron_combinations,
+		 settings.num_proton_combinations,
+		 elements);
+}
+
+void free_transform_2nf_block_manager(transform_2nf_block_manager_t manager)
+{
+	free_blocks(manager);
+	for (size_t i = 0; i<manager->num_stored_blocks; i++)
+		free_block_list(manager->stored_blocks[i].blocks,
+				manager->stored_blocks[i].num_blocks);
+	free(manager->stored_blocks);
+	free(manager->stored_matrix_blocks);
+	for (size_t i = 0; i<manager->num_species_connections; i++)
+		free(manager->species_connections[i].connections);
+	free(manager->species_connections);
+	if (manager->ket_basis)
+		free_m_scheme_2p_basis(manager->ket_basis);	
+	if (manager->bra_basis)
+		free_m_scheme_2p_basis(manager->bra_basis);	
+	free(manager->basis_files_path);
+	free(manager->index_list_path);
+	free_single_particle_basis(manager->single_particle_basis);
+	free_clebsch_gordan(manager->clebsch_gordan_data);
+	free(manager);
+}
+
+static
+double *compute_2nf_matrix_elements(transform_2nf_block_manager_t manager,
+				    block_t *blocks,
+				    int min_M,
+				    connection_list_t connection_list,
+				    size_t *num_elements)
+{
+	*num_elements = num_connections(connection_list);
+	double *elements = (double*)calloc(*num_elements,sizeof(double));
 	size_t element_index = 0;
-	log_entry("Creating matrix block %lu", settings.matrix_block_id);
+	log_entry("Creating matrix block %lu",
+		  get_matrix_block_setting(connection_list).matrix_block_id);
 	while (has_next_connection(connection_list))
 	{
 		connection_t current_connection =
@@ -225,9 +464,9 @@ get_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
 		int M = compute_M(current_connection,
 				  manager->single_particle_basis);
 		log_entry("M = %d",M);
-		size_t i = (M-manager->min_M)/2;
-		m_scheme_2p_basis_t ket_m_basis = manager->blocks[i].ket_basis;
-		m_scheme_2p_basis_t bra_m_basis = manager->blocks[i].bra_basis;
+		size_t i = (M-min_M)/2;
+		m_scheme_2p_basis_t ket_m_basis = blocks[i].ket_basis;
+		m_scheme_2p_basis_t bra_m_basis = blocks[i].bra_basis;
 		log_m_scheme_2p_basis(ket_m_basis);
 		log_m_scheme_2p_basis(bra_m_basis);
 		int phase = 1;
@@ -239,7 +478,7 @@ get_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
 						 &phase);
 		log_entry("ket_index = %lu",ket_index);
 		log_entry("bra_index = %lu",bra_index);
-		Dens_Matrix *current_matrix = manager->blocks[i].matrix; 
+		Dens_Matrix *current_matrix = blocks[i].matrix; 
 #ifndef NLOGING
 		log_entry("current_matrix:");
 		for (size_t k = 0; k<current_matrix->m; k++)
@@ -261,24 +500,73 @@ get_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
 			  element_index-1,
 			  elements[element_index-1]);
 	}
-	free_connection_list(connection_list);
-	return new_mercury_matrix_block_from_data(elements,
-						  num_elements,
-						  settings);
+	return elements;
 }
 
-void free_transform_2nf_block_manager(transform_2nf_block_manager_t manager)
+static
+size_t store_species_connections(transform_2nf_block_manager_t manager,
+				 size_t num_particles,
+				 char particle_type,
+				 int difference_energy,
+				 int difference_M,
+				 int depth)
 {
-	free_blocks(manager);
-	if (manager->ket_basis)
-		free_m_scheme_2p_basis(manager->ket_basis);	
-	if (manager->bra_basis)
-		free_m_scheme_2p_basis(manager->bra_basis);	
-	free(manager->basis_files_path);
-	free(manager->index_list_path);
-	free_single_particle_basis(manager->single_particle_basis);
-	free_clebsch_gordan(manager->clebsch_gordan_data);
-	free(manager);
+	for (size_t i = 0; i<manager->num_species_connections; i++)
+	{
+		species_connections_t stored = manager->species_connections[i];
+		if (stored.particle_type == particle_type &&
+		    stored.num_particles == num_particles &&
+		    (num_particles == 0 ||
+		     (stored.difference_energy == difference_energy &&
+		      stored.difference_M == difference_M &&
+		      stored.depth == depth)))
+			return i;
+	}
+	species_connections_t species_connections =
+	{
+		.particle_type = particle_type,
+		.num_particles = num_particles,
+		.difference_energy = difference_energy,
+		.difference_M = difference_M,
+		.depth = depth
+	};
+	species_connections.connections =
+		new_single_species_connections(manager->index_list_path,
+					       manager->single_particle_basis,
+					       num_particles,
+					       particle_type,
+					       difference_energy,
+					       difference_M,
+					       depth,
+					       &species_connections.num_connections);
+	manager->species_connections =
+		(species_connections_t*)
+		realloc(manager->species_connections,
+			(manager->num_species_connections+1)*
+			sizeof(species_connections_t));
+	manager->species_connections[manager->num_species_connections] =
+		species_connections;
+	return manager->num_species_connections++;
+}
+
+static
+void store_decoupled_blocks(transform_2nf_block_manager_t manager)
+{
+	manager->stored_blocks =
+		(stored_transform_block_t*)
+		realloc(manager->stored_blocks,
+			(manager->num_stored_blocks+1)*
+			sizeof(stored_transform_block_t));
+	stored_transform_block_t stored_block =
+	{
+		.blocks = manager->blocks,
+		.num_blocks = manager->num_blocks,
+		.min_M = manager->min_M
+	};
+	manager->stored_blocks[manager->num_stored_blocks++] = stored_block;
+	// The next decoupling allocates a fresh block list
+	manager->blocks = NULL;
+	manager->num_allocated_blocks = 0;
 }
 
 static
@@ -392,20 +680,24 @@ void expand_block_list(transform_2nf_block_manager_t manager,
 static
 void free_blocks(transform_2nf_block_manager_t manager)
 {
+	free_block_list(manager->blocks,manager->num_allocated_blocks);
+	manager->blocks = NULL;
+	manager->num_allocated_blocks = 0;
+}
 
-	for (size_t i = 0; i <manager->num_allocated_blocks; i++)
+static
+void free_block_list(block_t *blocks, size_t num_blocks)
+{
+	for (size_t i = 0; i <num_blocks; i++)
 	{
-		if (manager->blocks[i].matrix)
-			free_dens_matrix(manager->blocks[i].matrix);
-		manager->blocks[i].matrix = NULL;
-		if (manager->blocks[i].ket_basis)
-			free_m_scheme_2p_basis(manager->blocks[i].ket_basis);
-		manager->blocks[i].ket_basis = NULL;
-		if (manager->blocks[i].bra_basis)
-			free_m_scheme_2p_basis(manager->blocks[i].bra_basis);
-		manager->blocks[i].bra_basis = NULL;
+		if (blocks[i].matrix)
+			free_dens_matrix(blocks[i].matrix);
+		if (blocks[i].ket_basis)
+			free_m_scheme_2p_basis(blocks[i].ket_basis);
+		if (blocks[i].bra_basis)
+			free_m_scheme_2p_basis(blocks[i].bra_basis);
 	}
-	free(manager->blocks);
+	free(blocks);
 }
 
 static inline
@@ -538,3 +830,72 @@ void log_matrix(Dens_Matrix *matrix)
 	}
 }
 #endif
+
+#define MERCURY_RUN "mercury_run_data/he4/nmax2/"
+
+new_test(generated_2nf_blocks_match_saved_blocks,
+	 const char *matrix_block_directory = get_test_file_path("");
+	 combination_table_t combination_table =
+	 new_combination_table(TEST_DATA MERCURY_RUN "comb.txt",2,2);
+	 antoine_2nf_file_t coupled_2nf_data =
+	 open_antoine_2nf_file(TEST_DATA MERCURY_RUN "interaction_2nf",
+			       4,2,2,1);
+	 transform_2nf_block_manager_t manager =
+	 new_transform_2nf_block_manager(coupled_2nf_data,
+					 TEST_DATA MERCURY_RUN "index_lists",
+					 TEST_DATA MERCURY_RUN "index_lists",
+					 2);
+	 reset_2nf_block_iterator(combination_table);
+	 while (has_next_2nf_block(combination_table))
+	 {
+		matrix_block_setting_t settings =
+			next_2nf_block_iterator(combination_table);
+		decouple_transform_2nf_block(manager,
+					     setup_transform_block(settings));
+		mercury_matrix_block_t matrix_block =
+			get_transform_2nf_matrix_block(manager,settings);
+		save_mercury_matrix_block(matrix_block,
+					  matrix_block_directory);
+		free_mercury_matrix_block(matrix_block);
+	 }
+	 decouple_all_transform_2nf_blocks(manager,combination_table);
+	 size_t num_compared_blocks = 0;
+	 while (has_next_2nf_block(combination_table))
+	 {
+		size_t block_id =
+			next_2nf_block_iterator(combination_table)
+			.matrix_block_id;
+		matrix_block_t saved_block =
+			new_matrix_block(block_id,matrix_block_directory);
+		matrix_block_t generated_block =
+			generate_2nf_matrix_block(block_id,manager);
+		assert_that(generated_block != NULL);
+		size_t neutron_dimension =
+			get_neutron_matrix_dimension(saved_block);
+		size_t proton_dimension =
+			get_proton_matrix_dimension(saved_block);
+		size_t num_elements =
+			neutron_dimension == 0 ? proton_dimension :
+			proton_dimension == 0 ? neutron_dimension :
+			neutron_dimension*proton_dimension;
+		assert_that(get_neutron_matrix_dimension(generated_block) ==
+			    neutron_dimension);
+		assert_that(get_proton_matrix_dimension(generated_block) ==
+			    proton_dimension);
+		double *saved_elements =
+			get_matrix_block_elements(saved_block);
+		double *generated_elements =
+			get_matrix_block_elements(generated_block);
+		for (size_t i = 0; i<num_elements; i++)
+			assert_that(generated_elements[i] ==
+				    saved_elements[i]);
+		free_matrix_block(generated_block);
+		free_matrix_block(saved_block);
+		num_compared_blocks++;
+	 }
+	 reset_2nf_block_iterator(combination_table);
+	 assert_that(num_compared_blocks > 0);
+	 free_transform_2nf_block_manager(manager);
+	 free_antoine_2nf_file(coupled_2nf_data);
+	 free_combination_table(combination_table);
+	);
@@ -5,6 +5,8 @@
 #include <transform_block_settings/transform_block_settings.h>
 #include <matrix_block_setting/matrix_block_setting.h>
 #include <mercury_matrix_block/mercury_matrix_block.h>
+#include <combination_table/combination_table.h>
+#include <matrix_block/matrix_block.h>
 
 struct _transform_2nf_block_manager_;
 typedef struct _transform_2nf_block_manager_ *transform_2nf_block_manager_t;
@@ -22,6 +24,34 @@ mercury_matrix_block_t
 get_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
 			       matrix_block_setting_t settings);
 
+/* Decouples every 2NF block of the combination table once and keeps the
+ * transformed matrices of all shell pairs and M in memory, so that the
+ * elements of any 2NF matrix block can be computed without touching disk.
+ */
+void decouple_all_transform_2nf_blocks(transform_2nf_block_manager_t manager,
+				       combination_table_t combination_table);
+
+int has_stored_transform_2nf_matrix_block(transform_2nf_block_manager_t manager,
+					  size_t matrix_block_id);
+
+/* Computes the elements of a matrix block from the matrices kept by
+ * decouple_all_transform_2nf_blocks. The manager is only read, so this
+ * can be called from several threads at once. The caller frees the
+ * returned elements.
+ */
+double *get_stored_transform_2nf_matrix_elements
+(transform_2nf_block_manager_t manager,
+ size_t matrix_block_id,
+ matrix_block_setting_t *settings,
+ size_t *num_elements);
+
+/* A matrix_block_generator_t for Minerva with the manager as generator
+ * data. It computes the 2NF matrix blocks kept by
+ * decouple_all_transform_2nf_blocks and returns NULL for all other blocks.
+ */
+matrix_block_t generate_2nf_matrix_block(size_t block_id,
+					 void *generator_data);
+
 void free_transform_2nf_block_manager(transform_2nf_block_manager_t manager);
 
 #endif
@@ -0,0 +1,380 @@
+#include <block_writer/block_writer.h>
+#include <log/log.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h>
+#include <debug_mode/debug_mode.h>
+
+typedef struct
+{
+	vector_block_t vector_block;
+	size_t block_id;
+	size_t num_bytes;
+} pending_block_t;
+
+struct _block_writer_
+{
+	pending_block_t *queue;
+	size_t max_num_pending_blocks;
+	int num_reduction_threads;
+	size_t num_queued_blocks;
+	pending_block_t in_flight_block;
+	int has_in_flight_block;
+	size_t pending_write_bytes;
+	size_t num_written_blocks;
+	size_t num_reclaimed_blocks;
+	double total_reduction_time;
+	double total_writing_time;
+	int should_stop;
+	// A paused writer leaves the queued blocks alone, for the tests
+	int is_paused;
+	pthread_t writer_thread;
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t block_queued;
+	pthread_cond_t block_written;
+};
+
+static
+void *writer_thread_main(void *argument);
+
+static
+void remove_queued_block(block_writer_t writer, size_t queue_index);
+
+block_writer_t new_block_writer(size_t max_num_pending_blocks,
+				int num_reduction_threads)
+{
+	block_writer_t writer =
+		(block_writer_t)calloc(1,sizeof(struct _block_writer_));
+	writer->max_num_pending_blocks =
+		max_num_pending_blocks > 0 ? max_num_pending_blocks : 1;
+	writer->num_reduction_threads =
+		num_reduction_threads > 0 ? num_reduction_threads : 1;
+	writer->queue =
+		(pending_block_t*)calloc(writer->max_num_pending_blocks,
+					 sizeof(pending_block_t));
+	pthread_mutex_init(&writer->queue_mutex,NULL);
+	pthread_cond_init(&writer->block_queued,NULL);
+	pthread_cond_init(&writer->block_written,NULL);
+	if (pthread_create(&writer->writer_thread,
+			   NULL,
+			   writer_thread_main,
+			   writer) != 0)
+		error("Could not start the block writer thread\n");
+	return writer;
+}
+
+void enqueue_vector_block(block_writer_t writer,
+			  vector_block_t vector_block,
+			  size_t block_id,
+			  size_t num_bytes)
+{
+	log_entry("Enqueue vector block %lu for writing",block_id);
+	pthread_mutex_lock(&writer->queue_mutex);
+	while (writer->num_queued_blocks == writer->max_num_pending_blocks)
+		pthread_cond_wait(&writer->block_written,
+				  &writer->queue_mutex);
+	pending_block_t pending_block =
+	{
+		.vector_block = vector_block,
+		.block_id = block_id,
+		.num_bytes = num_bytes
+	};
+	writer->queue[writer->num_queued_blocks++] = pending_block;
+	writer->pending_write_bytes += num_bytes;
+	pthread_cond_signal(&writer->block_queued);
+	pthread_mutex_unlock(&writer->queue_mutex);
+}
+
+vector_block_t reclaim_vector_block(block_writer_t writer,
+				    size_t block_id)
+{
+	vector_block_t vector_block = NULL;
+	pthread_mutex_lock(&writer->queue_mutex);
+	for (size_t i = 0; i<writer->num_queued_blocks; i++)
+	{
+		if (writer->queue[i].block_id != block_id)
+			continue;
+		vector_block = writer->queue[i].vector_block;
+		writer->pending_write_bytes -= writer->queue[i].num_bytes;
+		writer->num_reclaimed_blocks++;
+		remove_queued_block(writer,i);
+		// There is room in the queue now
+		pthread_cond_broadcast(&writer->block_written);
+		break;
+	}
+	while (vector_block == NULL &&
+	       writer->has_in_flight_block &&
+	       writer->in_flight_block.block_id == block_id)
+		pthread_cond_wait(&writer->block_written,
+				  &writer->queue_mutex);
+	pthread_mutex_unlock(&writer->queue_mutex);
+	log_entry("Reclaimed vector block %lu: %p",block_id,vector_block);
+	return vector_block;
+}
+
+size_t get_pending_write_bytes(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	size_t pending_write_bytes = writer->pending_write_bytes;
+	pthread_mutex_unlock(&writer->queue_mutex);
+	return pending_write_bytes;
+}
+
+void wait_for_block_write(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	size_t num_written_blocks = writer->num_written_blocks;
+	while (writer->num_written_blocks == num_written_blocks &&
+	       (writer->num_queued_blocks > 0 ||
+		writer->has_in_flight_block))
+		pthread_cond_wait(&writer->block_written,
+				  &writer->queue_mutex);
+	pthread_mutex_unlock(&writer->queue_mutex);
+}
+
+void wait_for_all_block_writes(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	while (writer->num_queued_blocks > 0 ||
+	       writer->has_in_flight_block)
+		pthread_cond_wait(&writer->block_written,
+				  &writer->queue_mutex);
+	pthread_mutex_unlock(&writer->queue_mutex);
+}
+
+double get_background_reduction_time(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	double reduction_time = writer->total_reduction_time;
+	pthread_mutex_unlock(&writer->queue_mutex);
+	return reduction_time;
+}
+
+void print_block_writer_statistics(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	printf("Written vector blocks: %lu\n",
+	       writer->num_written_blocks);
+	printf("Reclaimed vector blocks: %lu\n",
+	       writer->num_reclaimed_blocks);
+	printf("Total background reduction time: %lg µs\n",
+	       writer->total_reduction_time);
+	printf("Total background writing time: %lg µs\n",
+	       writer->total_writing_time);
+	pthread_mutex_unlock(&writer->queue_mutex);
+}
+
+void free_block_writer(block_writer_t writer)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	writer->should_stop = 1;
+	pthread_cond_signal(&writer->block_queued);
+	pthread_mutex_unlock(&writer->queue_mutex);
+	// The writer thread empties the queue before it stops
+	pthread_join(writer->writer_thread,NULL);
+	pthread_mutex_destroy(&writer->queue_mutex);
+	pthread_cond_destroy(&writer->block_queued);
+	pthread_cond_destroy(&writer->block_written);
+	free(writer->queue);
+	free(writer);
+}
+
+static
+void *writer_thread_main(void *argument)
+{
+	block_writer_t writer = (block_writer_t)argument;
+	pthread_mutex_lock(&writer->queue_mutex);
+	while (1)
+	{
+		while (!writer->should_stop &&
+		       (writer->num_queued_blocks == 0 || writer->is_paused))
+			pthread_cond_wait(&writer->block_queued,
+					  &writer->queue_mutex);
+		if (writer->num_queued_blocks == 0)
+			break;
+		writer->in_flight_block = writer->queue[0];
+		writer->has_in_flight_block = 1;
+		remove_queued_block(writer,0);
+		pthread_cond_broadcast(&writer->block_written);
+		pthread_mutex_unlock(&writer->queue_mutex);
+
+		struct timespec t_start,t_reduced,t_end;
+		clock_gettime(CLOCK_REALTIME,&t_start);
+		vector_block_t vector_block =
+			writer->in_flight_block.vector_block;
+		// The writer thread is not part of the team of the
+		// instructions, its parallel region gets a team of its own
+		reduce_vector_block(vector_block,writer->num_reduction_threads);
+		clock_gettime(CLOCK_REALTIME,&t_reduced);
+		save_vector_block_elements(vector_block);
+		free_vector_block(vector_block);
+		clock_gettime(CLOCK_REALTIME,&t_end);
+
+		pthread_mutex_lock(&writer->queue_mutex);
+		writer->total_reduction_time +=
+			(t_reduced.tv_sec - t_start.tv_sec)*1e6 +
+			(t_reduced.tv_nsec - t_start.tv_nsec)*1e-3;
+		writer->total_writing_time +=
+			(t_end.tv_sec - t_reduced.tv_sec)*1e6 +
+			(t_end.tv_nsec - t_reduced.tv_nsec)*1e-3;
+		writer->pending_write_bytes -=
+			writer->in_flight_block.num_bytes;
+		writer->has_in_flight_block = 0;
+		writer->num_written_blocks++;
+		pthread_cond_broadcast(&writer->block_written);
+	}
+	pthread_mutex_unlock(&writer->queue_mutex);
+	return NULL;
+}
+
+static
+void remove_queued_block(block_writer_t writer, size_t queue_index)
+{
+	memmove(writer->queue + queue_index,
+		writer->queue + queue_index + 1,
+		(writer->num_queued_blocks - queue_index - 1)*
+		sizeof(pending_block_t));
+	writer->num_queued_blocks--;
+}
+
+#ifdef TEST
+static
+void set_block_writer_paused(block_writer_t writer, int is_paused)
+{
+	pthread_mutex_lock(&writer->queue_mutex);
+	writer->is_paused = is_paused;
+	pthread_cond_signal(&writer->block_queued);
+	pthread_mutex_unlock(&writer->queue_mutex);
+}
+
+static
+vector_block_t new_test_output_block(const char *directory,
+				     size_t block_id,
+				     size_t num_elements)
+{
+	char filename[2048];
+	sprintf(filename,"%s/vec_%lu",directory,block_id);
+	FILE *file = fopen(filename,"w");
+	double *zeros = (double*)calloc(num_elements,sizeof(double));
+	fwrite(zeros,sizeof(double),num_elements,file);
+	fclose(file);
+	free(zeros);
+	basis_block_t basis_block =
+		new_basis_block(0,0,0,0,1,num_elements,block_id);
+	return new_output_vector_block(directory,NULL,basis_block);
+}
+
+static
+vector_block_t new_test_output_block_filled_by_threads(const char *directory,
+							size_t num_elements,
+							int num_threads)
+{
+	vector_block_t vector_block = NULL;
+#pragma omp parallel num_threads(num_threads)
+	{
+#pragma omp single
+		vector_block =
+			new_test_output_block(directory,1,num_elements);
+		// Thread 1 never touches its copy
+		if (omp_get_thread_num() != 1)
+		{
+			double *elements =
+				get_vector_block_elements(vector_block);
+			for (size_t j = 0; j<num_elements; j++)
+				elements[j] += omp_get_thread_num()+j;
+		}
+	}
+	return vector_block;
+}
+#endif
+
+new_test(written_blocks_are_saved_and_reclaimed_blocks_are_intact,
+	 const char *directory = get_test_file_path("");
+	 const size_t num_elements = 16;
+	 const size_t num_blocks = 4;
+	 const size_t num_bytes = num_elements*sizeof(double);
+	 block_writer_t writer = new_block_writer(num_blocks,1);
+	 // The paused writer keeps all blocks in its queue
+	 set_block_writer_paused(writer,1);
+	 for (size_t i = 1; i<=num_blocks; i++)
+	 {
+		vector_block_t vector_block =
+			new_test_output_block(directory,i,num_elements);
+		double *elements = get_vector_block_elements(vector_block);
+		for (size_t j = 0; j<num_elements; j++)
+			elements[j] = i*100+j;
+		enqueue_vector_block(writer,vector_block,i,num_bytes);
+	 }
+	 vector_block_t reclaimed = reclaim_vector_block(writer,num_blocks);
+	 assert_that(reclaimed != NULL);
+	 assert_that(get_vector_block_elements(reclaimed)[1] ==
+		     num_blocks*100+1);
+	 assert_that(get_pending_write_bytes(writer) ==
+		     (num_blocks-1)*num_bytes);
+	 enqueue_vector_block(writer,reclaimed,num_blocks,num_bytes);
+	 set_block_writer_paused(writer,0);
+	 wait_for_all_block_writes(writer);
+	 assert_that(get_pending_write_bytes(writer) == 0);
+	 // A written block has to be read from disk
+	 assert_that(reclaim_vector_block(writer,1) == NULL);
+	 free_block_writer(writer);
+	 for (size_t i = 1; i<=num_blocks; i++)
+	 {
+		char filename[2048];
+		sprintf(filename,"%s/vec_%lu",directory,i);
+		FILE *file = fopen(filename,"r");
+		double elements[16];
+		assert_that(fread(elements,sizeof(double),num_elements,file)
+			    == num_elements);
+		fclose(file);
+		for (size_t j = 0; j<num_elements; j++)
+			assert_that(fabs(elements[j]-(i*100+j)) < 1e-12);
+	 }
+	);
+
+new_test(lazily_allocated_thread_copies_are_reduced,
+	 const char *directory = get_test_file_path("");
+	 const size_t num_elements = 10000;
+	 const int num_threads = 5;
+	 vector_block_t vector_block =
+		new_test_output_block_filled_by_threads(directory,
+							num_elements,
+							num_threads);
+	 reduce_vector_block(vector_block,num_threads);
+	 // A second reduction has nothing left to add
+	 reduce_vector_block(vector_block,1);
+	 double *elements = get_vector_block_elements(vector_block);
+	 for (size_t j = 0; j<num_elements; j++)
+		assert_that(fabs(elements[j]-(0+2+3+4+4.0*j)) < 1e-9);
+	 free_vector_block(vector_block);
+	);
+
+new_test(writer_reduces_thread_copies_with_its_team,
+	 const char *directory = get_test_file_path("");
+	 const size_t num_elements = 10000;
+	 const int num_threads = 5;
+	 vector_block_t vector_block =
+		new_test_output_block_filled_by_threads(directory,
+							num_elements,
+							num_threads);
+	 block_writer_t writer = new_block_writer(2,3);
+	 enqueue_vector_block(writer,vector_block,1,
+			      num_elements*sizeof(double));
+	 wait_for_all_block_writes(writer);
+	 free_block_writer(writer);
+	 char filename[2048];
+	 sprintf(filename,"%s/vec_1",directory);
+	 FILE *file = fopen(filename,"r");
+	 double *elements = (double*)malloc(num_elements*sizeof(double));
+	 assert_that(fread(elements,sizeof(double),num_elements,file) ==
+		     num_elements);
+	 fclose(file);
+	 for (size_t j = 0; j<num_elements; j++)
+		assert_that(fabs(elements[j]-(0+2+3+4+4.0*j)) < 1e-9);
+	 free(elements);
+	);
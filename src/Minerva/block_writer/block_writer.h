@@ -0,0 +1,53 @@
+#ifndef __BLOCK_WRITER__
+#define __BLOCK_WRITER__
+
+#include <stdlib.h>
+#include <vector_block/vector_block.h>
+
+/* The block writer owns a background thread that reduces and saves
+ * evicted output vector blocks, so that the thread evicting a block
+ * does not have to wait for the disk. The thread copies of a block are
+ * reduced by a team of num_reduction_threads threads of the writer. At
+ * most max_num_pending_blocks blocks can be queued, further calls to
+ * enqueue_vector_block block until there is room in the queue.
+ */
+struct _block_writer_;
+typedef struct _block_writer_ *block_writer_t;
+
+block_writer_t new_block_writer(size_t max_num_pending_blocks,
+				int num_reduction_threads);
+
+/* Hands over vector_block to the writer, which frees it once it is saved.
+ * The num_bytes of memory it occupies are counted as pending until then.
+ */
+void enqueue_vector_block(block_writer_t writer,
+			  vector_block_t vector_block,
+			  size_t block_id,
+			  size_t num_bytes);
+
+/* If the block with block_id is still waiting in the queue it is removed
+ * from the queue and returned, with its unsaved elements intact. If it is
+ * being written this waits until the write has completed. NULL is returned
+ * whenever the caller has to read the block from disk.
+ */
+vector_block_t reclaim_vector_block(block_writer_t writer,
+				    size_t block_id);
+
+size_t get_pending_write_bytes(block_writer_t writer);
+
+/* Waits until at least one more block has been written, returns
+ * immediately if nothing is pending.
+ */
+void wait_for_block_write(block_writer_t writer);
+
+void wait_for_all_block_writes(block_writer_t writer);
+
+/* Time in µs the writer thread has spent reducing thread copies.
+ */
+double get_background_reduction_time(block_writer_t writer);
+
+void print_block_writer_statistics(block_writer_t writer);
+
+void free_block_writer(block_writer_t writer);
+
+#endif
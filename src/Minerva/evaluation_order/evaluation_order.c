@@ -111,6 +111,30 @@ evaluation_order_t read_evaluation_order(const char *filename,
 	return evaluation_order;
 }
 
+evaluation_order_t
+new_diagonal_evaluation_order(evaluation_order_t evaluation_order)
+{
+	evaluation_order_t diagonal_order =
+		(evaluation_order_t)calloc(1,sizeof(struct _evaluation_order_));
+	diagonal_order->instructions =
+		(evaluation_instruction_t*)
+		malloc(evaluation_order->num_instruction*
+		       sizeof(evaluation_instruction_t));
+	for (size_t i = 0; i<evaluation_order->num_instruction; i++)
+	{
+		evaluation_instruction_t instruction =
+			evaluation_order->instructions[i];
+		if (instruction.type == unload ||
+		    instruction.vector_block_in != instruction.vector_block_out)
+			continue;
+		// The memory manager plans by the position in the order
+		instruction.instruction_index = diagonal_order->num_instruction;
+		diagonal_order->instructions[diagonal_order->num_instruction++] =
+			instruction;
+	}
+	return diagonal_order;
+}
+
 size_t get_num_instructions(evaluation_order_t evaluation_order)
 {
 	return evaluation_order->num_instruction;
@@ -33,6 +33,12 @@ typedef struct
 evaluation_order_t read_evaluation_order(const char *filename,
 				       combination_table_t combination_table);
 
+/* The instructions of the diagonal blocks, whose input and output vector
+ * blocks are the same, in their original order.
+ */
+evaluation_order_t
+new_diagonal_evaluation_order(evaluation_order_t evaluation_order);
+
 size_t get_num_instructions(evaluation_order_t evaluation_order);
 
 evaluation_order_iterator_t 
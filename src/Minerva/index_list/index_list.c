@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <debug_mode/debug_mode.h>
 
 struct _index_list_
@@ -96,6 +97,33 @@ index_list_t new_index_list_from_id(const char *base_directory,
 	return index_list;
 }
 
+index_list_t new_index_list_from_id_in_batch(const char *base_directory,
+					     const size_t id,
+					     batch_reader_t reader)
+{
+	char index_list_file_name[2048];
+	sprintf(index_list_file_name,
+		"%s/index_list_%lu",
+		base_directory,id);
+	struct stat file_status;
+	if (stat(index_list_file_name,&file_status) != 0)
+		error("Could not open file %s. %s\n",
+		      index_list_file_name,
+		      strerror(errno));
+	size_t num_bytes_in_file = file_status.st_size;
+	assert(num_bytes_in_file % sizeof(index_triple_t) == 0);
+	index_list_t index_list =
+		(index_list_t)malloc(sizeof(struct _index_list_));
+	index_list->num_elements = num_bytes_in_file / sizeof(index_triple_t);
+	index_list->elements = (index_triple_t*)new_io_buffer(num_bytes_in_file);
+	add_read_request(reader,
+			 index_list_file_name,
+			 index_list->elements,
+			 num_bytes_in_file,
+			 0);
+	return index_list;
+}
+
 size_t length_index_list(const index_list_t index_list)
 {
 	return index_list->num_elements;
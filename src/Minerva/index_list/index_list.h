@@ -3,6 +3,7 @@
 
 #include <sub_basis_block/sub_basis_block.h>
 #include <index_triple/index_triple.h>
+#include <batch_reader/batch_reader.h>
 
 struct _index_list_;
 typedef struct _index_list_ *index_list_t;
@@ -15,6 +16,13 @@ index_list_t new_index_list(const char *base_directory,
 index_list_t new_index_list_from_id(const char *base_directory,
 				    const size_t id);
 
+/* Like new_index_list_from_id, but the elements are only queued on reader,
+ * they are valid once submit_read_requests has returned.
+ */
+index_list_t new_index_list_from_id_in_batch(const char *base_directory,
+					     const size_t id,
+					     batch_reader_t reader);
+
 size_t length_index_list(const index_list_t index_list);
 
 index_triple_t *get_index_list_elements(const index_list_t index_list);
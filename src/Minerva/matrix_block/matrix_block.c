@@ -4,6 +4,7 @@
 #include <error/error.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <debug_mode/debug_mode.h>
 
 struct _matrix_block_
@@ -16,6 +17,9 @@ struct _matrix_block_
 	size_t block_id;
 };
 
+static
+void get_matrix_block_filename(matrix_block_t matrix_block,char *filename);
+
 static
 FILE *open_matrix_block_file(matrix_block_t matrix_block,const char *file_mode);
 
@@ -61,6 +65,70 @@ matrix_block_t new_matrix_block(size_t block_id,
 	return matrix_block;
 }
 
+matrix_block_t new_matrix_block_from_elements(size_t block_id,
+					      size_t neutron_matrix_dimension,
+					      size_t proton_matrix_dimension,
+					      double *elements)
+{
+	matrix_block_t matrix_block =
+	       	(matrix_block_t)malloc(sizeof(struct _matrix_block_));
+	matrix_block->block_id = block_id;
+	matrix_block->base_directory = copy_string("");
+	matrix_block->neutron_matrix_dimension = neutron_matrix_dimension;
+	matrix_block->proton_matrix_dimension = proton_matrix_dimension;
+	if (neutron_matrix_dimension == 0)
+		matrix_block->num_elements = proton_matrix_dimension;
+	else if (proton_matrix_dimension == 0)
+		matrix_block->num_elements = neutron_matrix_dimension;
+	else
+		matrix_block->num_elements =
+			neutron_matrix_dimension*proton_matrix_dimension;
+	matrix_block->matrix_elements = elements;
+	return matrix_block;
+}
+
+matrix_block_t new_matrix_block_in_batch(size_t block_id,
+					 const char *base_directory,
+					 batch_reader_t reader)
+{
+	matrix_block_t matrix_block =
+	       	(matrix_block_t)malloc(sizeof(struct _matrix_block_));
+	matrix_block->block_id = block_id;
+	matrix_block->base_directory = copy_string(base_directory);
+	char filename[2048];
+	get_matrix_block_filename(matrix_block,filename);
+	struct stat file_status;
+	if (stat(filename,&file_status) != 0)
+		error("Could not open block file %s. %s\n",
+		      filename,
+		      strerror(errno));
+	// The file starts with the two dimensions, and the number of
+	// elements they give is what remains of the file
+	const size_t header_size = 2*sizeof(size_t);
+	if ((size_t)file_status.st_size < header_size)
+		error("Matrix file %lu has no header\n",block_id);
+	matrix_block->num_elements =
+		(file_status.st_size - header_size)/sizeof(double);
+	matrix_block->matrix_elements =
+		(double*)malloc(matrix_block->num_elements*sizeof(double));
+	add_read_request(reader,
+			 filename,
+			 &matrix_block->neutron_matrix_dimension,
+			 sizeof(size_t),
+			 0);
+	add_read_request(reader,
+			 filename,
+			 &matrix_block->proton_matrix_dimension,
+			 sizeof(size_t),
+			 sizeof(size_t));
+	add_read_request(reader,
+			 filename,
+			 matrix_block->matrix_elements,
+			 matrix_block->num_elements*sizeof(double),
+			 header_size);
+	return matrix_block;
+}
+
 double *get_matrix_block_elements(const matrix_block_t matrix_block)
 {
 	return matrix_block->matrix_elements;
@@ -83,14 +151,20 @@ void free_matrix_block(matrix_block_t matrix_block)
 	free(matrix_block);
 }
 
-	static
-FILE *open_matrix_block_file(matrix_block_t matrix_block,const char *file_mode)
+static
+void get_matrix_block_filename(matrix_block_t matrix_block,char *filename)
 {
-	char filename[2048];
 	sprintf(filename,
 		"%s/%lu_matrix_elements",
 		matrix_block->base_directory,
 		matrix_block->block_id);
+}
+
+	static
+FILE *open_matrix_block_file(matrix_block_t matrix_block,const char *file_mode)
+{
+	char filename[2048];
+	get_matrix_block_filename(matrix_block,filename);
 	FILE *block_file = fopen(filename,file_mode);
 	if (block_file == NULL)
 		error("Could not open block file %s. %s\n",
@@ -3,6 +3,7 @@
 
 #include <basis_block/basis_block.h>
 #include <sub_basis_block/sub_basis_block.h>
+#include <batch_reader/batch_reader.h>
 
 struct _matrix_block_;
 typedef struct _matrix_block_ *matrix_block_t;
@@ -10,6 +11,27 @@ typedef struct _matrix_block_ *matrix_block_t;
 matrix_block_t new_matrix_block(size_t block_id,
 				const char *base_directory);
 
+/* Takes over elements, which are laid out as in a matrix block file.
+ */
+matrix_block_t new_matrix_block_from_elements(size_t block_id,
+					      size_t neutron_matrix_dimension,
+					      size_t proton_matrix_dimension,
+					      double *elements);
+
+/* Computes the matrix block with block_id in memory instead of reading it
+ * from disk, or returns NULL if the block has to be read from disk. It is
+ * called from several threads at once.
+ */
+typedef matrix_block_t (*matrix_block_generator_t)(size_t block_id,
+						   void *generator_data);
+
+/* Like new_matrix_block, but the dimensions and elements are only queued
+ * on reader, they are valid once submit_read_requests has returned.
+ */
+matrix_block_t new_matrix_block_in_batch(size_t block_id,
+					 const char *base_directory,
+					 batch_reader_t reader);
+
 double *get_matrix_block_elements(const matrix_block_t matrix_block);
 
 size_t get_neutron_matrix_dimension(const matrix_block_t matrix_block);
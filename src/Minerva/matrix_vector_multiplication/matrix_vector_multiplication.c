@@ -460,3 +460,134 @@ void multiplication_neutrons_protons_off_diag(vector_block_t out_block_left,
 		}
 	}
 }
+
+/* Copies the triples of the list whose in and out indices are the same,
+ * returns their number.
+ */
+static
+size_t get_diagonal_triples(index_triple_t **diagonal_triples,
+			    const index_list_t list)
+{
+	const size_t num_indices = length_index_list(list);
+	index_triple_t *indices = get_index_list_elements(list);
+	*diagonal_triples =
+		(index_triple_t*)malloc(num_indices*sizeof(index_triple_t));
+	size_t num_diagonal_triples = 0;
+	for (size_t i = 0; i < num_indices; i++)
+		if (indices[i].in_index == indices[i].out_index)
+			(*diagonal_triples)[num_diagonal_triples++] = indices[i];
+	return num_diagonal_triples;
+}
+
+void diagonal_neutrons(vector_block_t out_block,
+		       const matrix_block_t block,
+		       const index_list_t neutron_list)
+{
+	const size_t num_proton_states =
+		get_proton_dimension(out_block);
+	const size_t num_neutron_states =
+		get_neutron_dimension(out_block);
+	double *out_vector_elements =
+		get_vector_block_elements(out_block);
+	double *matrix_elements = get_matrix_block_elements(block);
+	index_triple_t *neutron_indices = NULL;
+	const size_t num_neutron_indices =
+		get_diagonal_triples(&neutron_indices,neutron_list);
+	log_entry("num_neutron_indices = %lu",
+		  num_neutron_indices);
+	for (size_t i = 0; i < num_neutron_indices; i++)
+	{
+		const size_t neutron_index = neutron_indices[i].out_index;
+		const int matrix_index = neutron_indices[i].matrix_index;
+		const double matrix_element =
+			retrive_phase_info(matrix_index)*
+			matrix_elements[remove_phase_info(matrix_index)];
+		for (size_t proton_state = 0;
+		     proton_state < num_proton_states;
+		     proton_state++)
+			out_vector_elements[neutron_index +
+					    num_neutron_states*proton_state] +=
+				matrix_element;
+	}
+	free(neutron_indices);
+}
+
+void diagonal_protons(vector_block_t out_block,
+		      const matrix_block_t block,
+		      const index_list_t proton_list)
+{
+	const size_t num_neutron_states =
+		get_neutron_dimension(out_block);
+	double *out_vector_elements =
+		get_vector_block_elements(out_block);
+	double *matrix_elements = get_matrix_block_elements(block);
+	index_triple_t *proton_indices = NULL;
+	const size_t num_proton_indices =
+		get_diagonal_triples(&proton_indices,proton_list);
+	log_entry("num_proton_indices = %lu",
+		  num_proton_indices);
+	for (size_t i = 0; i < num_proton_indices; i++)
+	{
+		const size_t proton_index = proton_indices[i].out_index;
+		const int matrix_index = proton_indices[i].matrix_index;
+		const double matrix_element =
+			retrive_phase_info(matrix_index)*
+			matrix_elements[remove_phase_info(matrix_index)];
+		for (size_t neutron_state = 0;
+		     neutron_state < num_neutron_states;
+		     neutron_state++)
+			out_vector_elements[num_neutron_states*proton_index +
+					    neutron_state] +=
+				matrix_element;
+	}
+	free(proton_indices);
+}
+
+void diagonal_neutrons_protons(vector_block_t out_block,
+			       const matrix_block_t block,
+			       const index_list_t neutron_list,
+			       const index_list_t proton_list)
+{
+	const size_t num_neutron_states =
+		get_neutron_dimension(out_block);
+	const size_t neutron_matrix_dimension =
+		get_neutron_matrix_dimension(block);
+	double *out_vector_elements =
+		get_vector_block_elements(out_block);
+	double *matrix_elements = get_matrix_block_elements(block);
+	index_triple_t *neutron_indices = NULL;
+	const size_t num_neutron_indices =
+		get_diagonal_triples(&neutron_indices,neutron_list);
+	index_triple_t *proton_indices = NULL;
+	const size_t num_proton_indices =
+		get_diagonal_triples(&proton_indices,proton_list);
+	log_entry("num_neutron_indices = %lu",
+		  num_neutron_indices);
+	log_entry("num_proton_indices = %lu",
+		  num_proton_indices);
+	for (size_t i = 0; i < num_neutron_indices; i++)
+	{
+		const size_t neutron_index = neutron_indices[i].out_index;
+		const int neutron_matrix_index =
+			neutron_indices[i].matrix_index;
+		for (size_t j = 0; j < num_proton_indices; j++)
+		{
+			const size_t proton_index =
+				proton_indices[j].out_index;
+			const int proton_matrix_index =
+				proton_indices[j].matrix_index;
+			const size_t matrix_index =
+				remove_phase_info(neutron_matrix_index) +
+				neutron_matrix_dimension *
+				remove_phase_info(proton_matrix_index);
+			const int sign =
+				retrive_phase_info(neutron_matrix_index) *
+				retrive_phase_info(proton_matrix_index);
+			out_vector_elements[neutron_index +
+					    num_neutron_states*proton_index] +=
+				sign * matrix_elements[matrix_index];
+		}
+	}
+	free(proton_indices);
+	free(neutron_indices);
+}
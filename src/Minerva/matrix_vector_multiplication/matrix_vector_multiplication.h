@@ -44,4 +44,20 @@ void multiplication_neutrons_protons_off_diag(vector_block_t out_block_left,
 					      const matrix_block_t block,
 					      const index_list_t neutron_list,
 					      const index_list_t proton_list);
+/* The diagonal variants add the diagonal of the matrix block to the output
+ * block instead of multiplying an input block. Only the index triples whose
+ * in and out indices are the same contribute.
+ */
+void diagonal_neutrons(vector_block_t out_block,
+		       const matrix_block_t block,
+		       const index_list_t neutron_list);
+
+void diagonal_protons(vector_block_t out_block,
+		      const matrix_block_t block,
+		      const index_list_t proton_list);
+
+void diagonal_neutrons_protons(vector_block_t out_block,
+			       const matrix_block_t block,
+			       const index_list_t neutron_list,
+			       const index_list_t proton_list);
 #endif
@@ -1,4 +1,6 @@
 #include <memory_manager/memory_manager.h>
+#include <block_writer/block_writer.h>
+#include <batch_reader/batch_reader.h>
 #include <string_tools/string_tools.h>
 #include <radix_sort/radix_sort.h>
 #include <global_constants/global_constants.h>
@@ -7,6 +9,7 @@
 #include <assert.h>
 #include <omp.h>
 #include <unistd.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <debug_mode/debug_mode.h>
@@ -14,6 +17,14 @@
 #define min(a,b) ((a) < (b) ? (a) : (b)) 
 #define max(a,b) ((a) > (b) ? (a) : (b)) 
 
+// Number of evicted output vector blocks that can wait for the block writer
+static const size_t max_num_pending_writes = 8;
+
+// The block writer reduces the thread copies of an evicted output vector
+// block with at most this many threads. The reduction is bound by the
+// memory bandwidth, more threads would only slow down the instructions.
+static const int max_num_reduction_threads = 4;
+
 typedef enum
 {
 	UNKNOWN,
@@ -22,14 +33,22 @@ typedef enum
 	INDEX_LIST
 } array_type_t;
 
+/* For vector blocks primary_array and secondary_array are arrays with the
+ * input and output vector blocks of every vector of the sweep.
+ */
 typedef struct
 {
 	array_type_t type;
 	void *primary_array;
 	void *secondary_array;
+	// Arrays whose elements are being read, they are moved to
+	// primary_array and secondary_array once the read has completed
+	void *loading_primary_array;
+	void *loading_secondary_array;
 	size_t in_use;
 	size_t needed_by_instruction;
 	size_t size_array;
+	size_t size_secondary_array;
 	size_t array_id;
 	// To make sure that no two threads loads the same array
 	omp_nest_lock_t loading_array_lock;
@@ -42,8 +61,17 @@ struct _memory_manager_
 {	
 	array_t *all_arrays;
 	size_t num_arrays;
-	char *input_vector_base_directory;
-	char *output_vector_base_directory;
+	size_t num_vectors;
+	// NULL when no input vector is read
+	char **input_vector_base_directories;
+	char **output_vector_base_directories;
+	// The vector files of the vectors, NULL with block files
+	vector_file_t *input_vector_files;
+	vector_file_t *output_vector_files;
+	// The input vectors held in memory, NULL when all are read from files.
+	// The block with id i starts at vector_block_offsets[i-1].
+	const double **input_vector_elements;
+	size_t *vector_block_offsets;
 	char *index_list_base_directory;
 	char *matrix_base_directory;
 	combination_table_t combination_table;
@@ -56,6 +84,11 @@ struct _memory_manager_
 	double min_waiting_time;
 	double max_waiting_time;
 	omp_lock_t size_current_loaded_memory_lock;
+	block_writer_t block_writer;
+	batch_reader_t *batch_readers;
+	size_t num_batch_readers;
+	matrix_block_generator_t matrix_block_generator;
+	void *matrix_block_generator_data;
 };
 
 static
@@ -70,6 +103,13 @@ static
 void make_space_for(memory_manager_t manager,
 		    evaluation_instruction_t instruction);
 
+static
+void wait_for_pending_writes(memory_manager_t manager,
+			     evaluation_instruction_t instruction);
+
+static
+size_t get_loaded_and_pending_memory(memory_manager_t manager);
+
 static
 void load_needed_arrays(memory_manager_t manager,
 			evaluation_instruction_t instruction);
@@ -80,7 +120,12 @@ static
 int is_array_loaded(memory_manager_t manager, size_t array_id);
 
 static
-void load_array(memory_manager_t manager, size_t array_id);
+int begin_loading_array(memory_manager_t manager,
+			size_t array_id,
+			batch_reader_t reader);
+
+static
+void finish_loading_array(memory_manager_t manager, size_t array_id);
 
 static
 void unload_array(memory_manager_t manager, size_t array_id);
@@ -113,6 +158,11 @@ size_t get_array_size(memory_manager_t manager,
 static
 uint64_t needed_by_key_function(size_t *array_index, memory_manager_t manager);
 
+static
+size_t get_written_block_id(memory_manager_t manager,
+			    size_t array_id,
+			    size_t vector_index);
+
 memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 				    const char *output_vector_base_directory,
 				    const char *index_list_base_directory,
@@ -120,6 +170,28 @@ memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 				    combination_table_t combination_table,
 				    evaluation_order_t evaluation_order,
 				    size_t maximum_loaded_memory)
+{
+	return new_multi_vector_memory_manager
+		(input_vector_base_directory != NULL ?
+		 &input_vector_base_directory : NULL,
+		 &output_vector_base_directory,
+		 1,
+		 index_list_base_directory,
+		 matrix_base_directory,
+		 combination_table,
+		 evaluation_order,
+		 maximum_loaded_memory);
+}
+
+memory_manager_t
+new_multi_vector_memory_manager(const char **input_vector_base_directories,
+				const char **output_vector_base_directories,
+				size_t num_vectors,
+				const char *index_list_base_directory,
+				const char *matrix_base_directory,
+				combination_table_t combination_table,
+				evaluation_order_t evaluation_order,
+				size_t maximum_loaded_memory)
 {
 	memory_manager_t manager =
 	       	(memory_manager_t)calloc(1,sizeof(struct _memory_manager_));
@@ -128,8 +200,38 @@ memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 		(array_t*)calloc(manager->num_arrays, sizeof(array_t));
 	manager->candidate_arrays_workspace =
 	       	(size_t*)calloc(manager->num_arrays,sizeof(size_t));
-	manager->input_vector_base_directory = copy_string(input_vector_base_directory);
-	manager->output_vector_base_directory = copy_string(output_vector_base_directory);
+	manager->num_vectors = num_vectors;
+	if (input_vector_base_directories != NULL)
+	{
+		manager->input_vector_base_directories =
+			(char**)malloc(num_vectors*sizeof(char*));
+		manager->input_vector_files =
+			(vector_file_t*)malloc(num_vectors*
+					       sizeof(vector_file_t));
+	}
+	manager->output_vector_base_directories =
+		(char**)malloc(num_vectors*sizeof(char*));
+	manager->output_vector_files =
+		(vector_file_t*)malloc(num_vectors*sizeof(vector_file_t));
+	for (size_t i = 0; i<num_vectors; i++)
+	{
+		if (input_vector_base_directories != NULL)
+		{
+			manager->input_vector_base_directories[i] =
+				copy_string(input_vector_base_directories[i]);
+			manager->input_vector_files[i] =
+				has_vector_file
+				(input_vector_base_directories[i]) ?
+				open_vector_file
+				(input_vector_base_directories[i]) : NULL;
+		}
+		manager->output_vector_base_directories[i] =
+			copy_string(output_vector_base_directories[i]);
+		manager->output_vector_files[i] =
+			has_vector_file(output_vector_base_directories[i]) ?
+			open_vector_file(output_vector_base_directories[i]) :
+			NULL;
+	}
 	manager->index_list_base_directory = copy_string(index_list_base_directory);
 	manager->matrix_base_directory = copy_string(matrix_base_directory);
 	manager->combination_table = combination_table;
@@ -141,10 +243,59 @@ memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 	manager->min_waiting_time = INFINITY;
 	manager->max_waiting_time = 0.0;
 	omp_init_lock(&manager->size_current_loaded_memory_lock);
+	manager->block_writer =
+		new_block_writer(max_num_pending_writes,
+				 min(max_num_reduction_threads,
+				     omp_get_max_threads()));
+	// One reader for each thread that can execute instructions
+	manager->num_batch_readers = omp_get_max_threads();
+	manager->batch_readers =
+		(batch_reader_t*)malloc(manager->num_batch_readers*
+					sizeof(batch_reader_t));
+	for (size_t i = 0; i<manager->num_batch_readers; i++)
+		manager->batch_readers[i] = new_batch_reader();
 	initialize_arrays(manager);
 	return manager;
 }
 
+void set_matrix_block_generator(memory_manager_t manager,
+				matrix_block_generator_t generator,
+				void *generator_data)
+{
+	manager->matrix_block_generator = generator;
+	manager->matrix_block_generator_data = generator_data;
+}
+
+void set_input_vector_elements(memory_manager_t manager,
+			       const double **input_vector_elements)
+{
+	if (manager->input_vector_base_directories == NULL)
+		error("The instructions do not read an input vector\n");
+	free(manager->input_vector_elements);
+	manager->input_vector_elements =
+		(const double**)malloc(manager->num_vectors*sizeof(double*));
+	memcpy(manager->input_vector_elements,
+	       input_vector_elements,
+	       manager->num_vectors*sizeof(double*));
+	if (manager->vector_block_offsets != NULL)
+		return;
+	manager->vector_block_offsets =
+		(size_t*)calloc(manager->num_arrays,sizeof(size_t));
+	size_t offset = 0;
+	iterator_t basis_blocks =
+		new_basis_block_iterator(manager->combination_table);
+	basis_block_t basis_block;
+	for (initialize(basis_blocks,&basis_block);
+	     has_next_element(basis_blocks);
+	     next_element(basis_blocks,&basis_block))
+	{
+		manager->vector_block_offsets[basis_block.block_id-1] = offset;
+		offset += basis_block.num_proton_states*
+			basis_block.num_neutron_states;
+	}
+	free_iterator(basis_blocks);
+}
+
 void begin_instruction(memory_manager_t manager,
 		       evaluation_instruction_t instruction)
 {
@@ -154,24 +305,34 @@ void begin_instruction(memory_manager_t manager,
 		set_all_in_use(manager,instruction);
 		make_space_for(manager,instruction);
 	}
+	wait_for_pending_writes(manager,instruction);
 	load_needed_arrays(manager,instruction);
 }
 
+size_t get_num_vectors(memory_manager_t manager)
+{
+	return manager->num_vectors;
+}
+
 vector_block_t request_input_vector_block(memory_manager_t manager,
-				       size_t vector_block_id)
+				       size_t vector_block_id,
+				       size_t vector_index)
 {
 	// No new requests are allowed while unloading
 	wait_til_array_is_loaded(manager,vector_block_id);
 	array_t *array = &manager->all_arrays[vector_block_id-1];
 	if (array->type != VECTOR_BLOCK)
 		error("%lu is not a vector block\n", vector_block_id);
+	if (array->primary_array == NULL)
+		return NULL;
 	vector_block_t output_vector_block = 
-		(vector_block_t)array->primary_array;
+		((vector_block_t*)array->primary_array)[vector_index];
 	return output_vector_block;
 }
 
 vector_block_t request_output_vector_block(memory_manager_t manager,
-					size_t vector_block_id)
+					size_t vector_block_id,
+					size_t vector_index)
 {
 	// No new requests are allowed while unloading
 	wait_til_array_is_loaded(manager,vector_block_id);
@@ -179,7 +340,7 @@ vector_block_t request_output_vector_block(memory_manager_t manager,
 	if (array->type != VECTOR_BLOCK)
 		error("%lu is not a vector block\n", vector_block_id);
 	vector_block_t output_vector_block = 
-		(vector_block_t)array->secondary_array;
+		((vector_block_t*)array->secondary_array)[vector_index];
 	return output_vector_block;
 }
 
@@ -249,18 +410,66 @@ void free_memory_manager(memory_manager_t manager)
 	       manager->min_waiting_time);
 	printf("Max wait time: %lg µs\n",
 	       manager->max_waiting_time);
+	// The output blocks still loaded at the end of the sweep are reduced
+	// here using all threads, instead of serially by the block writer
+	struct timespec t_start,t_end;
+	clock_gettime(CLOCK_REALTIME,&t_start);
+	for (size_t i = 0; i < manager->num_arrays; i++)
+	{
+		array_t *array = &manager->all_arrays[i];
+		if (array->type != VECTOR_BLOCK || !is_array_loaded(manager,i+1))
+			continue;
+		for (size_t j = 0; j<manager->num_vectors; j++)
+			reduce_vector_block
+				(((vector_block_t*)array->secondary_array)[j],
+				 omp_get_max_threads());
+	}
+	clock_gettime(CLOCK_REALTIME,&t_end);
+	double final_reduction_time =
+		(t_end.tv_sec - t_start.tv_sec)*1e6 +
+		(t_end.tv_nsec - t_start.tv_nsec)*1e-3;
 	for (size_t i = 0; i < manager->num_arrays; i++)
 	{
 		if (is_array_loaded(manager,i+1))
 			unload_array(manager,i+1);
+	}
+	wait_for_all_block_writes(manager->block_writer);
+	printf("Final parallel reduction time: %lg µs\n",
+	       final_reduction_time);
+	printf("Total reduction time: %lg µs\n",
+	       final_reduction_time +
+	       get_background_reduction_time(manager->block_writer));
+	print_block_writer_statistics(manager->block_writer);
+	free_block_writer(manager->block_writer);
+	for (size_t i = 0; i<manager->num_vectors; i++)
+	{
+		if (manager->input_vector_base_directories != NULL)
+		{
+			if (manager->input_vector_files[i] != NULL)
+				free_vector_file(manager->input_vector_files[i]);
+			free(manager->input_vector_base_directories[i]);
+		}
+		if (manager->output_vector_files[i] != NULL)
+			free_vector_file(manager->output_vector_files[i]);
+		free(manager->output_vector_base_directories[i]);
+	}
+	free(manager->input_vector_files);
+	free(manager->output_vector_files);
+	free(manager->input_vector_elements);
+	free(manager->vector_block_offsets);
+	free(manager->input_vector_base_directories);
+	free(manager->output_vector_base_directories);
+	for (size_t i = 0; i < manager->num_arrays; i++)
+	{
 		array_t *array = &manager->all_arrays[i];
 		omp_destroy_nest_lock(&array->loading_array_lock);
 		omp_destroy_lock(&array->array_loading_in_other_thread_lock);
 		omp_destroy_lock(&array->in_use_lock);
 	}
+	for (size_t i = 0; i<manager->num_batch_readers; i++)
+		free_batch_reader(manager->batch_readers[i]);
+	free(manager->batch_readers);
 	free(manager->all_arrays);
-	free(manager->input_vector_base_directory);
-	free(manager->output_vector_base_directory);
 	free(manager->index_list_base_directory);
 	free(manager->matrix_base_directory);
 	free(manager->candidate_arrays_workspace);
@@ -300,8 +509,11 @@ void initialize_arrays(memory_manager_t manager)
 		current_array->type = 
 			VECTOR_BLOCK;
 		// Since there is one output vector per thread
-		// and one input vector
-		current_array->size_array *= (num_threads+1);
+		// and one input vector, for each vector of the sweep
+		current_array->size_secondary_array =
+			current_array->size_array*num_threads;
+		current_array->size_array *=
+			(num_threads+1)*manager->num_vectors;
 	}
 	free_iterator(basis_blocks);
 	iterator_t index_lists = 
@@ -365,6 +577,8 @@ void make_space_for(memory_manager_t manager,
 		      manager->maximum_loaded_memory);
 
 
+	// Memory held by blocks waiting for the block writer is not
+	// counted here, it is waited for in wait_for_pending_writes
 	if (manager->size_current_loaded_memory + needed_memory <
 	    manager->maximum_loaded_memory)
 		return;
@@ -408,17 +622,64 @@ void make_space_for(memory_manager_t manager,
 	}
 }
 
+static
+void wait_for_pending_writes(memory_manager_t manager,
+			     evaluation_instruction_t instruction)
+{
+	// The memory of evicted blocks is reclaimed once they are written,
+	// this is done outside of the unloading critical section so that
+	// only threads that actually need the memory waits for the disk
+	size_t needed_memory = 
+		get_size_of_unloaded_arrays(manager,instruction);
+	while (get_loaded_and_pending_memory(manager) + needed_memory >
+	       manager->maximum_loaded_memory &&
+	       get_pending_write_bytes(manager->block_writer) > 0)
+		wait_for_block_write(manager->block_writer);
+}
+
+static
+size_t get_loaded_and_pending_memory(memory_manager_t manager)
+{
+	omp_set_lock(&manager->size_current_loaded_memory_lock);
+	size_t loaded_memory = manager->size_current_loaded_memory;
+	omp_unset_lock(&manager->size_current_loaded_memory_lock);
+	return loaded_memory + get_pending_write_bytes(manager->block_writer);
+}
+
 static
 void load_needed_arrays(memory_manager_t manager,
 			evaluation_instruction_t instruction)
 {
-	load_array(manager,instruction.vector_block_in);
-	load_array(manager,instruction.vector_block_out);
-	load_array(manager,instruction.matrix_element_file);
-	if (instruction.neutron_index != no_index) 
-		load_array(manager,instruction.neutron_index);
-	if (instruction.proton_index != no_index)
-		load_array(manager,instruction.proton_index);
+	const size_t needed_arrays[] =
+	{
+		instruction.vector_block_in,
+		instruction.vector_block_out,
+		instruction.matrix_element_file,
+		instruction.neutron_index,
+		instruction.proton_index
+	};
+	const size_t num_needed_arrays =
+		sizeof(needed_arrays)/sizeof(size_t);
+	size_t loading_arrays[num_needed_arrays];
+	size_t num_loading_arrays = 0;
+	batch_reader_t reader = 
+		manager->batch_readers[omp_get_thread_num() %
+				       manager->num_batch_readers];
+	for (size_t i = 0; i<num_needed_arrays; i++)
+	{
+		if (needed_arrays[i] == no_index)
+			continue;
+		int is_duplicate = 0;
+		for (size_t j = 0; j<i; j++)
+			is_duplicate |= needed_arrays[j] == needed_arrays[i];
+		if (!is_duplicate &&
+		    begin_loading_array(manager,needed_arrays[i],reader))
+			loading_arrays[num_loading_arrays++] = needed_arrays[i];
+	}
+	// All files of the instruction are read in one batch
+	submit_read_requests(reader);
+	for (size_t i = 0; i<num_loading_arrays; i++)
+		finish_loading_array(manager,loading_arrays[i]);
 }
 
 static
@@ -452,19 +713,25 @@ int is_array_loaded(memory_manager_t manager,
 	return value;
 }
 
+/* Queues the reads of the array on reader, unless it is already loaded or
+ * being loaded by another thread. Returns 1 if the array has to be
+ * finished with finish_loading_array after the reads are submitted. Until
+ * then the array stays locked, so other threads wait for the read.
+ */
 static
-void load_array(memory_manager_t manager,
-		size_t array_id)
+int begin_loading_array(memory_manager_t manager,
+			size_t array_id,
+			batch_reader_t reader)
 {
 	array_t *array = &manager->all_arrays[array_id-1];
 	if (!omp_test_lock(&array->array_loading_in_other_thread_lock))
-		return;
+		return 0;
 	omp_set_nest_lock(&array->loading_array_lock);
 	if (is_array_loaded(manager,array_id))
 	{
 		omp_unset_nest_lock(&array->loading_array_lock);
 		omp_unset_lock(&array->array_loading_in_other_thread_lock);
-		return;
+		return 0;
 	}
 	switch(array->type)
 	{
@@ -473,34 +740,88 @@ void load_array(memory_manager_t manager,
 		basis_block_t basis_block =
 		       	get_basis_block(manager->combination_table,
 					array_id);
-		array->primary_array =
-			(void*)
-		       	new_vector_block(manager->input_vector_base_directory,
-					 basis_block);
-		array->secondary_array = 
-			(void*)
-			new_output_vector_block
-			(manager->output_vector_base_directory,
-			 basis_block);
+		vector_block_t *input_blocks =
+			manager->input_vector_base_directories != NULL ?
+			(vector_block_t*)
+			malloc(manager->num_vectors*sizeof(vector_block_t)) :
+			NULL;
+		vector_block_t *output_blocks =
+			(vector_block_t*)
+			malloc(manager->num_vectors*sizeof(vector_block_t));
+		for (size_t i = 0; i<manager->num_vectors; i++)
+		{
+			if (manager->input_vector_elements != NULL &&
+			    manager->input_vector_elements[i] != NULL)
+				input_blocks[i] =
+					new_vector_block_from_elements
+					(basis_block,
+					 manager->input_vector_elements[i] +
+					 manager->vector_block_offsets
+					 [array_id-1]);
+			else if (input_blocks != NULL)
+				input_blocks[i] =
+					new_vector_block_in_batch
+					(manager->input_vector_base_directories[i],
+					 manager->input_vector_files[i],
+					 basis_block,
+					 reader);
+			// An evicted output block that is not yet written is
+			// taken back as it is, instead of being read from disk
+			output_blocks[i] =
+				reclaim_vector_block
+				(manager->block_writer,
+				 get_written_block_id(manager,array_id,i));
+			if (output_blocks[i] == NULL)
+				output_blocks[i] = 
+					new_output_vector_block_in_batch
+					(manager->output_vector_base_directories[i],
+					 manager->output_vector_files[i],
+					 basis_block,
+					 reader);
+		}
+		array->loading_primary_array = (void*)input_blocks;
+		array->loading_secondary_array = (void*)output_blocks;
 		break;
 	case INDEX_LIST:
 		log_entry("It is an index list\n");
-		array->primary_array =
+		array->loading_primary_array =
 			(void*)
-			new_index_list_from_id
+			new_index_list_from_id_in_batch
 			(manager->index_list_base_directory,
-			 array_id);
+			 array_id,
+			 reader);
 		break;
 	case MATRIX_BLOCK:
 		log_entry("It is a matrix block\n");
-		array->primary_array =
-			(void*)
-			new_matrix_block(array_id,
-					 manager->matrix_base_directory);		
+		if (manager->matrix_block_generator != NULL)
+			array->loading_primary_array =
+				(void*)
+				manager->matrix_block_generator
+				(array_id,
+				 manager->matrix_block_generator_data);
+		if (array->loading_primary_array == NULL)
+			array->loading_primary_array =
+				(void*)
+				new_matrix_block_in_batch
+				(array_id,
+				 manager->matrix_base_directory,
+				 reader);
 		break;
 	default:
 		error("Can't load unknown array\n");
 	}	
+	return 1;
+}
+
+static
+void finish_loading_array(memory_manager_t manager,
+			  size_t array_id)
+{
+	array_t *array = &manager->all_arrays[array_id-1];
+	array->primary_array = array->loading_primary_array;
+	array->secondary_array = array->loading_secondary_array;
+	array->loading_primary_array = NULL;
+	array->loading_secondary_array = NULL;
 	omp_set_lock(&manager->size_current_loaded_memory_lock);
 	manager->size_current_loaded_memory+=array->size_array;
 	omp_unset_lock(&manager->size_current_loaded_memory_lock);
@@ -516,14 +837,28 @@ void unload_array(memory_manager_t manager,
 	switch(array->type)
 	{
 	case VECTOR_BLOCK:
-		log_entry("Unloading vector %p\n",
-			  array->primary_array);
-		free_vector_block((vector_block_t)array->primary_array);
-		save_vector_block_elements((vector_block_t)
-					   array->secondary_array);
-		log_entry("Unloading vector %p\n",
-			  array->secondary_array);
-		free_vector_block((vector_block_t)array->secondary_array);
+		for (size_t i = 0; i<manager->num_vectors; i++)
+		{
+			if (array->primary_array != NULL)
+			{
+				log_entry("Unloading vector %p\n",
+					  ((vector_block_t*)
+					   array->primary_array)[i]);
+				free_vector_block(((vector_block_t*)
+						   array->primary_array)[i]);
+			}
+			log_entry("Unloading vector %p\n",
+				  ((vector_block_t*)array->secondary_array)[i]);
+			// The block writer reduces, saves and frees the output
+			// block
+			enqueue_vector_block
+				(manager->block_writer,
+				 ((vector_block_t*)array->secondary_array)[i],
+				 get_written_block_id(manager,array_id,i),
+				 array->size_secondary_array);
+		}
+		free(array->primary_array);
+		free(array->secondary_array);
 		break;
 	case INDEX_LIST:
 		free_index_list((index_list_t)array->primary_array);
@@ -545,9 +880,10 @@ static
 void set_all_needed_by(memory_manager_t manager,
 		       evaluation_instruction_t instruction)
 {
-	set_needed_by(manager,
-		      instruction.vector_block_in,
-		      instruction.instruction_index);
+	if (manager->input_vector_base_directories != NULL)
+		set_needed_by(manager,
+			      instruction.vector_block_in,
+			      instruction.instruction_index);
 	set_needed_by(manager,
 		      instruction.vector_block_out,
 		      instruction.instruction_index);
@@ -566,7 +902,9 @@ static
 void set_all_in_use(memory_manager_t manager,
 		    evaluation_instruction_t instruction)
 {
-	set_in_use(manager,instruction.vector_block_in);
+	// Without input vectors only the output block is requested
+	if (manager->input_vector_base_directories != NULL)
+		set_in_use(manager,instruction.vector_block_in);
 	set_in_use(manager,instruction.vector_block_out);
 	set_in_use(manager,instruction.matrix_element_file);
 	set_in_use(manager,instruction.neutron_index);
@@ -622,3 +960,14 @@ uint64_t needed_by_key_function(size_t *array_id, memory_manager_t manager)
 {
 	return manager->all_arrays[(*array_id)-1].needed_by_instruction;
 }
+
+/* The block writer tells the output blocks of the different vectors apart
+ * by their id.
+ */
+static
+size_t get_written_block_id(memory_manager_t manager,
+			    size_t array_id,
+			    size_t vector_index)
+{
+	return vector_index*manager->num_arrays + array_id;
+}
@@ -11,6 +11,9 @@
 struct _memory_manager_;
 typedef struct _memory_manager_ *memory_manager_t;
 
+/* The input vector base directory may be NULL when the instructions only
+ * write to the output vector, the input vector blocks are then NULL.
+ */
 memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 				    const char *output_vector_base_directory,
 				    const char *index_list_base_directory,
@@ -19,15 +22,50 @@ memory_manager_t new_memory_manager(const char *input_vector_base_directory,
 				    evaluation_order_t evaluation_order,
 				    size_t maximum_loaded_memory);
 
+/* Like new_memory_manager, but the instructions are run on num_vectors
+ * input and output vectors at once. Each matrix block and index list is
+ * loaded once for all of them, the vector blocks of all vectors are loaded
+ * and unloaded together.
+ */
+memory_manager_t
+new_multi_vector_memory_manager(const char **input_vector_base_directories,
+				const char **output_vector_base_directories,
+				size_t num_vectors,
+				const char *index_list_base_directory,
+				const char *matrix_base_directory,
+				combination_table_t combination_table,
+				evaluation_order_t evaluation_order,
+				size_t maximum_loaded_memory);
+
+/* Matrix blocks the generator returns are computed in memory instead of
+ * being read from the matrix file base directory.
+ */
+void set_matrix_block_generator(memory_manager_t manager,
+				matrix_block_generator_t generator,
+				void *generator_data);
+
+/* The input vectors whose elements are not NULL are taken from memory
+ * instead of their files. The elements of a vector are ordered by basis
+ * block id, like the block files.
+ */
+void set_input_vector_elements(memory_manager_t manager,
+			       const double **input_vector_elements);
+
 void begin_instruction(memory_manager_t manager,
 		       evaluation_instruction_t instruction);
 
 
+size_t get_num_vectors(memory_manager_t manager);
+
+/* The block with vector_block_id of the vector_index:th vector.
+ */
 vector_block_t request_input_vector_block(memory_manager_t manager,
-				       size_t vector_block_id);
+				       size_t vector_block_id,
+				       size_t vector_index);
 
 vector_block_t request_output_vector_block(memory_manager_t manager,
-					size_t vector_block_id);
+					size_t vector_block_id,
+					size_t vector_index);
 
 index_list_t request_index_list(memory_manager_t manager,
 			     size_t index_list_id);
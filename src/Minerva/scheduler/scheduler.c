@@ -19,13 +19,27 @@ struct _scheduler_
 	char *matrix_file_base_directory;
 	combination_table_t combination_table;
 	size_t maximum_loaded_memory;
+	matrix_block_generator_t matrix_block_generator;
+	void *matrix_block_generator_data;
 };
 
+static
+void run_instructions(const char **output_vector_base_directories,
+		      const char **input_vector_base_directories,
+		      const double **input_vector_elements,
+		      size_t num_vectors,
+		      evaluation_order_t evaluation_order,
+		      scheduler_t scheduler);
+
 static
 void execute_instruction(evaluation_instruction_t instruction,
 			 memory_manager_t memory_manager,
 			 scheduler_t scheduler);
 
+static
+void execute_diagonal_instruction(evaluation_instruction_t instruction,
+				  memory_manager_t memory_manager);
+
 static
 void neutron_case(memory_manager_t memory_manager,
 		  evaluation_instruction_t instruction);
@@ -74,23 +88,103 @@ scheduler_t new_scheduler(evaluation_order_t evaluation_order,
 	scheduler->matrix_file_base_directory =
 		copy_string(matrix_file_base_directory);
 	scheduler->maximum_loaded_memory = maximum_loaded_memory;
+	scheduler->matrix_block_generator = NULL;
+	scheduler->matrix_block_generator_data = NULL;
 	return scheduler;
 }
 
+void set_scheduler_matrix_block_generator(scheduler_t scheduler,
+					  matrix_block_generator_t generator,
+					  void *generator_data)
+{
+	scheduler->matrix_block_generator = generator;
+	scheduler->matrix_block_generator_data = generator_data;
+}
+
 void run_matrix_vector_multiplication(const char *output_vector_base_directory,
 				      const char *input_vector_base_directory,
 				      scheduler_t scheduler)
+{
+	run_instructions(&output_vector_base_directory,
+			 input_vector_base_directory != NULL ?
+			 &input_vector_base_directory : NULL,
+			 NULL,
+			 1,
+			 scheduler->evaluation_order,
+			 scheduler);
+}
+
+void run_multi_vector_multiplication
+(const char **output_vector_base_directories,
+ const char **input_vector_base_directories,
+ const double **input_vector_elements,
+ size_t num_vectors,
+ scheduler_t scheduler)
+{
+	run_instructions(output_vector_base_directories,
+			 input_vector_base_directories,
+			 input_vector_elements,
+			 num_vectors,
+			 scheduler->evaluation_order,
+			 scheduler);
+}
+
+void run_diagonal_extraction(const char *output_vector_base_directory,
+			     scheduler_t scheduler)
+{
+	evaluation_order_t diagonal_order =
+		new_diagonal_evaluation_order(scheduler->evaluation_order);
+	printf("Extracting the diagonal with %lu of %lu instructions\n",
+	       get_num_instructions(diagonal_order),
+	       get_num_instructions(scheduler->evaluation_order));
+	// The input vector is not read
+	run_instructions(&output_vector_base_directory,
+			 NULL,
+			 NULL,
+			 1,
+			 diagonal_order,
+			 scheduler);
+	free_evaluation_order(diagonal_order);
+}
+
+void free_scheduler(scheduler_t scheduler)
+{
+	free(scheduler->index_lists_base_directory);
+	free(scheduler->matrix_file_base_directory);
+	free(scheduler);
+}
+
+/* Runs the instructions of the evaluation order, which multiply the matrix
+ * with the input vectors, or add its diagonal to the output vector when
+ * there are no input vectors. Input vectors with elements are taken from
+ * memory.
+ */
+static
+void run_instructions(const char **output_vector_base_directories,
+		      const char **input_vector_base_directories,
+		      const double **input_vector_elements,
+		      size_t num_vectors,
+		      evaluation_order_t evaluation_order,
+		      scheduler_t scheduler)
 {
 	memory_manager_t memory_manager = 
-		new_memory_manager(input_vector_base_directory,
-				   output_vector_base_directory,
-				   scheduler->index_lists_base_directory,
-				   scheduler->matrix_file_base_directory,
-				   scheduler->combination_table,
-				   scheduler->evaluation_order,
-				   scheduler->maximum_loaded_memory);
+		new_multi_vector_memory_manager
+		(input_vector_base_directories,
+		 output_vector_base_directories,
+		 num_vectors,
+		 scheduler->index_lists_base_directory,
+		 scheduler->matrix_file_base_directory,
+		 scheduler->combination_table,
+		 evaluation_order,
+		 scheduler->maximum_loaded_memory);
+	set_matrix_block_generator(memory_manager,
+				   scheduler->matrix_block_generator,
+				   scheduler->matrix_block_generator_data);
+	if (input_vector_elements != NULL)
+		set_input_vector_elements(memory_manager,
+					  input_vector_elements);
 	evaluation_order_iterator_t instruction_iterator =
-		get_evaluation_order_iterator(scheduler->evaluation_order);
+		get_evaluation_order_iterator(evaluation_order);
 	double fastest_block_time = INFINITY;
 	double slowes_block_time = -INFINITY;
 	double total_block_time = 0;
@@ -113,9 +207,13 @@ void run_matrix_vector_multiplication(const char *output_vector_base_directory,
 			begin_instruction(memory_manager,instruction);
 			struct timespec t_start,t_end;
 			clock_gettime(CLOCK_REALTIME,&t_start);
-			execute_instruction(instruction,
-					    memory_manager,
-					    scheduler);
+			if (input_vector_base_directories != NULL)
+				execute_instruction(instruction,
+						    memory_manager,
+						    scheduler);
+			else
+				execute_diagonal_instruction(instruction,
+							     memory_manager);
 			clock_gettime(CLOCK_REALTIME,&t_end);
 			double block_time = 
 				(t_end.tv_sec - t_start.tv_sec)*1e6+
@@ -141,14 +239,7 @@ void run_matrix_vector_multiplication(const char *output_vector_base_directory,
 	printf("Slowest block: %lg µs\n",slowes_block_time);
 	printf("Average block: %lg µs\n",
 	       total_block_time /
-	       get_num_instructions(scheduler->evaluation_order));
-}
-
-void free_scheduler(scheduler_t scheduler)
-{
-	free(scheduler->index_lists_base_directory);
-	free(scheduler->matrix_file_base_directory);
-	free(scheduler);
+	       get_num_instructions(evaluation_order));
 }
 
 	static
@@ -221,27 +312,89 @@ void neutron_proton_case(memory_manager_t memory_manager,
 		off_diagonal_neutron_proton_case(memory_manager,instruction);
 }
 
+	static
+void execute_diagonal_instruction(evaluation_instruction_t instruction,
+				  memory_manager_t memory_manager)
+{
+	if (instruction.type == unload)
+		return;
+	// The diagonal is only extracted into one vector
+	vector_block_t output_vector_block =
+		request_output_vector_block(memory_manager,
+					 instruction.vector_block_out,
+					 0);	
+	matrix_block_t matrix_block =
+		request_matrix_block(memory_manager,
+				  instruction.matrix_element_file);
+	switch (instruction.type)
+	{
+		case neutron_block:
+			diagonal_neutrons(output_vector_block,
+					  matrix_block,
+					  request_index_list
+					  (memory_manager,
+					   instruction.neutron_index));
+			release_index_list(memory_manager,
+					   instruction.neutron_index);
+			break;
+		case proton_block:
+			diagonal_protons(output_vector_block,
+					 matrix_block,
+					 request_index_list
+					 (memory_manager,
+					  instruction.proton_index));
+			release_index_list(memory_manager,
+					   instruction.proton_index);
+			break;
+		case neutron_proton_block:
+			diagonal_neutrons_protons(output_vector_block,
+						  matrix_block,
+						  request_index_list
+						  (memory_manager,
+						   instruction.neutron_index),
+						  request_index_list
+						  (memory_manager,
+						   instruction.proton_index));
+			release_index_list(memory_manager,
+					   instruction.neutron_index);
+			release_index_list(memory_manager,
+					   instruction.proton_index);
+			break;
+		default:
+			error("instruction type is not known\n");
+			break;
+	}
+	release_output_vector(memory_manager,instruction.vector_block_out);
+	release_matrix_block(memory_manager,instruction.matrix_element_file);
+}
+
 	static
 void diagonal_neutron_case(memory_manager_t memory_manager,
 			   evaluation_instruction_t instruction)
 {
 	log_entry("Running the neutron only case");
-	vector_block_t input_vector_block =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t output_vector_block =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t list = 
+	index_list_t list =
 		request_index_list(memory_manager,
 				instruction.neutron_index);
-	multiplication_neutrons(output_vector_block,
-				input_vector_block,
-				matrix_block,
-				list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t output_vector_block =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		multiplication_neutrons(output_vector_block,
+					input_vector_block,
+					matrix_block,
+					list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
@@ -253,22 +406,28 @@ void diagonal_proton_case(memory_manager_t memory_manager,
 			  evaluation_instruction_t instruction)
 {
 	log_entry("Running the proton only case");
-	vector_block_t input_vector_block =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t output_vector_block =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t list = 
+	index_list_t list =
 		request_index_list(memory_manager,
 				instruction.proton_index);
-	multiplication_protons(output_vector_block,
-			       input_vector_block,
-			       matrix_block,
-			       list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t output_vector_block =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		multiplication_protons(output_vector_block,
+				       input_vector_block,
+				       matrix_block,
+				       list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
@@ -280,26 +439,32 @@ void diagonal_neutron_proton_case(memory_manager_t memory_manager,
 				  evaluation_instruction_t instruction)
 {
 	log_entry("Running the neutron and proton case");
-	vector_block_t input_vector_block =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t output_vector_block =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t  neutron_list =
+	index_list_t neutron_list =
 		request_index_list(memory_manager,
 				instruction.neutron_index);
-	index_list_t  proton_list =
+	index_list_t proton_list =
 		request_index_list(memory_manager,
 				instruction.proton_index);
-	multiplication_neutrons_protons(output_vector_block,
-					input_vector_block,
-					matrix_block,
-					neutron_list,
-					proton_list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t output_vector_block =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		multiplication_neutrons_protons(output_vector_block,
+						input_vector_block,
+						matrix_block,
+						neutron_list,
+						proton_list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
@@ -309,33 +474,42 @@ void diagonal_neutron_proton_case(memory_manager_t memory_manager,
 
 	static
 void off_diagonal_neutron_case(memory_manager_t memory_manager,
-			   evaluation_instruction_t instruction)
+			       evaluation_instruction_t instruction)
 {
 	log_entry("Running the neutron only case");
-	vector_block_t input_vector_block_left =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t input_vector_block_right =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_out);
-	vector_block_t output_vector_block_left =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
-	vector_block_t output_vector_block_right =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_in);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t list = 
+	index_list_t list =
 		request_index_list(memory_manager,
 				instruction.neutron_index);
-	multiplication_neutrons_off_diag(output_vector_block_left,
-					 output_vector_block_right,
-					 input_vector_block_left,
-					 input_vector_block_right,
-					 matrix_block,
-					 list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block_left =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t input_vector_block_right =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_out,
+						i);	
+		vector_block_t output_vector_block_left =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		vector_block_t output_vector_block_right =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_in,
+						 i);	
+		multiplication_neutrons_off_diag
+			(output_vector_block_left,
+			 output_vector_block_right,
+			 input_vector_block_left,
+			 input_vector_block_right,
+			 matrix_block,
+			 list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
@@ -344,33 +518,42 @@ void off_diagonal_neutron_case(memory_manager_t memory_manager,
 
 	static
 void off_diagonal_proton_case(memory_manager_t memory_manager,
-			  evaluation_instruction_t instruction)
+			      evaluation_instruction_t instruction)
 {
 	log_entry("Running the proton only case");
-	vector_block_t input_vector_block_left =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t input_vector_block_right =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_out);	
-	vector_block_t output_vector_block_left =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
-	vector_block_t output_vector_block_right =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_in);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t list = 
+	index_list_t list =
 		request_index_list(memory_manager,
 				instruction.proton_index);
-	multiplication_protons_off_diag(output_vector_block_left,
-					output_vector_block_right,
-					input_vector_block_left,
-					input_vector_block_right,
-					matrix_block,
-					list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block_left =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t input_vector_block_right =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_out,
+						i);	
+		vector_block_t output_vector_block_left =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		vector_block_t output_vector_block_right =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_in,
+						 i);	
+		multiplication_protons_off_diag
+			(output_vector_block_left,
+			 output_vector_block_right,
+			 input_vector_block_left,
+			 input_vector_block_right,
+			 matrix_block,
+			 list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
@@ -379,37 +562,46 @@ void off_diagonal_proton_case(memory_manager_t memory_manager,
 
 	static
 void off_diagonal_neutron_proton_case(memory_manager_t memory_manager,
-				  evaluation_instruction_t instruction)
+				      evaluation_instruction_t instruction)
 {
 	log_entry("Running the neutron and proton case");
-	vector_block_t input_vector_block_left =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_in);	
-	vector_block_t input_vector_block_right =
-		request_input_vector_block(memory_manager,
-					instruction.vector_block_out);	
-	vector_block_t output_vector_block_left =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_out);	
-	vector_block_t output_vector_block_right =
-		request_output_vector_block(memory_manager,
-					 instruction.vector_block_in);	
 	matrix_block_t matrix_block =
 		request_matrix_block(memory_manager,
 				  instruction.matrix_element_file);
-	index_list_t  neutron_list =
+	index_list_t neutron_list =
 		request_index_list(memory_manager,
 				instruction.neutron_index);
-	index_list_t  proton_list =
+	index_list_t proton_list =
 		request_index_list(memory_manager,
 				instruction.proton_index);
-	multiplication_neutrons_protons_off_diag(output_vector_block_left,
-						 output_vector_block_right,
-					input_vector_block_left,
-					input_vector_block_right,
-					matrix_block,
-					neutron_list,
-					proton_list);
+	// The matrix block and index lists are applied to every vector
+	for (size_t i = 0; i<get_num_vectors(memory_manager); i++)
+	{
+		vector_block_t input_vector_block_left =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_in,
+						i);	
+		vector_block_t input_vector_block_right =
+			request_input_vector_block(memory_manager,
+						instruction.vector_block_out,
+						i);	
+		vector_block_t output_vector_block_left =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_out,
+						 i);	
+		vector_block_t output_vector_block_right =
+			request_output_vector_block(memory_manager,
+						 instruction.vector_block_in,
+						 i);	
+		multiplication_neutrons_protons_off_diag
+			(output_vector_block_left,
+			 output_vector_block_right,
+			 input_vector_block_left,
+			 input_vector_block_right,
+			 matrix_block,
+			 neutron_list,
+			 proton_list);
+	}
 	release_input_vector(memory_manager,instruction.vector_block_in);
 	release_output_vector(memory_manager,instruction.vector_block_out);
 	release_matrix_block(memory_manager,instruction.matrix_element_file);
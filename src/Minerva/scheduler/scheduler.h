@@ -3,6 +3,7 @@
 
 #include <evaluation_order/evaluation_order.h>
 #include <combination_table/combination_table.h>
+#include <matrix_block/matrix_block.h>
 
 struct _scheduler_;
 typedef struct _scheduler_ *scheduler_t;
@@ -13,10 +14,39 @@ scheduler_t new_scheduler(evaluation_order_t evaluation_order,
 			  const char *matrix_file_base_directory,
 			  size_t maximum_loaded_memory);
 
+/* Lets the generator compute matrix blocks in memory during the
+ * multiplications, see set_matrix_block_generator in the memory manager.
+ */
+void set_scheduler_matrix_block_generator(scheduler_t scheduler,
+					  matrix_block_generator_t generator,
+					  void *generator_data);
+
 void run_matrix_vector_multiplication(const char *output_vector_base_directory,
 				      const char *input_vector_base_directory,
 				      scheduler_t scheduler);
 
+/* Multiplies the matrix with num_vectors input vectors in one sweep, the
+ * products are added to the corresponding output vectors. Each matrix
+ * block and index list is loaded once for all vectors, but the vector
+ * blocks of all vectors have to fit in the loaded memory at once.
+ * The input vectors with elements in input_vector_elements, which may be
+ * NULL, are taken from memory and their files are not read, see
+ * set_input_vector_elements in the memory manager.
+ */
+void run_multi_vector_multiplication
+(const char **output_vector_base_directories,
+ const char **input_vector_base_directories,
+ const double **input_vector_elements,
+ size_t num_vectors,
+ scheduler_t scheduler);
+
+/* Adds the diagonal of the matrix to the output vector. Only the
+ * instructions of the diagonal blocks are run, and of those only the index
+ * triples on the diagonal, so this is much cheaper than a multiplication.
+ */
+void run_diagonal_extraction(const char *output_vector_base_directory,
+			     scheduler_t scheduler);
+
 void free_scheduler(scheduler_t scheduler);
 
 #endif
@@ -5,7 +5,7 @@ size_t get_sub_basis_block_dimension(sub_basis_block_t sub_basis_block)
 	return sub_basis_block.dimension;
 }
 
-size_t get_num_particles(sub_basis_block_t sub_basis_block)
+size_t get_sub_basis_block_num_particles(sub_basis_block_t sub_basis_block)
 {
 	return sub_basis_block.num_particles;
 }
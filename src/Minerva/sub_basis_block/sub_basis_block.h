@@ -14,6 +14,6 @@ typedef struct
 
 size_t get_sub_basis_block_dimension(sub_basis_block_t sub_basis_block);
 
-size_t get_num_particles(sub_basis_block_t sub_basis_block);
+size_t get_sub_basis_block_num_particles(sub_basis_block_t sub_basis_block);
 
 #endif
@@ -16,16 +16,35 @@ struct _vector_block_
 	double **elements;
 	int block_id;
 	char *base_directory;
+	// The file of all blocks of the vector, NULL with block files
+	vector_file_t vector_file;
 };
 
+static
+vector_block_t allocate_vector_block(const char *base_directory,
+				     vector_file_t vector_file,
+				     const basis_block_t basis_block,
+				     size_t num_instances);
+
+static
+void check_vector_file(vector_block_t vector_block);
+
+static
+void get_vector_block_filename(vector_block_t vector_block,
+			       char *filename);
+
 static
 FILE *open_vector_block_file(vector_block_t vector_block,
 			     const char *open_mode);
 
 static
-void reduce_vector(vector_block_t vector_block);
+void reduce_copies_in_range(double **copies,
+			    size_t num_copies,
+			    size_t start_index,
+			    size_t end_index);
 
 vector_block_t new_vector_block(const char *base_directory,
+				vector_file_t vector_file,
 				const basis_block_t basis_block)
 {
 	vector_block_t vector_block =
@@ -34,6 +53,7 @@ vector_block_t new_vector_block(const char *base_directory,
 	vector_block->proton_dimension = basis_block.num_proton_states;
 	vector_block->block_id = basis_block.block_id;
 	vector_block->base_directory = copy_string(base_directory);
+	vector_block->vector_file = vector_file;
 	const size_t num_elements =
 		vector_block->neutron_dimension*vector_block->proton_dimension;
 	vector_block->num_instances = 1;
@@ -45,7 +65,8 @@ vector_block_t new_vector_block(const char *base_directory,
 }
 
 vector_block_t new_output_vector_block(const char *base_directory,
-				const basis_block_t basis_block)
+				       vector_file_t vector_file,
+				       const basis_block_t basis_block)
 {
 	vector_block_t vector_block =
 		(vector_block_t)malloc(sizeof(struct _vector_block_));	
@@ -53,21 +74,103 @@ vector_block_t new_output_vector_block(const char *base_directory,
 	vector_block->proton_dimension = basis_block.num_proton_states;
 	vector_block->block_id = basis_block.block_id;
 	vector_block->base_directory = copy_string(base_directory);
+	vector_block->vector_file = vector_file;
 	const size_t num_elements =
 		vector_block->neutron_dimension*vector_block->proton_dimension;
 	vector_block->num_instances = omp_get_num_threads();
 	usleep(1);
+	// The copies of the other threads are allocated when they are first
+	// requested, so that untouched copies are never reduced
 	vector_block->elements = 
-		(double**)malloc(vector_block->num_instances*sizeof(double*));
-	for (size_t i = 0; i<vector_block->num_instances; i++)
-		vector_block->elements[i] = (double*)calloc(num_elements,
-							    sizeof(double));
+		(double**)calloc(vector_block->num_instances,sizeof(double*));
+	*vector_block->elements = (double*)calloc(num_elements,
+						  sizeof(double));
 	load_vector_block_elements(vector_block);
 	return vector_block;
 }
 
+vector_block_t new_vector_block_in_batch(const char *base_directory,
+					 vector_file_t vector_file,
+					 const basis_block_t basis_block,
+					 batch_reader_t reader)
+{
+	vector_block_t vector_block =
+		allocate_vector_block(base_directory,vector_file,basis_block,1);
+	queue_vector_block_elements(vector_block,reader);
+	return vector_block;
+}
+
+vector_block_t new_output_vector_block_in_batch(const char *base_directory,
+						vector_file_t vector_file,
+						const basis_block_t basis_block,
+						batch_reader_t reader)
+{
+	vector_block_t vector_block =
+		allocate_vector_block(base_directory,
+				      vector_file,
+				      basis_block,
+				      omp_get_num_threads());
+	queue_vector_block_elements(vector_block,reader);
+	return vector_block;
+}
+
+vector_block_t new_vector_block_from_elements(const basis_block_t basis_block,
+					      const double *elements)
+{
+	vector_block_t vector_block =
+		(vector_block_t)malloc(sizeof(struct _vector_block_));
+	vector_block->neutron_dimension = basis_block.num_neutron_states;
+	vector_block->proton_dimension = basis_block.num_proton_states;
+	vector_block->block_id = basis_block.block_id;
+	vector_block->base_directory = NULL;
+	vector_block->vector_file = NULL;
+	const size_t num_elements =
+		vector_block->neutron_dimension*vector_block->proton_dimension;
+	vector_block->num_instances = 1;
+	vector_block->elements = (double**)malloc(sizeof(double*));
+	*vector_block->elements = (double*)malloc(num_elements*sizeof(double));
+	memcpy(*vector_block->elements,elements,num_elements*sizeof(double));
+	return vector_block;
+}
+
+void queue_vector_block_elements(vector_block_t vector_block,
+				 batch_reader_t reader)
+{
+	if (vector_block->vector_file != NULL)
+	{
+		check_vector_file(vector_block);
+		// The whole aligned slot is read, so that the read can bypass
+		// the page cache
+		add_read_request(reader,
+				 get_vector_file_path(vector_block->vector_file),
+				 *vector_block->elements,
+				 get_vector_file_slot_size(vector_block->vector_file,
+							   vector_block->block_id),
+				 get_vector_file_block_offset
+				 (vector_block->vector_file,
+				  vector_block->block_id));
+		return;
+	}
+	char filename[2048];
+	get_vector_block_filename(vector_block,filename);
+	add_read_request(reader,
+			 filename,
+			 *vector_block->elements,
+			 vector_block->neutron_dimension*
+			 vector_block->proton_dimension*sizeof(double),
+			 0);
+}
+
 void load_vector_block_elements(vector_block_t vector_block)
 {
+	if (vector_block->vector_file != NULL)
+	{
+		check_vector_file(vector_block);
+		read_vector_file_block(vector_block->vector_file,
+				       vector_block->block_id,
+				       *vector_block->elements);
+		return;
+	}
 	FILE *file = open_vector_block_file(vector_block,"r");
 	const size_t num_elements =
 		vector_block->neutron_dimension*vector_block->proton_dimension;
@@ -82,9 +185,55 @@ void load_vector_block_elements(vector_block_t vector_block)
 	fclose(file);
 }
 
+void reduce_vector_block(vector_block_t vector_block,
+			 int num_threads)
+{
+	const size_t num_elements =  
+		vector_block->neutron_dimension*vector_block->proton_dimension;
+	double **copies = (double**)malloc(vector_block->num_instances*
+					   sizeof(double*));
+	size_t num_copies = 0;
+	for (size_t i = 0; i < vector_block->num_instances; i++)
+		if (vector_block->elements[i] != NULL)
+			copies[num_copies++] = vector_block->elements[i];
+	if (num_copies > 1)
+	{
+		const size_t chunk_length = 4096;
+		const size_t num_chunks =
+			(num_elements + chunk_length - 1)/chunk_length;
+#pragma omp parallel for schedule(static) num_threads(num_threads)
+		for (size_t chunk = 0; chunk < num_chunks; chunk++)
+		{
+			size_t start_index = chunk*chunk_length;
+			size_t end_index = start_index + chunk_length;
+			if (end_index > num_elements)
+				end_index = num_elements;
+			reduce_copies_in_range(copies,
+					       num_copies,
+					       start_index,
+					       end_index);
+		}
+	}
+	free(copies);
+	// The other copies are consumed by the reduction
+	for (size_t i = 1; i < vector_block->num_instances; i++)
+	{
+		free(vector_block->elements[i]);
+		vector_block->elements[i] = NULL;
+	}
+}
+
 void save_vector_block_elements(vector_block_t vector_block)
 {
-	reduce_vector(vector_block);
+	reduce_vector_block(vector_block,1);
+	if (vector_block->vector_file != NULL)
+	{
+		check_vector_file(vector_block);
+		write_vector_file_block(vector_block->vector_file,
+					vector_block->block_id,
+					*vector_block->elements);
+		return;
+	}
 	FILE *file = open_vector_block_file(vector_block,"w");
 	const size_t num_elements =
 		vector_block->neutron_dimension*vector_block->proton_dimension;	
@@ -112,8 +261,13 @@ double *get_vector_block_elements(const vector_block_t vector_block)
 {
 	if (vector_block->num_instances == 1)
 		return *vector_block->elements;
-	else
-		return vector_block->elements[omp_get_thread_num()];
+	size_t thread_id = omp_get_thread_num();
+	if (vector_block->elements[thread_id] == NULL)
+		vector_block->elements[thread_id] =
+			(double*)calloc(vector_block->neutron_dimension*
+					vector_block->proton_dimension,
+					sizeof(double));
+	return vector_block->elements[thread_id];
 }
 
 void free_vector_block(vector_block_t vector_block)
@@ -126,14 +280,64 @@ void free_vector_block(vector_block_t vector_block)
 }
 
 static
-FILE *open_vector_block_file(vector_block_t vector_block,
-			     const char *open_mode)
+vector_block_t allocate_vector_block(const char *base_directory,
+				     vector_file_t vector_file,
+				     const basis_block_t basis_block,
+				     size_t num_instances)
+{
+	vector_block_t vector_block =
+		(vector_block_t)malloc(sizeof(struct _vector_block_));	
+	vector_block->neutron_dimension = basis_block.num_neutron_states;
+	vector_block->proton_dimension = basis_block.num_proton_states;
+	vector_block->block_id = basis_block.block_id;
+	vector_block->base_directory = copy_string(base_directory);
+	vector_block->vector_file = vector_file;
+	vector_block->num_instances = num_instances;
+	vector_block->elements = 
+		(double**)calloc(vector_block->num_instances,sizeof(double*));
+	// The first copy is filled by the reader, and aligned so that the
+	// read can bypass the page cache. From a vector file it holds the
+	// padding of the block slot too.
+	const size_t num_bytes = vector_file != NULL ?
+		get_vector_file_slot_size(vector_file,basis_block.block_id) :
+		vector_block->neutron_dimension*
+		vector_block->proton_dimension*sizeof(double);
+	*vector_block->elements = (double*)new_io_buffer(num_bytes);
+	return vector_block;
+}
+
+static
+void check_vector_file(vector_block_t vector_block)
+{
+	const size_t num_elements =
+		vector_block->neutron_dimension*vector_block->proton_dimension;
+	if (get_vector_file_element_size(vector_block->vector_file) !=
+	    sizeof(double) ||
+	    get_vector_file_block_length(vector_block->vector_file,
+					 vector_block->block_id) !=
+	    num_elements)
+		error("Block %d of %s is not %lu doubles\n",
+		      vector_block->block_id,
+		      get_vector_file_path(vector_block->vector_file),
+		      num_elements);
+}
+
+static
+void get_vector_block_filename(vector_block_t vector_block,
+			       char *filename)
 {
-	char filename[2048];
 	sprintf(filename,
 		"%s/vec_%d",
 		vector_block->base_directory,
 		vector_block->block_id);
+}
+
+static
+FILE *open_vector_block_file(vector_block_t vector_block,
+			     const char *open_mode)
+{
+	char filename[2048];
+	get_vector_block_filename(vector_block,filename);
 	FILE *file = fopen(filename,open_mode);
 	if (file == NULL)
 		error("Could not open vector block file %s. %s\n",
@@ -143,13 +347,18 @@ FILE *open_vector_block_file(vector_block_t vector_block,
 }
 
 static
-void reduce_vector(vector_block_t vector_block)
+void reduce_copies_in_range(double **copies,
+			    size_t num_copies,
+			    size_t start_index,
+			    size_t end_index)
 {
-	const size_t num_elements =  
-		vector_block->neutron_dimension*vector_block->proton_dimension;
-#pragma omp critical(reduce_vector)
-	for (size_t i = 1; i < vector_block->num_instances; i++)
-		for (size_t j = 0; j<num_elements; j++)
-			vector_block->elements[0][j] +=
-				vector_block->elements[i][j];
+	// Pairwise tree reduction, copies[0] ends up with the sum
+	for (size_t stride = 1; stride < num_copies; stride *= 2)
+		for (size_t i = 0; i + stride < num_copies; i += 2*stride)
+		{
+			double *restrict target = copies[i];
+			const double *restrict term = copies[i+stride];
+			for (size_t j = start_index; j < end_index; j++)
+				target[j] += term[j];
+		}
 }
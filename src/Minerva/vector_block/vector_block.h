@@ -2,19 +2,56 @@
 #define __VECTOR_BLOCK__
 
 #include <basis_block/basis_block.h>
+#include <batch_reader/batch_reader.h>
+#include <vector_file/vector_file.h>
 #include <stdlib.h>
 
 struct _vector_block_;
 typedef struct _vector_block_ *vector_block_t;
 
+/* The block is read from and written to the vector file when it is not
+ * NULL, otherwise to its block file in the base directory.
+ */
 vector_block_t new_vector_block(const char *base_directory,
+				vector_file_t vector_file,
 				const basis_block_t basis_block);
 
 vector_block_t new_output_vector_block(const char *base_directory,
+				       vector_file_t vector_file,
 				       const basis_block_t basis_block);
 
+/* Like new_vector_block and new_output_vector_block, but the elements are
+ * only queued on reader, they are valid once submit_read_requests has
+ * returned.
+ */
+vector_block_t new_vector_block_in_batch(const char *base_directory,
+					 vector_file_t vector_file,
+					 const basis_block_t basis_block,
+					 batch_reader_t reader);
+
+vector_block_t new_output_vector_block_in_batch(const char *base_directory,
+						vector_file_t vector_file,
+						const basis_block_t basis_block,
+						batch_reader_t reader);
+
+/* An input block whose elements are copied from the block's part of a
+ * vector held in memory, instead of being read from a file.
+ */
+vector_block_t new_vector_block_from_elements(const basis_block_t basis_block,
+					      const double *elements);
+
+void queue_vector_block_elements(vector_block_t vector_block,
+				 batch_reader_t reader);
+
 void load_vector_block_elements(vector_block_t vector_block);
 
+/* Sums the per thread copies of an output vector block into the first
+ * copy, using num_threads threads. Copies that no thread has requested
+ * are skipped.
+ */
+void reduce_vector_block(vector_block_t vector_block,
+			 int num_threads);
+
 void save_vector_block_elements(vector_block_t vector_block);
 
 size_t get_neutron_dimension(const vector_block_t vector_block);
@@ -3,7 +3,7 @@
 #include <assert.h>
 #include <math.h>
 #include <jt_transformation/jt_transformation.h>
-#include <matrix_builder/matrix_builder.h>
+#include <Neptune/matrix_builder/matrix_builder.h>
 #include <jt_block_iterator/jt_block_iterator.h>
 #include <utils/assertion.h>
 #include <utils/permutation_tools.h>
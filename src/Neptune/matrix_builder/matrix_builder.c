@@ -1,4 +1,4 @@
-#include <matrix_builder/matrix_builder.h>
+#include <Neptune/matrix_builder/matrix_builder.h>
 #include <utils/index_hash.h>
 #include <debug_mode/debug_mode.h>
 
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <batch_reader/batch_reader.h>
+#include <string_tools/string_tools.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+#include <debug_mode/debug_mode.h>
+
+#define min(a,b) ((a) < (b) ? (a) : (b))
+
+const size_t io_alignment = 4096;
+
+#ifdef DIRECT_IO
+static const int use_direct_io = 1;
+#else
+static const int use_direct_io = 0;
+#endif
+
+#ifdef IO_URING
+// Number of requests submitted to the ring at once
+static const unsigned ring_depth = 64;
+#endif
+
+// Requests on a file read by one of this many recently opened files share
+// its file descriptor
+static const size_t num_recent_files = 8;
+
+typedef struct
+{
+	char *filename;
+	void *buffer;
+	size_t num_bytes;
+	size_t offset;
+	size_t num_bytes_read;
+	int file_descriptor;
+	int owns_file_descriptor;
+} read_request_t;
+
+struct _batch_reader_
+{
+	read_request_t *requests;
+	size_t num_requests;
+	size_t max_num_requests;
+#ifdef IO_URING
+	struct io_uring ring;
+	int has_ring;
+#endif
+};
+
+static
+int get_open_flags(const read_request_t *request);
+
+static
+void open_request_file(read_request_t *request);
+
+static
+void open_request_files(read_request_t *requests,size_t num_requests);
+
+static
+void close_request_files(read_request_t *requests,size_t num_requests);
+
+static
+void finish_request_with_pread(read_request_t *request);
+
+static
+void submit_with_pread(batch_reader_t reader);
+
+#ifdef IO_URING
+static
+void submit_with_io_uring(batch_reader_t reader);
+#endif
+
+batch_reader_t new_batch_reader()
+{
+	batch_reader_t reader =
+		(batch_reader_t)calloc(1,sizeof(struct _batch_reader_));
+	reader->max_num_requests = 8;
+	reader->requests =
+		(read_request_t*)malloc(reader->max_num_requests*
+					sizeof(read_request_t));
+#ifdef IO_URING
+	// Kernels without io_uring make us fall back to pread
+	reader->has_ring =
+		io_uring_queue_init(ring_depth,&reader->ring,0) == 0;
+#endif
+	return reader;
+}
+
+void add_read_request(batch_reader_t reader,
+		      const char *filename,
+		      void *buffer,
+		      size_t num_bytes,
+		      size_t offset)
+{
+	if (reader->num_requests == reader->max_num_requests)
+	{
+		reader->max_num_requests *= 2;
+		reader->requests =
+			(read_request_t*)realloc(reader->requests,
+						 reader->max_num_requests*
+						 sizeof(read_request_t));
+	}
+	read_request_t request =
+	{
+		.filename = copy_string(filename),
+		.buffer = buffer,
+		.num_bytes = num_bytes,
+		.offset = offset,
+		.num_bytes_read = 0,
+		.file_descriptor = -1,
+		.owns_file_descriptor = 0
+	};
+	reader->requests[reader->num_requests++] = request;
+}
+
+size_t get_num_read_requests(batch_reader_t reader)
+{
+	return reader->num_requests;
+}
+
+size_t submit_read_requests(batch_reader_t reader)
+{
+	if (reader->num_requests == 0)
+		return 0;
+#ifdef IO_URING
+	if (reader->has_ring)
+		submit_with_io_uring(reader);
+	else
+		submit_with_pread(reader);
+#else
+	submit_with_pread(reader);
+#endif
+	size_t num_bytes_read = 0;
+	for (size_t i = 0; i<reader->num_requests; i++)
+	{
+		num_bytes_read += reader->requests[i].num_bytes_read;
+		free(reader->requests[i].filename);
+	}
+	reader->num_requests = 0;
+	return num_bytes_read;
+}
+
+void *new_io_buffer(size_t num_bytes)
+{
+	void *buffer = NULL;
+	if (posix_memalign(&buffer,io_alignment,
+			   num_bytes > 0 ? num_bytes : io_alignment) != 0)
+		error("Could not allocate %lu aligned bytes\n",num_bytes);
+	return buffer;
+}
+
+void free_batch_reader(batch_reader_t reader)
+{
+	for (size_t i = 0; i<reader->num_requests; i++)
+		free(reader->requests[i].filename);
+#ifdef IO_URING
+	if (reader->has_ring)
+		io_uring_queue_exit(&reader->ring);
+#endif
+	free(reader->requests);
+	free(reader);
+}
+
+static
+int get_open_flags(const read_request_t *request)
+{
+	int flags = O_RDONLY;
+	// O_DIRECT requires aligned buffers, lengths and offsets
+	if (use_direct_io &&
+	    (uintptr_t)request->buffer % io_alignment == 0 &&
+	    request->num_bytes % io_alignment == 0 &&
+	    request->offset % io_alignment == 0)
+		flags |= O_DIRECT;
+	return flags;
+}
+
+static
+void open_request_file(read_request_t *request)
+{
+	const int flags = get_open_flags(request);
+	request->owns_file_descriptor = 1;
+	request->file_descriptor = open(request->filename,flags);
+	if (request->file_descriptor < 0 && (flags & O_DIRECT))
+		// Not all file systems support O_DIRECT
+		request->file_descriptor = open(request->filename,O_RDONLY);
+	if (request->file_descriptor < 0)
+		error("Could not open file %s. %s\n",
+		      request->filename,
+		      strerror(errno));
+}
+
+/* Opens the files of the requests, where requests on a recently opened file
+ * reuse its file descriptor. The blocks of a vector file are then read
+ * with one open.
+ */
+static
+void open_request_files(read_request_t *requests,size_t num_requests)
+{
+	read_request_t *recent_requests[num_recent_files];
+	for (size_t j = 0; j<num_recent_files; j++)
+		recent_requests[j] = NULL;
+	size_t next_recent_request = 0;
+	for (size_t i = 0; i<num_requests; i++)
+	{
+		read_request_t *request = &requests[i];
+		for (size_t j = 0; j<num_recent_files; j++)
+			if (recent_requests[j] != NULL &&
+			    get_open_flags(recent_requests[j]) ==
+			    get_open_flags(request) &&
+			    strcmp(recent_requests[j]->filename,
+				   request->filename) == 0)
+			{
+				request->file_descriptor =
+					recent_requests[j]->file_descriptor;
+				request->owns_file_descriptor = 0;
+				break;
+			}
+		if (request->file_descriptor >= 0)
+			continue;
+		open_request_file(request);
+		recent_requests[next_recent_request] = request;
+		next_recent_request = (next_recent_request+1)%num_recent_files;
+	}
+}
+
+static
+void close_request_files(read_request_t *requests,size_t num_requests)
+{
+	for (size_t i = 0; i<num_requests; i++)
+	{
+		if (requests[i].owns_file_descriptor)
+			close(requests[i].file_descriptor);
+		requests[i].file_descriptor = -1;
+		requests[i].owns_file_descriptor = 0;
+	}
+}
+
+static
+void finish_request_with_pread(read_request_t *request)
+{
+	while (request->num_bytes_read < request->num_bytes)
+	{
+		ssize_t num_bytes_read =
+			pread(request->file_descriptor,
+			      (char*)request->buffer + request->num_bytes_read,
+			      request->num_bytes - request->num_bytes_read,
+			      request->offset + request->num_bytes_read);
+		if (num_bytes_read < 0 && errno == EINTR)
+			continue;
+		if (num_bytes_read < 0)
+			error("Could not read %s. %s\n",
+			      request->filename,
+			      strerror(errno));
+		if (num_bytes_read == 0)
+			error("Could only read %lu of %lu bytes from %s\n",
+			      request->num_bytes_read,
+			      request->num_bytes,
+			      request->filename);
+		request->num_bytes_read += num_bytes_read;
+	}
+}
+
+static
+void submit_with_pread(batch_reader_t reader)
+{
+	open_request_files(reader->requests,reader->num_requests);
+	// Inside a parallel region the calling thread reads all files itself
+#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i<reader->num_requests; i++)
+		finish_request_with_pread(&reader->requests[i]);
+	close_request_files(reader->requests,reader->num_requests);
+}
+
+#ifdef IO_URING
+static
+void submit_with_io_uring(batch_reader_t reader)
+{
+	for (size_t first_request = 0;
+	     first_request < reader->num_requests;
+	     first_request += ring_depth)
+	{
+		read_request_t *requests = reader->requests + first_request;
+		const size_t num_requests =
+			min(ring_depth,reader->num_requests - first_request);
+		open_request_files(requests,num_requests);
+		/* The buffers are not registered to the ring, they differ
+		 * from batch to batch and registering them costs as much as
+		 * the pinning it saves.
+		 */
+		for (size_t i = 0; i<num_requests; i++)
+		{
+			struct io_uring_sqe *entry =
+				io_uring_get_sqe(&reader->ring);
+			io_uring_prep_read(entry,
+					   requests[i].file_descriptor,
+					   requests[i].buffer,
+					   requests[i].num_bytes,
+					   requests[i].offset);
+			io_uring_sqe_set_data(entry,&requests[i]);
+		}
+		if (io_uring_submit(&reader->ring) < 0)
+			error("Could not submit %lu read requests\n",
+			      num_requests);
+		for (size_t i = 0; i<num_requests; i++)
+		{
+			struct io_uring_cqe *completion = NULL;
+			int status = io_uring_wait_cqe(&reader->ring,
+						       &completion);
+			if (status < 0)
+				error("Could not wait for read request. %s\n",
+				      strerror(-status));
+			read_request_t *request =
+				(read_request_t*)
+				io_uring_cqe_get_data(completion);
+			if (completion->res < 0)
+				error("Could not read %s. %s\n",
+				      request->filename,
+				      strerror(-completion->res));
+			request->num_bytes_read = completion->res;
+			io_uring_cqe_seen(&reader->ring,completion);
+		}
+		// Short reads are completed synchronously
+		for (size_t i = 0; i<num_requests; i++)
+			finish_request_with_pread(&requests[i]);
+		close_request_files(requests,num_requests);
+	}
+}
+#endif
+
+#ifdef TEST
+static
+void write_test_file(const char *filename,
+		     const double *elements,
+		     size_t num_elements)
+{
+	FILE *file = fopen(filename,"w");
+	fwrite(elements,sizeof(double),num_elements,file);
+	fclose(file);
+}
+
+/* Makes the reader fall back to pread, as without io_uring.
+ */
+static
+void close_ring(batch_reader_t reader)
+{
+#ifdef IO_URING
+	if (reader->has_ring)
+		io_uring_queue_exit(&reader->ring);
+	reader->has_ring = 0;
+#else
+	(void)(reader);
+#endif
+}
+#endif
+
+new_test(batch_of_reads_returns_file_contents,
+	 const size_t num_files = 100;
+	 const size_t num_elements = 1000;
+	 double *elements =
+		(double*)malloc(num_files*num_elements*sizeof(double));
+	 for (size_t i = 0; i<num_files*num_elements; i++)
+		elements[i] = i;
+	 char filename[2048];
+	 for (size_t i = 0; i<num_files; i++)
+	 {
+		sprintf(filename,"%s/batch_file_%lu",
+			get_test_file_path(""),i);
+		write_test_file(filename,elements+i*num_elements,num_elements);
+	 }
+	 double *read_elements =
+		(double*)new_io_buffer(num_files*num_elements*sizeof(double));
+	 batch_reader_t reader = new_batch_reader();
+	 for (size_t i = 0; i<num_files; i++)
+	 {
+		sprintf(filename,"%s/batch_file_%lu",
+			get_test_file_path(""),i);
+		// Every other file is read from an offset
+		size_t offset = i % 2 == 0 ? 0 : 10;
+		add_read_request(reader,
+				 filename,
+				 read_elements+i*num_elements+offset,
+				 (num_elements-offset)*sizeof(double),
+				 offset*sizeof(double));
+		if (offset > 0)
+			memcpy(read_elements+i*num_elements,
+			       elements+i*num_elements,
+			       offset*sizeof(double));
+	 }
+	 assert_that(get_num_read_requests(reader) == num_files);
+	 size_t num_bytes_read = submit_read_requests(reader);
+	 assert_that(get_num_read_requests(reader) == 0);
+	 assert_that(num_bytes_read ==
+		     num_files*num_elements*sizeof(double) -
+		     num_files/2*10*sizeof(double));
+	 assert_that(memcmp(elements,read_elements,
+			    num_files*num_elements*sizeof(double)) == 0);
+	 free_batch_reader(reader);
+	 free(read_elements);
+	 free(elements);
+	);
+
+new_test(interleaved_reads_of_two_files_return_their_contents,
+	 const size_t num_elements = 1000;
+	 const size_t num_parts = 10;
+	 double *elements = (double*)malloc(2*num_elements*sizeof(double));
+	 for (size_t i = 0; i<2*num_elements; i++)
+		elements[i] = i;
+	 char filenames[2][2048];
+	 for (size_t i = 0; i<2; i++)
+	 {
+		sprintf(filenames[i],"%s/shared_file_%lu",
+			get_test_file_path(""),i);
+		write_test_file(filenames[i],elements+i*num_elements,
+				num_elements);
+	 }
+	 double *read_elements =
+		(double*)malloc(2*num_elements*sizeof(double));
+	 batch_reader_t reader = new_batch_reader();
+	 const size_t part_length = num_elements/num_parts;
+	 for (size_t j = 0; j<num_parts; j++)
+		for (size_t i = 0; i<2; i++)
+			add_read_request(reader,
+					 filenames[i],
+					 read_elements+i*num_elements+
+					 j*part_length,
+					 part_length*sizeof(double),
+					 j*part_length*sizeof(double));
+	 assert_that(submit_read_requests(reader) ==
+		     2*num_elements*sizeof(double));
+	 assert_that(memcmp(elements,read_elements,
+			    2*num_elements*sizeof(double)) == 0);
+	 free_batch_reader(reader);
+	 free(read_elements);
+	 free(elements);
+	);
+
+new_test(io_uring_and_pread_read_the_same_contents,
+	 // More requests than fit in the ring at once, of lengths and
+	 // offsets that are not aligned
+	 const size_t num_requests = 150;
+	 const size_t num_elements = 137;
+	 double *elements =
+		(double*)malloc(num_requests*num_elements*sizeof(double));
+	 for (size_t i = 0; i<num_requests*num_elements; i++)
+		elements[i] = 0.5*i;
+	 char filename[2048];
+	 sprintf(filename,"%s/batch_file",get_test_file_path(""));
+	 write_test_file(filename,elements,num_requests*num_elements);
+	 double *read_elements[2];
+	 for (size_t k = 0; k<2; k++)
+	 {
+		read_elements[k] =
+			(double*)calloc(num_requests*num_elements,
+					sizeof(double));
+		batch_reader_t reader = new_batch_reader();
+		if (k == 1)
+			close_ring(reader);
+		// The requests read the file back to front
+		for (size_t i = 0; i<num_requests; i++)
+		{
+			size_t j = num_requests-1-i;
+			add_read_request(reader,
+					 filename,
+					 read_elements[k]+j*num_elements,
+					 num_elements*sizeof(double),
+					 j*num_elements*sizeof(double));
+		}
+		assert_that(submit_read_requests(reader) ==
+			    num_requests*num_elements*sizeof(double));
+		free_batch_reader(reader);
+	 }
+	 for (size_t k = 0; k<2; k++)
+		assert_that(memcmp(elements,read_elements[k],
+				   num_requests*num_elements*
+				   sizeof(double)) == 0);
+	 free(read_elements[1]);
+	 free(read_elements[0]);
+	 free(elements);
+	);
@@ -0,0 +1,45 @@
+#ifndef __BATCH_READER__
+#define __BATCH_READER__
+
+#include <stdlib.h>
+
+/* The batch reader collects read requests on many small files and performs
+ * them together. When compiled with -DIO_URING (and linked with -luring)
+ * the requests are submitted to an io_uring in batches. Otherwise, or if
+ * no ring can be set up, the files are read with pread by the OpenMP
+ * threads. With
+ * -DDIRECT_IO files are opened with O_DIRECT whenever the buffer, the
+ * length and the offset of a request are aligned to io_alignment.
+ */
+struct _batch_reader_;
+typedef struct _batch_reader_ *batch_reader_t;
+
+extern const size_t io_alignment;
+
+batch_reader_t new_batch_reader();
+
+/* Queues a read of num_bytes bytes starting at offset in filename into
+ * buffer. The buffer has to stay valid until submit_read_requests returns.
+ */
+void add_read_request(batch_reader_t reader,
+		      const char *filename,
+		      void *buffer,
+		      size_t num_bytes,
+		      size_t offset);
+
+size_t get_num_read_requests(batch_reader_t reader);
+
+/* Performs all queued read requests and waits for them to complete. It is
+ * an error if a file is shorter than requested. Returns the number of bytes
+ * read, and empties the queue.
+ */
+size_t submit_read_requests(batch_reader_t reader);
+
+/* Allocates num_bytes bytes aligned to io_alignment, so that reads into
+ * the buffer can bypass the page cache. Free it with free.
+ */
+void *new_io_buffer(size_t num_bytes);
+
+void free_batch_reader(batch_reader_t reader);
+
+#endif
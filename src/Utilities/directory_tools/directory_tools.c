@@ -36,3 +36,18 @@ void clear_directory(const char *directory_name)
 	system(command);
 	free(command);
 }
+
+char *new_subdirectory_name(const char *directory_name,
+			    const char *subdirectory)
+{
+	char *subdirectory_name =
+		(char*)calloc(strlen(directory_name)+strlen(subdirectory)+2,
+			      sizeof(char));
+	sprintf(subdirectory_name,"%s/%s",directory_name,subdirectory);
+	if (!directory_exists(subdirectory_name) &&
+		create_directory(subdirectory_name) != 0)
+		error("Could not create directory \"%s\". %s\n",
+		      subdirectory_name,
+		      strerror(errno));
+	return subdirectory_name;
+}
@@ -26,4 +26,10 @@ int create_directory(const char *directory_name);
 
 void clear_directory(const char *directory_name);
 
+/* Returns "directory_name/subdirectory", creating the directory if it
+ * does not exist. The caller frees the returned name.
+ */
+char *new_subdirectory_name(const char *directory_name,
+			    const char *subdirectory);
+
 #endif
@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include <vector_file/vector_file.h>
+#include <batch_reader/batch_reader.h>
+#include <string_tools/string_tools.h>
+#include <log/log.h>
+#include <error/error.h>
+#include <unit_testing/test.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <debug_mode/debug_mode.h>
+
+#ifdef DIRECT_IO
+static const int use_direct_io = 1;
+#else
+static const int use_direct_io = 0;
+#endif
+
+const char *vector_file_name = "vector_blocks";
+
+static const char vector_file_magic[8] = {'J','N','C','S','M','V','E','C'};
+
+struct _vector_file_
+{
+	char *path;
+	size_t num_blocks;
+	size_t element_size;
+	uint64_t *block_lengths;
+	uint64_t *block_offsets;
+	int file_descriptor;
+	int direct_file_descriptor;
+	pthread_mutex_t open_mutex;
+};
+
+static
+vector_file_t allocate_vector_file(const char *directory_name,
+				   size_t num_blocks);
+
+static
+size_t align_up(size_t num_bytes);
+
+static
+size_t get_header_size(size_t num_blocks);
+
+static
+void set_block_offsets(vector_file_t vector_file);
+
+static
+void write_header(vector_file_t vector_file);
+
+static
+void open_file_descriptors(vector_file_t vector_file);
+
+static
+void read_bytes(vector_file_t vector_file,
+		void *buffer,
+		size_t num_bytes,
+		size_t offset);
+
+static
+void write_bytes(vector_file_t vector_file,
+		 const void *buffer,
+		 size_t num_bytes,
+		 size_t offset);
+
+static
+int is_direct_io_possible(const void *buffer,
+			  size_t num_bytes,
+			  size_t offset);
+
+int has_vector_file(const char *directory_name)
+{
+	char path[2048];
+	sprintf(path,"%s/%s",directory_name,vector_file_name);
+	return access(path,F_OK) == 0;
+}
+
+vector_file_t new_vector_file(const char *directory_name,
+			      const size_t *block_lengths,
+			      size_t num_blocks,
+			      size_t element_size)
+{
+	vector_file_t vector_file =
+		allocate_vector_file(directory_name,num_blocks);
+	vector_file->element_size = element_size;
+	for (size_t i = 0; i<num_blocks; i++)
+		vector_file->block_lengths[i] = block_lengths[i];
+	set_block_offsets(vector_file);
+	int file_descriptor =
+		open(vector_file->path,O_RDWR | O_CREAT | O_TRUNC,0644);
+	if (file_descriptor < 0)
+		error("Could not create vector file %s. %s\n",
+		      vector_file->path,
+		      strerror(errno));
+	// The truncated file is extended with zeros
+	const size_t file_size = num_blocks == 0 ?
+		get_header_size(0) :
+		vector_file->block_offsets[num_blocks-1] +
+		get_vector_file_slot_size(vector_file,num_blocks);
+	if (ftruncate(file_descriptor,file_size) != 0)
+		error("Could not resize vector file %s. %s\n",
+		      vector_file->path,
+		      strerror(errno));
+	vector_file->file_descriptor = file_descriptor;
+	write_header(vector_file);
+	return vector_file;
+}
+
+vector_file_t open_vector_file(const char *directory_name)
+{
+	char path[2048];
+	sprintf(path,"%s/%s",directory_name,vector_file_name);
+	FILE *file = fopen(path,"r");
+	if (file == NULL)
+		error("Could not open vector file %s. %s\n",
+		      path,
+		      strerror(errno));
+	char magic[8];
+	uint64_t num_blocks = 0;
+	uint64_t element_size = 0;
+	if (fread(magic,sizeof(char),8,file) != 8 ||
+	    memcmp(magic,vector_file_magic,8) != 0 ||
+	    fread(&num_blocks,sizeof(uint64_t),1,file) != 1 ||
+	    fread(&element_size,sizeof(uint64_t),1,file) != 1)
+		error("%s is not a vector file\n",path);
+	vector_file_t vector_file =
+		allocate_vector_file(directory_name,num_blocks);
+	vector_file->element_size = element_size;
+	if (fread(vector_file->block_lengths,
+		  sizeof(uint64_t),
+		  num_blocks,
+		  file) != num_blocks ||
+	    fread(vector_file->block_offsets,
+		  sizeof(uint64_t),
+		  num_blocks,
+		  file) != num_blocks)
+		error("Could not read the block table of %s\n",path);
+	fclose(file);
+	return vector_file;
+}
+
+const char *get_vector_file_path(const vector_file_t vector_file)
+{
+	return vector_file->path;
+}
+
+size_t get_vector_file_num_blocks(const vector_file_t vector_file)
+{
+	return vector_file->num_blocks;
+}
+
+size_t get_vector_file_element_size(const vector_file_t vector_file)
+{
+	return vector_file->element_size;
+}
+
+size_t get_vector_file_block_length(const vector_file_t vector_file,
+				    size_t block_id)
+{
+	assert(block_id > 0 && block_id <= vector_file->num_blocks);
+	return vector_file->block_lengths[block_id-1];
+}
+
+size_t get_vector_file_block_offset(const vector_file_t vector_file,
+				    size_t block_id)
+{
+	assert(block_id > 0 && block_id <= vector_file->num_blocks);
+	return vector_file->block_offsets[block_id-1];
+}
+
+size_t get_vector_file_slot_size(const vector_file_t vector_file,
+				 size_t block_id)
+{
+	return align_up(get_vector_file_block_length(vector_file,block_id)*
+			vector_file->element_size);
+}
+
+void read_vector_file_block(vector_file_t vector_file,
+			    size_t block_id,
+			    void *elements)
+{
+	log_entry("Reading block %lu of %s",block_id,vector_file->path);
+	read_bytes(vector_file,
+		   elements,
+		   get_vector_file_block_length(vector_file,block_id)*
+		   vector_file->element_size,
+		   get_vector_file_block_offset(vector_file,block_id));
+}
+
+void write_vector_file_block(vector_file_t vector_file,
+			     size_t block_id,
+			     const void *elements)
+{
+	log_entry("Writing block %lu of %s",block_id,vector_file->path);
+	write_bytes(vector_file,
+		    elements,
+		    get_vector_file_block_length(vector_file,block_id)*
+		    vector_file->element_size,
+		    get_vector_file_block_offset(vector_file,block_id));
+}
+
+void convert_vector_file_precision(vector_file_t vector_file,
+				   size_t element_size)
+{
+	assert(element_size == sizeof(double) ||
+	       element_size == sizeof(float));
+	if (element_size == vector_file->element_size)
+		return;
+	log_entry("Converting %s to %lu byte elements",
+		  vector_file->path,element_size);
+	const size_t num_blocks = vector_file->num_blocks;
+	uint64_t *old_offsets =
+		(uint64_t*)malloc(num_blocks*sizeof(uint64_t));
+	memcpy(old_offsets,
+	       vector_file->block_offsets,
+	       num_blocks*sizeof(uint64_t));
+	const int to_single = element_size == sizeof(float);
+	vector_file->element_size = element_size;
+	set_block_offsets(vector_file);
+	size_t max_block_length = 0;
+	for (size_t i = 0; i<num_blocks; i++)
+		if (vector_file->block_lengths[i] > max_block_length)
+			max_block_length = vector_file->block_lengths[i];
+	double *elements = (double*)malloc(max_block_length*sizeof(double));
+	float *single_elements = (float*)elements;
+	// Shrinking blocks only move towards the start of the file and growing
+	// ones towards its end, so a block never overwrites one that has not
+	// been moved yet when they are moved in this order
+	for (size_t k = 0; k<num_blocks; k++)
+	{
+		const size_t i = to_single ? k : num_blocks - 1 - k;
+		const size_t length = vector_file->block_lengths[i];
+		if (to_single)
+		{
+			read_bytes(vector_file,elements,
+				   length*sizeof(double),old_offsets[i]);
+			for (size_t j = 0; j<length; j++)
+				single_elements[j] = (float)elements[j];
+		}
+		else
+		{
+			read_bytes(vector_file,single_elements,
+				   length*sizeof(float),old_offsets[i]);
+			for (size_t j = length; j-- > 0;)
+				elements[j] = single_elements[j];
+		}
+		write_bytes(vector_file,elements,length*element_size,
+			    vector_file->block_offsets[i]);
+	}
+	write_header(vector_file);
+	free(elements);
+	free(old_offsets);
+}
+
+void free_vector_file(vector_file_t vector_file)
+{
+	if (vector_file->file_descriptor >= 0)
+		close(vector_file->file_descriptor);
+	if (vector_file->direct_file_descriptor >= 0)
+		close(vector_file->direct_file_descriptor);
+	pthread_mutex_destroy(&vector_file->open_mutex);
+	free(vector_file->path);
+	free(vector_file->block_lengths);
+	free(vector_file->block_offsets);
+	free(vector_file);
+}
+
+static
+vector_file_t allocate_vector_file(const char *directory_name,
+				   size_t num_blocks)
+{
+	vector_file_t vector_file =
+		(vector_file_t)calloc(1,sizeof(struct _vector_file_));
+	vector_file->path =
+		(char*)malloc(strlen(directory_name) +
+			      strlen(vector_file_name) + 2);
+	sprintf(vector_file->path,"%s/%s",directory_name,vector_file_name);
+	vector_file->num_blocks = num_blocks;
+	vector_file->block_lengths =
+		(uint64_t*)calloc(num_blocks,sizeof(uint64_t));
+	vector_file->block_offsets =
+		(uint64_t*)calloc(num_blocks,sizeof(uint64_t));
+	vector_file->file_descriptor = -1;
+	vector_file->direct_file_descriptor = -1;
+	pthread_mutex_init(&vector_file->open_mutex,NULL);
+	return vector_file;
+}
+
+static
+size_t align_up(size_t num_bytes)
+{
+	return (num_bytes + io_alignment - 1)/io_alignment*io_alignment;
+}
+
+static
+size_t get_header_size(size_t num_blocks)
+{
+	return align_up(sizeof(vector_file_magic) +
+			(2 + 2*num_blocks)*sizeof(uint64_t));
+}
+
+static
+void set_block_offsets(vector_file_t vector_file)
+{
+	size_t offset = get_header_size(vector_file->num_blocks);
+	for (size_t i = 0; i<vector_file->num_blocks; i++)
+	{
+		vector_file->block_offsets[i] = offset;
+		offset += get_vector_file_slot_size(vector_file,i+1);
+	}
+}
+
+static
+void write_header(vector_file_t vector_file)
+{
+	const size_t num_blocks = vector_file->num_blocks;
+	const size_t header_length =
+		sizeof(vector_file_magic) +
+		(2 + 2*num_blocks)*sizeof(uint64_t);
+	char *header = (char*)calloc(header_length,sizeof(char));
+	memcpy(header,vector_file_magic,sizeof(vector_file_magic));
+	uint64_t *fields = (uint64_t*)(header + sizeof(vector_file_magic));
+	fields[0] = num_blocks;
+	fields[1] = vector_file->element_size;
+	memcpy(fields + 2,
+	       vector_file->block_lengths,
+	       num_blocks*sizeof(uint64_t));
+	memcpy(fields + 2 + num_blocks,
+	       vector_file->block_offsets,
+	       num_blocks*sizeof(uint64_t));
+	write_bytes(vector_file,header,header_length,0);
+	free(header);
+}
+
+static
+void open_file_descriptors(vector_file_t vector_file)
+{
+	pthread_mutex_lock(&vector_file->open_mutex);
+	if (vector_file->file_descriptor < 0)
+	{
+		vector_file->file_descriptor = open(vector_file->path,O_RDWR);
+		if (vector_file->file_descriptor < 0)
+			error("Could not open vector file %s. %s\n",
+			      vector_file->path,
+			      strerror(errno));
+		// Not all file systems support O_DIRECT, the buffered file
+		// descriptor is used then
+		if (use_direct_io)
+			vector_file->direct_file_descriptor =
+				open(vector_file->path,O_RDWR | O_DIRECT);
+	}
+	pthread_mutex_unlock(&vector_file->open_mutex);
+}
+
+static
+void read_bytes(vector_file_t vector_file,
+		void *buffer,
+		size_t num_bytes,
+		size_t offset)
+{
+	open_file_descriptors(vector_file);
+	const int file_descriptor =
+		vector_file->direct_file_descriptor >= 0 &&
+		is_direct_io_possible(buffer,num_bytes,offset) ?
+		vector_file->direct_file_descriptor :
+		vector_file->file_descriptor;
+	size_t num_bytes_read = 0;
+	while (num_bytes_read < num_bytes)
+	{
+		ssize_t num_new_bytes = pread(file_descriptor,
+					      (char*)buffer + num_bytes_read,
+					      num_bytes - num_bytes_read,
+					      offset + num_bytes_read);
+		if (num_new_bytes < 0 && errno == EINTR)
+			continue;
+		if (num_new_bytes <= 0)
+			error("Could only read %lu of %lu bytes from %s. %s\n",
+			      num_bytes_read,
+			      num_bytes,
+			      vector_file->path,
+			      num_new_bytes < 0 ? strerror(errno) : "");
+		num_bytes_read += num_new_bytes;
+	}
+}
+
+static
+void write_bytes(vector_file_t vector_file,
+		 const void *buffer,
+		 size_t num_bytes,
+		 size_t offset)
+{
+	open_file_descriptors(vector_file);
+	const int file_descriptor =
+		vector_file->direct_file_descriptor >= 0 &&
+		is_direct_io_possible(buffer,num_bytes,offset) ?
+		vector_file->direct_file_descriptor :
+		vector_file->file_descriptor;
+	size_t num_bytes_written = 0;
+	while (num_bytes_written < num_bytes)
+	{
+		ssize_t num_new_bytes =
+			pwrite(file_descriptor,
+			       (const char*)buffer + num_bytes_written,
+			       num_bytes - num_bytes_written,
+			       offset + num_bytes_written);
+		if (num_new_bytes < 0 && errno == EINTR)
+			continue;
+		if (num_new_bytes < 0)
+			error("Could not write to %s. %s\n",
+			      vector_file->path,
+			      strerror(errno));
+		num_bytes_written += num_new_bytes;
+	}
+}
+
+static
+int is_direct_io_possible(const void *buffer,
+			  size_t num_bytes,
+			  size_t offset)
+{
+	return (uintptr_t)buffer % io_alignment == 0 &&
+		num_bytes % io_alignment == 0 &&
+		offset % io_alignment == 0;
+}
+
+new_test(vector_file_blocks_are_aligned_and_read_back,
+	 const size_t block_lengths[3] = {100,1,1000};
+	 const char *directory_name = get_test_file_path("");
+	 vector_file_t vector_file =
+		new_vector_file(directory_name,block_lengths,3,sizeof(double));
+	 for (size_t i = 1; i<=3; i++)
+		assert_that(get_vector_file_block_offset(vector_file,i) %
+			    io_alignment == 0);
+	 double *elements = (double*)new_io_buffer(1024*sizeof(double));
+	 for (size_t i = 1; i<=3; i++)
+	 {
+		for (size_t j = 0; j<block_lengths[i-1]; j++)
+			elements[j] = 1000*i + j;
+		write_vector_file_block(vector_file,i,elements);
+	 }
+	 free_vector_file(vector_file);
+	 assert_that(has_vector_file(directory_name));
+	 vector_file = open_vector_file(directory_name);
+	 assert_that(get_vector_file_num_blocks(vector_file) == 3);
+	 assert_that(get_vector_file_element_size(vector_file) ==
+		     sizeof(double));
+	 for (size_t i = 3; i>=1; i--)
+	 {
+		assert_that(get_vector_file_block_length(vector_file,i) ==
+			    block_lengths[i-1]);
+		read_vector_file_block(vector_file,i,elements);
+		for (size_t j = 0; j<block_lengths[i-1]; j++)
+			assert_that(elements[j] == 1000*i + j);
+	 }
+	 // A whole slot can be read with the batch reader, the padding after
+	 // the last block is part of the file
+	 batch_reader_t reader = new_batch_reader();
+	 add_read_request(reader,
+			  get_vector_file_path(vector_file),
+			  elements,
+			  get_vector_file_slot_size(vector_file,3),
+			  get_vector_file_block_offset(vector_file,3));
+	 submit_read_requests(reader);
+	 assert_that(elements[999] == 3999);
+	 free_batch_reader(reader);
+	 free(elements);
+	 free_vector_file(vector_file);
+	);
+
+new_test(vector_file_precision_is_converted_in_place,
+	 const size_t block_lengths[4] = {700,1,3000,513};
+	 const char *directory_name = get_test_file_path("");
+	 vector_file_t vector_file =
+		new_vector_file(directory_name,block_lengths,4,sizeof(double));
+	 double elements[3000];
+	 for (size_t i = 1; i<=4; i++)
+	 {
+		for (size_t j = 0; j<block_lengths[i-1]; j++)
+			elements[j] = 1.0/(i+j+1);
+		write_vector_file_block(vector_file,i,elements);
+	 }
+	 convert_vector_file_precision(vector_file,sizeof(float));
+	 free_vector_file(vector_file);
+	 vector_file = open_vector_file(directory_name);
+	 assert_that(get_vector_file_element_size(vector_file) ==
+		     sizeof(float));
+	 float single_elements[3000];
+	 for (size_t i = 1; i<=4; i++)
+	 {
+		read_vector_file_block(vector_file,i,single_elements);
+		for (size_t j = 0; j<block_lengths[i-1]; j++)
+			assert_that(single_elements[j] == (float)(1.0/(i+j+1)));
+	 }
+	 convert_vector_file_precision(vector_file,sizeof(double));
+	 for (size_t i = 1; i<=4; i++)
+	 {
+		read_vector_file_block(vector_file,i,elements);
+		for (size_t j = 0; j<block_lengths[i-1]; j++)
+			assert_that(elements[j] == (float)(1.0/(i+j+1)));
+	 }
+	 free_vector_file(vector_file);
+	);
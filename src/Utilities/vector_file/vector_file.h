@@ -0,0 +1,72 @@
+#ifndef __VECTOR_FILE__
+#define __VECTOR_FILE__
+
+#include <stdlib.h>
+
+/* A vector file keeps all blocks of a vector in the single file
+ * vector_file_name of the vector directory, instead of one vec_<block id>
+ * file per block. The file starts with a header holding the block lengths
+ * and the table of block offsets. Every block starts at a multiple of
+ * io_alignment and its slot is padded to one, so that a whole slot can be
+ * read or written with O_DIRECT into a buffer from new_io_buffer. The
+ * blocks are numbered from 1, like the block files, and hold elements of
+ * element_size bytes.
+ *
+ * The file descriptor is opened once, on the first read or write, and kept
+ * until the vector file is freed. Reads and writes of different blocks may
+ * run in parallel. With -DDIRECT_IO, aligned reads and writes bypass the
+ * page cache.
+ */
+struct _vector_file_;
+typedef struct _vector_file_ *vector_file_t;
+
+extern const char *vector_file_name;
+
+int has_vector_file(const char *directory_name);
+
+/* Creates the vector file of the directory with all elements zero,
+ * replacing a previous one.
+ */
+vector_file_t new_vector_file(const char *directory_name,
+			      const size_t *block_lengths,
+			      size_t num_blocks,
+			      size_t element_size);
+
+vector_file_t open_vector_file(const char *directory_name);
+
+const char *get_vector_file_path(const vector_file_t vector_file);
+
+size_t get_vector_file_num_blocks(const vector_file_t vector_file);
+
+size_t get_vector_file_element_size(const vector_file_t vector_file);
+
+size_t get_vector_file_block_length(const vector_file_t vector_file,
+				    size_t block_id);
+
+size_t get_vector_file_block_offset(const vector_file_t vector_file,
+				    size_t block_id);
+
+/* The number of bytes from the block offset to the next multiple of
+ * io_alignment after the block.
+ */
+size_t get_vector_file_slot_size(const vector_file_t vector_file,
+				 size_t block_id);
+
+void read_vector_file_block(vector_file_t vector_file,
+			    size_t block_id,
+			    void *elements);
+
+void write_vector_file_block(vector_file_t vector_file,
+			     size_t block_id,
+			     const void *elements);
+
+/* Converts the elements between double and float precision, element_size
+ * being sizeof(double) or sizeof(float). The blocks are moved within the
+ * file, which is not resized.
+ */
+void convert_vector_file_precision(vector_file_t vector_file,
+				   size_t element_size);
+
+void free_vector_file(vector_file_t vector_file);
+
+#endif